@@ -19,11 +19,13 @@
 #include "kmsbasertpendpoint.h"
 
 #include <stdlib.h>
+#include <gst/rtp/gstrtcpbuffer.h>
 
 #include "kms-core-enumtypes.h"
 #include "kms-core-marshal.h"
 #include "sdp_utils.h"
 #include "kmsremb.h"
+#include "kmsutils.h"
 
 #define PLUGIN_NAME "base_rtp_endpoint"
 
@@ -44,6 +46,34 @@ G_DEFINE_TYPE (KmsBaseRtpEndpoint, kms_base_rtp_endpoint,
 
 #define RTCP_DEMUX_PEER "rtcp-demux-peer"
 
+#define RTP_PT_MAP_LEN 128
+
+#define N_RTP_SESSIONS 2
+
+typedef struct _KmsRtpFeedbackCount
+{
+  guint nacks;
+  guint plis;
+  guint firs;
+} KmsRtpFeedbackCount;
+
+typedef struct _KmsRtpSessionStats
+{
+  KmsBaseRtpEndpoint *self;
+  guint session;
+  gboolean connected;
+
+  /* Feedback counters by media SSRC, updated from the RTCP threads and
+   * protected by the element lock */
+  GHashTable *feedback_sent;
+  GHashTable *feedback_received;
+
+  /* Set once per RTCP interval, the snapshot is rebuilt on the next read */
+  gint stale;
+  /* Protected by the element lock */
+  GstStructure *snapshot;
+} KmsRtpSessionStats;
+
 struct _KmsBaseRtpEndpointPrivate
 {
   GstElement *rtpbin;
@@ -72,8 +102,22 @@ struct _KmsBaseRtpEndpointPrivate
   guint max_video_send_bw;
 
   /* REMB */
+  KmsCongestionControl congestion_control;
   KmsRembLocal *rl;
   KmsRembRemote *rm;
+
+  /* Caps of the negotiated payload types indexed by pt, built once */
+  GstCaps **pt_map;
+
+  /* Jitter buffers indexed by session */
+  KmsJitterBufferProfile jb_profile;
+  guint jb_latency;
+  guint jb_min_latency;
+  GstElement *jitterbuffers[N_RTP_SESSIONS];
+  guint jb_ssrcs[N_RTP_SESSIONS];
+
+  /* Stats indexed by session */
+  KmsRtpSessionStats stats[N_RTP_SESSIONS];
 };
 
 /* Signals and args */
@@ -96,6 +140,10 @@ static guint obj_signals[LAST_SIGNAL] = { 0 };
 #define DEFAULT_TARGET_BITRATE    0
 #define MIN_VIDEO_SEND_BW_DEFAULT 100
 #define MAX_VIDEO_SEND_BW_DEFAULT 500
+#define DEFAULT_CONGESTION_CONTROL KMS_CONGESTION_CONTROL_LOSS
+#define DEFAULT_JITTER_BUFFER_PROFILE KMS_JITTER_BUFFER_PROFILE_BUFFERED
+#define DEFAULT_JITTER_BUFFER_LATENCY 1500      /* ms */
+#define DEFAULT_JITTER_BUFFER_MIN_LATENCY 50    /* ms */
 
 enum
 {
@@ -110,9 +158,443 @@ enum
   PROP_TARGET_BITRATE,
   PROP_MIN_VIDEO_SEND_BW,
   PROP_MAX_VIDEO_SEND_BW,
+  PROP_JITTER_BUFFER_PROFILE,
+  PROP_JITTER_BUFFER_LATENCY,
+  PROP_JITTER_BUFFER_MIN_LATENCY,
+  PROP_JITTER_BUFFER_STATS,
+  PROP_STATS,
+  PROP_CONGESTION_CONTROL,
   PROP_LAST
 };
 
+/* Stats begin */
+
+static void
+kms_rtp_session_stats_inc (KmsRtpSessionStats * stats, GstRTCPType type,
+    guint fbtype, guint media_ssrc, gboolean sent)
+{
+  GHashTable *table = sent ? stats->feedback_sent : stats->feedback_received;
+  KmsRtpFeedbackCount *count;
+
+  KMS_ELEMENT_LOCK (stats->self);
+
+  count = g_hash_table_lookup (table, GUINT_TO_POINTER (media_ssrc));
+  if (count == NULL) {
+    count = g_slice_new0 (KmsRtpFeedbackCount);
+    g_hash_table_insert (table, GUINT_TO_POINTER (media_ssrc), count);
+  }
+
+  if (type == GST_RTCP_TYPE_RTPFB) {
+    count->nacks++;
+  } else if (fbtype == GST_RTCP_PSFB_TYPE_PLI) {
+    count->plis++;
+  } else {
+    count->firs++;
+  }
+
+  KMS_ELEMENT_UNLOCK (stats->self);
+}
+
+/* fci_len in bytes */
+static void
+kms_rtp_session_stats_count_feedback (KmsRtpSessionStats * stats,
+    GstRTCPType type, guint fbtype, guint media_ssrc, const guint8 * fci,
+    guint fci_len, gboolean sent)
+{
+  guint i;
+
+  if (type == GST_RTCP_TYPE_RTPFB && fbtype == GST_RTCP_RTPFB_TYPE_NACK) {
+    kms_rtp_session_stats_inc (stats, type, fbtype, media_ssrc, sent);
+  } else if (type == GST_RTCP_TYPE_PSFB && fbtype == GST_RTCP_PSFB_TYPE_PLI) {
+    kms_rtp_session_stats_inc (stats, type, fbtype, media_ssrc, sent);
+  } else if (type == GST_RTCP_TYPE_PSFB && fbtype == GST_RTCP_PSFB_TYPE_FIR) {
+    /* FIR targets are in its 8 byte FCI entries, not in the header */
+    for (i = 0; fci != NULL && i + 8 <= fci_len; i += 8) {
+      kms_rtp_session_stats_inc (stats, type, fbtype,
+          GST_READ_UINT32_BE (fci + i), sent);
+    }
+  }
+}
+
+static void
+kms_rtp_session_stats_count_sent_feedback (KmsRtpSessionStats * stats,
+    GstBuffer * buffer)
+{
+  GstRTCPBuffer rtcp = { NULL, };
+  GstRTCPPacket packet;
+  gboolean more;
+
+  if (!gst_rtcp_buffer_map (buffer, GST_MAP_READ, &rtcp)) {
+    return;
+  }
+
+  for (more = gst_rtcp_buffer_get_first_packet (&rtcp, &packet); more;
+      more = gst_rtcp_packet_move_to_next (&packet)) {
+    GstRTCPType type = gst_rtcp_packet_get_type (&packet);
+
+    if (type == GST_RTCP_TYPE_RTPFB || type == GST_RTCP_TYPE_PSFB) {
+      kms_rtp_session_stats_count_feedback (stats, type,
+          gst_rtcp_packet_fb_get_type (&packet),
+          gst_rtcp_packet_fb_get_media_ssrc (&packet),
+          gst_rtcp_packet_fb_get_fci (&packet),
+          gst_rtcp_packet_fb_get_fci_length (&packet) * 4, TRUE);
+    }
+  }
+
+  gst_rtcp_buffer_unmap (&rtcp);
+}
+
+static void
+kms_rtp_session_stats_get_feedback (KmsRtpSessionStats * stats,
+    gboolean sent, guint ssrc, KmsRtpFeedbackCount * count)
+{
+  GHashTable *table = sent ? stats->feedback_sent : stats->feedback_received;
+  KmsRtpFeedbackCount *found;
+
+  KMS_ELEMENT_LOCK (stats->self);
+
+  found = g_hash_table_lookup (table, GUINT_TO_POINTER (ssrc));
+  if (found != NULL) {
+    *count = *found;
+  } else {
+    count->nacks = count->plis = count->firs = 0;
+  }
+
+  KMS_ELEMENT_UNLOCK (stats->self);
+}
+
+static guint
+kms_rtp_session_stats_get_ms (GstStructure * source_stats,
+    const gchar * field, gint clock_rate)
+{
+  guint value;
+
+  /* Jitter values come in timestamp units */
+  if (clock_rate <= 0 || !gst_structure_get_uint (source_stats, field, &value)) {
+    return 0;
+  }
+
+  return gst_util_uint64_scale_int (value, 1000, clock_rate);
+}
+
+static guint
+kms_rtp_session_stats_get_rtt (GstStructure * source_stats)
+{
+  gboolean have_rb;
+  guint rtt;
+
+  if (source_stats == NULL ||
+      !gst_structure_get_boolean (source_stats, "have-rb", &have_rb) ||
+      !have_rb || !gst_structure_get_uint (source_stats, "rb-round-trip",
+          &rtt)) {
+    return 0;
+  }
+
+  /* RTT comes in 1/65536 seconds */
+  return gst_util_uint64_scale_int (rtt, 1000, 65536);
+}
+
+/* jitterbuffer is the one receiving the stream, it can be NULL */
+static GstStructure *
+kms_rtp_session_stats_new_inbound (KmsRtpSessionStats * stats,
+    GstStructure * source_stats, GstElement * jitterbuffer, guint ssrc,
+    guint remb)
+{
+  guint64 packets = 0, bytes = 0, late = 0;
+  guint fraction_lost = 0, latency = 0;
+  gint packets_lost = 0, clock_rate = 0;
+  KmsRtpFeedbackCount sent;
+
+  kms_rtp_session_stats_get_feedback (stats, TRUE, ssrc, &sent);
+
+  gst_structure_get_uint64 (source_stats, "packets-received", &packets);
+  gst_structure_get_uint64 (source_stats, "octets-received", &bytes);
+  gst_structure_get_int (source_stats, "packets-lost", &packets_lost);
+  gst_structure_get_uint (source_stats, "sent-rb-fractionlost",
+      &fraction_lost);
+  gst_structure_get_int (source_stats, "clock-rate", &clock_rate);
+
+  if (jitterbuffer != NULL) {
+    GstStructure *jb_stats;
+
+    /* Packets arriving after their latency are dropped by the jitterbuffer */
+    g_object_get (jitterbuffer, "stats", &jb_stats, "latency", &latency,
+        NULL);
+    gst_structure_get_uint64 (jb_stats, "num-late", &late);
+    gst_structure_free (jb_stats);
+  }
+
+  /* Feedback about a received stream is sent by us */
+  return gst_structure_new ("inbound-rtp",
+      "ssrc", G_TYPE_UINT, ssrc,
+      "packets", G_TYPE_UINT64, packets,
+      "bytes", G_TYPE_UINT64, bytes,
+      "packets-lost", G_TYPE_INT, packets_lost,
+      "fraction-lost", G_TYPE_UINT, fraction_lost,
+      "jitter", G_TYPE_UINT, kms_rtp_session_stats_get_ms (source_stats,
+          "jitter", clock_rate),
+      "round-trip-time", G_TYPE_UINT,
+      kms_rtp_session_stats_get_rtt (source_stats),
+      "nack-count", G_TYPE_UINT, sent.nacks,
+      "pli-count", G_TYPE_UINT, sent.plis,
+      "fir-count", G_TYPE_UINT, sent.firs,
+      "remb", G_TYPE_UINT, remb,
+      "jitter-buffer-latency", G_TYPE_UINT, latency,
+      "late-packets", G_TYPE_UINT64, late, NULL);
+}
+
+static GstStructure *
+kms_rtp_session_stats_new_outbound (KmsRtpSessionStats * stats,
+    GstStructure * source_stats, GstStructure * rb_stats, guint ssrc,
+    guint remb)
+{
+  guint64 packets = 0, bytes = 0;
+  guint fraction_lost = 0, jitter = 0;
+  gint packets_lost = 0, clock_rate = 0;
+  KmsRtpFeedbackCount received;
+
+  kms_rtp_session_stats_get_feedback (stats, FALSE, ssrc, &received);
+
+  gst_structure_get_uint64 (source_stats, "packets-sent", &packets);
+  gst_structure_get_uint64 (source_stats, "octets-sent", &bytes);
+  gst_structure_get_int (source_stats, "clock-rate", &clock_rate);
+
+  /* Losses of a sent stream are known from the receiver reports */
+  if (rb_stats != NULL) {
+    gst_structure_get_int (rb_stats, "rb-packetslost", &packets_lost);
+    gst_structure_get_uint (rb_stats, "rb-fractionlost", &fraction_lost);
+    jitter = kms_rtp_session_stats_get_ms (rb_stats, "rb-jitter", clock_rate);
+  }
+
+  return gst_structure_new ("outbound-rtp",
+      "ssrc", G_TYPE_UINT, ssrc,
+      "packets", G_TYPE_UINT64, packets,
+      "bytes", G_TYPE_UINT64, bytes,
+      "packets-lost", G_TYPE_INT, packets_lost,
+      "fraction-lost", G_TYPE_UINT, fraction_lost,
+      "jitter", G_TYPE_UINT, jitter,
+      "round-trip-time", G_TYPE_UINT, kms_rtp_session_stats_get_rtt (rb_stats),
+      "nack-count", G_TYPE_UINT, received.nacks,
+      "pli-count", G_TYPE_UINT, received.plis,
+      "fir-count", G_TYPE_UINT, received.firs,
+      "remb", G_TYPE_UINT, remb, NULL);
+}
+
+static void
+kms_rtp_session_stats_set_ssrc (GstStructure * snapshot,
+    GstStructure * ssrc_stats, guint ssrc)
+{
+  gchar *name = g_strdup_printf ("ssrc-%u", ssrc);
+
+  gst_structure_set (snapshot, name, GST_TYPE_STRUCTURE, ssrc_stats, NULL);
+  gst_structure_free (ssrc_stats);
+  g_free (name);
+}
+
+static void
+kms_rtp_session_stats_update (KmsRtpSessionStats * stats, GObject * rtpsession)
+{
+  KmsBaseRtpEndpoint *self = stats->self;
+  GstStructure *snapshot, *old;
+  GstElement *jitterbuffer = NULL;
+  GSList *internals = NULL, *reports = NULL, *l, *r;
+  guint remb_local = 0, remb_remote = 0, jb_ssrc = 0;
+  GValueArray *arr;
+  guint i;
+
+  KMS_ELEMENT_LOCK (self);
+
+  if (self->priv->jitterbuffers[stats->session] != NULL) {
+    jitterbuffer = g_object_ref (self->priv->jitterbuffers[stats->session]);
+    jb_ssrc = self->priv->jb_ssrcs[stats->session];
+  }
+
+  if (stats->session == VIDEO_RTP_SESSION && self->priv->rl != NULL) {
+    remb_local = g_atomic_int_get (&self->priv->rl->remb_sent);
+  }
+
+  if (stats->session == VIDEO_RTP_SESSION && self->priv->rm != NULL) {
+    remb_remote = self->priv->rm->remb;
+  }
+
+  KMS_ELEMENT_UNLOCK (self);
+
+  snapshot = gst_structure_new_empty (stats->session == AUDIO_RTP_SESSION ?
+      AUDIO_STREAM_NAME : VIDEO_STREAM_NAME);
+
+  g_object_get (rtpsession, "sources", &arr, NULL);
+
+  for (i = 0; i < arr->n_values; i++) {
+    GObject *source = g_value_get_object (g_value_array_get_nth (arr, i));
+    GstStructure *source_stats;
+    gboolean internal, have_rb;
+    guint ssrc;
+
+    g_object_get (source, "stats", &source_stats, NULL);
+
+    if (!gst_structure_get_boolean (source_stats, "internal", &internal) ||
+        !gst_structure_get_uint (source_stats, "ssrc", &ssrc)) {
+      gst_structure_free (source_stats);
+      continue;
+    }
+
+    if (internal) {
+      internals = g_slist_prepend (internals, source_stats);
+      continue;
+    }
+
+    kms_rtp_session_stats_set_ssrc (snapshot,
+        kms_rtp_session_stats_new_inbound (stats, source_stats,
+            ssrc == jb_ssrc ? jitterbuffer : NULL, ssrc, remb_local), ssrc);
+
+    /* Receivers report about our sending sources */
+    if (gst_structure_get_boolean (source_stats, "have-rb", &have_rb) &&
+        have_rb) {
+      reports = g_slist_prepend (reports, source_stats);
+    } else {
+      gst_structure_free (source_stats);
+    }
+  }
+
+  g_value_array_free (arr);
+
+  for (l = internals; l != NULL; l = l->next) {
+    GstStructure *source_stats = l->data, *rb_stats = NULL;
+    gboolean is_sender;
+    guint ssrc, rb_ssrc;
+
+    if (gst_structure_get_boolean (source_stats, "is-sender", &is_sender) &&
+        is_sender && gst_structure_get_uint (source_stats, "ssrc", &ssrc)) {
+      for (r = reports; r != NULL && rb_stats == NULL; r = r->next) {
+        if (gst_structure_get_uint (r->data, "rb-ssrc", &rb_ssrc) &&
+            rb_ssrc == ssrc) {
+          rb_stats = r->data;
+        }
+      }
+
+      kms_rtp_session_stats_set_ssrc (snapshot,
+          kms_rtp_session_stats_new_outbound (stats, source_stats, rb_stats,
+              ssrc, remb_remote), ssrc);
+    }
+  }
+
+  g_slist_free_full (internals, (GDestroyNotify) gst_structure_free);
+  g_slist_free_full (reports, (GDestroyNotify) gst_structure_free);
+
+  if (jitterbuffer != NULL) {
+    g_object_unref (jitterbuffer);
+  }
+
+  KMS_ELEMENT_LOCK (self);
+  old = stats->snapshot;
+  stats->snapshot = snapshot;
+  KMS_ELEMENT_UNLOCK (self);
+
+  if (old != NULL) {
+    gst_structure_free (old);
+  }
+}
+
+static gboolean
+kms_rtp_session_stats_on_sending_rtcp (GObject * rtpsession,
+    GstBuffer * buffer, gboolean is_early, KmsRtpSessionStats * stats)
+{
+  kms_rtp_session_stats_count_sent_feedback (stats, buffer);
+
+  /* Early packets only carry feedback, the snapshot is kept per interval */
+  if (!is_early) {
+    g_atomic_int_set (&stats->stale, TRUE);
+  }
+
+  return FALSE;
+}
+
+static void
+kms_rtp_session_stats_on_feedback_rtcp (GObject * rtpsession, guint type,
+    guint fbtype, guint sender_ssrc, guint media_ssrc, GstBuffer * fci,
+    KmsRtpSessionStats * stats)
+{
+  GstMapInfo info = { NULL, };
+
+  if (fci != NULL && !gst_buffer_map (fci, &info, GST_MAP_READ)) {
+    return;
+  }
+
+  kms_rtp_session_stats_count_feedback (stats, type, fbtype, media_ssrc,
+      info.data, info.size, FALSE);
+
+  if (fci != NULL) {
+    gst_buffer_unmap (fci, &info);
+  }
+}
+
+static void
+kms_base_rtp_endpoint_connect_stats (KmsBaseRtpEndpoint * self,
+    GObject * rtpsession, guint session_id)
+{
+  KmsRtpSessionStats *stats;
+
+  if (session_id >= N_RTP_SESSIONS) {
+    return;
+  }
+
+  stats = &self->priv->stats[session_id];
+  if (stats->connected) {
+    return;
+  }
+
+  stats->connected = TRUE;
+  /* Available from the first read, before any RTCP is sent */
+  g_atomic_int_set (&stats->stale, TRUE);
+  g_signal_connect (rtpsession, "on-sending-rtcp",
+      G_CALLBACK (kms_rtp_session_stats_on_sending_rtcp), stats);
+  g_signal_connect (rtpsession, "on-feedback-rtcp",
+      G_CALLBACK (kms_rtp_session_stats_on_feedback_rtcp), stats);
+}
+
+/* Must be called without the element lock, it queries the RTP sessions */
+static GstStructure *
+kms_base_rtp_endpoint_get_stats (KmsBaseRtpEndpoint * self)
+{
+  GstStructure *stats = gst_structure_new_empty ("rtp-stats");
+  guint session;
+
+  for (session = 0; session < N_RTP_SESSIONS; session++) {
+    KmsRtpSessionStats *session_stats = &self->priv->stats[session];
+    GstStructure *snapshot;
+
+    if (g_atomic_int_compare_and_exchange (&session_stats->stale, TRUE,
+            FALSE)) {
+      GObject *rtpsession;
+
+      g_signal_emit_by_name (self->priv->rtpbin, "get-internal-session",
+          session, &rtpsession);
+      if (rtpsession != NULL) {
+        kms_rtp_session_stats_update (session_stats, rtpsession);
+        g_object_unref (rtpsession);
+      }
+    }
+
+    KMS_ELEMENT_LOCK (self);
+    snapshot = session_stats->snapshot;
+    if (snapshot != NULL) {
+      gst_structure_set (stats, gst_structure_get_name (snapshot),
+          GST_TYPE_STRUCTURE, snapshot, NULL);
+    }
+    KMS_ELEMENT_UNLOCK (self);
+  }
+
+  return stats;
+}
+
+static void
+kms_rtp_feedback_count_free (KmsRtpFeedbackCount * count)
+{
+  g_slice_free (KmsRtpFeedbackCount, count);
+}
+
+/* Stats end */
+
 /* Set Transport begin */
 static gboolean
 sdp_message_is_bundle (GstSDPMessage * msg)
@@ -317,6 +799,7 @@ kms_base_rtp_endpoint_create_rtp_session (KmsBaseRtpEndpoint * self,
 
   g_object_set (rtpsession, "rtcp-min-interval",
       RTCP_MIN_INTERVAL * GST_MSECOND, NULL);
+  kms_base_rtp_endpoint_connect_stats (self, rtpsession, session_id);
 
   return rtpsession;
 }
@@ -513,9 +996,13 @@ kms_base_rtp_endpoint_create_remb_managers (KmsBaseRtpEndpoint * self)
   }
 
   g_object_get (self, "max-video-recv-bandwidth", &max_recv_bw, NULL);
+
+  /* rtpbin hands back this same pad when the connection requests it */
+  pad = gst_element_get_request_pad (rtpbin, VIDEO_RTPBIN_RECV_RTP_SINK);
   self->priv->rl =
       kms_remb_local_create (rtpsession, self->priv->remote_video_ssrc,
-      max_recv_bw);
+      max_recv_bw, self->priv->congestion_control, pad);
+  g_object_unref (pad);
 
   pad = gst_element_get_static_pad (rtpbin, VIDEO_RTPBIN_SEND_RTP_SINK);
   self->priv->rm =
@@ -666,6 +1153,140 @@ kms_base_rtp_endpoint_add_connection (KmsBaseRtpEndpoint * self,
   kms_base_rtp_endpoint_add_connection_src (self, conn, rtp_session);
 }
 
+static const gchar *
+get_caps_codec_name (const gchar * codec_name)
+{
+  if (g_ascii_strcasecmp (OPUS_ENCONDING_NAME, codec_name) == 0) {
+    return "X-GST-OPUS-DRAFT-SPITTKA-00";
+  }
+  if (g_ascii_strcasecmp (VP8_ENCONDING_NAME, codec_name) == 0) {
+    return "VP8-DRAFT-IETF-01";
+  }
+
+  return codec_name;
+}
+
+static GstCaps *
+kms_base_rtp_endpoint_get_caps_from_rtpmap (const gchar * media,
+    const gchar * pt, const gchar * rtpmap)
+{
+  GstCaps *caps = NULL;
+  gchar **tokens;
+
+  if (rtpmap == NULL) {
+    GST_WARNING ("rtpmap is NULL");
+    return NULL;
+  }
+
+  tokens = g_strsplit (rtpmap, "/", 3);
+
+  if (tokens[0] == NULL || tokens[1] == NULL) {
+    goto end;
+  }
+
+  caps = gst_caps_new_simple ("application/x-rtp",
+      "media", G_TYPE_STRING, media,
+      "payload", G_TYPE_INT, atoi (pt),
+      "clock-rate", G_TYPE_INT, atoi (tokens[1]),
+      "encoding-name", G_TYPE_STRING, get_caps_codec_name (tokens[0]), NULL);
+
+end:
+  g_strfreev (tokens);
+
+  return caps;
+}
+
+static void
+kms_base_rtp_endpoint_pt_map_free (GstCaps ** pt_map)
+{
+  guint i;
+
+  if (pt_map == NULL) {
+    return;
+  }
+
+  for (i = 0; i < RTP_PT_MAP_LEN; i++) {
+    if (pt_map[i] != NULL) {
+      gst_caps_unref (pt_map[i]);
+    }
+  }
+
+  g_free (pt_map);
+}
+
+/* Call this function holding the lock */
+static void
+kms_base_rtp_endpoint_pt_map_set_feedback (KmsBaseRtpEndpoint * self)
+{
+  guint pt;
+
+  if (self->priv->pt_map == NULL) {
+    return;
+  }
+
+  for (pt = 0; pt < RTP_PT_MAP_LEN; pt++) {
+    GstCaps *caps = self->priv->pt_map[pt];
+
+    if (caps == NULL || g_strcmp0 (VIDEO_STREAM_NAME,
+            gst_structure_get_string (gst_caps_get_structure (caps, 0),
+                "media")) != 0) {
+      continue;
+    }
+
+    /* Caps already given to rtpbin are not modified */
+    caps = gst_caps_make_writable (caps);
+    gst_caps_set_simple (caps, "rtcp-fb-ccm-fir", G_TYPE_BOOLEAN,
+        self->priv->rtcp_fir, "rtcp-fb-nack-pli", G_TYPE_BOOLEAN,
+        self->priv->rtcp_pli, NULL);
+    self->priv->pt_map[pt] = caps;
+  }
+}
+
+/* Call this function holding the lock */
+static void
+kms_base_rtp_endpoint_build_pt_map (KmsBaseRtpEndpoint * self,
+    const GstSDPMessage * answer)
+{
+  GstCaps **pt_map = g_new0 (GstCaps *, RTP_PT_MAP_LEN);
+  guint i, len;
+
+  len = gst_sdp_message_medias_len (answer);
+  for (i = 0; i < len; i++) {
+    const GstSDPMedia *media = gst_sdp_message_get_media (answer, i);
+    const gchar *media_str = gst_sdp_media_get_media (media);
+    const gchar *rtpmap;
+    guint j, f_len;
+
+    f_len = gst_sdp_media_formats_len (media);
+    for (j = 0; j < f_len; j++) {
+      GstCaps *caps;
+      const gchar *payload = gst_sdp_media_get_format (media, j);
+      gint pt = atoi (payload);
+
+      if (pt < 0 || pt >= RTP_PT_MAP_LEN || pt_map[pt] != NULL) {
+        continue;
+      }
+
+      rtpmap = sdp_utils_sdp_media_get_rtpmap (media, payload);
+      caps =
+          kms_base_rtp_endpoint_get_caps_from_rtpmap (media_str, payload,
+          rtpmap);
+
+      if (caps == NULL) {
+        continue;
+      }
+
+      GST_DEBUG_OBJECT (self, "pt %d: %" GST_PTR_FORMAT, pt, caps);
+      pt_map[pt] = caps;
+    }
+  }
+
+  kms_base_rtp_endpoint_pt_map_free (self->priv->pt_map);
+  self->priv->pt_map = pt_map;
+
+  kms_base_rtp_endpoint_pt_map_set_feedback (self);
+}
+
 static void
 kms_base_rtp_endpoint_start_transport_send (KmsBaseSdpEndpoint *
     base_sdp_endpoint, const GstSDPMessage * offer,
@@ -689,6 +1310,8 @@ kms_base_rtp_endpoint_start_transport_send (KmsBaseSdpEndpoint *
     sdp = offer;
   }
 
+  kms_base_rtp_endpoint_build_pt_map (self, answer);
+
   if (self->priv->bundle) {
     bundle_conn =
         kms_base_rtp_endpoint_add_bundle_connection (self, local_offer);
@@ -796,74 +1419,27 @@ kms_base_rtp_endpoint_create_bundle_connection_default (KmsBaseRtpEndpoint *
 
 /* Connection management end */
 
-static const gchar *
-get_caps_codec_name (const gchar * codec_name)
-{
-  if (g_ascii_strcasecmp (OPUS_ENCONDING_NAME, codec_name) == 0) {
-    return "X-GST-OPUS-DRAFT-SPITTKA-00";
-  }
-  if (g_ascii_strcasecmp (VP8_ENCONDING_NAME, codec_name) == 0) {
-    return "VP8-DRAFT-IETF-01";
-  }
-
-  return codec_name;
-}
-
-static GstCaps *
-kms_base_rtp_endpoint_get_caps_from_rtpmap (const gchar * media,
-    const gchar * pt, const gchar * rtpmap)
-{
-  GstCaps *caps = NULL;
-  gchar **tokens;
-
-  if (rtpmap == NULL) {
-    GST_WARNING ("rtpmap is NULL");
-    return NULL;
-  }
-
-  tokens = g_strsplit (rtpmap, "/", 3);
-
-  if (tokens[0] == NULL || tokens[1] == NULL) {
-    goto end;
-  }
-
-  caps = gst_caps_new_simple ("application/x-rtp",
-      "media", G_TYPE_STRING, media,
-      "payload", G_TYPE_INT, atoi (pt),
-      "clock-rate", G_TYPE_INT, atoi (tokens[1]),
-      "encoding-name", G_TYPE_STRING, get_caps_codec_name (tokens[0]), NULL);
-
-end:
-  g_strfreev (tokens);
-
-  return caps;
-}
-
 static GstElement *
 gst_base_rtp_get_payloader_for_caps (GstCaps * caps)
 {
   GstElementFactory *factory;
   GstElement *payloader = NULL;
-  GList *payloader_list, *filtered_list;
   GParamSpec *pspec;
 
-  payloader_list =
-      gst_element_factory_list_get_elements (GST_ELEMENT_FACTORY_TYPE_PAYLOADER,
-      GST_RANK_NONE);
-  filtered_list =
-      gst_element_factory_list_filter (payloader_list, caps, GST_PAD_SRC,
-      FALSE);
-
-  if (filtered_list == NULL) {
-    goto end;
-  }
+  factory =
+      kms_utils_get_element_factory_for_caps
+      (GST_ELEMENT_FACTORY_TYPE_PAYLOADER, NULL, caps, NULL);
 
-  factory = GST_ELEMENT_FACTORY (filtered_list->data);
   if (factory == NULL) {
-    goto end;
+    return NULL;
   }
 
   payloader = gst_element_factory_create (factory, NULL);
+  gst_object_unref (factory);
+
+  if (payloader == NULL) {
+    return NULL;
+  }
 
   pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (payloader), "pt");
   if (pspec != NULL && G_PARAM_SPEC_VALUE_TYPE (pspec) == G_TYPE_UINT) {
@@ -882,55 +1458,22 @@ gst_base_rtp_get_payloader_for_caps (GstCaps * caps)
     g_object_set (payloader, "config-interval", 1, NULL);
   }
 
-end:
-  gst_plugin_feature_list_free (filtered_list);
-  gst_plugin_feature_list_free (payloader_list);
-
   return payloader;
 }
 
+static gboolean
+depayloader_factory_filter (GstElementFactory * factory)
+{
+  /* Do not use asteriskh263 for H263 */
+  return g_strcmp0 (gst_plugin_feature_get_name (factory), "asteriskh263") != 0;
+}
+
 static GstElement *
 gst_base_rtp_get_depayloader_for_caps (GstCaps * caps)
 {
-  GstElementFactory *factory;
-  GstElement *depayloader = NULL;
-  GList *payloader_list, *filtered_list, *l;
-
-  payloader_list =
-      gst_element_factory_list_get_elements
-      (GST_ELEMENT_FACTORY_TYPE_DEPAYLOADER, GST_RANK_NONE);
-  filtered_list =
-      gst_element_factory_list_filter (payloader_list, caps, GST_PAD_SINK,
-      FALSE);
-
-  if (filtered_list == NULL) {
-    goto end;
-  }
-
-  for (l = filtered_list; l != NULL; l = l->next) {
-    factory = GST_ELEMENT_FACTORY (l->data);
-
-    if (factory == NULL) {
-      continue;
-    }
-
-    if (g_strcmp0 (gst_plugin_feature_get_name (factory), "asteriskh263") == 0) {
-      /* Do not use asteriskh263 for H263 */
-      continue;
-    }
-
-    depayloader = gst_element_factory_create (factory, NULL);
-
-    if (depayloader != NULL) {
-      break;
-    }
-  }
-
-end:
-  gst_plugin_feature_list_free (filtered_list);
-  gst_plugin_feature_list_free (payloader_list);
-
-  return depayloader;
+  return kms_utils_create_element_for_caps
+      (GST_ELEMENT_FACTORY_TYPE_DEPAYLOADER, caps, NULL,
+      depayloader_factory_filter);
 }
 
 static void
@@ -1038,56 +1581,16 @@ kms_base_rtp_endpoint_connect_input_elements (KmsBaseSdpEndpoint *
 static GstCaps *
 kms_base_rtp_endpoint_get_caps_for_pt (KmsBaseRtpEndpoint * self, guint pt)
 {
-  KmsBaseSdpEndpoint *base_endpoint = KMS_BASE_SDP_ENDPOINT (self);
-  GstSDPMessage *answer;
-  guint i, len;
   GstCaps *ret = NULL;
 
-  g_object_get (base_endpoint, "local-answer-sdp", &answer, NULL);
-  if (answer == NULL) {
-    g_object_get (base_endpoint, "remote-answer-sdp", &answer, NULL);
-  }
-
-  if (answer == NULL) {
-    return NULL;
-  }
-
-  len = gst_sdp_message_medias_len (answer);
-  for (i = 0; i < len; i++) {
-    const GstSDPMedia *media = gst_sdp_message_get_media (answer, i);
-    const gchar *media_str = gst_sdp_media_get_media (media);
-    const gchar *rtpmap;
-    guint j, f_len;
-
-    f_len = gst_sdp_media_formats_len (media);
-    for (j = 0; j < f_len; j++) {
-      GstCaps *caps;
-      const gchar *payload = gst_sdp_media_get_format (media, j);
-
-      if (atoi (payload) != pt) {
-        continue;
-      }
-
-      rtpmap = sdp_utils_sdp_media_get_rtpmap (media, payload);
-      caps =
-          kms_base_rtp_endpoint_get_caps_from_rtpmap (media_str, payload,
-          rtpmap);
-
-      if (caps != NULL) {
-        if (g_strcmp0 (VIDEO_STREAM_NAME, media_str) == 0) {
-          gst_caps_set_simple (caps, "rtcp-fb-ccm-fir",
-              G_TYPE_BOOLEAN, self->priv->rtcp_fir, "rtcp-fb-nack-pli",
-              G_TYPE_BOOLEAN, self->priv->rtcp_pli, NULL);
-        }
+  KMS_ELEMENT_LOCK (self);
 
-        ret = caps;
-        goto end;
-      }
-    }
+  if (self->priv->pt_map != NULL && pt < RTP_PT_MAP_LEN &&
+      self->priv->pt_map[pt] != NULL) {
+    ret = gst_caps_ref (self->priv->pt_map[pt]);
   }
 
-end:
-  gst_sdp_message_free (answer);
+  KMS_ELEMENT_UNLOCK (self);
 
   return ret;
 }
@@ -1178,21 +1681,152 @@ end:
   }
 }
 
+/*
+ * Latencies can be set in any order, so they are only checked against each
+ * other when used. Call with the lock held.
+ */
+static guint
+kms_base_rtp_endpoint_get_min_latency (KmsBaseRtpEndpoint * self)
+{
+  return MIN (self->priv->jb_min_latency, self->priv->jb_latency);
+}
+
 static void
 kms_base_rtp_endpoint_rtpbin_new_jitterbuffer (GstElement * rtpbin,
     GstElement * jitterbuffer,
     guint session, guint ssrc, KmsBaseRtpEndpoint * self)
 {
-  g_object_set (jitterbuffer, "mode", 4 /* synced */ , "latency", 1500, NULL);
+  KmsJitterBufferProfile profile;
+  gboolean is_video, rtcp_nack;
+  guint latency, min;
+
+  KMS_ELEMENT_LOCK (self);
+
+  profile = self->priv->jb_profile;
+  is_video = ssrc == self->priv->video_ssrc;
+  rtcp_nack = self->priv->rtcp_nack;
+  min = kms_base_rtp_endpoint_get_min_latency (self);
+
+  if (self->priv->jb_min_latency > self->priv->jb_latency) {
+    GST_WARNING_OBJECT (self, "Jitter buffer min latency %u ms is over "
+        "latency %u ms, using %u ms", self->priv->jb_min_latency,
+        self->priv->jb_latency, min);
+  }
+
+  if (profile == KMS_JITTER_BUFFER_PROFILE_INTERACTIVE) {
+    latency = min;
+  } else {
+    /* Adaptive buffers start large and shrink once RTCP is received */
+    latency = self->priv->jb_latency;
+  }
+
+  if (session < N_RTP_SESSIONS) {
+    g_clear_object (&self->priv->jitterbuffers[session]);
+    self->priv->jitterbuffers[session] = g_object_ref (jitterbuffer);
+    self->priv->jb_ssrcs[session] = ssrc;
+  }
+
+  KMS_ELEMENT_UNLOCK (self);
 
-  if (ssrc == self->priv->video_ssrc) {
+  GST_DEBUG_OBJECT (self, "New jitterbuffer for ssrc %u in session %u with "
+      "latency %u ms", ssrc, session, latency);
+
+  g_object_set (jitterbuffer, "mode", 4 /* synced */ , "latency", latency,
+      "drop-on-latency", profile == KMS_JITTER_BUFFER_PROFILE_INTERACTIVE,
+      NULL);
+
+  if (is_video) {
     g_object_set (jitterbuffer, "do-lost", TRUE,
-        "do-retransmission", self->priv->rtcp_nack,
+        "do-retransmission", rtcp_nack,
         "rtx-next-seqnum", FALSE,
         "rtx-max-retries", 0, "rtp-max-dropout", -1, NULL);
   }
 }
 
+static void
+kms_base_rtp_endpoint_rtpbin_on_ssrc_active (GstElement * rtpbin,
+    guint session, guint ssrc, gpointer user_data)
+{
+  KmsBaseRtpEndpoint *self = KMS_BASE_RTP_ENDPOINT (user_data);
+  GstElement *jitterbuffer = NULL;
+  GObject *rtpsession, *source = NULL;
+  GstStructure *stats;
+  guint min, max, latency;
+
+  if (session >= N_RTP_SESSIONS) {
+    return;
+  }
+
+  KMS_ELEMENT_LOCK (self);
+
+  if (self->priv->jb_profile == KMS_JITTER_BUFFER_PROFILE_ADAPTIVE &&
+      self->priv->jb_ssrcs[session] == ssrc &&
+      self->priv->jitterbuffers[session] != NULL) {
+    jitterbuffer = g_object_ref (self->priv->jitterbuffers[session]);
+  }
+
+  min = kms_base_rtp_endpoint_get_min_latency (self);
+  max = self->priv->jb_latency;
+
+  KMS_ELEMENT_UNLOCK (self);
+
+  if (jitterbuffer == NULL) {
+    return;
+  }
+
+  g_signal_emit_by_name (rtpbin, "get-internal-session", session,
+      &rtpsession);
+  if (rtpsession != NULL) {
+    g_signal_emit_by_name (rtpsession, "get-source-by-ssrc", ssrc, &source);
+    g_object_unref (rtpsession);
+  }
+
+  if (source == NULL) {
+    g_object_unref (jitterbuffer);
+    return;
+  }
+
+  g_object_get (source, "stats", &stats, NULL);
+  latency = kms_jitter_buffer_adapt_latency (jitterbuffer, stats, min, max);
+
+  if (latency != 0) {
+    GST_TRACE_OBJECT (self, "Latency for ssrc %u: %u ms", ssrc, latency);
+  }
+
+  gst_structure_free (stats);
+  g_object_unref (source);
+  g_object_unref (jitterbuffer);
+}
+
+static GstStructure *
+kms_base_rtp_endpoint_get_jitter_buffer_stats (KmsBaseRtpEndpoint * self)
+{
+  GstStructure *stats = gst_structure_new_empty ("jitter-buffer-stats");
+  guint session;
+
+  for (session = 0; session < N_RTP_SESSIONS; session++) {
+    GstElement *jitterbuffer = self->priv->jitterbuffers[session];
+    GstStructure *jb_stats;
+    guint latency;
+
+    if (jitterbuffer == NULL) {
+      continue;
+    }
+
+    /* Lost and late packets are counted by the jitterbuffer itself */
+    g_object_get (jitterbuffer, "stats", &jb_stats, "latency", &latency,
+        NULL);
+    gst_structure_set (jb_stats, "ssrc", G_TYPE_UINT,
+        self->priv->jb_ssrcs[session], "latency", G_TYPE_UINT, latency, NULL);
+    gst_structure_set (stats,
+        session == AUDIO_RTP_SESSION ? AUDIO_STREAM_NAME : VIDEO_STREAM_NAME,
+        GST_TYPE_STRUCTURE, jb_stats, NULL);
+    gst_structure_free (jb_stats);
+  }
+
+  return stats;
+}
+
 static void
 kms_base_rtp_endpoint_stop_signal (KmsBaseRtpEndpoint * self, guint session,
     guint ssrc)
@@ -1252,12 +1886,14 @@ kms_base_rtp_endpoint_set_property (GObject * object, guint property_id,
       break;
     case PROP_RTCP_FIR:
       self->priv->rtcp_fir = g_value_get_boolean (value);
+      kms_base_rtp_endpoint_pt_map_set_feedback (self);
       break;
     case PROP_RTCP_NACK:
       self->priv->rtcp_nack = g_value_get_boolean (value);
       break;
     case PROP_RTCP_PLI:
       self->priv->rtcp_pli = g_value_get_boolean (value);
+      kms_base_rtp_endpoint_pt_map_set_feedback (self);
       break;
     case PROP_RTCP_REMB:
       self->priv->rtcp_remb = g_value_get_boolean (value);
@@ -1289,6 +1925,18 @@ kms_base_rtp_endpoint_set_property (GObject * object, guint property_id,
       self->priv->max_video_send_bw = v;
       break;
     }
+    case PROP_CONGESTION_CONTROL:
+      self->priv->congestion_control = g_value_get_enum (value);
+      break;
+    case PROP_JITTER_BUFFER_PROFILE:
+      self->priv->jb_profile = g_value_get_enum (value);
+      break;
+    case PROP_JITTER_BUFFER_LATENCY:
+      self->priv->jb_latency = g_value_get_uint (value);
+      break;
+    case PROP_JITTER_BUFFER_MIN_LATENCY:
+      self->priv->jb_min_latency = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -1303,6 +1951,12 @@ kms_bse_rtp_endpoint_get_property (GObject * object, guint property_id,
 {
   KmsBaseRtpEndpoint *self = KMS_BASE_RTP_ENDPOINT (object);
 
+  if (property_id == PROP_STATS) {
+    /* Snapshots are built from the RTP sessions, which take their own locks */
+    g_value_take_boxed (value, kms_base_rtp_endpoint_get_stats (self));
+    return;
+  }
+
   KMS_ELEMENT_LOCK (self);
 
   switch (property_id) {
@@ -1336,6 +1990,22 @@ kms_bse_rtp_endpoint_get_property (GObject * object, guint property_id,
     case PROP_MAX_VIDEO_SEND_BW:
       g_value_set_uint (value, self->priv->max_video_send_bw);
       break;
+    case PROP_CONGESTION_CONTROL:
+      g_value_set_enum (value, self->priv->congestion_control);
+      break;
+    case PROP_JITTER_BUFFER_PROFILE:
+      g_value_set_enum (value, self->priv->jb_profile);
+      break;
+    case PROP_JITTER_BUFFER_LATENCY:
+      g_value_set_uint (value, self->priv->jb_latency);
+      break;
+    case PROP_JITTER_BUFFER_MIN_LATENCY:
+      g_value_set_uint (value, self->priv->jb_min_latency);
+      break;
+    case PROP_JITTER_BUFFER_STATS:
+      g_value_take_boxed (value,
+          kms_base_rtp_endpoint_get_jitter_buffer_stats (self));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -1348,6 +2018,7 @@ static void
 kms_base_rtp_endpoint_dispose (GObject * gobject)
 {
   KmsBaseRtpEndpoint *self = KMS_BASE_RTP_ENDPOINT (gobject);
+  guint session;
 
   GST_DEBUG_OBJECT (self, "dispose");
 
@@ -1368,6 +2039,10 @@ kms_base_rtp_endpoint_dispose (GObject * gobject)
         KMS_MEDIA_TYPE_VIDEO, TRUE);
   }
 
+  for (session = 0; session < N_RTP_SESSIONS; session++) {
+    g_clear_object (&self->priv->jitterbuffers[session]);
+  }
+
   G_OBJECT_CLASS (kms_base_rtp_endpoint_parent_class)->dispose (gobject);
 }
 
@@ -1375,13 +2050,24 @@ static void
 kms_base_rtp_endpoint_finalize (GObject * gobject)
 {
   KmsBaseRtpEndpoint *self = KMS_BASE_RTP_ENDPOINT (gobject);
+  guint session;
 
   GST_DEBUG_OBJECT (self, "finalize");
 
   kms_remb_local_destroy (self->priv->rl);
   kms_remb_remote_destroy (self->priv->rm);
+  kms_base_rtp_endpoint_pt_map_free (self->priv->pt_map);
   g_free (self->priv->proto);
 
+  for (session = 0; session < N_RTP_SESSIONS; session++) {
+    if (self->priv->stats[session].snapshot != NULL) {
+      gst_structure_free (self->priv->stats[session].snapshot);
+    }
+
+    g_hash_table_unref (self->priv->stats[session].feedback_sent);
+    g_hash_table_unref (self->priv->stats[session].feedback_received);
+  }
+
   G_OBJECT_CLASS (kms_base_rtp_endpoint_parent_class)->finalize (gobject);
 }
 
@@ -1475,6 +2161,46 @@ kms_base_rtp_endpoint_class_init (KmsBaseRtpEndpointClass * klass)
           0, G_MAXUINT32, MAX_VIDEO_SEND_BW_DEFAULT,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (object_class, PROP_CONGESTION_CONTROL,
+      g_param_spec_enum ("congestion-control", "Congestion control",
+          "Estimator used to compute the REMB sent for received video. "
+          "Only applies once REMB is negotiated",
+          KMS_TYPE_CONGESTION_CONTROL, DEFAULT_CONGESTION_CONTROL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_JITTER_BUFFER_PROFILE,
+      g_param_spec_enum ("jitter-buffer-profile", "Jitter buffer profile",
+          "How the latency of the jitter buffers is chosen. Only applies to "
+          "jitter buffers created afterwards",
+          KMS_TYPE_JITTER_BUFFER_PROFILE, DEFAULT_JITTER_BUFFER_PROFILE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_JITTER_BUFFER_LATENCY,
+      g_param_spec_uint ("jitter-buffer-latency", "Jitter buffer latency",
+          "Latency of buffered jitter buffers and upper bound of adaptive "
+          "ones. Unit: ms", 0, G_MAXUINT, DEFAULT_JITTER_BUFFER_LATENCY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class,
+      PROP_JITTER_BUFFER_MIN_LATENCY,
+      g_param_spec_uint ("jitter-buffer-min-latency",
+          "Jitter buffer minimum latency",
+          "Latency of interactive jitter buffers and lower bound of adaptive "
+          "ones. Unit: ms", 0, G_MAXUINT, DEFAULT_JITTER_BUFFER_MIN_LATENCY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_JITTER_BUFFER_STATS,
+      g_param_spec_boxed ("jitter-buffer-stats", "Jitter buffer statistics",
+          "Effective latency, lost and late packets of the audio and video "
+          "jitter buffers", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "RTP statistics",
+          "Per SSRC statistics of the audio and video sessions, updated once "
+          "per RTCP interval", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
   /* set signals */
   obj_signals[MEDIA_START] =
       g_signal_new ("media-start",
@@ -1584,6 +2310,8 @@ kms_base_rtp_endpoint_rtpbin_on_sender_timeout (GstElement * rtpbin,
 static void
 kms_base_rtp_endpoint_init (KmsBaseRtpEndpoint * self)
 {
+  guint session;
+
   self->priv = KMS_BASE_RTP_ENDPOINT_GET_PRIVATE (self);
   self->priv->proto = DEFAULT_PROTO;
   self->priv->bundle = DEFAULT_BUNDLE;
@@ -1595,6 +2323,22 @@ kms_base_rtp_endpoint_init (KmsBaseRtpEndpoint * self)
   self->priv->min_video_send_bw = MIN_VIDEO_SEND_BW_DEFAULT;
   self->priv->max_video_send_bw = MAX_VIDEO_SEND_BW_DEFAULT;
 
+  self->priv->congestion_control = DEFAULT_CONGESTION_CONTROL;
+  self->priv->jb_profile = DEFAULT_JITTER_BUFFER_PROFILE;
+  self->priv->jb_latency = DEFAULT_JITTER_BUFFER_LATENCY;
+  self->priv->jb_min_latency = DEFAULT_JITTER_BUFFER_MIN_LATENCY;
+
+  for (session = 0; session < N_RTP_SESSIONS; session++) {
+    self->priv->stats[session].self = self;
+    self->priv->stats[session].session = session;
+    self->priv->stats[session].feedback_sent =
+        g_hash_table_new_full (NULL, NULL, NULL,
+        (GDestroyNotify) kms_rtp_feedback_count_free);
+    self->priv->stats[session].feedback_received =
+        g_hash_table_new_full (NULL, NULL, NULL,
+        (GDestroyNotify) kms_rtp_feedback_count_free);
+  }
+
   self->priv->rtpbin = gst_element_factory_make ("rtpbin", NULL);
 
   g_signal_connect (self->priv->rtpbin, "request-pt-map",
@@ -1614,6 +2358,9 @@ kms_base_rtp_endpoint_init (KmsBaseRtpEndpoint * self)
   g_signal_connect (self->priv->rtpbin, "on-sender-timeout",
       G_CALLBACK (kms_base_rtp_endpoint_rtpbin_on_sender_timeout), self);
 
+  g_signal_connect (self->priv->rtpbin, "on-ssrc-active",
+      G_CALLBACK (kms_base_rtp_endpoint_rtpbin_on_ssrc_active), self);
+
   g_signal_connect (self->priv->rtpbin, "new-jitterbuffer",
       G_CALLBACK (kms_base_rtp_endpoint_rtpbin_new_jitterbuffer), self);
 
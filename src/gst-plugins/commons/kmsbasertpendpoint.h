@@ -18,6 +18,8 @@
 #include "kmsbasesdpendpoint.h"
 #include "kmsirtpconnection.h"
 #include "kmsmediatype.h"
+#include "kmsjitterbufferprofile.h"
+#include "kmscongestioncontrol.h"
 
 /* TODO: remove from here, it is defined in kmrtcp.h */
 #define RTCP_MIN_INTERVAL 500 /* ms */
@@ -0,0 +1,27 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#ifndef __KMS_CONGESTION_CONTROL_H__
+#define __KMS_CONGESTION_CONTROL_H__
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  KMS_CONGESTION_CONTROL_LOSS,
+  KMS_CONGESTION_CONTROL_DELAY
+} KmsCongestionControl;
+
+G_END_DECLS
+#endif /* __KMS_CONGESTION_CONTROL_H__ */
@@ -79,6 +79,9 @@ struct _KmsElementPrivate
   gboolean do_synchronization;
 
   GHashTable *pendingpads;
+
+  /* Forwarded to the video agnosticbin */
+  GstStructure *encoder_config;
 };
 
 /* Signals and args */
@@ -99,6 +102,7 @@ enum
   PROP_AUDIO_CAPS,
   PROP_VIDEO_CAPS,
   PROP_DO_SYNCHRONIZATION,
+  PROP_ENCODER_CONFIG,
   PROP_LAST
 };
 
@@ -456,6 +460,11 @@ kms_element_get_video_agnosticbin (KmsElement * self)
   self->priv->video_agnosticbin =
       gst_element_factory_make ("agnosticbin", NULL);
 
+  if (self->priv->encoder_config != NULL) {
+    g_object_set (self->priv->video_agnosticbin, "encoder-config",
+        self->priv->encoder_config, NULL);
+  }
+
   sink = gst_element_get_static_pad (self->priv->video_agnosticbin, "sink");
   gst_pad_add_probe (sink, GST_PAD_PROBE_TYPE_BUFFER, synchronize_probe, self,
       NULL);
@@ -711,6 +720,23 @@ kms_element_set_property (GObject * object, guint property_id,
     case PROP_DO_SYNCHRONIZATION:
       self->priv->do_synchronization = g_value_get_boolean (value);
       break;
+    case PROP_ENCODER_CONFIG:{
+      const GstStructure *config = gst_value_get_structure (value);
+
+      KMS_ELEMENT_LOCK (self);
+      if (self->priv->encoder_config != NULL) {
+        gst_structure_free (self->priv->encoder_config);
+      }
+      self->priv->encoder_config =
+          config != NULL ? gst_structure_copy (config) : NULL;
+
+      if (self->priv->video_agnosticbin != NULL) {
+        g_object_set (self->priv->video_agnosticbin, "encoder-config",
+            self->priv->encoder_config, NULL);
+      }
+      KMS_ELEMENT_UNLOCK (self);
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -740,6 +766,11 @@ kms_element_get_property (GObject * object, guint property_id,
     case PROP_DO_SYNCHRONIZATION:
       g_value_set_boolean (value, self->priv->do_synchronization);
       break;
+    case PROP_ENCODER_CONFIG:
+      KMS_ELEMENT_LOCK (self);
+      gst_value_set_structure (value, self->priv->encoder_config);
+      KMS_ELEMENT_UNLOCK (self);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -757,6 +788,10 @@ kms_element_finalize (GObject * object)
 
   g_mutex_clear (&element->priv->sync_lock);
 
+  if (element->priv->encoder_config != NULL) {
+    gst_structure_free (element->priv->encoder_config);
+  }
+
   /* chain up */
   G_OBJECT_CLASS (kms_element_parent_class)->finalize (object);
 }
@@ -929,6 +964,11 @@ kms_element_class_init (KmsElementClass * klass)
           "The allowed caps for video", GST_TYPE_CAPS,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_ENCODER_CONFIG,
+      g_param_spec_boxed ("encoder-config", "Encoder configuration",
+          "Settings for the video encoders created by this element",
+          GST_TYPE_STRUCTURE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   klass->sink_query = GST_DEBUG_FUNCPTR (kms_element_sink_query_default);
 
   /* set actions */
@@ -977,6 +1017,7 @@ kms_element_init (KmsElement * element)
   element->priv->do_synchronization = DEFAULT_DO_SYNCHRONIZATION;
   element->priv->pendingpads = g_hash_table_new_full (g_str_hash, g_str_equal,
       g_free, (GDestroyNotify) destroy_pendingpads);
+  element->priv->encoder_config = NULL;
 }
 
 KmsElementPadType
@@ -0,0 +1,88 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <kmsjitterbufferprofile.h>
+
+#define JB_JITTER_FACTOR 4
+#define JB_LATENCY_STEP 10      /* ms */
+
+/*
+ * Latency for an adaptive jitter buffer currently at latency ms, from the
+ * stats of the RTP source it receives. Grows at once on jitter spikes and
+ * shrinks slowly, always within [min, max]. Returns 0 if the latency does
+ * not need to be changed.
+ */
+guint
+kms_jitter_buffer_get_adaptive_latency (const GstStructure * source_stats,
+    guint latency, gboolean retransmission, guint min, guint max)
+{
+  gboolean have_rb;
+  guint jitter, rtt, target;
+  gint clock_rate;
+
+  if (!gst_structure_get_uint (source_stats, "jitter", &jitter) ||
+      !gst_structure_get_int (source_stats, "clock-rate", &clock_rate) ||
+      clock_rate <= 0) {
+    return 0;
+  }
+
+  /* Interarrival jitter comes in timestamp units */
+  target = JB_JITTER_FACTOR * gst_util_uint64_scale_int (jitter, 1000,
+      clock_rate);
+
+  /* Retransmitted packets need a round trip to arrive */
+  if (retransmission &&
+      gst_structure_get_boolean (source_stats, "have-rb", &have_rb) &&
+      have_rb && gst_structure_get_uint (source_stats, "rb-round-trip", &rtt)) {
+    /* RTT comes in 1/65536 seconds */
+    target += gst_util_uint64_scale_int (rtt, 1000, 65536);
+  }
+
+  if (target < latency) {
+    target = (latency * 7 + target) / 8;
+  }
+
+  target = CLAMP (target, min, max);
+
+  if (ABS ((gint) target - (gint) latency) < JB_LATENCY_STEP) {
+    return 0;
+  }
+
+  return target;
+}
+
+/*
+ * Applies the adaptive latency to an rtpjitterbuffer. Returns the new
+ * latency, 0 if it was not changed.
+ */
+guint
+kms_jitter_buffer_adapt_latency (GstElement * jitterbuffer,
+    const GstStructure * source_stats, guint min, guint max)
+{
+  gboolean retransmission;
+  guint latency;
+
+  g_object_get (jitterbuffer, "latency", &latency, "do-retransmission",
+      &retransmission, NULL);
+
+  latency = kms_jitter_buffer_get_adaptive_latency (source_stats, latency,
+      retransmission, min, max);
+
+  if (latency != 0) {
+    g_object_set (jitterbuffer, "latency", latency, NULL);
+  }
+
+  return latency;
+}
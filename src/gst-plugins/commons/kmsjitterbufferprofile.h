@@ -0,0 +1,36 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#ifndef __KMS_JITTER_BUFFER_PROFILE_H__
+#define __KMS_JITTER_BUFFER_PROFILE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  KMS_JITTER_BUFFER_PROFILE_BUFFERED,
+  KMS_JITTER_BUFFER_PROFILE_INTERACTIVE,
+  KMS_JITTER_BUFFER_PROFILE_ADAPTIVE
+} KmsJitterBufferProfile;
+
+guint kms_jitter_buffer_get_adaptive_latency (const GstStructure * source_stats,
+    guint latency, gboolean retransmission, guint min, guint max);
+
+guint kms_jitter_buffer_adapt_latency (GstElement * jitterbuffer,
+    const GstStructure * source_stats, guint min, guint max);
+
+G_END_DECLS
+#endif /* __KMS_JITTER_BUFFER_PROFILE_H__ */
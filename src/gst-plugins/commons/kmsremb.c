@@ -16,6 +16,9 @@
 #include "kmsremb.h"
 #include "kmsrtcp.h"
 
+#include <math.h>
+#include <gst/rtp/gstrtpbuffer.h>
+
 #define GST_CAT_DEFAULT kmsutils
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define GST_DEFAULT_NAME "kmsremb"
@@ -23,9 +26,9 @@ GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define REMB_MIN 30000          /* bps */
 #define REMB_MAX 2000000        /* bps */
 
-/* KmsRembLocal begin */
+/* KmsRembEstimator begin */
 
-#define KMS_REMB_LOCAL "kms-remb-local"
+/* Loss based estimator */
 
 #define REMB_EXPONENTIAL_FACTOR 0.04
 #define REMB_LINEAL_FACTOR_MIN 50       /* bps */
@@ -34,145 +37,569 @@ GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define REMB_THRESHOLD_FACTOR 0.8
 #define REMB_UP_LOSSES 12       /* 4% losses */
 
+typedef struct _KmsRembLossEstimator
+{
+  KmsRembEstimator parent;
+
+  gboolean probed;
+  guint threshold;
+  guint lineal_factor;
+  guint max_br;
+  guint avg_br;
+} KmsRembLossEstimator;
+
 static gboolean
-get_video_recv_info (KmsRembLocal * rl,
-    guint64 * bitrate, guint * fraction_lost)
+kms_remb_loss_estimator_update (KmsRembEstimator * est, GstClockTime now,
+    guint64 bitrate, guint fraction_lost)
 {
-  GValueArray *arr;
-  GValue *val;
-  guint i;
-  gboolean ret = FALSE;
+  KmsRembLossEstimator *loss = (KmsRembLossEstimator *) est;
 
-  g_object_get (rl->rtpsess, "sources", &arr, NULL);
+  if (!loss->probed) {
+    if (bitrate == 0) {
+      return FALSE;
+    }
 
-  for (i = 0; i < arr->n_values; i++) {
-    GObject *source;
-    guint ssrc;
-    GstStructure *s;
+    est->remb = bitrate;
+    loss->probed = TRUE;
+  }
 
-    val = g_value_array_get_nth (arr, i);
-    source = g_value_get_object (val);
-    g_object_get (source, "ssrc", &ssrc, NULL);
-    GST_TRACE_OBJECT (source, "source ssrc: %u", ssrc);
+  loss->max_br = MAX (loss->max_br, bitrate);
+
+  if (loss->avg_br == 0) {
+    loss->avg_br = bitrate;
+  } else {
+    loss->avg_br = (loss->avg_br * 7 + bitrate) / 8;
+  }
 
-    g_object_get (source, "stats", &s, NULL);
-    GST_TRACE_OBJECT (rl->rtpsess, "stats: %" GST_PTR_FORMAT, s);
+  if (fraction_lost == 0) {
+    gint remb_base, remb_new;
 
-    if (ssrc == rl->remote_ssrc) {
-      GstClockTime current_time;
-      guint64 octets_received;
+    remb_base = MIN (est->remb, loss->max_br);
 
-      if (!gst_structure_get_uint64 (s, "bitrate", bitrate)) {
-        break;
-      }
-      if (!gst_structure_get_uint64 (s, "octets-received", &octets_received)) {
-        break;
-      }
-      if (!gst_structure_get_uint (s, "sent-rb-fractionlost", fraction_lost)) {
-        break;
-      }
+    if (remb_base < loss->threshold) {
+      GST_TRACE ("A.1) Exponential (%f)", REMB_EXPONENTIAL_FACTOR);
+      remb_new = remb_base * (1 + REMB_EXPONENTIAL_FACTOR);
+    } else {
+      GST_TRACE ("A.2) Lineal (%" G_GUINT32_FORMAT ")", loss->lineal_factor);
+      remb_new = remb_base + loss->lineal_factor;
+    }
 
-      current_time = kms_utils_get_time_nsecs ();
+    est->remb = MAX (est->remb, remb_new);
+  } else if (fraction_lost < REMB_UP_LOSSES) {
+    GST_TRACE ("B) Assumable losses");
 
-      if (rl->last_time != 0) {
-        GstClockTime elapsed = current_time - rl->last_time;
-        guint64 bytes_handled = octets_received - rl->last_octets_received;
+    est->remb = MIN (est->remb, loss->max_br);
+    loss->threshold = est->remb * REMB_THRESHOLD_FACTOR;
+  } else {
+    gint remb_base, lineal_factor_new;
 
-        *bitrate =
-            gst_util_uint64_scale (bytes_handled, 8 * GST_SECOND, elapsed);
-        GST_TRACE_OBJECT (rl->rtpsess,
-            "Elapsed %" G_GUINT64_FORMAT " bytes %" G_GUINT64_FORMAT ", rate %"
-            G_GUINT64_FORMAT, elapsed, bytes_handled, *bitrate);
-      }
+    GST_TRACE ("C) Too losses");
 
-      rl->last_time = current_time;
-      rl->last_octets_received = octets_received;
+    remb_base = MAX (est->remb, loss->avg_br);
+    est->remb = remb_base * REMB_DECREMENT_FACTOR;
+    loss->threshold = remb_base * REMB_THRESHOLD_FACTOR;
+    lineal_factor_new =
+        (remb_base - loss->threshold) / REMB_LINEAL_FACTOR_GRADE;
+    loss->lineal_factor = MAX (REMB_LINEAL_FACTOR_MIN, lineal_factor_new);
+    loss->max_br = 0;
+    loss->avg_br = 0;
+  }
 
-      ret = TRUE;
-      break;
+  GST_TRACE ("REMB: %" G_GUINT32_FORMAT ", TH: %" G_GUINT32_FORMAT
+      ", fraction_lost: %d, bitrate: %" G_GUINT64_FORMAT "," " max_br: %"
+      G_GUINT32_FORMAT ", avg_br: %" G_GUINT32_FORMAT, est->remb,
+      loss->threshold, fraction_lost, bitrate, loss->max_br, loss->avg_br);
+
+  return TRUE;
+}
+
+static void
+kms_remb_loss_estimator_destroy (KmsRembEstimator * est)
+{
+  g_slice_free (KmsRembLossEstimator, (KmsRembLossEstimator *) est);
+}
+
+static KmsRembEstimator *
+kms_remb_loss_estimator_create (void)
+{
+  KmsRembLossEstimator *loss = g_slice_new0 (KmsRembLossEstimator);
+
+  loss->parent.update = kms_remb_loss_estimator_update;
+  loss->parent.destroy = kms_remb_loss_estimator_destroy;
+  loss->parent.remb = REMB_MAX;
+  loss->threshold = REMB_MAX;
+  loss->lineal_factor = REMB_LINEAL_FACTOR_MIN;
+
+  return (KmsRembEstimator *) loss;
+}
+
+/*
+ * Delay based estimator: arrival-time filter, over-use detector and rate
+ * controller as described in draft-ietf-rmcat-gcc. Packets sharing an RTP
+ * timestamp are handled as one group.
+ */
+
+#define DELAY_VIDEO_CLOCK_RATE 90000
+#define DELAY_KALMAN_Q 1e-3
+#define DELAY_KALMAN_E_INIT 0.1
+#define DELAY_KALMAN_VAR_INIT 50.0
+#define DELAY_KALMAN_ALPHA 0.99
+#define DELAY_OUTLIER_FACTOR 3.0
+#define DELAY_TREND_GAIN 60
+#define DELAY_GAMMA_INIT 12.5   /* ms */
+#define DELAY_GAMMA_MIN 6.0     /* ms */
+#define DELAY_GAMMA_MAX 600.0   /* ms */
+#define DELAY_GAMMA_MAX_JUMP 15.0       /* ms */
+#define DELAY_GAMMA_K_UP 0.01
+#define DELAY_GAMMA_K_DOWN 0.00018
+#define DELAY_GAMMA_MAX_DELTA 100.0     /* ms */
+#define DELAY_OVERUSE_TIME (10 * GST_MSECOND)
+#define DELAY_INCREASE_FACTOR 1.08      /* per second */
+#define DELAY_DECREASE_FACTOR 0.85
+#define DELAY_MAX_INCOMING_FACTOR 1.5
+#define DELAY_MAX_INCOMING_MARGIN 10000 /* bps */
+
+typedef enum
+{
+  DELAY_USAGE_NORMAL,
+  DELAY_USAGE_UNDERUSE,
+  DELAY_USAGE_OVERUSE
+} DelayUsage;
+
+typedef enum
+{
+  DELAY_RATE_HOLD,
+  DELAY_RATE_INCREASE,
+  DELAY_RATE_DECREASE
+} DelayRateState;
+
+typedef struct _KmsRembDelayEstimator
+{
+  KmsRembEstimator parent;
+
+  /* Protects the filter and detector, fed from the streaming thread */
+  GMutex mutex;
+
+  gboolean have_group;
+  guint32 group_ts;
+  GstClockTime group_arrival;
+
+  gboolean have_prev_group;
+  guint32 prev_group_ts;
+  GstClockTime prev_group_arrival;
+
+  /* Arrival-time filter, in ms */
+  gdouble m;
+  gdouble e;
+  gdouble var_v;
+
+  /* Over-use detector, on the gradient scaled by the number of deltas */
+  guint n_deltas;
+  gdouble prev_trend;
+  gdouble gamma;
+  GstClockTime last_detection;
+  GstClockTime overuse_start;
+  DelayUsage usage;
+  DelayUsage worst_usage;
+
+  /* Rate controller, only used from the RTCP thread */
+  gboolean probed;
+  DelayRateState state;
+  GstClockTime last_update;
+} KmsRembDelayEstimator;
+
+static void
+kms_remb_delay_estimator_filter (KmsRembDelayEstimator * delay, gdouble d)
+{
+  gdouble z, max_z, k;
+
+  z = d - delay->m;
+
+  /* Do not let a single late group move the estimation too much */
+  max_z = DELAY_OUTLIER_FACTOR * sqrt (delay->var_v);
+  z = CLAMP (z, -max_z, max_z);
+
+  k = (delay->e + DELAY_KALMAN_Q) / (delay->var_v + delay->e + DELAY_KALMAN_Q);
+  delay->m += z * k;
+  delay->e = (1 - k) * (delay->e + DELAY_KALMAN_Q);
+  delay->var_v = MAX (DELAY_KALMAN_ALPHA * delay->var_v +
+      (1 - DELAY_KALMAN_ALPHA) * z * z, 1.0);
+}
+
+static void
+kms_remb_delay_estimator_detect (KmsRembDelayEstimator * delay,
+    GstClockTime now)
+{
+  gdouble trend, abs_trend;
+
+  delay->n_deltas = MIN (delay->n_deltas + 1, DELAY_TREND_GAIN);
+  trend = delay->m * delay->n_deltas;
+  abs_trend = fabs (trend);
+
+  if (trend > delay->gamma) {
+    if (!GST_CLOCK_TIME_IS_VALID (delay->overuse_start)) {
+      delay->overuse_start = now;
+    }
+
+    if (now - delay->overuse_start >= DELAY_OVERUSE_TIME &&
+        trend >= delay->prev_trend) {
+      delay->usage = DELAY_USAGE_OVERUSE;
     }
+  } else {
+    delay->overuse_start = GST_CLOCK_TIME_NONE;
+    delay->usage = trend < -delay->gamma ?
+        DELAY_USAGE_UNDERUSE : DELAY_USAGE_NORMAL;
   }
 
-  g_value_array_free (arr);
+  /* Adaptive threshold, so that competing TCP flows do not starve us */
+  if (GST_CLOCK_TIME_IS_VALID (delay->last_detection) &&
+      abs_trend - delay->gamma <= DELAY_GAMMA_MAX_JUMP) {
+    gdouble dt, k;
 
-  return ret;
+    dt = MIN ((gdouble) (now - delay->last_detection) / GST_MSECOND,
+        DELAY_GAMMA_MAX_DELTA);
+    k = abs_trend < delay->gamma ? DELAY_GAMMA_K_DOWN : DELAY_GAMMA_K_UP;
+    delay->gamma += dt * k * (abs_trend - delay->gamma);
+    delay->gamma = CLAMP (delay->gamma, DELAY_GAMMA_MIN, DELAY_GAMMA_MAX);
+  }
+
+  delay->prev_trend = trend;
+  delay->last_detection = now;
+  delay->worst_usage = MAX (delay->worst_usage, delay->usage);
 }
 
-static gboolean
-kms_remb_local_update (KmsRembLocal * rl)
+static void
+kms_remb_delay_estimator_packet_received (KmsRembEstimator * est,
+    GstClockTime arrival, guint32 rtp_timestamp)
 {
-  guint64 bitrate;
-  guint fraction_lost;
+  KmsRembDelayEstimator *delay = (KmsRembDelayEstimator *) est;
 
-  if (!get_video_recv_info (rl, &bitrate, &fraction_lost)) {
-    return FALSE;
+  g_mutex_lock (&delay->mutex);
+
+  if (!delay->have_group) {
+    delay->have_group = TRUE;
+    delay->group_ts = rtp_timestamp;
+    delay->group_arrival = arrival;
+    goto end;
+  }
+
+  if (rtp_timestamp == delay->group_ts) {
+    delay->group_arrival = arrival;
+    goto end;
+  }
+
+  if ((gint32) (rtp_timestamp - delay->group_ts) < 0) {
+    /* Reordered packet of an older group */
+    goto end;
+  }
+
+  if (delay->have_prev_group) {
+    gdouble send_delta, arrival_delta;
+
+    send_delta = (gdouble) (guint32) (delay->group_ts - delay->prev_group_ts)
+        * 1000 / DELAY_VIDEO_CLOCK_RATE;
+    arrival_delta = (gdouble) (gint64) (delay->group_arrival -
+        delay->prev_group_arrival) / GST_MSECOND;
+
+    kms_remb_delay_estimator_filter (delay, arrival_delta - send_delta);
+    kms_remb_delay_estimator_detect (delay, arrival);
   }
 
-  if (!rl->probed) {
+  delay->have_prev_group = TRUE;
+  delay->prev_group_ts = delay->group_ts;
+  delay->prev_group_arrival = delay->group_arrival;
+  delay->group_ts = rtp_timestamp;
+  delay->group_arrival = arrival;
+
+end:
+  g_mutex_unlock (&delay->mutex);
+}
+
+static gboolean
+kms_remb_delay_estimator_update (KmsRembEstimator * est, GstClockTime now,
+    guint64 bitrate, guint fraction_lost)
+{
+  KmsRembDelayEstimator *delay = (KmsRembDelayEstimator *) est;
+  guint64 max_remb;
+  gdouble elapsed;
+  DelayUsage usage;
+
+  /* Over-use seen at any time since the last update must be acted on */
+  g_mutex_lock (&delay->mutex);
+  usage = delay->worst_usage;
+  delay->worst_usage = delay->usage;
+  g_mutex_unlock (&delay->mutex);
+
+  if (!delay->probed) {
     if (bitrate == 0) {
       return FALSE;
     }
 
-    rl->remb = bitrate;
-    rl->probed = TRUE;
+    est->remb = bitrate;
+    delay->probed = TRUE;
+    delay->last_update = now;
+
+    return TRUE;
   }
 
-  rl->max_br = MAX (rl->max_br, bitrate);
+  switch (usage) {
+    case DELAY_USAGE_OVERUSE:
+      delay->state = DELAY_RATE_DECREASE;
+      break;
+    case DELAY_USAGE_UNDERUSE:
+      /* Queues are draining, wait for them to be empty */
+      delay->state = DELAY_RATE_HOLD;
+      break;
+    case DELAY_USAGE_NORMAL:
+      delay->state = delay->state == DELAY_RATE_DECREASE ?
+          DELAY_RATE_HOLD : DELAY_RATE_INCREASE;
+      break;
+  }
 
-  if (rl->avg_br == 0) {
-    rl->avg_br = bitrate;
-  } else {
-    rl->avg_br = (rl->avg_br * 7 + bitrate) / 8;
+  elapsed = (gdouble) (now - delay->last_update) / GST_SECOND;
+  delay->last_update = now;
+
+  switch (delay->state) {
+    case DELAY_RATE_INCREASE:
+      est->remb *= pow (DELAY_INCREASE_FACTOR, MIN (elapsed, 1.0));
+      break;
+    case DELAY_RATE_DECREASE:
+      est->remb = bitrate * DELAY_DECREASE_FACTOR;
+      break;
+    case DELAY_RATE_HOLD:
+      break;
   }
 
-  if (fraction_lost == 0) {
-    gint remb_base, remb_new;
+  /* Do not ask for much more than what is being received */
+  max_remb = bitrate * DELAY_MAX_INCOMING_FACTOR + DELAY_MAX_INCOMING_MARGIN;
+  est->remb = MIN (est->remb, MIN (max_remb, REMB_MAX));
 
-    remb_base = MIN (rl->remb, rl->max_br);
+  GST_TRACE ("REMB: %" G_GUINT32_FORMAT ", usage: %d, state: %d, m: %f, "
+      "gamma: %f, bitrate: %" G_GUINT64_FORMAT, est->remb, usage,
+      delay->state, delay->m, delay->gamma, bitrate);
 
-    if (remb_base < rl->threshold) {
-      GST_TRACE_OBJECT (rl->rtpsess, "A.1) Exponential (%f)",
-          REMB_EXPONENTIAL_FACTOR);
-      remb_new = remb_base * (1 + REMB_EXPONENTIAL_FACTOR);
-    } else {
-      GST_TRACE_OBJECT (rl->rtpsess, "A.2) Lineal (%" G_GUINT32_FORMAT ")",
-          rl->lineal_factor);
-      remb_new = remb_base + rl->lineal_factor;
-    }
+  return TRUE;
+}
 
-    rl->remb = MAX (rl->remb, remb_new);
-  } else if (fraction_lost < REMB_UP_LOSSES) {
-    GST_TRACE_OBJECT (rl->rtpsess, "B) Assumable losses");
+static void
+kms_remb_delay_estimator_destroy (KmsRembEstimator * est)
+{
+  KmsRembDelayEstimator *delay = (KmsRembDelayEstimator *) est;
 
-    rl->remb = MIN (rl->remb, rl->max_br);
-    rl->threshold = rl->remb * REMB_THRESHOLD_FACTOR;
-  } else {
-    gint remb_base, lineal_factor_new;
+  g_mutex_clear (&delay->mutex);
+  g_slice_free (KmsRembDelayEstimator, delay);
+}
+
+static KmsRembEstimator *
+kms_remb_delay_estimator_create (void)
+{
+  KmsRembDelayEstimator *delay = g_slice_new0 (KmsRembDelayEstimator);
+
+  delay->parent.packet_received = kms_remb_delay_estimator_packet_received;
+  delay->parent.update = kms_remb_delay_estimator_update;
+  delay->parent.destroy = kms_remb_delay_estimator_destroy;
+  delay->parent.remb = REMB_MAX;
+
+  g_mutex_init (&delay->mutex);
+  delay->e = DELAY_KALMAN_E_INIT;
+  delay->var_v = DELAY_KALMAN_VAR_INIT;
+  delay->gamma = DELAY_GAMMA_INIT;
+  delay->last_detection = GST_CLOCK_TIME_NONE;
+  delay->overuse_start = GST_CLOCK_TIME_NONE;
+  delay->state = DELAY_RATE_INCREASE;
+
+  return (KmsRembEstimator *) delay;
+}
+
+KmsRembEstimator *
+kms_remb_estimator_create (KmsCongestionControl type, guint max_bw)
+{
+  KmsRembEstimator *est;
+
+  switch (type) {
+    case KMS_CONGESTION_CONTROL_DELAY:
+      est = kms_remb_delay_estimator_create ();
+      break;
+    case KMS_CONGESTION_CONTROL_LOSS:
+    default:
+      est = kms_remb_loss_estimator_create ();
+      break;
+  }
+
+  est->type = type;
+  est->max_bw = max_bw;
 
-    GST_TRACE_OBJECT (rl->rtpsess, "C) Too losses");
+  return est;
+}
+
+void
+kms_remb_estimator_destroy (KmsRembEstimator * est)
+{
+  if (est == NULL) {
+    return;
+  }
+
+  est->destroy (est);
+}
 
-    remb_base = MAX (rl->remb, rl->avg_br);
-    rl->remb = remb_base * REMB_DECREMENT_FACTOR;
-    rl->threshold = remb_base * REMB_THRESHOLD_FACTOR;
-    lineal_factor_new = (remb_base - rl->threshold) / REMB_LINEAL_FACTOR_GRADE;
-    rl->lineal_factor = MAX (REMB_LINEAL_FACTOR_MIN, lineal_factor_new);
-    rl->max_br = 0;
-    rl->avg_br = 0;
+void
+kms_remb_estimator_packet_received (KmsRembEstimator * est,
+    GstClockTime arrival, guint32 rtp_timestamp)
+{
+  if (est->packet_received != NULL) {
+    est->packet_received (est, arrival, rtp_timestamp);
   }
+}
 
-  if (rl->max_bw > 0) {
-    rl->remb = MIN (rl->remb, rl->max_bw * 1000);
+gboolean
+kms_remb_estimator_update (KmsRembEstimator * est, GstClockTime now,
+    guint64 bitrate, guint fraction_lost)
+{
+  if (!est->update (est, now, bitrate, fraction_lost)) {
+    return FALSE;
   }
 
-  GST_TRACE_OBJECT (rl->rtpsess,
-      "REMB: %" G_GUINT32_FORMAT ", TH: %" G_GUINT32_FORMAT
-      ", fraction_lost: %d, bitrate: %" G_GUINT64_FORMAT "," " max_br: %"
-      G_GUINT32_FORMAT ", avg_br: %" G_GUINT32_FORMAT, rl->remb,
-      rl->threshold, fraction_lost, bitrate, rl->max_br, rl->avg_br);
+  if (est->max_bw > 0) {
+    est->remb = MIN (est->remb, est->max_bw * 1000);
+  }
 
   return TRUE;
 }
 
+/* KmsRembEstimator end */
+
+/* KmsRembLocal begin */
+
+#define KMS_REMB_LOCAL "kms-remb-local"
+
+static gboolean
+get_video_recv_bitrate (KmsRembLocal * rl, guint64 * bitrate)
+{
+  GstClockTime current_time, elapsed;
+  gsize octets_received, bytes_handled;
+  gboolean ret = FALSE;
+
+  current_time = kms_utils_get_time_nsecs ();
+  octets_received = (gsize) g_atomic_pointer_get (&rl->octets_received);
+
+  /* Unsigned difference is right even if the counter wraps */
+  bytes_handled = octets_received - rl->last_octets_received;
+  elapsed = current_time - rl->last_time;
+
+  if (rl->last_time != 0 && elapsed > 0) {
+    *bitrate = gst_util_uint64_scale (bytes_handled, 8 * GST_SECOND, elapsed);
+    GST_TRACE_OBJECT (rl->rtpsess,
+        "Elapsed %" G_GUINT64_FORMAT " bytes %" G_GSIZE_FORMAT ", rate %"
+        G_GUINT64_FORMAT, elapsed, bytes_handled, *bitrate);
+    ret = TRUE;
+  }
+
+  rl->last_time = current_time;
+  rl->last_octets_received = octets_received;
+
+  return ret;
+}
+
+/*
+ * Fraction lost is taken from the report block being sent. Returns FALSE if
+ * there is none for the remote SSRC.
+ */
+static gboolean
+get_video_recv_fraction_lost (KmsRembLocal * rl, GstRTCPBuffer * rtcp,
+    guint * fraction_lost)
+{
+  GstRTCPPacket packet;
+  gboolean more;
+
+  for (more = gst_rtcp_buffer_get_first_packet (rtcp, &packet); more;
+      more = gst_rtcp_packet_move_to_next (&packet)) {
+    GstRTCPType type = gst_rtcp_packet_get_type (&packet);
+    guint i, count;
+
+    if (type != GST_RTCP_TYPE_SR && type != GST_RTCP_TYPE_RR) {
+      continue;
+    }
+
+    count = gst_rtcp_packet_get_rb_count (&packet);
+    for (i = 0; i < count; i++) {
+      guint32 ssrc, exthighestseq, jitter, lsr, dlsr;
+      gint32 packetslost;
+      guint8 fl;
+
+      gst_rtcp_packet_get_rb (&packet, i, &ssrc, &fl, &packetslost,
+          &exthighestseq, &jitter, &lsr, &dlsr);
+
+      if (ssrc == rl->remote_ssrc) {
+        *fraction_lost = fl;
+        return TRUE;
+      }
+    }
+  }
+
+  return FALSE;
+}
+
+static void
+process_recv_buffer (KmsRembLocal * rl, GstBuffer * buffer,
+    GstClockTime arrival)
+{
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+
+  if (!gst_rtp_buffer_map (buffer, GST_MAP_READ, &rtp)) {
+    return;
+  }
+
+  /* The pad also carries other streams of the session, like retransmissions */
+  if (gst_rtp_buffer_get_ssrc (&rtp) != rl->remote_ssrc) {
+    gst_rtp_buffer_unmap (&rtp);
+    return;
+  }
+
+  /* Payload only, as the octets-received stat of the session */
+  g_atomic_pointer_add (&rl->octets_received,
+      gst_rtp_buffer_get_payload_len (&rtp));
+
+  if (rl->estimator->packet_received != NULL) {
+    kms_remb_estimator_packet_received (rl->estimator, arrival,
+        gst_rtp_buffer_get_timestamp (&rtp));
+  }
+
+  gst_rtp_buffer_unmap (&rtp);
+}
+
+static GstPadProbeReturn
+recv_rtp_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  KmsRembLocal *rl = user_data;
+  GstClockTime arrival = kms_utils_get_time_nsecs ();
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    process_recv_buffer (rl, GST_PAD_PROBE_INFO_BUFFER (info), arrival);
+  } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+    guint i, len = gst_buffer_list_length (list);
+
+    for (i = 0; i < len; i++) {
+      process_recv_buffer (rl, gst_buffer_list_get (list, i), arrival);
+    }
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+kms_remb_local_update (KmsRembLocal * rl, guint fraction_lost)
+{
+  guint64 bitrate;
+
+  if (!get_video_recv_bitrate (rl, &bitrate)) {
+    return FALSE;
+  }
+
+  return kms_remb_estimator_update (rl->estimator, rl->last_time, bitrate,
+      fraction_lost);
+}
+
 static void
 on_sending_rtcp (GObject * sess, GstBuffer * buffer, gboolean is_early,
     gboolean * do_not_supress)
@@ -192,16 +619,20 @@ on_sending_rtcp (GObject * sess, GstBuffer * buffer, gboolean is_early,
     return;
   }
 
-  if (!gst_rtcp_buffer_add_packet (&rtcp, GST_RTCP_TYPE_PSFB, &packet)) {
-    GST_WARNING_OBJECT (sess, "Cannot add RTCP packet");
-    return;
+  /* Not every RTCP packet reports on the remote SSRC, the last fraction
+   * lost reported is kept for those */
+  get_video_recv_fraction_lost (rl, &rtcp, &rl->fraction_lost);
+
+  if (!kms_remb_local_update (rl, rl->fraction_lost)) {
+    goto end;
   }
 
-  if (!kms_remb_local_update (rl)) {
-    return;
+  if (!gst_rtcp_buffer_add_packet (&rtcp, GST_RTCP_TYPE_PSFB, &packet)) {
+    GST_WARNING_OBJECT (sess, "Cannot add RTCP packet");
+    goto end;
   }
 
-  remb_packet.bitrate = rl->remb;
+  remb_packet.bitrate = rl->estimator->remb;
   if (rl->event_manager != NULL) {
     guint remb_local_max;
 
@@ -209,7 +640,7 @@ on_sending_rtcp (GObject * sess, GstBuffer * buffer, gboolean is_early,
     if (remb_local_max > 0) {
       GST_TRACE_OBJECT (sess, "REMB local max: %" G_GUINT32_FORMAT,
           remb_local_max);
-      remb_packet.bitrate = MIN (remb_local_max, rl->remb);
+      remb_packet.bitrate = MIN (remb_local_max, rl->estimator->remb);
     }
   }
 
@@ -220,10 +651,14 @@ on_sending_rtcp (GObject * sess, GstBuffer * buffer, gboolean is_early,
   if (!kms_rtcp_psfb_afb_remb_marshall_packet (&packet, &remb_packet,
           packet_ssrc)) {
     gst_rtcp_packet_remove (&packet);
+  } else {
+    GST_TRACE_OBJECT (sess, "Sending REMB with bitrate: %d",
+        remb_packet.bitrate);
+    g_atomic_int_set (&rl->remb_sent, remb_packet.bitrate);
   }
-  gst_rtcp_buffer_unmap (&rtcp);
 
-  GST_TRACE_OBJECT (sess, "Sending REMB with bitrate: %d", remb_packet.bitrate);
+end:
+  gst_rtcp_buffer_unmap (&rtcp);
 }
 
 void
@@ -237,12 +672,20 @@ kms_remb_local_destroy (KmsRembLocal * rl)
     kms_utils_remb_event_manager_destroy (rl->event_manager);
   }
 
+  if (rl->recv_pad != NULL) {
+    gst_pad_remove_probe (rl->recv_pad, rl->probe_id);
+    g_object_unref (rl->recv_pad);
+  }
+
+  kms_remb_estimator_destroy (rl->estimator);
+
   g_object_unref (rl->rtpsess);
   g_slice_free (KmsRembLocal, rl);
 }
 
 KmsRembLocal *
-kms_remb_local_create (GObject * rtpsess, guint remote_ssrc, guint max_bw)
+kms_remb_local_create (GObject * rtpsess, guint remote_ssrc, guint max_bw,
+    KmsCongestionControl type, GstPad * recv_pad)
 {
   KmsRembLocal *rl = g_slice_new0 (KmsRembLocal);
 
@@ -251,12 +694,12 @@ kms_remb_local_create (GObject * rtpsess, guint remote_ssrc, guint max_bw)
       G_CALLBACK (on_sending_rtcp), NULL);
   rl->rtpsess = g_object_ref (rtpsess);
   rl->remote_ssrc = remote_ssrc;
-  rl->max_bw = max_bw;
+  rl->estimator = kms_remb_estimator_create (type, max_bw);
 
-  rl->probed = FALSE;
-  rl->remb = REMB_MAX;
-  rl->threshold = REMB_MAX;
-  rl->lineal_factor = REMB_LINEAL_FACTOR_MIN;
+  rl->recv_pad = g_object_ref (recv_pad);
+  rl->probe_id = gst_pad_add_probe (recv_pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      recv_rtp_probe, rl, NULL);
 
   return rl;
 }
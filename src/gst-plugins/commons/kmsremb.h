@@ -17,9 +17,37 @@
 #define __KMS_REMB_H__
 
 #include "kmsutils.h" /* TODO: must be not needed */
+#include "kmscongestioncontrol.h"
 
 G_BEGIN_DECLS
 
+/* KmsRembEstimator begin */
+typedef struct _KmsRembEstimator KmsRembEstimator;
+
+struct _KmsRembEstimator
+{
+  KmsCongestionControl type;
+  guint max_bw;
+
+  guint remb;
+
+  /* Only set by estimators that use the arrival of each packet */
+  void (*packet_received) (KmsRembEstimator *est, GstClockTime arrival,
+      guint32 rtp_timestamp);
+  gboolean (*update) (KmsRembEstimator *est, GstClockTime now,
+      guint64 bitrate, guint fraction_lost);
+  void (*destroy) (KmsRembEstimator *est);
+};
+
+KmsRembEstimator * kms_remb_estimator_create (KmsCongestionControl type,
+    guint max_bw);
+void kms_remb_estimator_destroy (KmsRembEstimator *est);
+void kms_remb_estimator_packet_received (KmsRembEstimator *est,
+    GstClockTime arrival, guint32 rtp_timestamp);
+gboolean kms_remb_estimator_update (KmsRembEstimator *est, GstClockTime now,
+    guint64 bitrate, guint fraction_lost);
+/* KmsRembEstimator end */
+
 /* KmsRembLocal begin */
 typedef struct _KmsRembLocal KmsRembLocal;
 
@@ -27,20 +55,23 @@ struct _KmsRembLocal
 {
   GObject *rtpsess;
   guint remote_ssrc;
-  guint max_bw;
 
-  guint remb;
-  gboolean probed;
-  guint threshold;
-  guint lineal_factor;
-  guint max_br;
-  guint avg_br;
+  KmsRembEstimator *estimator;
   GstClockTime last_time;
-  guint64 last_octets_received;
+  gsize last_octets_received;
+  guint fraction_lost;
   RembEventManager *event_manager;
+  /* Bitrate of the last REMB sent, read from stats */
+  volatile guint remb_sent;
+
+  /* Counted on the reception pad, read on every RTCP sent */
+  volatile gsize octets_received;
+  GstPad *recv_pad;
+  gulong probe_id;
 };
 
-KmsRembLocal * kms_remb_local_create (GObject *rtpsess, guint remote_ssrc, guint max_bw);
+KmsRembLocal * kms_remb_local_create (GObject *rtpsess, guint remote_ssrc,
+    guint max_bw, KmsCongestionControl type, GstPad *recv_pad);
 void kms_remb_local_destroy (KmsRembLocal *rl);
 /* KmsRembLocal end */
 
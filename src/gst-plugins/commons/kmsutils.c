@@ -22,7 +22,6 @@
 #define GST_CAT_DEFAULT kmsutils
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define GST_DEFAULT_NAME "kmsutils"
-#define LAST_KEY_FRAME_REQUEST_TIME "kmslastkeyframe"
 
 #define DEFAULT_KEYFRAME_DISPERSION GST_SECOND  /* 1s */
 
@@ -183,54 +182,160 @@ kms_utils_create_rate_for_caps (const GstCaps * caps)
 
 /* key frame management */
 
-#define DROPPING_UNTIL_KEY_FRAME "dropping_until_key_frame"
+static GstStaticCaps static_raw_caps = GST_STATIC_CAPS (KMS_AGNOSTIC_RAW_CAPS);
 
-/* Call this function holding the lock */
-static inline gboolean
-is_dropping (GstPad * pad)
+gboolean
+kms_utils_caps_are_raw (const GstCaps * caps)
+{
+  GstCaps *raw_caps;
+  gboolean ret;
+
+  if (caps == NULL) {
+    return FALSE;
+  }
+
+  /* Static caps are parsed only once */
+  raw_caps = gst_static_caps_get (&static_raw_caps);
+  ret = gst_caps_is_always_compatible (caps, raw_caps);
+  gst_caps_unref (raw_caps);
+
+  return ret;
+}
+
+typedef enum
+{
+  PAD_CAPS_UNKNOWN,
+  PAD_CAPS_RAW,
+  PAD_CAPS_ENCODED
+} PadCapsType;
+
+/*
+ * State of the kms probes of a pad. It is allocated once, when the first
+ * probe is installed, so probes do not allocate while data flows. Fields are
+ * protected by the pad object lock.
+ */
+typedef struct _KmsPadContext
 {
-  return GPOINTER_TO_INT (g_object_get_data (G_OBJECT (pad),
-          DROPPING_UNTIL_KEY_FRAME));
+  gboolean dropping;
+  gboolean all_headers;
+  PadCapsType caps_type;
+  GstClockTime last_request;
+} KmsPadContext;
+
+static GQuark pad_context_quark;
+
+static void
+pad_context_destroy (gpointer state)
+{
+  g_slice_free (KmsPadContext, state);
 }
 
-/* Call this function holding the lock */
-static inline void
-set_dropping (GstPad * pad, gboolean dropping)
+static GstPadProbeReturn
+pad_context_caps_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
 {
-  g_object_set_data (G_OBJECT (pad), DROPPING_UNTIL_KEY_FRAME,
-      GINT_TO_POINTER (dropping));
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  KmsPadContext *state = user_data;
+  PadCapsType caps_type;
+  GstCaps *caps;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  gst_event_parse_caps (event, &caps);
+  caps_type = kms_utils_caps_are_raw (caps) ? PAD_CAPS_RAW : PAD_CAPS_ENCODED;
+
+  GST_OBJECT_LOCK (pad);
+  state->caps_type = caps_type;
+  GST_OBJECT_UNLOCK (pad);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static KmsPadContext *
+get_pad_context (GstPad * pad)
+{
+  KmsPadContext *state;
+
+  GST_OBJECT_LOCK (pad);
+  state = g_object_get_qdata (G_OBJECT (pad), pad_context_quark);
+
+  if (state != NULL) {
+    GST_OBJECT_UNLOCK (pad);
+    return state;
+  }
+
+  state = g_slice_new0 (KmsPadContext);
+  state->caps_type = PAD_CAPS_UNKNOWN;
+  state->last_request = GST_CLOCK_TIME_NONE;
+  g_object_set_qdata_full (G_OBJECT (pad), pad_context_quark, state,
+      pad_context_destroy);
+  GST_OBJECT_UNLOCK (pad);
+
+  /* Context lives as long as the pad, so the probe does not own it */
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      pad_context_caps_probe, state, NULL);
+
+  return state;
 }
 
 static gboolean
-is_raw_caps (GstCaps * caps)
+pad_caps_are_raw (GstPad * pad, KmsPadContext * state)
 {
+  PadCapsType caps_type;
+  GstCaps *caps;
   gboolean ret;
-  GstCaps *raw_caps = gst_caps_from_string (KMS_AGNOSTIC_RAW_CAPS);
 
-  ret = gst_caps_is_always_compatible (caps, raw_caps);
+  GST_OBJECT_LOCK (pad);
+  caps_type = state->caps_type;
+  GST_OBJECT_UNLOCK (pad);
+
+  if (caps_type != PAD_CAPS_UNKNOWN) {
+    return caps_type == PAD_CAPS_RAW;
+  }
+
+  caps = gst_pad_get_current_caps (pad);
+
+  if (caps != NULL) {
+    ret = kms_utils_caps_are_raw (caps);
+    caps_type = ret ? PAD_CAPS_RAW : PAD_CAPS_ENCODED;
+
+    GST_OBJECT_LOCK (pad);
+    if (state->caps_type == PAD_CAPS_UNKNOWN) {
+      state->caps_type = caps_type;
+    }
+    GST_OBJECT_UNLOCK (pad);
+
+    gst_caps_unref (caps);
+
+    return ret;
+  }
+
+  /* Not negotiated yet, allowed caps may still change so do not cache */
+  caps = gst_pad_get_allowed_caps (pad);
+
+  if (caps == NULL) {
+    /* Nothing to request a key frame from */
+    return TRUE;
+  }
+
+  ret = kms_utils_caps_are_raw (caps);
+  gst_caps_unref (caps);
 
-  gst_caps_unref (raw_caps);
   return ret;
 }
 
 static void
-send_force_key_unit_event (GstPad * pad, gboolean all_headers)
+send_force_key_unit_event (GstPad * pad, KmsPadContext * state,
+    gboolean all_headers)
 {
   GstEvent *event;
-  GstCaps *caps = gst_pad_get_current_caps (pad);
-
-  if (caps == NULL) {
-    caps = gst_pad_get_allowed_caps (pad);
-  }
 
-  if (caps == NULL) {
+  if (pad_caps_are_raw (pad, state)) {
     return;
   }
 
-  if (is_raw_caps (caps)) {
-    goto end;
-  }
-
   event =
       gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE,
       all_headers, 0);
@@ -240,29 +345,31 @@ send_force_key_unit_event (GstPad * pad, gboolean all_headers)
   } else {
     gst_pad_push_event (pad, event);
   }
-
-end:
-  gst_caps_unref (caps);
 }
 
 static GstPadProbeReturn
 drop_until_keyframe_probe (GstPad * pad, GstPadProbeInfo * info,
     gpointer user_data)
 {
+  KmsPadContext *state = user_data;
   GstBuffer *buffer;
-  gboolean all_headers = GPOINTER_TO_INT (user_data);
+  gboolean all_headers;
 
   buffer = GST_PAD_PROBE_INFO_BUFFER (info);
 
   if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
     /* Drop buffer until a keyframe is received */
-    send_force_key_unit_event (pad, all_headers);
+    GST_OBJECT_LOCK (pad);
+    all_headers = state->all_headers;
+    GST_OBJECT_UNLOCK (pad);
+
+    send_force_key_unit_event (pad, state, all_headers);
     GST_TRACE_OBJECT (pad, "Dropping buffer");
     return GST_PAD_PROBE_DROP;
   }
 
   GST_OBJECT_LOCK (pad);
-  set_dropping (pad, FALSE);
+  state->dropping = FALSE;
   GST_OBJECT_UNLOCK (pad);
 
   GST_DEBUG_OBJECT (pad, "Finish dropping buffers until key frame");
@@ -271,20 +378,30 @@ drop_until_keyframe_probe (GstPad * pad, GstPadProbeInfo * info,
   return GST_PAD_PROBE_REMOVE;
 }
 
+void
+kms_utils_request_keyframe (GstPad * pad, gboolean all_headers)
+{
+  send_force_key_unit_event (pad, get_pad_context (pad), all_headers);
+}
+
 void
 kms_utils_drop_until_keyframe (GstPad * pad, gboolean all_headers)
 {
+  KmsPadContext *state = get_pad_context (pad);
+
   GST_OBJECT_LOCK (pad);
-  if (is_dropping (pad)) {
+  if (state->dropping) {
     GST_DEBUG_OBJECT (pad, "Already dropping buffers until key frame");
+    state->all_headers |= all_headers;
     GST_OBJECT_UNLOCK (pad);
   } else {
     GST_DEBUG_OBJECT (pad, "Start dropping buffers until key frame");
-    set_dropping (pad, TRUE);
+    state->dropping = TRUE;
+    state->all_headers = all_headers;
     GST_OBJECT_UNLOCK (pad);
     gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
-        drop_until_keyframe_probe, GINT_TO_POINTER (all_headers), NULL);
-    send_force_key_unit_event (pad, all_headers);
+        drop_until_keyframe_probe, state, NULL);
+    send_force_key_unit_event (pad, state, all_headers);
   }
 }
 
@@ -312,7 +429,7 @@ gap_detection_probe (GstPad * pad, GstPadProbeInfo * info, gpointer data)
 
   if (GST_EVENT_TYPE (event) == GST_EVENT_GAP) {
     GST_WARNING_OBJECT (pad, "Gap detected");
-    send_force_key_unit_event (pad, FALSE);
+    send_force_key_unit_event (pad, data, FALSE);
     return GST_PAD_PROBE_DROP;
   }
 
@@ -325,13 +442,13 @@ kms_utils_manage_gaps (GstPad * pad)
   gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, discont_detection_probe,
       NULL, NULL);
   gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
-      gap_detection_probe, NULL, NULL);
+      gap_detection_probe, get_pad_context (pad), NULL);
 }
 
 static gboolean
-check_last_request_time (GstPad * pad)
+check_last_request_time (GstPad * pad, KmsPadContext * state)
 {
-  GstClockTime *last, now;
+  GstClockTime now;
   GstClock *clock;
   GstElement *element = gst_pad_get_parent_element (pad);
   gboolean ret = FALSE;
@@ -348,18 +465,10 @@ check_last_request_time (GstPad * pad)
 
   GST_OBJECT_LOCK (pad);
 
-  last = g_object_get_data (G_OBJECT (pad), LAST_KEY_FRAME_REQUEST_TIME);
-
-  if (last == NULL) {
-    last = g_slice_new (GstClockTime);
-    g_object_set_data_full (G_OBJECT (pad), LAST_KEY_FRAME_REQUEST_TIME, last,
-        (GDestroyNotify) kms_utils_destroy_GstClockTime);
-
-    *last = now;
+  if (!GST_CLOCK_TIME_IS_VALID (state->last_request) ||
+      state->last_request + DEFAULT_KEYFRAME_DISPERSION < now) {
+    state->last_request = now;
     ret = TRUE;
-  } else if (((*last) + DEFAULT_KEYFRAME_DISPERSION) < now) {
-    ret = TRUE;
-    *last = now;
   }
 
   GST_OBJECT_UNLOCK (pad);
@@ -373,7 +482,7 @@ control_duplicates (GstPad * pad, GstPadProbeInfo * info, gpointer data)
   GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
 
   if (gst_video_event_is_force_key_unit (event)) {
-    if (check_last_request_time (pad)) {
+    if (check_last_request_time (pad, data)) {
       GST_TRACE_OBJECT (pad, "Sending keyframe request");
       return GST_PAD_PROBE_OK;
     } else {
@@ -389,7 +498,208 @@ void
 kms_utils_control_key_frames_request_duplicates (GstPad * pad)
 {
   gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM, control_duplicates,
-      NULL, NULL);
+      get_pad_context (pad), NULL);
+}
+
+/* Key frame request coordinator */
+
+#define KEYFRAME_WINDOW_MIN (100 * GST_MSECOND)
+#define KEYFRAME_WINDOW_MAX DEFAULT_KEYFRAME_DISPERSION
+
+struct _KmsKeyframeCoordinator
+{
+  GMutex mutex;
+  GstPad *pad;
+  gulong event_probe_id;
+  gulong buffer_probe_id;
+  /* Request sent by the coordinator itself, let through its own probe */
+  GstEvent *own_event;
+
+  GstClockTime last_sent;
+  GstClockTime latency;
+  GstClockTime window;
+  gboolean awaiting;
+  gboolean trailing;
+  gboolean trailing_headers;
+
+  guint64 requested;
+  guint64 coalesced;
+  guint64 sent;
+};
+
+static void
+keyframe_coordinator_send (KmsKeyframeCoordinator * coordinator,
+    gboolean all_headers)
+{
+  GstEvent *event;
+
+  event =
+      gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE,
+      all_headers, 0);
+
+  g_mutex_lock (&coordinator->mutex);
+  coordinator->own_event = event;
+  g_mutex_unlock (&coordinator->mutex);
+
+  GST_TRACE_OBJECT (coordinator->pad, "Sending coalesced keyframe request");
+  gst_pad_push_event (coordinator->pad, event);
+
+  g_mutex_lock (&coordinator->mutex);
+  coordinator->own_event = NULL;
+  g_mutex_unlock (&coordinator->mutex);
+}
+
+static GstPadProbeReturn
+keyframe_coordinator_event_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  KmsKeyframeCoordinator *coordinator = user_data;
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstPadProbeReturn ret = GST_PAD_PROBE_OK;
+  gboolean all_headers = FALSE;
+  GstClockTime now;
+
+  if (!gst_video_event_is_force_key_unit (event)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  now = kms_utils_get_time_nsecs ();
+  gst_video_event_parse_upstream_force_key_unit (event, NULL, &all_headers,
+      NULL);
+
+  g_mutex_lock (&coordinator->mutex);
+
+  if (event == coordinator->own_event) {
+    goto end;
+  }
+
+  coordinator->requested++;
+
+  if (GST_CLOCK_TIME_IS_VALID (coordinator->last_sent) &&
+      now - coordinator->last_sent < coordinator->window) {
+    coordinator->coalesced++;
+
+    /* The awaited key frame serves requests made before it arrives */
+    if (!coordinator->awaiting) {
+      coordinator->trailing = TRUE;
+      coordinator->trailing_headers |= all_headers;
+    }
+
+    ret = GST_PAD_PROBE_DROP;
+    goto end;
+  }
+
+  coordinator->sent++;
+  coordinator->last_sent = now;
+  coordinator->awaiting = TRUE;
+  coordinator->trailing = FALSE;
+  coordinator->trailing_headers = FALSE;
+
+end:
+  g_mutex_unlock (&coordinator->mutex);
+
+  return ret;
+}
+
+static GstPadProbeReturn
+keyframe_coordinator_buffer_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  KmsKeyframeCoordinator *coordinator = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  gboolean send = FALSE, all_headers = FALSE;
+  GstClockTime now = kms_utils_get_time_nsecs ();
+
+  g_mutex_lock (&coordinator->mutex);
+
+  if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    if (coordinator->awaiting) {
+      GstClockTime sample = now - coordinator->last_sent;
+
+      coordinator->latency = GST_CLOCK_TIME_IS_VALID (coordinator->latency) ?
+          (7 * coordinator->latency + sample) / 8 : sample;
+      coordinator->window = CLAMP (2 * coordinator->latency,
+          KEYFRAME_WINDOW_MIN, KEYFRAME_WINDOW_MAX);
+      coordinator->awaiting = FALSE;
+
+      GST_TRACE_OBJECT (pad, "Key frame after %" GST_TIME_FORMAT
+          ", window is %" GST_TIME_FORMAT, GST_TIME_ARGS (sample),
+          GST_TIME_ARGS (coordinator->window));
+    }
+
+    /* Any key frame serves pending requests */
+    coordinator->trailing = FALSE;
+    coordinator->trailing_headers = FALSE;
+  } else if (coordinator->trailing &&
+      now - coordinator->last_sent >= coordinator->window) {
+    send = TRUE;
+    all_headers = coordinator->trailing_headers;
+    coordinator->trailing = FALSE;
+    coordinator->trailing_headers = FALSE;
+    coordinator->sent++;
+    coordinator->last_sent = now;
+    coordinator->awaiting = TRUE;
+  }
+
+  g_mutex_unlock (&coordinator->mutex);
+
+  if (send) {
+    keyframe_coordinator_send (coordinator, all_headers);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+KmsKeyframeCoordinator *
+kms_utils_keyframe_coordinator_create (GstPad * pad)
+{
+  KmsKeyframeCoordinator *coordinator = g_slice_new0 (KmsKeyframeCoordinator);
+
+  g_mutex_init (&coordinator->mutex);
+  coordinator->pad = g_object_ref (pad);
+  coordinator->last_sent = GST_CLOCK_TIME_NONE;
+  coordinator->latency = GST_CLOCK_TIME_NONE;
+  coordinator->window = KEYFRAME_WINDOW_MAX;
+
+  coordinator->event_probe_id = gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_EVENT_UPSTREAM, keyframe_coordinator_event_probe,
+      coordinator, NULL);
+  coordinator->buffer_probe_id = gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_BUFFER, keyframe_coordinator_buffer_probe,
+      coordinator, NULL);
+
+  return coordinator;
+}
+
+void
+kms_utils_keyframe_coordinator_destroy (KmsKeyframeCoordinator * coordinator)
+{
+  gst_pad_remove_probe (coordinator->pad, coordinator->event_probe_id);
+  gst_pad_remove_probe (coordinator->pad, coordinator->buffer_probe_id);
+  g_object_unref (coordinator->pad);
+  g_mutex_clear (&coordinator->mutex);
+  g_slice_free (KmsKeyframeCoordinator, coordinator);
+}
+
+void
+kms_utils_keyframe_coordinator_get_stats (KmsKeyframeCoordinator *
+    coordinator, guint64 * requested, guint64 * coalesced, guint64 * sent)
+{
+  g_mutex_lock (&coordinator->mutex);
+
+  if (requested != NULL) {
+    *requested = coordinator->requested;
+  }
+
+  if (coalesced != NULL) {
+    *coalesced = coordinator->coalesced;
+  }
+
+  if (sent != NULL) {
+    *sent = coordinator->sent;
+  }
+
+  g_mutex_unlock (&coordinator->mutex);
 }
 
 void
@@ -670,7 +980,7 @@ static guint
 remb_event_manager_calc_min_full (RembEventManager * manager, guint bitrate,
     guint ssrc)
 {
-  RembHashValue *last_value, *value;
+  RembHashValue *last_value;
 
   last_value = g_hash_table_lookup (manager->remb_hash,
       GUINT_TO_POINTER (ssrc));
@@ -678,8 +988,14 @@ remb_event_manager_calc_min_full (RembEventManager * manager, guint bitrate,
     return manager->remb_min;
   }
 
-  value = remb_hash_value_create (bitrate);
-  g_hash_table_insert (manager->remb_hash, GUINT_TO_POINTER (ssrc), value);
+  if (last_value != NULL) {
+    /* Known sources are updated in place */
+    last_value->bitrate = bitrate;
+    last_value->ts = kms_utils_get_time_nsecs ();
+  } else {
+    g_hash_table_insert (manager->remb_hash, GUINT_TO_POINTER (ssrc),
+        remb_hash_value_create (bitrate));
+  }
 
   if (bitrate > manager->remb_min) {
     remb_event_manager_calc_min (manager);
@@ -762,8 +1078,272 @@ kms_utils_remb_event_manager_get_min (RembEventManager * manager)
   return ret;
 }
 
+/*
+ * Returns the rung that fits the given bitrate starting from the current one.
+ * Moving up requires the bitrate to exceed the next rung by the hysteresis
+ * margin, moving down happens once it falls that margin below the current
+ * rung, so estimations oscillating around a rung do not cause switches.
+ */
+guint
+kms_utils_bitrate_ladder_select_rung (const guint * rungs, guint n_rungs,
+    guint current, guint bitrate, guint hysteresis)
+{
+  guint64 br = bitrate;
+
+  g_return_val_if_fail (n_rungs > 0, 0);
+
+  current = MIN (current, n_rungs - 1);
+
+  while (current + 1 < n_rungs &&
+      br * 100 >= (guint64) rungs[current + 1] * (100 + hysteresis)) {
+    current++;
+  }
+
+  while (current > 0 &&
+      br * 100 < (guint64) rungs[current] * (100 - MIN (hysteresis, 100))) {
+    current--;
+  }
+
+  return current;
+}
+
 /* REMB event end */
 
+/* Element factory begin */
+
+/* Resolved factories by codec. Only the media type and the RTP encoding
+ * name take part in the key, so the cache is bounded by the number of
+ * codecs in use rather than by every caps variation. Negative results are
+ * not stored, unknown codecs announced by peers would grow it otherwise.
+ * The whole cache is dropped whenever the registry feature list changes. */
+G_LOCK_DEFINE_STATIC (factory_cache);
+static GHashTable *factory_cache = NULL;
+static guint32 factory_cache_cookie = 0;
+
+static void
+factory_cache_append_caps (GString * key, const GstCaps * caps)
+{
+  guint i;
+
+  if (caps == NULL) {
+    return;
+  }
+
+  if (gst_caps_is_any (caps)) {
+    g_string_append (key, "ANY");
+    return;
+  }
+
+  for (i = 0; i < gst_caps_get_size (caps); i++) {
+    GstStructure *st = gst_caps_get_structure (caps, i);
+    const gchar *media = gst_structure_get_string (st, "media");
+    const gchar *encoding = gst_structure_get_string (st, "encoding-name");
+
+    g_string_append_printf (key, "%s%s,%s,%s", i > 0 ? ";" : "",
+        gst_structure_get_name (st), media != NULL ? media : "",
+        encoding != NULL ? encoding : "");
+  }
+}
+
+static gchar *
+factory_cache_key (GstElementFactoryListType type, const GstCaps * sink_caps,
+    const GstCaps * src_caps, KmsFactoryFilter filter)
+{
+  GString *key;
+
+  key = g_string_new (NULL);
+  g_string_append_printf (key, "%" G_GUINT64_FORMAT "|%p|", type,
+      (gpointer) filter);
+  factory_cache_append_caps (key, sink_caps);
+  g_string_append_c (key, '|');
+  factory_cache_append_caps (key, src_caps);
+
+  return g_string_free (key, FALSE);
+}
+
+/* Returns a new reference to the cached factory or NULL. Takes ownership of
+ * key. */
+static GstElementFactory *
+factory_cache_lookup (gchar * key, guint32 cookie)
+{
+  GstElementFactory *factory = NULL;
+
+  G_LOCK (factory_cache);
+
+  if (factory_cache == NULL) {
+    factory_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        gst_object_unref);
+    factory_cache_cookie = cookie;
+  } else if (factory_cache_cookie != cookie) {
+    GST_DEBUG ("Registry changed, clearing factory cache");
+    g_hash_table_remove_all (factory_cache);
+    factory_cache_cookie = cookie;
+  }
+
+  factory = g_hash_table_lookup (factory_cache, key);
+
+  if (factory != NULL) {
+    gst_object_ref (factory);
+  }
+
+  G_UNLOCK (factory_cache);
+  g_free (key);
+
+  return factory;
+}
+
+/* Takes ownership of key */
+static void
+factory_cache_store (gchar * key, guint32 cookie, GstElementFactory * factory)
+{
+  G_LOCK (factory_cache);
+
+  if (factory_cache_cookie == cookie) {
+    g_hash_table_replace (factory_cache, key, gst_object_ref (factory));
+    key = NULL;
+  }
+
+  G_UNLOCK (factory_cache);
+  g_free (key);
+}
+
+/* Candidates sorted by rank, free with gst_plugin_feature_list_free */
+static GList *
+get_element_factories_for_caps (GstElementFactoryListType type,
+    const GstCaps * sink_caps, const GstCaps * src_caps)
+{
+  GList *factory_list, *filtered_list;
+
+  factory_list = gst_element_factory_list_get_elements (type, GST_RANK_NONE);
+
+  if (sink_caps != NULL) {
+    filtered_list = gst_element_factory_list_filter (factory_list, sink_caps,
+        GST_PAD_SINK, FALSE);
+    gst_plugin_feature_list_free (factory_list);
+    factory_list = filtered_list;
+  }
+
+  if (src_caps != NULL) {
+    filtered_list = gst_element_factory_list_filter (factory_list, src_caps,
+        GST_PAD_SRC, FALSE);
+    gst_plugin_feature_list_free (factory_list);
+    factory_list = filtered_list;
+  }
+
+  return factory_list;
+}
+
+gboolean
+kms_utils_factory_has_two_pad_templates (GstElementFactory * factory)
+{
+  return gst_element_factory_get_num_pad_templates (factory) == 2;
+}
+
+/*
+ * Returns a new reference to the highest ranked factory of the given type that
+ * accepts sink_caps and produces src_caps (any of them can be NULL) and passes
+ * the filter, or NULL if there is none. Results are cached per codec.
+ */
+GstElementFactory *
+kms_utils_get_element_factory_for_caps (GstElementFactoryListType type,
+    const GstCaps * sink_caps, const GstCaps * src_caps,
+    KmsFactoryFilter filter)
+{
+  GstElementFactory *factory = NULL;
+  GList *factory_list, *l;
+  guint32 cookie;
+
+  cookie = gst_registry_get_feature_list_cookie (gst_registry_get ());
+  factory = factory_cache_lookup (factory_cache_key (type, sink_caps, src_caps,
+          filter), cookie);
+
+  if (factory != NULL) {
+    return factory;
+  }
+
+  /* Registry is scanned without holding the cache lock */
+  factory_list = get_element_factories_for_caps (type, sink_caps, src_caps);
+
+  for (l = factory_list; l != NULL && factory == NULL; l = l->next) {
+    GstElementFactory *candidate = GST_ELEMENT_FACTORY (l->data);
+
+    if (filter == NULL || filter (candidate)) {
+      factory = gst_object_ref (candidate);
+    }
+  }
+
+  gst_plugin_feature_list_free (factory_list);
+
+  if (factory != NULL) {
+    factory_cache_store (factory_cache_key (type, sink_caps, src_caps, filter),
+        cookie, factory);
+  }
+
+  GST_DEBUG ("Factory %" GST_PTR_FORMAT " resolved for sink %" GST_PTR_FORMAT
+      " src %" GST_PTR_FORMAT, factory, sink_caps, src_caps);
+
+  return factory;
+}
+
+/*
+ * Creates an element from the factory returned by
+ * kms_utils_get_element_factory_for_caps. If it cannot be instantiated the
+ * next candidates are tried, and the first one that works replaces it in
+ * the cache.
+ */
+GstElement *
+kms_utils_create_element_for_caps (GstElementFactoryListType type,
+    const GstCaps * sink_caps, const GstCaps * src_caps,
+    KmsFactoryFilter filter)
+{
+  GstElementFactory *factory;
+  GstElement *element = NULL;
+  GList *factory_list, *l;
+  guint32 cookie;
+
+  factory = kms_utils_get_element_factory_for_caps (type, sink_caps, src_caps,
+      filter);
+
+  if (factory == NULL) {
+    return NULL;
+  }
+
+  element = gst_element_factory_create (factory, NULL);
+
+  if (element != NULL) {
+    gst_object_unref (factory);
+    return element;
+  }
+
+  GST_WARNING ("Cannot create element from %" GST_PTR_FORMAT
+      ", trying other factories", factory);
+
+  cookie = gst_registry_get_feature_list_cookie (gst_registry_get ());
+  factory_list = get_element_factories_for_caps (type, sink_caps, src_caps);
+
+  for (l = factory_list; l != NULL && element == NULL; l = l->next) {
+    GstElementFactory *candidate = GST_ELEMENT_FACTORY (l->data);
+
+    if (candidate == factory || (filter != NULL && !filter (candidate))) {
+      continue;
+    }
+
+    element = gst_element_factory_create (candidate, NULL);
+
+    if (element != NULL) {
+      factory_cache_store (factory_cache_key (type, sink_caps, src_caps,
+              filter), cookie, candidate);
+    }
+  }
+
+  gst_plugin_feature_list_free (factory_list);
+  gst_object_unref (factory);
+
+  return element;
+}
+
+/* Element factory end */
+
 /* time begin */
 
 GstClockTime
@@ -785,6 +1365,8 @@ init_debug (void)
 {
   GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
       GST_DEFAULT_NAME);
+
+  pad_context_quark = g_quark_from_static_string ("kms-pad-context");
 }
 
 /* Type destroying */
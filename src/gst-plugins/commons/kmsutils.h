@@ -32,16 +32,35 @@ gboolean gst_element_sync_state_with_parent_target_state (GstElement * element);
 /* Caps */
 gboolean kms_utils_caps_are_audio (const GstCaps * caps);
 gboolean kms_utils_caps_are_video (const GstCaps * caps);
+gboolean kms_utils_caps_are_raw (const GstCaps * caps);
 
 GstElement * kms_utils_create_convert_for_caps (const GstCaps * caps);
 GstElement * kms_utils_create_mediator_element (const GstCaps * caps);
 GstElement * kms_utils_create_rate_for_caps (const GstCaps * caps);
 
+/* Element factories */
+typedef gboolean (*KmsFactoryFilter) (GstElementFactory * factory);
+
+gboolean kms_utils_factory_has_two_pad_templates (GstElementFactory * factory);
+GstElementFactory * kms_utils_get_element_factory_for_caps (
+  GstElementFactoryListType type, const GstCaps * sink_caps,
+  const GstCaps * src_caps, KmsFactoryFilter filter);
+GstElement * kms_utils_create_element_for_caps (
+  GstElementFactoryListType type, const GstCaps * sink_caps,
+  const GstCaps * src_caps, KmsFactoryFilter filter);
+
 /* key frame management */
 void kms_utils_drop_until_keyframe (GstPad *pad, gboolean all_headers);
+void kms_utils_request_keyframe (GstPad *pad, gboolean all_headers);
 void kms_utils_manage_gaps (GstPad *pad);
 void kms_utils_control_key_frames_request_duplicates (GstPad *pad);
 
+/* Coalesces the key frame requests going upstream through a pad */
+typedef struct _KmsKeyframeCoordinator KmsKeyframeCoordinator;
+KmsKeyframeCoordinator * kms_utils_keyframe_coordinator_create (GstPad *pad);
+void kms_utils_keyframe_coordinator_destroy (KmsKeyframeCoordinator * coordinator);
+void kms_utils_keyframe_coordinator_get_stats (KmsKeyframeCoordinator * coordinator, guint64 *requested, guint64 *coalesced, guint64 *sent);
+
 /* Pad blocked action */
 void kms_utils_execute_with_pad_blocked (GstPad * pad, gboolean drop, KmsPadCallback func, gpointer userData);
 
@@ -56,6 +75,9 @@ void kms_utils_remb_event_manager_destroy (RembEventManager * manager);
 void kms_utils_remb_event_manager_pointer_destroy (gpointer manager);
 guint kms_utils_remb_event_manager_get_min (RembEventManager * manager);
 
+/* Bitrate ladder, rungs sorted in ascending order, hysteresis in percent */
+guint kms_utils_bitrate_ladder_select_rung (const guint * rungs, guint n_rungs, guint current, guint bitrate, guint hysteresis);
+
 /* time */
 GstClockTime kms_utils_get_time_nsecs ();
 
@@ -23,6 +23,8 @@
 #include "kmsparsetreebin.h"
 #include "kmsdectreebin.h"
 #include "kmsenctreebin.h"
+#include "kmsscaletreebin.h"
+#include "kmsringfanout.h"
 
 #define PLUGIN_NAME "agnosticbin"
 
@@ -31,6 +33,15 @@
 
 #define DEFAULT_QUEUE_SIZE 60
 
+#define LADDER_CONFIG_FIELD "bitrate-ladder"
+#define LADDER_SUBSCRIBER_KEY "kms-ladder-subscriber"
+#define LADDER_HYSTERESIS 15    /* percent */
+
+#define IDLE_SINCE_KEY "kms-idle-since"
+#define FANOUT_KEY "kms-fanout"
+#define DEFAULT_IDLE_TIMEOUT 10 /* seconds */
+#define IDLE_SWEEP_INTERVAL GST_SECOND
+
 static GstStaticCaps static_raw_audio_caps =
 GST_STATIC_CAPS (KMS_AGNOSTIC_RAW_AUDIO_CAPS);
 static GstStaticCaps static_raw_video_caps =
@@ -58,12 +69,17 @@ G_DEFINE_TYPE (KmsAgnosticBin2, kms_agnostic_bin2, GST_TYPE_BIN);
   g_rec_mutex_unlock (&KMS_AGNOSTIC_BIN2 (obj)->priv->thread_mutex) \
 )
 
-#define OLD_CHAIN_KEY "kms-old-chain-key"
 #define CONFIGURED_KEY "kms-configured-key"
 
 struct _KmsAgnosticBin2Private
 {
   GHashTable *bins;
+  /* Compatibility key of requested caps -> bin in bins, not owned */
+  GHashTable *bins_index;
+  /* Resolution pyramid shared by the video encoders, "WxH" -> layer */
+  GHashTable *layers;
+  /* Bitrate ladders, one per encoded caps when enabled */
+  GList *ladders;
 
   GRecMutex thread_mutex;
 
@@ -77,6 +93,29 @@ struct _KmsAgnosticBin2Private
   gboolean started;
 
   GThreadPool *remove_pool;
+
+  GstStructure *encoder_config;
+
+  /* Branches without consumers for this long are reclaimed, 0 disables it */
+  guint idle_timeout;
+  GstClockID idle_sweep_id;
+
+  /* Encoded consumers share one ring fan-out per branch instead of a queue
+   * and a streaming thread each */
+  gboolean shared_fanout;
+
+  /* Merges the key frame requests of all the branches */
+  KmsKeyframeCoordinator *keyframe_coordinator;
+};
+
+enum
+{
+  PROP_0,
+  PROP_ENCODER_CONFIG,
+  PROP_IDLE_TIMEOUT,
+  PROP_SHARED_FANOUT,
+  PROP_KEYFRAME_STATS,
+  N_PROPERTIES
 };
 
 /* the capabilities of the inputs and outputs. */
@@ -90,11 +129,99 @@ static GstStaticPadTemplate src_factory = GST_STATIC_PAD_TEMPLATE ("src_%u",
     GST_PAD_REQUEST,
     GST_STATIC_CAPS_ANY);
 
+/*
+ * Fixed set of encoders for the same caps, each one at a different bitrate.
+ * Encoders (rungs) are created the first time a subscriber needs them.
+ */
+typedef struct _BitrateLadder
+{
+  gint ref;
+  gboolean active;
+  GstCaps *caps;
+  guint n_rungs;
+  guint *bitrates;
+  GstBin **bins;
+} BitrateLadder;
+
+typedef struct _LadderSubscriber
+{
+  BitrateLadder *ladder;
+  guint rung;
+  /* Set while the subscriber is being moved to another rung */
+  GstElement *target_tee;
+} LadderSubscriber;
+
+static BitrateLadder *
+bitrate_ladder_ref (BitrateLadder * ladder)
+{
+  g_atomic_int_inc (&ladder->ref);
+
+  return ladder;
+}
+
 static void
-kms_agnostic_bin2_insert_bin (KmsAgnosticBin2 * self, GstBin * bin)
+bitrate_ladder_unref (BitrateLadder * ladder)
 {
-  g_hash_table_insert (self->priv->bins, GST_OBJECT_NAME (bin),
-      g_object_ref (bin));
+  guint i;
+
+  if (!g_atomic_int_dec_and_test (&ladder->ref)) {
+    return;
+  }
+
+  for (i = 0; i < ladder->n_rungs; i++) {
+    g_clear_object (&ladder->bins[i]);
+  }
+
+  gst_caps_unref (ladder->caps);
+  g_free (ladder->bitrates);
+  g_free (ladder->bins);
+  g_slice_free (BitrateLadder, ladder);
+}
+
+static void
+bitrate_ladder_deactivate (gpointer data)
+{
+  BitrateLadder *ladder = data;
+
+  ladder->active = FALSE;
+  bitrate_ladder_unref (ladder);
+}
+
+static void
+ladder_subscriber_destroy (gpointer data)
+{
+  LadderSubscriber *sub = data;
+
+  if (sub->target_tee != NULL) {
+    g_object_unref (sub->target_tee);
+  }
+
+  bitrate_ladder_unref (sub->ladder);
+  g_slice_free (LadderSubscriber, sub);
+}
+
+static gint
+compare_bitrates (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  guint br_a = *(const guint *) a;
+  guint br_b = *(const guint *) b;
+
+  return br_a < br_b ? -1 : (br_a > br_b ? 1 : 0);
+}
+
+/*
+ * Marks a branch as in use so that it is not reclaimed before the consumer
+ * about to be linked is actually there. Must be called with the lock held.
+ */
+static void
+kms_agnostic_bin2_touch_branch (GstBin * bin)
+{
+  GstClockTime *idle_since = g_object_get_data (G_OBJECT (bin),
+      IDLE_SINCE_KEY);
+
+  if (idle_since != NULL) {
+    *idle_since = GST_CLOCK_TIME_NONE;
+  }
 }
 
 /*
@@ -124,18 +251,6 @@ send_dummy_event (GstPad * pad)
   g_object_unref (parent);
 }
 
-static gboolean
-is_raw_caps (GstCaps * caps)
-{
-  gboolean ret;
-  GstCaps *raw_caps = gst_caps_from_string (KMS_AGNOSTIC_RAW_CAPS);
-
-  ret = gst_caps_is_always_compatible (caps, raw_caps);
-
-  gst_caps_unref (raw_caps);
-  return ret;
-}
-
 static GstPadProbeReturn
 tee_src_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
 {
@@ -156,10 +271,11 @@ remove_on_unlinked_async (gpointer data, gpointer not_used)
 {
   GstElement *elem = GST_ELEMENT_CAST (data);
   GstObject *parent = gst_object_get_parent (GST_OBJECT (elem));
+  GstElementFactory *factory = gst_element_get_factory (elem);
 
   gst_element_set_locked_state (elem, TRUE);
-  if (g_strcmp0 (GST_OBJECT_NAME (gst_element_get_factory (elem)),
-          "queue") == 0) {
+  /* Tree bins are not created from a factory */
+  if (factory != NULL && g_strcmp0 (GST_OBJECT_NAME (factory), "queue") == 0) {
     g_object_set (G_OBJECT (elem), "flush-on-eos", TRUE, NULL);
     gst_element_send_event (elem, gst_event_new_eos ());
   }
@@ -289,62 +405,12 @@ remove_tee_pad_on_unlink (GstPad * pad, GstPad * peer, gpointer user_data)
   g_object_unref (tee);
 }
 
-static GstFlowReturn
-no_fail_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
-{
-  GstFlowReturn ret;
-  GstPadChainFunction old_func =
-      g_object_get_data (G_OBJECT (pad), OLD_CHAIN_KEY);
-
-  if (old_func == NULL) {
-    return GST_FLOW_OK;
-  }
-
-  ret = old_func (pad, parent, buffer);
-
-  if (G_UNLIKELY (ret != GST_FLOW_OK)) {
-    GstPad *peer;
-
-    switch (ret) {
-      case GST_FLOW_FLUSHING:
-        break;
-      default:
-        GST_WARNING_OBJECT (pad, "Chain returned: %s. It will be unlinked",
-            gst_flow_get_name (ret));
-        peer = gst_pad_get_peer (pad);
-        if (peer != NULL) {
-          gst_pad_unlink (peer, pad);
-          g_object_unref (peer);
-        }
-    }
-  }
-
-  return GST_FLOW_OK;
-}
-
 static void
-link_element_to_tee (GstElement * tee, GstElement * element)
+link_tee_to_pad (GstElement * tee, GstPad * element_sink)
 {
   GstPad *tee_src = gst_element_get_request_pad (tee, "src_%u");
-  GstPad *element_sink = gst_element_get_static_pad (element, "sink");
   GstPadLinkReturn ret;
-  GstPadChainFunction old_func;
-
-  /*
-   * HACK Add a custom chain function that does not return error, this way
-   * we avoid race conditions produced by reconnect events not using the stream
-   * lock
-   */
-  old_func = GST_PAD_CHAINFUNC (element_sink);
-
-  if (old_func != NULL) {
-    if (old_func != no_fail_chain) {
-      g_object_set_data (G_OBJECT (element_sink), OLD_CHAIN_KEY, old_func);
-    }
-    gst_pad_set_chain_function (element_sink, no_fail_chain);
-  }
 
-  remove_element_on_unlinked (element, "src", "sink");
   g_signal_connect (tee_src, "unlinked", G_CALLBACK (remove_tee_pad_on_unlink),
       NULL);
 
@@ -358,44 +424,109 @@ link_element_to_tee (GstElement * tee, GstElement * element)
         tee_src, element_sink, ret);
   }
 
-  g_object_unref (element_sink);
   g_object_unref (tee_src);
 }
 
+static void
+link_element_to_tee (GstElement * tee, GstElement * element)
+{
+  GstPad *element_sink = gst_element_get_static_pad (element, "sink");
+
+  remove_element_on_unlinked (element, "src", "sink");
+  link_tee_to_pad (tee, element_sink);
+
+  g_object_unref (element_sink);
+}
+
+typedef struct _RetargetData
+{
+  GstPad *pad;
+  GstPad *target;
+  GstElement *tee;
+  GstPad *sink;
+} RetargetData;
+
+static void
+retarget_data_destroy (gpointer user_data)
+{
+  RetargetData *data = user_data;
+
+  g_object_unref (data->pad);
+  g_clear_object (&data->target);
+  g_clear_object (&data->tee);
+  g_clear_object (&data->sink);
+
+  g_slice_free (RetargetData, data);
+}
+
+static void
+retarget_data_apply (RetargetData * data)
+{
+  GST_DEBUG_OBJECT (data->pad, "Setting target %" GST_PTR_FORMAT,
+      data->target);
+
+  /* The previous target is unlinked here, its branch is removed on unlink */
+  gst_ghost_pad_set_target (GST_GHOST_PAD (data->pad), data->target);
+
+  if (data->tee != NULL) {
+    link_tee_to_pad (data->tee, data->sink);
+  }
+}
+
 static GstPadProbeReturn
-remove_target_pad_block (GstPad * pad, GstPadProbeInfo * info, gpointer gp)
+retarget_on_idle (GstPad * old_target, GstPadProbeInfo * info,
+    gpointer user_data)
 {
-  GST_DEBUG_OBJECT (pad, "Drop");
-  return GST_PAD_PROBE_DROP;
+  retarget_data_apply (user_data);
+
+  return GST_PAD_PROBE_REMOVE;
 }
 
+/*
+ * Replace the target of an output pad. The swap is done while no data is
+ * flowing from the previous target so buffers from the old and the new
+ * branch never interleave downstream. When @tee is given, @sink is linked
+ * to it once the new target is in place.
+ */
 static void
-remove_target_pad (GstPad * pad)
+kms_agnostic_bin2_retarget (GstPad * pad, GstPad * target, GstElement * tee,
+    GstPad * sink)
 {
-  // TODO: Remove target pad is just like a disconnection it should be done
-  // with care, possibly blocking the pad, or at least disconnecting directly
-  // from the tee
-  GstPad *target = gst_ghost_pad_get_target (GST_GHOST_PAD (pad));
+  GstPad *old_target = gst_ghost_pad_get_target (GST_GHOST_PAD (pad));
+  RetargetData *data = g_slice_new0 (RetargetData);
 
-  GST_DEBUG_OBJECT (pad, "Removing target pad");
+  data->pad = g_object_ref (pad);
+  data->target = target != NULL ? g_object_ref (target) : NULL;
+  data->tee = tee != NULL ? g_object_ref (tee) : NULL;
+  data->sink = sink != NULL ? g_object_ref (sink) : NULL;
 
-  if (target == NULL) {
+  if (old_target == NULL) {
+    retarget_data_apply (data);
+    retarget_data_destroy (data);
     return;
   }
 
-  gst_pad_add_probe (target, GST_PAD_PROBE_TYPE_DATA_DOWNSTREAM,
-      remove_target_pad_block, NULL, NULL);
-  gst_ghost_pad_set_target (GST_GHOST_PAD (pad), NULL);
-
-  g_object_unref (target);
+  /* Called at once if the old target is idle */
+  gst_pad_add_probe (old_target, GST_PAD_PROBE_TYPE_IDLE, retarget_on_idle,
+      data, retarget_data_destroy);
+  g_object_unref (old_target);
 }
 
 static void
+remove_target_pad (GstPad * pad)
+{
+  GST_DEBUG_OBJECT (pad, "Removing target pad");
+
+  kms_agnostic_bin2_retarget (pad, NULL, NULL, NULL);
+}
+
+/* Returns the queue that feeds the pad, owned by the agnosticbin */
+static GstElement *
 kms_agnostic_bin2_link_to_tee (KmsAgnosticBin2 * self, GstPad * pad,
     GstElement * tee, GstCaps * caps)
 {
   GstElement *queue = gst_element_factory_make ("queue", NULL);
-  GstPad *target;
+  GstPad *target, *queue_sink;
 
   g_object_set (queue, "leaky", 2 /* downstream */ ,
       "max-size-buffers", DEFAULT_QUEUE_SIZE, NULL);
@@ -403,7 +534,7 @@ kms_agnostic_bin2_link_to_tee (KmsAgnosticBin2 * self, GstPad * pad,
   gst_bin_add (GST_BIN (self), queue);
   gst_element_sync_state_with_parent (queue);
 
-  if (!gst_caps_is_any (caps) && is_raw_caps (caps)) {
+  if (!gst_caps_is_any (caps) && kms_utils_caps_are_raw (caps)) {
     GstElement *convert = kms_utils_create_convert_for_caps (caps);
     GstElement *rate = kms_utils_create_rate_for_caps (caps);
     GstElement *mediator = kms_utils_create_mediator_element (caps);
@@ -424,46 +555,216 @@ kms_agnostic_bin2_link_to_tee (KmsAgnosticBin2 * self, GstPad * pad,
     target = gst_element_get_static_pad (queue, "src");
   }
 
-  gst_ghost_pad_set_target (GST_GHOST_PAD (pad), target);
+  remove_element_on_unlinked (queue, "src", "sink");
+  queue_sink = gst_element_get_static_pad (queue, "sink");
+  kms_agnostic_bin2_retarget (pad, target, tee, queue_sink);
+  g_object_unref (queue_sink);
+  g_object_unref (target);
+
+  return queue;
+}
+
+static gboolean
+append_structure_field (GQuark field_id, const GValue * value, gpointer key)
+{
+  const gchar *name = g_quark_to_string (field_id);
+  gchar *serialized;
+
+  /* Already appended as part of the fixed prefix */
+  if (g_strcmp0 (name, "encoding-name") == 0 || g_strcmp0 (name, "width") == 0
+      || g_strcmp0 (name, "height") == 0 || g_strcmp0 (name, "framerate") == 0) {
+    return TRUE;
+  }
+
+  serialized = gst_value_serialize (value);
+  g_string_append_printf (key, ",%s=%s", name, serialized);
+  g_free (serialized);
+
+  return TRUE;
+}
+
+static void
+append_key_field (GString * key, const GstStructure * st, const gchar * name)
+{
+  const GValue *value = gst_structure_get_value (st, name);
+  gchar *serialized;
+
+  if (value == NULL) {
+    g_string_append_c (key, '|');
+    return;
+  }
+
+  serialized = gst_value_serialize (value);
+  g_string_append_printf (key, "|%s", serialized);
+  g_free (serialized);
+}
+
+/*
+ * Compatibility key of the caps: media type, encoding name, resolution and
+ * framerate of each structure, followed by any other field so that caps that
+ * differ in anything never share a key.
+ */
+static gchar *
+kms_agnostic_bin2_caps_key (const GstCaps * caps)
+{
+  GString *key = g_string_new (NULL);
+  guint i;
+
+  for (i = 0; i < gst_caps_get_size (caps); i++) {
+    const GstStructure *st = gst_caps_get_structure (caps, i);
+
+    if (i > 0) {
+      g_string_append_c (key, ';');
+    }
+
+    g_string_append (key, gst_structure_get_name (st));
+    append_key_field (key, st, "encoding-name");
+    append_key_field (key, st, "width");
+    append_key_field (key, st, "height");
+    append_key_field (key, st, "framerate");
+    gst_structure_foreach (st, append_structure_field, key);
+  }
+
+  return g_string_free (key, FALSE);
+}
+
+static void
+kms_agnostic_bin2_index_bin (KmsAgnosticBin2 * self, GstCaps * caps,
+    GstBin * bin)
+{
+  g_hash_table_insert (self->priv->bins_index,
+      kms_agnostic_bin2_caps_key (caps), bin);
+}
+
+static gboolean
+index_entry_is_bin (gpointer key, gpointer value, gpointer bin)
+{
+  return value == bin;
+}
+
+static void
+kms_agnostic_bin2_unindex_bin (KmsAgnosticBin2 * self, GstBin * bin)
+{
+  g_hash_table_foreach_remove (self->priv->bins_index, index_entry_is_bin,
+      bin);
+}
+
+static GstPadProbeReturn
+branch_caps_probe (GstPad * pad, GstPadProbeInfo * info, gpointer bin)
+{
+  GstEvent *event = gst_pad_probe_info_get_event (info);
+  KmsAgnosticBin2 *self;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS ||
+      GST_OBJECT_PARENT (bin) == NULL) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  self = KMS_AGNOSTIC_BIN2 (GST_OBJECT_PARENT (bin));
+
+  /* Matches made against the previous caps of the branch are stale */
+  KMS_AGNOSTIC_BIN2_LOCK (self);
+  kms_agnostic_bin2_unindex_bin (self, bin);
+  KMS_AGNOSTIC_BIN2_UNLOCK (self);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+kms_agnostic_bin2_insert_bin (KmsAgnosticBin2 * self, GstBin * bin)
+{
+  if (!g_hash_table_contains (self->priv->bins, GST_OBJECT_NAME (bin))) {
+    GstElement *output_tee = kms_tree_bin_get_output_tee (KMS_TREE_BIN (bin));
+    GstPad *tee_sink = gst_element_get_static_pad (output_tee, "sink");
+
+    gst_pad_add_probe (tee_sink, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+        branch_caps_probe, bin, NULL);
+    g_object_unref (tee_sink);
+  }
+
+  g_hash_table_insert (self->priv->bins, GST_OBJECT_NAME (bin),
+      g_object_ref (bin));
+}
+
+static void
+kms_agnostic_bin2_link_to_fanout (KmsAgnosticBin2 * self, GstPad * pad,
+    GstElement * tee)
+{
+  GstElement *fanout = g_object_get_data (G_OBJECT (tee), FANOUT_KEY);
+  GstPad *target;
+
+  if (fanout == NULL) {
+    fanout = g_object_new (KMS_TYPE_RING_FANOUT, NULL);
+    gst_bin_add (GST_BIN (self), fanout);
+    gst_element_sync_state_with_parent (fanout);
+    link_element_to_tee (tee, fanout);
+    g_object_set_data_full (G_OBJECT (tee), FANOUT_KEY, g_object_ref (fanout),
+        g_object_unref);
+  }
+
+  target = gst_element_get_request_pad (fanout, "src_%u");
+  g_signal_connect (target, "unlinked", G_CALLBACK (remove_tee_pad_on_unlink),
+      NULL);
+
+  kms_agnostic_bin2_retarget (pad, target, NULL, NULL);
   g_object_unref (target);
-  link_element_to_tee (tee, queue);
 }
 
 static GstBin *
 kms_agnostic_bin2_find_bin_for_caps (KmsAgnosticBin2 * self, GstCaps * caps)
 {
-  GList *bins, *l;
+  GHashTableIter iter;
+  gpointer value;
   GstBin *bin = NULL;
+  gboolean negotiated = FALSE;
+  gchar *key;
 
   if (gst_caps_is_any (caps)) {
     return self->priv->input_bin;
   }
 
-  bins = g_hash_table_get_values (self->priv->bins);
-  for (l = bins; l != NULL && bin == NULL; l = l->next) {
-    GstElement *output_tee =
-        kms_tree_bin_get_output_tee (KMS_TREE_BIN (l->data));
+  key = kms_agnostic_bin2_caps_key (caps);
+  bin = g_hash_table_lookup (self->priv->bins_index, key);
+
+  if (bin != NULL) {
+    GST_TRACE_OBJECT (self, "Index hit for %s: %" GST_PTR_FORMAT, key, bin);
+    g_free (key);
+    return bin;
+  }
+
+  g_hash_table_iter_init (&iter, self->priv->bins);
+  while (bin == NULL && g_hash_table_iter_next (&iter, NULL, &value)) {
+    GstElement *output_tee = kms_tree_bin_get_output_tee (KMS_TREE_BIN (value));
     GstPad *tee_sink = gst_element_get_static_pad (output_tee, "sink");
     GstCaps *current_caps = gst_pad_get_current_caps (tee_sink);
 
+    negotiated = current_caps != NULL;
+
     if (current_caps == NULL) {
       current_caps = gst_pad_get_allowed_caps (tee_sink);
-      GST_TRACE_OBJECT (l->data, "Allowed caps are: %" GST_PTR_FORMAT,
+      GST_TRACE_OBJECT (value, "Allowed caps are: %" GST_PTR_FORMAT,
           current_caps);
     } else {
-      GST_TRACE_OBJECT (l->data, "Current caps are: %" GST_PTR_FORMAT,
+      GST_TRACE_OBJECT (value, "Current caps are: %" GST_PTR_FORMAT,
           current_caps);
     }
 
     if (current_caps != NULL) {
       if (gst_caps_can_intersect (caps, current_caps))
-        bin = l->data;
+        bin = value;
       gst_caps_unref (current_caps);
     }
 
     g_object_unref (tee_sink);
   }
-  g_list_free (bins);
+
+  /* Allowed caps change as the branch negotiates, only matches against
+   * current caps are worth remembering */
+  if (bin != NULL && negotiated) {
+    g_hash_table_insert (self->priv->bins_index, key, bin);
+  } else {
+    g_free (key);
+  }
 
   return bin;
 }
@@ -489,6 +790,7 @@ kms_agnostic_bin2_create_dec_bin (KmsAgnosticBin2 * self,
   KmsDecTreeBin *dec_bin;
   GstElement *output_tee, *input_element;
   GstCaps *caps = self->priv->input_bin_src_caps;
+  GstPad *input_sink;
 
   if (caps == NULL || raw_caps == NULL) {
     return NULL;
@@ -507,6 +809,12 @@ kms_agnostic_bin2_create_dec_bin (KmsAgnosticBin2 * self,
   input_element = kms_tree_bin_get_input_element (KMS_TREE_BIN (dec_bin));
   link_element_to_tee (output_tee, input_element);
 
+  /* The decoder may be rebuilt after being reclaimed, it cannot start
+   * decoding until the next keyframe */
+  input_sink = gst_element_get_static_pad (input_element, "sink");
+  kms_utils_drop_until_keyframe (input_sink, TRUE);
+  g_object_unref (input_sink);
+
   return GST_BIN (dec_bin);
 }
 
@@ -527,6 +835,8 @@ kms_agnostic_bin2_get_or_create_dec_bin (KmsAgnosticBin2 * self, GstCaps * caps)
       if (dec_bin != NULL) {
         kms_agnostic_bin2_insert_bin (self, dec_bin);
       }
+    } else {
+      kms_agnostic_bin2_touch_branch (dec_bin);
     }
 
     gst_caps_unref (raw_caps);
@@ -539,23 +849,101 @@ kms_agnostic_bin2_get_or_create_dec_bin (KmsAgnosticBin2 * self, GstCaps * caps)
   }
 }
 
+static gboolean
+get_caps_resolution (const GstCaps * caps, gint * width, gint * height)
+{
+  GstStructure *st;
+
+  if (gst_caps_get_size (caps) == 0) {
+    return FALSE;
+  }
+
+  st = gst_caps_get_structure (caps, 0);
+
+  return gst_structure_get_int (st, "width", width) &&
+      gst_structure_get_int (st, "height", height);
+}
+
+/*
+ * Returns the tee of the pyramid layer for the given resolution, creating it
+ * if needed. New layers are scaled from the smallest existing layer that is
+ * at least as big, or from the decoded video if there is none.
+ */
+static GstElement *
+kms_agnostic_bin2_get_layer_tee (KmsAgnosticBin2 * self, GstBin * dec_bin,
+    gint width, gint height)
+{
+  KmsScaleTreeBin *layer, *parent = NULL;
+  GstElement *parent_tee, *input_element;
+  GHashTableIter iter;
+  gpointer value;
+  gchar *key;
+
+  key = g_strdup_printf ("%dx%d", width, height);
+  layer = g_hash_table_lookup (self->priv->layers, key);
+
+  if (layer != NULL) {
+    g_free (key);
+    kms_agnostic_bin2_touch_branch (GST_BIN (layer));
+    return kms_tree_bin_get_output_tee (KMS_TREE_BIN (layer));
+  }
+
+  g_hash_table_iter_init (&iter, self->priv->layers);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    KmsScaleTreeBin *candidate = value;
+    gint w = kms_scale_tree_bin_get_width (candidate);
+    gint h = kms_scale_tree_bin_get_height (candidate);
+
+    if (w < width || h < height) {
+      continue;
+    }
+
+    if (parent == NULL || w * h < kms_scale_tree_bin_get_width (parent) *
+        kms_scale_tree_bin_get_height (parent)) {
+      parent = candidate;
+    }
+  }
+
+  if (parent != NULL) {
+    parent_tee = kms_tree_bin_get_output_tee (KMS_TREE_BIN (parent));
+  } else {
+    parent_tee = kms_tree_bin_get_output_tee (KMS_TREE_BIN (dec_bin));
+  }
+
+  layer = kms_scale_tree_bin_new (width, height);
+  GST_DEBUG_OBJECT (self, "Created layer %s from %" GST_PTR_FORMAT, key,
+      parent != NULL ? (gpointer) parent : (gpointer) dec_bin);
+
+  gst_bin_add (GST_BIN (self), GST_ELEMENT (layer));
+  gst_element_sync_state_with_parent (GST_ELEMENT (layer));
+
+  input_element = kms_tree_bin_get_input_element (KMS_TREE_BIN (layer));
+  link_element_to_tee (parent_tee, input_element);
+
+  g_hash_table_insert (self->priv->layers, key, g_object_ref (layer));
+
+  return kms_tree_bin_get_output_tee (KMS_TREE_BIN (layer));
+}
+
+/*
+ * Creates an encoder for the caps fed from the decoded media. The returned
+ * bin is not registered in the bins table.
+ */
 static GstBin *
-kms_agnostic_bin2_create_bin_for_caps (KmsAgnosticBin2 * self, GstCaps * caps)
+kms_agnostic_bin2_create_enc_bin (KmsAgnosticBin2 * self, GstCaps * caps,
+    const GstStructure * config)
 {
   GstBin *dec_bin;
   KmsEncTreeBin *enc_bin;
   GstElement *input_element, *output_tee;
+  gint width, height;
 
   dec_bin = kms_agnostic_bin2_get_or_create_dec_bin (self, caps);
   if (dec_bin == NULL) {
     return NULL;
   }
 
-  if (is_raw_caps (caps)) {
-    return dec_bin;
-  }
-
-  enc_bin = kms_enc_tree_bin_new (caps);
+  enc_bin = kms_enc_tree_bin_new (caps, config);
   if (enc_bin == NULL) {
     return NULL;
   }
@@ -563,16 +951,344 @@ kms_agnostic_bin2_create_bin_for_caps (KmsAgnosticBin2 * self, GstCaps * caps)
   gst_bin_add (GST_BIN (self), GST_ELEMENT (enc_bin));
   gst_element_sync_state_with_parent (GST_ELEMENT (enc_bin));
 
-  output_tee = kms_tree_bin_get_output_tee (KMS_TREE_BIN (dec_bin));
+  if (kms_utils_caps_are_video (caps) &&
+      get_caps_resolution (caps, &width, &height)) {
+    /* Encoders of the same resolution share conversion and scaling */
+    output_tee = kms_agnostic_bin2_get_layer_tee (self, dec_bin, width, height);
+  } else {
+    output_tee = kms_tree_bin_get_output_tee (KMS_TREE_BIN (dec_bin));
+  }
+
   input_element = kms_tree_bin_get_input_element (KMS_TREE_BIN (enc_bin));
   link_element_to_tee (output_tee, input_element);
 
-  kms_agnostic_bin2_insert_bin (self, GST_BIN (enc_bin));
-
   return GST_BIN (enc_bin);
 }
 
-/**
+static GstBin *
+kms_agnostic_bin2_create_bin_for_caps (KmsAgnosticBin2 * self, GstCaps * caps)
+{
+  GstBin *bin;
+
+  if (kms_utils_caps_are_raw (caps)) {
+    bin = kms_agnostic_bin2_get_or_create_dec_bin (self, caps);
+  } else {
+    bin = kms_agnostic_bin2_create_enc_bin (self, caps,
+        self->priv->encoder_config);
+
+    if (bin != NULL) {
+      kms_agnostic_bin2_insert_bin (self, bin);
+    }
+  }
+
+  if (bin != NULL) {
+    kms_agnostic_bin2_index_bin (self, caps, bin);
+  }
+
+  return bin;
+}
+
+/*
+ * Reads the ladder bitrates from the encoder configuration, sorted in
+ * ascending order. Returns the number of rungs, 0 if ladders are disabled.
+ */
+static guint
+kms_agnostic_bin2_get_ladder_bitrates (KmsAgnosticBin2 * self,
+    guint ** bitrates)
+{
+  const GValue *ladder;
+  guint i, size, n_rungs = 0;
+
+  if (self->priv->encoder_config == NULL) {
+    return 0;
+  }
+
+  ladder = gst_structure_get_value (self->priv->encoder_config,
+      LADDER_CONFIG_FIELD);
+
+  if (ladder == NULL || !GST_VALUE_HOLDS_ARRAY (ladder)) {
+    return 0;
+  }
+
+  size = gst_value_array_get_size (ladder);
+  *bitrates = g_new (guint, MAX (size, 1));
+
+  for (i = 0; i < size; i++) {
+    const GValue *rung = gst_value_array_get_value (ladder, i);
+
+    if (G_VALUE_HOLDS_INT (rung) && g_value_get_int (rung) > 0) {
+      (*bitrates)[n_rungs++] = g_value_get_int (rung);
+    }
+  }
+
+  if (n_rungs == 0) {
+    g_free (*bitrates);
+    *bitrates = NULL;
+    return 0;
+  }
+
+  g_qsort_with_data (*bitrates, n_rungs, sizeof (guint), compare_bitrates,
+      NULL);
+
+  return n_rungs;
+}
+
+static gboolean
+kms_agnostic_bin2_uses_ladder (KmsAgnosticBin2 * self, GstCaps * caps)
+{
+  const GValue *ladder;
+
+  if (self->priv->encoder_config == NULL || gst_caps_is_any (caps) ||
+      !kms_utils_caps_are_video (caps) || kms_utils_caps_are_raw (caps)) {
+    return FALSE;
+  }
+
+  ladder = gst_structure_get_value (self->priv->encoder_config,
+      LADDER_CONFIG_FIELD);
+
+  return ladder != NULL && GST_VALUE_HOLDS_ARRAY (ladder) &&
+      gst_value_array_get_size (ladder) > 0;
+}
+
+static BitrateLadder *
+kms_agnostic_bin2_get_or_create_ladder (KmsAgnosticBin2 * self, GstCaps * caps)
+{
+  BitrateLadder *ladder;
+  guint *bitrates = NULL;
+  guint n_rungs;
+  GList *l;
+
+  for (l = self->priv->ladders; l != NULL; l = l->next) {
+    ladder = l->data;
+
+    if (gst_caps_can_intersect (caps, ladder->caps)) {
+      return ladder;
+    }
+  }
+
+  n_rungs = kms_agnostic_bin2_get_ladder_bitrates (self, &bitrates);
+  if (n_rungs == 0) {
+    return NULL;
+  }
+
+  ladder = g_slice_new0 (BitrateLadder);
+  ladder->ref = 1;
+  ladder->active = TRUE;
+  ladder->caps = gst_caps_copy (caps);
+  ladder->n_rungs = n_rungs;
+  ladder->bitrates = bitrates;
+  ladder->bins = g_new0 (GstBin *, n_rungs);
+
+  self->priv->ladders = g_list_prepend (self->priv->ladders, ladder);
+
+  GST_DEBUG_OBJECT (self, "Created ladder of %u rungs for %" GST_PTR_FORMAT,
+      n_rungs, caps);
+
+  return ladder;
+}
+
+static GstElement *
+kms_agnostic_bin2_get_rung_tee (KmsAgnosticBin2 * self,
+    BitrateLadder * ladder, guint rung)
+{
+  if (ladder->bins[rung] == NULL) {
+    GstStructure *config;
+
+    if (self->priv->encoder_config != NULL) {
+      config = gst_structure_copy (self->priv->encoder_config);
+    } else {
+      config = gst_structure_new_empty ("encoder-config");
+    }
+
+    gst_structure_set (config, "target-bitrate", G_TYPE_INT,
+        (gint) ladder->bitrates[rung], NULL);
+
+    ladder->bins[rung] =
+        kms_agnostic_bin2_create_enc_bin (self, ladder->caps, config);
+    gst_structure_free (config);
+
+    if (ladder->bins[rung] == NULL) {
+      return NULL;
+    }
+
+    g_object_ref (ladder->bins[rung]);
+
+    GST_DEBUG_OBJECT (self, "Created rung %u at %u bps: %" GST_PTR_FORMAT,
+        rung, ladder->bitrates[rung], ladder->bins[rung]);
+  } else {
+    kms_agnostic_bin2_touch_branch (ladder->bins[rung]);
+  }
+
+  return kms_tree_bin_get_output_tee (KMS_TREE_BIN (ladder->bins[rung]));
+}
+
+static GstPadProbeReturn
+ladder_switch_blocked (GstPad * tee_src, GstPadProbeInfo * info,
+    gpointer queue)
+{
+  KmsAgnosticBin2 *self;
+  LadderSubscriber *sub;
+  GstElement *tee = NULL;
+  GstObject *parent;
+  GstPad *sink;
+
+  parent = gst_object_get_parent (GST_OBJECT (queue));
+  if (parent == NULL) {
+    /* Subscriber already released */
+    return GST_PAD_PROBE_REMOVE;
+  }
+
+  self = KMS_AGNOSTIC_BIN2 (parent);
+
+  KMS_AGNOSTIC_BIN2_LOCK (self);
+  sub = g_object_get_data (G_OBJECT (queue), LADDER_SUBSCRIBER_KEY);
+  if (sub != NULL) {
+    tee = sub->target_tee;
+    sub->target_tee = NULL;
+  }
+  KMS_AGNOSTIC_BIN2_UNLOCK (self);
+
+  if (tee == NULL) {
+    g_object_unref (self);
+    return GST_PAD_PROBE_REMOVE;
+  }
+
+  sink = gst_element_get_static_pad (queue, "sink");
+
+  GST_DEBUG_OBJECT (queue, "Switching to rung %u", sub->rung);
+
+  /* The old tee pad is released when unlinked */
+  gst_pad_unlink (tee_src, sink);
+  link_tee_to_pad (tee, sink);
+  kms_utils_drop_until_keyframe (sink, TRUE);
+
+  g_object_unref (sink);
+  g_object_unref (tee);
+  g_object_unref (self);
+
+  return GST_PAD_PROBE_DROP;
+}
+
+static void
+kms_agnostic_bin2_switch_rung (KmsAgnosticBin2 * self, GstElement * queue,
+    LadderSubscriber * sub, guint rung)
+{
+  GstElement *tee;
+  GstPad *sink, *peer;
+
+  tee = kms_agnostic_bin2_get_rung_tee (self, sub->ladder, rung);
+  if (tee == NULL) {
+    GST_WARNING_OBJECT (self, "Cannot create rung %u", rung);
+    return;
+  }
+
+  sink = gst_element_get_static_pad (queue, "sink");
+  peer = gst_pad_get_peer (sink);
+  g_object_unref (sink);
+
+  if (peer == NULL) {
+    return;
+  }
+
+  GST_DEBUG_OBJECT (queue, "Moving from rung %u to %u", sub->rung, rung);
+
+  sub->rung = rung;
+  sub->target_tee = g_object_ref (tee);
+
+  gst_pad_add_probe (peer, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
+      ladder_switch_blocked, g_object_ref (queue), g_object_unref);
+  g_object_unref (peer);
+}
+
+/*
+ * REMB from a subscriber on a ladder only selects its rung. It is not
+ * propagated to the encoder, rungs keep their configured bitrate.
+ */
+static GstPadProbeReturn
+ladder_remb_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstEvent *event = gst_pad_probe_info_get_event (info);
+  LadderSubscriber *sub = user_data;
+  GstElement *queue;
+  GstObject *parent;
+  guint bitrate, ssrc, rung;
+
+  if (!kms_utils_remb_event_upstream_parse (event, &bitrate, &ssrc)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  queue = gst_pad_get_parent_element (pad);
+  if (queue == NULL) {
+    return GST_PAD_PROBE_DROP;
+  }
+
+  parent = gst_object_get_parent (GST_OBJECT (queue));
+  if (parent == NULL) {
+    g_object_unref (queue);
+    return GST_PAD_PROBE_DROP;
+  }
+
+  KMS_AGNOSTIC_BIN2_LOCK (parent);
+
+  if (sub->ladder->active && sub->target_tee == NULL) {
+    rung = kms_utils_bitrate_ladder_select_rung (sub->ladder->bitrates,
+        sub->ladder->n_rungs, sub->rung, bitrate, LADDER_HYSTERESIS);
+
+    GST_TRACE_OBJECT (pad, "REMB %" G_GUINT32_FORMAT " selects rung %u",
+        bitrate, rung);
+
+    if (rung != sub->rung) {
+      kms_agnostic_bin2_switch_rung (KMS_AGNOSTIC_BIN2 (parent), queue, sub,
+          rung);
+    }
+  }
+
+  KMS_AGNOSTIC_BIN2_UNLOCK (parent);
+
+  g_object_unref (parent);
+  g_object_unref (queue);
+
+  return GST_PAD_PROBE_DROP;
+}
+
+static gboolean
+kms_agnostic_bin2_link_pad_to_ladder (KmsAgnosticBin2 * self, GstPad * pad,
+    GstCaps * caps)
+{
+  LadderSubscriber *sub;
+  BitrateLadder *ladder;
+  GstElement *tee, *queue;
+  GstPad *queue_src;
+
+  ladder = kms_agnostic_bin2_get_or_create_ladder (self, caps);
+  if (ladder == NULL) {
+    return FALSE;
+  }
+
+  /* Start on the lowest rung until the first estimation arrives */
+  tee = kms_agnostic_bin2_get_rung_tee (self, ladder, 0);
+  if (tee == NULL) {
+    return FALSE;
+  }
+
+  kms_utils_drop_until_keyframe (pad, TRUE);
+  queue = kms_agnostic_bin2_link_to_tee (self, pad, tee, caps);
+
+  sub = g_slice_new0 (LadderSubscriber);
+  sub->ladder = bitrate_ladder_ref (ladder);
+  sub->rung = 0;
+  g_object_set_data_full (G_OBJECT (queue), LADDER_SUBSCRIBER_KEY, sub,
+      ladder_subscriber_destroy);
+
+  queue_src = gst_element_get_static_pad (queue, "src");
+  gst_pad_add_probe (queue_src, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+      ladder_remb_probe, sub, NULL);
+  g_object_unref (queue_src);
+
+  return TRUE;
+}
+
+/**
  * Link a pad internally
  *
  * @self: The #KmsAgnosticBin2 owner of the pad
@@ -596,6 +1312,12 @@ kms_agnostic_bin2_link_pad (KmsAgnosticBin2 * self, GstPad * pad, GstPad * peer)
   GST_DEBUG ("Query caps are: %" GST_PTR_FORMAT, caps);
   bin = kms_agnostic_bin2_find_bin_for_caps (self, caps);
 
+  if (bin == NULL && kms_agnostic_bin2_uses_ladder (self, caps)) {
+    if (kms_agnostic_bin2_link_pad_to_ladder (self, pad, caps)) {
+      goto unref_caps;
+    }
+  }
+
   if (bin == NULL) {
     bin = kms_agnostic_bin2_create_bin_for_caps (self, caps);
     GST_DEBUG_OBJECT (self, "Created bin: %" GST_PTR_FORMAT, bin);
@@ -604,10 +1326,20 @@ kms_agnostic_bin2_link_pad (KmsAgnosticBin2 * self, GstPad * pad, GstPad * peer)
   if (bin != NULL) {
     GstElement *tee = kms_tree_bin_get_output_tee (KMS_TREE_BIN (bin));
 
+    kms_agnostic_bin2_touch_branch (bin);
     kms_utils_drop_until_keyframe (pad, TRUE);
-    kms_agnostic_bin2_link_to_tee (self, pad, tee, caps);
+
+    if (self->priv->shared_fanout &&
+        (gst_caps_is_any (caps) || !kms_utils_caps_are_raw (caps))) {
+      kms_agnostic_bin2_link_to_fanout (self, pad, tee);
+    } else {
+      kms_agnostic_bin2_link_to_tee (self, pad, tee, caps);
+    }
+  } else {
+    remove_target_pad (pad);
   }
 
+unref_caps:
   gst_caps_unref (caps);
 
 end:
@@ -653,10 +1385,10 @@ kms_agnostic_bin2_process_pad (KmsAgnosticBin2 * self, GstPad * pad)
         if (accepted) {
           GST_DEBUG_OBJECT (self, "No need to reconfigure pad %" GST_PTR_FORMAT,
               pad);
+          g_object_unref (target);
+          g_object_unref (peer);
           return FALSE;
         }
-
-        remove_target_pad (pad);
       }
 
       g_object_unref (target);
@@ -671,12 +1403,14 @@ kms_agnostic_bin2_process_pad (KmsAgnosticBin2 * self, GstPad * pad)
 static void
 add_linked_pads (GstPad * pad, KmsAgnosticBin2 * self)
 {
-  if (!gst_pad_is_linked (pad)) {
+  GstPad *peer = gst_pad_get_peer (pad);
+
+  if (peer == NULL) {
     return;
   }
 
-  remove_target_pad (pad);
-  kms_agnostic_bin2_process_pad (self, pad);
+  /* The tree changed, current targets are replaced even if caps still fit */
+  kms_agnostic_bin2_link_pad (self, pad, peer);
 }
 
 static GstPadProbeReturn
@@ -707,6 +1441,8 @@ input_bin_src_caps_probe (GstPad * pad, GstPadProbeInfo * info, gpointer bin)
   gst_event_parse_caps (event, &current_caps);
   self->priv->input_bin_src_caps = gst_caps_copy (current_caps);
   kms_agnostic_bin2_insert_bin (self, GST_BIN (bin));
+  /* Matches against the previous input caps are no longer valid */
+  g_hash_table_remove_all (self->priv->bins_index);
 
   GST_INFO_OBJECT (self, "Setting current caps to: %" GST_PTR_FORMAT,
       current_caps);
@@ -719,6 +1455,170 @@ input_bin_src_caps_probe (GstPad * pad, GstPadProbeInfo * info, gpointer bin)
   return GST_PAD_PROBE_REMOVE;
 }
 
+/*
+ * Returns TRUE when the branch has had no consumers for longer than the idle
+ * timeout. The output tee always keeps a fakesink linked.
+ */
+static gboolean
+kms_agnostic_bin2_branch_expired (KmsAgnosticBin2 * self, GstBin * bin,
+    GstClockTime now)
+{
+  GstElement *tee = kms_tree_bin_get_output_tee (KMS_TREE_BIN (bin));
+  GstElement *fanout = g_object_get_data (G_OBJECT (tee), FANOUT_KEY);
+  GstClockTime *idle_since;
+  guint16 consumers;
+
+  GST_OBJECT_LOCK (tee);
+  consumers = tee->numsrcpads > 0 ? tee->numsrcpads - 1 : 0;
+  GST_OBJECT_UNLOCK (tee);
+
+  if (fanout != NULL) {
+    /* The fan-out itself is not a consumer, its pads are */
+    GST_OBJECT_LOCK (fanout);
+    consumers = MAX (consumers, 1) - 1 + fanout->numsrcpads;
+    GST_OBJECT_UNLOCK (fanout);
+  }
+
+  idle_since = g_object_get_data (G_OBJECT (bin), IDLE_SINCE_KEY);
+
+  if (idle_since == NULL) {
+    idle_since = g_new (GstClockTime, 1);
+    *idle_since = GST_CLOCK_TIME_NONE;
+    g_object_set_data_full (G_OBJECT (bin), IDLE_SINCE_KEY, idle_since,
+        g_free);
+  }
+
+  if (consumers > 0) {
+    *idle_since = GST_CLOCK_TIME_NONE;
+    return FALSE;
+  }
+
+  if (!GST_CLOCK_TIME_IS_VALID (*idle_since)) {
+    *idle_since = now;
+    return FALSE;
+  }
+
+  return now - *idle_since >= self->priv->idle_timeout * GST_SECOND;
+}
+
+static void
+kms_agnostic_bin2_reclaim_branch (KmsAgnosticBin2 * self, GstBin * bin)
+{
+  GstElement *input_element, *fanout;
+  GstPad *sink, *peer;
+
+  GST_DEBUG_OBJECT (self, "Reclaiming idle branch %" GST_PTR_FORMAT, bin);
+
+  /* Upstream tee pad is released once unlinked */
+  input_element = kms_tree_bin_get_input_element (KMS_TREE_BIN (bin));
+  sink = gst_element_get_static_pad (input_element, "sink");
+  peer = gst_pad_get_peer (sink);
+
+  if (peer != NULL) {
+    gst_pad_unlink (peer, sink);
+    g_object_unref (peer);
+  }
+
+  g_object_unref (sink);
+
+  g_thread_pool_push (self->priv->remove_pool, g_object_ref (bin), NULL);
+
+  fanout = g_object_steal_data (G_OBJECT (kms_tree_bin_get_output_tee
+          (KMS_TREE_BIN (bin))), FANOUT_KEY);
+  if (fanout != NULL) {
+    g_thread_pool_push (self->priv->remove_pool, fanout, NULL);
+  }
+}
+
+static gboolean
+kms_agnostic_bin2_idle_sweep (GstClock * clock, GstClockTime now,
+    GstClockID id, gpointer user_data)
+{
+  KmsAgnosticBin2 *self = user_data;
+  GHashTableIter iter;
+  gpointer value;
+  GList *l;
+  guint i;
+
+  KMS_AGNOSTIC_BIN2_LOCK (self);
+
+  if (self->priv->idle_timeout == 0) {
+    goto end;
+  }
+
+  g_hash_table_iter_init (&iter, self->priv->bins);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    GstBin *bin = value;
+
+    if (bin == self->priv->input_bin ||
+        !kms_agnostic_bin2_branch_expired (self, bin, now)) {
+      continue;
+    }
+
+    kms_agnostic_bin2_reclaim_branch (self, bin);
+    kms_agnostic_bin2_unindex_bin (self, bin);
+    g_hash_table_iter_remove (&iter);
+  }
+
+  g_hash_table_iter_init (&iter, self->priv->layers);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    if (kms_agnostic_bin2_branch_expired (self, value, now)) {
+      kms_agnostic_bin2_reclaim_branch (self, value);
+      g_hash_table_iter_remove (&iter);
+    }
+  }
+
+  for (l = self->priv->ladders; l != NULL; l = l->next) {
+    BitrateLadder *ladder = l->data;
+
+    for (i = 0; i < ladder->n_rungs; i++) {
+      if (ladder->bins[i] != NULL &&
+          kms_agnostic_bin2_branch_expired (self, ladder->bins[i], now)) {
+        kms_agnostic_bin2_reclaim_branch (self, ladder->bins[i]);
+        g_clear_object (&ladder->bins[i]);
+      }
+    }
+  }
+
+end:
+  KMS_AGNOSTIC_BIN2_UNLOCK (self);
+
+  return TRUE;
+}
+
+static void
+kms_agnostic_bin2_start_idle_sweep (KmsAgnosticBin2 * self)
+{
+  GstClock *clock = gst_system_clock_obtain ();
+
+  KMS_AGNOSTIC_BIN2_LOCK (self);
+  if (self->priv->idle_sweep_id == NULL) {
+    self->priv->idle_sweep_id = gst_clock_new_periodic_id (clock,
+        gst_clock_get_time (clock) + IDLE_SWEEP_INTERVAL, IDLE_SWEEP_INTERVAL);
+    gst_clock_id_wait_async (self->priv->idle_sweep_id,
+        kms_agnostic_bin2_idle_sweep, g_object_ref (self), g_object_unref);
+  }
+  KMS_AGNOSTIC_BIN2_UNLOCK (self);
+
+  gst_object_unref (clock);
+}
+
+static void
+kms_agnostic_bin2_stop_idle_sweep (KmsAgnosticBin2 * self)
+{
+  GstClockID id;
+
+  KMS_AGNOSTIC_BIN2_LOCK (self);
+  id = self->priv->idle_sweep_id;
+  self->priv->idle_sweep_id = NULL;
+  KMS_AGNOSTIC_BIN2_UNLOCK (self);
+
+  if (id != NULL) {
+    gst_clock_id_unschedule (id);
+    gst_clock_id_unref (id);
+  }
+}
+
 static void
 kms_agnostic_bin2_configure_input (KmsAgnosticBin2 * self, const GstCaps * caps)
 {
@@ -753,7 +1653,11 @@ kms_agnostic_bin2_configure_input (KmsAgnosticBin2 * self, const GstCaps * caps)
   link_element_to_tee (self->priv->input_tee, input_element);
 
   self->priv->started = FALSE;
+  g_hash_table_remove_all (self->priv->bins_index);
   g_hash_table_remove_all (self->priv->bins);
+  g_hash_table_remove_all (self->priv->layers);
+  g_list_free_full (self->priv->ladders, bitrate_ladder_deactivate);
+  self->priv->ladders = NULL;
 
   KMS_AGNOSTIC_BIN2_UNLOCK (self);
 
@@ -799,7 +1703,8 @@ kms_agnostic_bin2_sink_caps_probe (GstPad * pad, GstPadProbeInfo * info,
         current_caps);
 
     if (!gst_caps_can_intersect (new_caps, current_caps) &&
-        !is_raw_caps (current_caps) && !is_raw_caps (new_caps)) {
+        !kms_utils_caps_are_raw (current_caps) &&
+        !kms_utils_caps_are_raw (new_caps)) {
       GST_DEBUG_OBJECT (user_data, "Caps differ caps: %" GST_PTR_FORMAT,
           new_caps);
       kms_agnostic_bin2_configure_input (self, new_caps);
@@ -860,6 +1765,100 @@ kms_agnostic_bin2_src_unlinked (GstPad * pad, GstPad * peer,
   remove_target_pad (pad);
 }
 
+/* Returns if @element is part of the branch that ends in @target */
+static gboolean
+branch_contains (GstPad * target, GstObject * element)
+{
+  GstElement *elem = gst_pad_get_parent_element (target);
+  gboolean found = FALSE;
+
+  /* Branches start with a queue linked to a tee */
+  while (elem != NULL && !found) {
+    GstElementFactory *factory = gst_element_get_factory (elem);
+    GstPad *sink, *peer = NULL;
+    GstElement *prev = NULL;
+
+    found = GST_OBJECT_CAST (elem) == element;
+
+    if (!found && (factory == NULL ||
+            g_strcmp0 (GST_OBJECT_NAME (factory), "queue") != 0)) {
+      sink = gst_element_get_static_pad (elem, "sink");
+      if (sink != NULL) {
+        peer = gst_pad_get_peer (sink);
+        g_object_unref (sink);
+      }
+
+      if (peer != NULL) {
+        prev = gst_pad_get_parent_element (peer);
+        g_object_unref (peer);
+      }
+    }
+
+    g_object_unref (elem);
+    elem = prev;
+  }
+
+  if (elem != NULL) {
+    g_object_unref (elem);
+  }
+
+  return found;
+}
+
+/*
+ * A failing consumer makes the branch feeding it post an error. Its output
+ * is detached like an unlinked one, the flow error itself is not masked.
+ */
+static void
+kms_agnostic_bin2_detach_failed_output (KmsAgnosticBin2 * self,
+    GstObject * element)
+{
+  GstIterator *it = gst_element_iterate_src_pads (GST_ELEMENT (self));
+  GValue item = G_VALUE_INIT;
+  gboolean done = FALSE;
+
+  while (!done) {
+    switch (gst_iterator_next (it, &item)) {
+      case GST_ITERATOR_OK:{
+        GstPad *pad = g_value_get_object (&item);
+        GstPad *target = gst_ghost_pad_get_target (GST_GHOST_PAD (pad));
+
+        if (target != NULL) {
+          if (branch_contains (target, element)) {
+            GST_WARNING_OBJECT (pad, "Branch failed, detaching output");
+            remove_target_pad (pad);
+            done = TRUE;
+          }
+          g_object_unref (target);
+        }
+
+        g_value_reset (&item);
+        break;
+      }
+      case GST_ITERATOR_RESYNC:
+        gst_iterator_resync (it);
+        break;
+      default:
+        done = TRUE;
+        break;
+    }
+  }
+
+  g_value_unset (&item);
+  gst_iterator_free (it);
+}
+
+static void
+kms_agnostic_bin2_handle_message (GstBin * bin, GstMessage * message)
+{
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ERROR) {
+    kms_agnostic_bin2_detach_failed_output (KMS_AGNOSTIC_BIN2 (bin),
+        GST_MESSAGE_SRC (message));
+  }
+
+  GST_BIN_CLASS (parent_class)->handle_message (bin, message);
+}
+
 static GstPad *
 kms_agnostic_bin2_request_new_pad (GstElement * element,
     GstPadTemplate * templ, const gchar * name, const GstCaps * caps)
@@ -898,6 +1897,100 @@ kms_agnostic_bin2_release_pad (GstElement * element, GstPad * pad)
   gst_element_remove_pad (element, pad);
 }
 
+static GstStateChangeReturn
+kms_agnostic_bin2_change_state (GstElement * element,
+    GstStateChange transition)
+{
+  KmsAgnosticBin2 *self = KMS_AGNOSTIC_BIN2 (element);
+  GstStateChangeReturn ret;
+
+  if (transition == GST_STATE_CHANGE_READY_TO_PAUSED) {
+    kms_agnostic_bin2_start_idle_sweep (self);
+  }
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+  if (transition == GST_STATE_CHANGE_PAUSED_TO_READY) {
+    kms_agnostic_bin2_stop_idle_sweep (self);
+  }
+
+  return ret;
+}
+
+static void
+kms_agnostic_bin2_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  KmsAgnosticBin2 *self = KMS_AGNOSTIC_BIN2 (object);
+
+  switch (property_id) {
+    case PROP_ENCODER_CONFIG:{
+      const GstStructure *config = gst_value_get_structure (value);
+
+      KMS_AGNOSTIC_BIN2_LOCK (self);
+      if (self->priv->encoder_config != NULL) {
+        gst_structure_free (self->priv->encoder_config);
+      }
+      self->priv->encoder_config =
+          config != NULL ? gst_structure_copy (config) : NULL;
+      KMS_AGNOSTIC_BIN2_UNLOCK (self);
+      break;
+    }
+    case PROP_IDLE_TIMEOUT:
+      KMS_AGNOSTIC_BIN2_LOCK (self);
+      self->priv->idle_timeout = g_value_get_uint (value);
+      KMS_AGNOSTIC_BIN2_UNLOCK (self);
+      break;
+    case PROP_SHARED_FANOUT:
+      KMS_AGNOSTIC_BIN2_LOCK (self);
+      self->priv->shared_fanout = g_value_get_boolean (value);
+      KMS_AGNOSTIC_BIN2_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+kms_agnostic_bin2_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  KmsAgnosticBin2 *self = KMS_AGNOSTIC_BIN2 (object);
+
+  switch (property_id) {
+    case PROP_ENCODER_CONFIG:
+      KMS_AGNOSTIC_BIN2_LOCK (self);
+      gst_value_set_structure (value, self->priv->encoder_config);
+      KMS_AGNOSTIC_BIN2_UNLOCK (self);
+      break;
+    case PROP_IDLE_TIMEOUT:
+      KMS_AGNOSTIC_BIN2_LOCK (self);
+      g_value_set_uint (value, self->priv->idle_timeout);
+      KMS_AGNOSTIC_BIN2_UNLOCK (self);
+      break;
+    case PROP_SHARED_FANOUT:
+      KMS_AGNOSTIC_BIN2_LOCK (self);
+      g_value_set_boolean (value, self->priv->shared_fanout);
+      KMS_AGNOSTIC_BIN2_UNLOCK (self);
+      break;
+    case PROP_KEYFRAME_STATS:{
+      guint64 requested, coalesced, sent;
+
+      kms_utils_keyframe_coordinator_get_stats
+          (self->priv->keyframe_coordinator, &requested, &coalesced, &sent);
+      g_value_take_boxed (value, gst_structure_new ("keyframe-stats",
+              "requested", G_TYPE_UINT64, requested,
+              "coalesced", G_TYPE_UINT64, coalesced,
+              "sent", G_TYPE_UINT64, sent, NULL));
+      break;
+    }
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
 static void
 kms_agnostic_bin2_dispose (GObject * object)
 {
@@ -918,6 +2011,12 @@ kms_agnostic_bin2_dispose (GObject * object)
     self->priv->input_caps = NULL;
   }
 
+  /* Lives as long as the sink pad, across input reconfigurations */
+  if (self->priv->keyframe_coordinator != NULL) {
+    kms_utils_keyframe_coordinator_destroy (self->priv->keyframe_coordinator);
+    self->priv->keyframe_coordinator = NULL;
+  }
+
   KMS_AGNOSTIC_BIN2_UNLOCK (self);
 
   /* chain up */
@@ -933,7 +2032,14 @@ kms_agnostic_bin2_finalize (GObject * object)
 
   g_rec_mutex_clear (&self->priv->thread_mutex);
 
+  g_hash_table_unref (self->priv->bins_index);
   g_hash_table_unref (self->priv->bins);
+  g_hash_table_unref (self->priv->layers);
+  g_list_free_full (self->priv->ladders, bitrate_ladder_deactivate);
+
+  if (self->priv->encoder_config != NULL) {
+    gst_structure_free (self->priv->encoder_config);
+  }
 
   /* chain up */
   G_OBJECT_CLASS (kms_agnostic_bin2_parent_class)->finalize (object);
@@ -944,12 +2050,43 @@ kms_agnostic_bin2_class_init (KmsAgnosticBin2Class * klass)
 {
   GObjectClass *gobject_class;
   GstElementClass *gstelement_class;
+  GstBinClass *gstbin_class;
 
   gobject_class = G_OBJECT_CLASS (klass);
   gstelement_class = GST_ELEMENT_CLASS (klass);
+  gstbin_class = GST_BIN_CLASS (klass);
 
   gobject_class->dispose = kms_agnostic_bin2_dispose;
   gobject_class->finalize = kms_agnostic_bin2_finalize;
+  gobject_class->set_property = kms_agnostic_bin2_set_property;
+  gobject_class->get_property = kms_agnostic_bin2_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_ENCODER_CONFIG,
+      g_param_spec_boxed ("encoder-config", "Encoder configuration",
+          "Settings for the encoders created by this element "
+          "(threads, token-partitions, cpu-used, deadline, speed-preset, "
+          "keyframe-interval, target-bitrate). An array of bitrates in "
+          "bitrate-ladder enables a shared ladder of encoders per caps",
+          GST_TYPE_STRUCTURE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_IDLE_TIMEOUT,
+      g_param_spec_uint ("idle-timeout", "Idle timeout",
+          "Seconds a decoding or encoding branch can stay without consumers "
+          "before it is released (0 = never)", 0, G_MAXUINT,
+          DEFAULT_IDLE_TIMEOUT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SHARED_FANOUT,
+      g_param_spec_boolean ("shared-fanout", "Shared fan-out",
+          "Deliver encoded media to all the consumers of a branch from one "
+          "shared ring instead of a queue per consumer", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_KEYFRAME_STATS,
+      g_param_spec_boxed ("keyframe-stats", "Key frame statistics",
+          "Key frame requests received from the consumers, coalesced into "
+          "previous ones and sent upstream", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
   gst_element_class_set_details_simple (gstelement_class,
       "Agnostic connector 2nd version",
@@ -966,6 +2103,10 @@ kms_agnostic_bin2_class_init (KmsAgnosticBin2Class * klass)
       GST_DEBUG_FUNCPTR (kms_agnostic_bin2_request_new_pad);
   gstelement_class->release_pad =
       GST_DEBUG_FUNCPTR (kms_agnostic_bin2_release_pad);
+  gstelement_class->change_state =
+      GST_DEBUG_FUNCPTR (kms_agnostic_bin2_change_state);
+  gstbin_class->handle_message =
+      GST_DEBUG_FUNCPTR (kms_agnostic_bin2_handle_message);
 
   GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, PLUGIN_NAME, 0, PLUGIN_NAME);
 
@@ -1015,6 +2156,8 @@ kms_agnostic_bin2_init (KmsAgnosticBin2 * self)
   self->priv->sink = gst_ghost_pad_new_from_template ("sink", target, templ);
   gst_pad_set_query_function (self->priv->sink, kms_agnostic_bin2_sink_query);
   kms_utils_manage_gaps (self->priv->sink);
+  self->priv->keyframe_coordinator =
+      kms_utils_keyframe_coordinator_create (self->priv->sink);
   g_object_unref (templ);
   g_object_unref (target);
 
@@ -1032,7 +2175,15 @@ kms_agnostic_bin2_init (KmsAgnosticBin2 * self)
       g_thread_pool_new (remove_on_unlinked_async, NULL, -1, FALSE, NULL);
   self->priv->bins =
       g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_object_unref);
+  self->priv->bins_index =
+      g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->priv->layers =
+      g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
   g_rec_mutex_init (&self->priv->thread_mutex);
+  self->priv->encoder_config = NULL;
+  self->priv->idle_timeout = DEFAULT_IDLE_TIMEOUT;
+  self->priv->idle_sweep_id = NULL;
+  self->priv->shared_fanout = FALSE;
 }
 
 gboolean
@@ -38,11 +38,24 @@ G_DEFINE_TYPE (KmsBitrateFilter, kms_bitrate_filter, GST_TYPE_BASE_TRANSFORM);
 
 #define BITRATE_CALC_INTERVAL GST_SECOND
 #define BITRATE_CALC_THRESHOLD 100000   /* bps */
+#define BITRATE_CALC_INITIAL_SAMPLES 64
 
+typedef struct _KmsBitrateSample
+{
+  GstClockTime pts;
+  gsize size;
+} KmsBitrateSample;
+
+/*
+ * Samples of the last interval are kept in a ring that only grows when the
+ * packet rate does, so steady flow does not allocate.
+ */
 typedef struct _KmsBitrateCalcData
 {
-  GQueue /*GstClockTime */  * pts_queue;
-  GQueue /*gsize */  * sizes_queue;
+  KmsBitrateSample *samples;
+  guint capacity;
+  guint first;
+  guint len;
   guint64 total_size;
   gint bitrate, last_bitrate;   /* bps */
 } KmsBitrateCalcData;
@@ -69,46 +82,66 @@ kms_bitrate_calc_data_clear (KmsBitrateCalcData * data)
     return;
   }
 
-  g_queue_free_full (data->pts_queue,
-      (GDestroyNotify) kms_utils_destroy_guint64);
-  g_queue_free (data->sizes_queue);
+  g_free (data->samples);
+  data->samples = NULL;
+  data->capacity = data->first = data->len = 0;
 }
 
 static void
 kms_bitrate_calc_data_init (KmsBitrateCalcData * data)
 {
-  data->pts_queue = g_queue_new ();
-  data->sizes_queue = g_queue_new ();
+  data->capacity = BITRATE_CALC_INITIAL_SAMPLES;
+  data->samples = g_new (KmsBitrateSample, data->capacity);
+}
+
+static KmsBitrateSample *
+kms_bitrate_calc_data_get (KmsBitrateCalcData * data, guint i)
+{
+  return &data->samples[(data->first + i) % data->capacity];
+}
+
+static void
+kms_bitrate_calc_data_grow (KmsBitrateCalcData * data)
+{
+  guint capacity = data->capacity * 2;
+  KmsBitrateSample *samples = g_new (KmsBitrateSample, capacity);
+  guint i;
+
+  for (i = 0; i < data->len; i++) {
+    samples[i] = *kms_bitrate_calc_data_get (data, i);
+  }
+
+  g_free (data->samples);
+  data->samples = samples;
+  data->capacity = capacity;
+  data->first = 0;
 }
 
 static void
 kms_bitrate_calc_data_update (KmsBitrateCalcData * data, GstBuffer * buffer)
 {
-  gsize size;
-  guint64 *current_pts, *last_pts, diff;
+  KmsBitrateSample *current, *last;
+  guint64 diff;
 
-  current_pts = g_slice_new0 (guint64);
-  *current_pts = buffer->pts;
-  g_queue_push_head (data->pts_queue, current_pts);
+  if (data->len == data->capacity) {
+    kms_bitrate_calc_data_grow (data);
+  }
 
-  size = gst_buffer_get_size (buffer);
-  g_queue_push_head (data->sizes_queue, GSIZE_TO_POINTER (size));
-  data->total_size += size;
+  current = kms_bitrate_calc_data_get (data, data->len++);
+  current->pts = buffer->pts;
+  current->size = gst_buffer_get_size (buffer);
+  data->total_size += current->size;
 
   /* Remove old buffers */
-  last_pts = (guint64 *) g_queue_peek_tail (data->pts_queue);
-  diff = *current_pts - *last_pts;
+  last = kms_bitrate_calc_data_get (data, 0);
+  diff = current->pts - last->pts;
   while (diff > BITRATE_CALC_INTERVAL) {
-    gpointer p;
-
-    p = g_queue_pop_tail (data->pts_queue);
-    kms_utils_destroy_guint64 (p);
-
-    p = g_queue_pop_tail (data->sizes_queue);
-    data->total_size -= GPOINTER_TO_SIZE (p);
+    data->total_size -= last->size;
+    data->first = (data->first + 1) % data->capacity;
+    data->len--;
 
-    last_pts = (guint64 *) g_queue_peek_tail (data->pts_queue);
-    diff = *current_pts - *last_pts;
+    last = kms_bitrate_calc_data_get (data, 0);
+    diff = current->pts - last->pts;
   }
 
   if (diff == 0) {
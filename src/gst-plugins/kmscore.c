@@ -23,6 +23,7 @@
 #include <kmsaudiomixerbin.h>
 #include <kmsbitratefilter.h>
 #include <kmsbufferinjector.h>
+#include <kmsringfanout.h>
 #include <kmsdummysrc.h>
 #include <kmsdummysink.h>
 #include <kmsdummyduplex.h>
@@ -54,6 +55,9 @@ kurento_init (GstPlugin * kurento)
   if (!kms_buffer_injector_plugin_init (kurento))
     return FALSE;
 
+  if (!kms_ring_fanout_plugin_init (kurento))
+    return FALSE;
+
   if (!kms_dummy_src_plugin_init (kurento))
     return FALSE;
 
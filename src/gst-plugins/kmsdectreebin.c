@@ -30,32 +30,18 @@ G_DEFINE_TYPE (KmsDecTreeBin, kms_dec_tree_bin, KMS_TYPE_TREE_BIN);
 static GstElement *
 create_decoder_for_caps (const GstCaps * caps, const GstCaps * raw_caps)
 {
-  GList *decoder_list, *filtered_list, *aux_list, *l;
-  GstElementFactory *decoder_factory = NULL;
+  GstElementFactory *decoder_factory;
   GstElement *decoder = NULL;
 
-  decoder_list =
-      gst_element_factory_list_get_elements (GST_ELEMENT_FACTORY_TYPE_DECODER,
-      GST_RANK_NONE);
-  aux_list =
-      gst_element_factory_list_filter (decoder_list, caps, GST_PAD_SINK, FALSE);
-  filtered_list =
-      gst_element_factory_list_filter (aux_list, raw_caps, GST_PAD_SRC, FALSE);
-
-  for (l = filtered_list; l != NULL && decoder_factory == NULL; l = l->next) {
-    decoder_factory = GST_ELEMENT_FACTORY (l->data);
-    if (gst_element_factory_get_num_pad_templates (decoder_factory) != 2)
-      decoder_factory = NULL;
-  }
+  decoder_factory =
+      kms_utils_get_element_factory_for_caps (GST_ELEMENT_FACTORY_TYPE_DECODER,
+      caps, raw_caps, kms_utils_factory_has_two_pad_templates);
 
   if (decoder_factory != NULL) {
     decoder = gst_element_factory_create (decoder_factory, NULL);
+    gst_object_unref (decoder_factory);
   }
 
-  gst_plugin_feature_list_free (filtered_list);
-  gst_plugin_feature_list_free (decoder_list);
-  gst_plugin_feature_list_free (aux_list);
-
   return decoder;
 }
 
@@ -27,48 +27,228 @@ GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define kms_enc_tree_bin_parent_class parent_class
 G_DEFINE_TYPE (KmsEncTreeBin, kms_enc_tree_bin, KMS_TYPE_TREE_BIN);
 
+#define AUTO_THREADS 0
+#define AUTO_TOKEN_PARTITIONS -1
+#define MAX_AUTO_THREADS 8
+#define MAX_TOKEN_PARTITIONS 3  /* 8 partitions */
+
+#define DEFAULT_THREADS 1
+#define DEFAULT_TOKEN_PARTITIONS AUTO_TOKEN_PARTITIONS
+#define DEFAULT_CPU_USED 16
+#define DEFAULT_DEADLINE 200000
+#define DEFAULT_SPEED_PRESET 1  /* ultrafast */
+#define DEFAULT_KEYFRAME_INTERVAL 0     /* encoder default */
+#define DEFAULT_TARGET_BITRATE 0        /* encoder default */
+
+#define VP8ENC_TARGET_BITRATE 300000
+
+typedef struct _EncoderConfig
+{
+  gint threads;
+  gint token_partitions;
+  gint cpu_used;
+  gint deadline;
+  gint speed_preset;
+  gint keyframe_interval;
+  gint target_bitrate;
+} EncoderConfig;
+
+static void
+encoder_config_parse (EncoderConfig * config, const GstStructure * st)
+{
+  config->threads = DEFAULT_THREADS;
+  config->token_partitions = DEFAULT_TOKEN_PARTITIONS;
+  config->cpu_used = DEFAULT_CPU_USED;
+  config->deadline = DEFAULT_DEADLINE;
+  config->speed_preset = DEFAULT_SPEED_PRESET;
+  config->keyframe_interval = DEFAULT_KEYFRAME_INTERVAL;
+  config->target_bitrate = DEFAULT_TARGET_BITRATE;
+
+  if (st == NULL) {
+    return;
+  }
+
+  gst_structure_get_int (st, "threads", &config->threads);
+  gst_structure_get_int (st, "token-partitions", &config->token_partitions);
+  gst_structure_get_int (st, "cpu-used", &config->cpu_used);
+  gst_structure_get_int (st, "deadline", &config->deadline);
+  gst_structure_get_int (st, "speed-preset", &config->speed_preset);
+  gst_structure_get_int (st, "keyframe-interval", &config->keyframe_interval);
+  gst_structure_get_int (st, "target-bitrate", &config->target_bitrate);
+}
+
+static gint
+auto_threads_for_resolution (gint width, gint height)
+{
+  gint pixels = width * height;
+  gint threads;
+
+  if (pixels <= 320 * 240) {
+    threads = 1;
+  } else if (pixels <= 640 * 480) {
+    threads = 2;
+  } else if (pixels <= 1280 * 720) {
+    threads = 4;
+  } else {
+    threads = MAX_AUTO_THREADS;
+  }
+
+  return CLAMP (threads, 1, (gint) g_get_num_processors ());
+}
+
+static gint
+token_partitions_for_threads (gint threads)
+{
+  gint partitions = 0;
+
+  /* Token partitions are a power of two, use one per thread */
+  while ((1 << (partitions + 1)) <= threads
+      && partitions < MAX_TOKEN_PARTITIONS) {
+    partitions++;
+  }
+
+  return partitions;
+}
+
+static void
+vp8enc_set_threads (GstElement * encoder, const EncoderConfig * config,
+    gint threads)
+{
+  gint partitions = config->token_partitions;
+
+  if (partitions == AUTO_TOKEN_PARTITIONS) {
+    partitions = token_partitions_for_threads (threads);
+  }
+
+  GST_DEBUG_OBJECT (encoder, "Using %d threads, %d token partitions", threads,
+      partitions);
+  g_object_set (G_OBJECT (encoder), "threads", threads, "token-partitions",
+      partitions, NULL);
+}
+
+static GstPadProbeReturn
+vp8enc_auto_threads_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  EncoderConfig *config = user_data;
+  GstEvent *event = gst_pad_probe_info_get_event (info);
+  GstStructure *st;
+  GstElement *encoder;
+  GstCaps *caps;
+  gint width, height;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  gst_event_parse_caps (event, &caps);
+  st = gst_caps_get_structure (caps, 0);
+
+  if (!gst_structure_get_int (st, "width", &width) ||
+      !gst_structure_get_int (st, "height", &height)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  /* Encoder reads its threads when it gets the new format */
+  encoder = gst_pad_get_parent_element (pad);
+  if (encoder != NULL) {
+    vp8enc_set_threads (encoder, config, auto_threads_for_resolution (width,
+            height));
+    g_object_unref (encoder);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+encoder_config_destroy (gpointer config)
+{
+  g_slice_free (EncoderConfig, config);
+}
+
 static void
-configure_encoder (GstElement * encoder, const gchar * factory_name)
+configure_vp8enc (GstElement * encoder, const EncoderConfig * config)
 {
+  gint target_bitrate = config->target_bitrate;
+
+  if (target_bitrate <= 0) {
+    target_bitrate = VP8ENC_TARGET_BITRATE;
+  }
+
+  g_object_set (G_OBJECT (encoder), "deadline",
+      (gint64) config->deadline, "cpu-used", config->cpu_used,
+      "resize-allowed", TRUE, "target-bitrate", target_bitrate,
+      "end-usage", /* cbr */ 1, NULL);
+
+  if (config->keyframe_interval > 0) {
+    g_object_set (G_OBJECT (encoder), "keyframe-max-dist",
+        config->keyframe_interval, NULL);
+  }
+
+  if (config->threads == AUTO_THREADS) {
+    GstPad *sink = gst_element_get_static_pad (encoder, "sink");
+
+    vp8enc_set_threads (encoder, config, 1);
+    gst_pad_add_probe (sink, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+        vp8enc_auto_threads_probe, g_slice_dup (EncoderConfig, config),
+        encoder_config_destroy);
+    g_object_unref (sink);
+  } else {
+    vp8enc_set_threads (encoder, config, config->threads);
+  }
+}
+
+static void
+configure_x264enc (GstElement * encoder, const EncoderConfig * config)
+{
+  /* x264 picks the thread count itself when it is 0 */
+  g_object_set (G_OBJECT (encoder), "speed-preset", config->speed_preset,
+      "tune", 4 /* zerolatency */ , "threads", (guint) config->threads, NULL);
+
+  if (config->keyframe_interval > 0) {
+    g_object_set (G_OBJECT (encoder), "key-int-max",
+        (guint) config->keyframe_interval, NULL);
+  }
+
+  if (config->target_bitrate > 0) {
+    /* x264 bitrate is expressed in kbit/s */
+    g_object_set (G_OBJECT (encoder), "bitrate",
+        (guint) config->target_bitrate / 1000, NULL);
+  }
+}
+
+static void
+configure_encoder (GstElement * encoder, const gchar * factory_name,
+    const GstStructure * st)
+{
+  EncoderConfig config;
+
   GST_DEBUG ("Configure encoder: %s", factory_name);
+  encoder_config_parse (&config, st);
+
   if (g_strcmp0 ("vp8enc", factory_name) == 0) {
-    g_object_set (G_OBJECT (encoder), "deadline", G_GINT64_CONSTANT (200000),
-        "threads", 1, "cpu-used", 16, "resize-allowed", TRUE,
-        "target-bitrate", 300000, "end-usage", /* cbr */ 1, NULL);
+    configure_vp8enc (encoder, &config);
   } else if (g_strcmp0 ("x264enc", factory_name) == 0) {
-    g_object_set (G_OBJECT (encoder), "speed-preset", 1 /* ultrafast */ ,
-        "tune", 4 /* zerolatency */ , "threads", (guint) 1,
-        NULL);
+    configure_x264enc (encoder, &config);
   }
 }
 
 static GstElement *
-create_encoder_for_caps (const GstCaps * caps)
+create_encoder_for_caps (const GstCaps * caps, const GstStructure * config)
 {
-  GList *encoder_list, *filtered_list, *l;
-  GstElementFactory *encoder_factory = NULL;
+  GstElementFactory *encoder_factory;
   GstElement *encoder = NULL;
 
-  encoder_list =
-      gst_element_factory_list_get_elements (GST_ELEMENT_FACTORY_TYPE_ENCODER,
-      GST_RANK_NONE);
-  filtered_list =
-      gst_element_factory_list_filter (encoder_list, caps, GST_PAD_SRC, FALSE);
-
-  for (l = filtered_list; l != NULL && encoder_factory == NULL; l = l->next) {
-    encoder_factory = GST_ELEMENT_FACTORY (l->data);
-    if (gst_element_factory_get_num_pad_templates (encoder_factory) != 2)
-      encoder_factory = NULL;
-  }
+  encoder_factory =
+      kms_utils_get_element_factory_for_caps (GST_ELEMENT_FACTORY_TYPE_ENCODER,
+      NULL, caps, kms_utils_factory_has_two_pad_templates);
 
   if (encoder_factory != NULL) {
     encoder = gst_element_factory_create (encoder_factory, NULL);
-    configure_encoder (encoder, GST_OBJECT_NAME (encoder_factory));
+    configure_encoder (encoder, GST_OBJECT_NAME (encoder_factory), config);
+    gst_object_unref (encoder_factory);
   }
 
-  gst_plugin_feature_list_free (filtered_list);
-  gst_plugin_feature_list_free (encoder_list);
-
   return encoder;
 }
 
@@ -120,14 +300,15 @@ config_enc_bitrate_probe (GstPad * pad, GstPadProbeInfo * info,
 }
 
 static gboolean
-kms_enc_tree_bin_configure (KmsEncTreeBin * self, const GstCaps * caps)
+kms_enc_tree_bin_configure (KmsEncTreeBin * self, const GstCaps * caps,
+    const GstStructure * config)
 {
   KmsTreeBin *tree_bin = KMS_TREE_BIN (self);
   GstElement *rate, *convert, *mediator, *enc, *output_tee;
   RembEventManager *remb_manager;
   GstPad *sink;
 
-  enc = create_encoder_for_caps (caps);
+  enc = create_encoder_for_caps (caps, config);
   if (enc == NULL) {
     GST_WARNING_OBJECT (self, "Invalid encoder for caps: %" GST_PTR_FORMAT,
         caps);
@@ -160,12 +341,12 @@ kms_enc_tree_bin_configure (KmsEncTreeBin * self, const GstCaps * caps)
 }
 
 KmsEncTreeBin *
-kms_enc_tree_bin_new (const GstCaps * caps)
+kms_enc_tree_bin_new (const GstCaps * caps, const GstStructure * config)
 {
   GObject *enc;
 
   enc = g_object_new (KMS_TYPE_ENC_TREE_BIN, NULL);
-  if (!kms_enc_tree_bin_configure (KMS_ENC_TREE_BIN (enc), caps)) {
+  if (!kms_enc_tree_bin_configure (KMS_ENC_TREE_BIN (enc), caps, config)) {
     g_object_unref (enc);
     return NULL;
   }
@@ -47,7 +47,13 @@ struct _KmsEncTreeBinClass
 
 GType kms_enc_tree_bin_get_type (void);
 
-KmsEncTreeBin * kms_enc_tree_bin_new (const GstCaps * caps);
+/*
+ * config is an optional structure with encoder settings: "threads" (0 picks
+ * them from the output resolution and available cores), "token-partitions",
+ * "cpu-used", "deadline", "speed-preset" and "keyframe-interval" (frames).
+ */
+KmsEncTreeBin * kms_enc_tree_bin_new (const GstCaps * caps,
+  const GstStructure * config);
 
 G_END_DECLS
 #endif /* __KMS_ENC_TREE_BIN_H__ */
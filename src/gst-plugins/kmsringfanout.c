@@ -0,0 +1,696 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "kmsringfanout.h"
+#include "kmsutils.h"
+
+#define PLUGIN_NAME "ringfanout"
+
+#define DEFAULT_RING_SIZE 64
+#define DEFAULT_WORKERS 2
+/* Items delivered to a consumer before yielding the worker to others */
+#define DELIVERY_BATCH 16
+
+static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src_%u",
+    GST_PAD_SRC,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS_ANY);
+
+GST_DEBUG_CATEGORY_STATIC (kms_ring_fanout_debug);
+#define GST_CAT_DEFAULT kms_ring_fanout_debug
+#define kms_ring_fanout_parent_class parent_class
+
+G_DEFINE_TYPE_WITH_CODE (KmsRingFanout, kms_ring_fanout,
+    GST_TYPE_ELEMENT,
+    GST_DEBUG_CATEGORY_INIT (kms_ring_fanout_debug,
+        PLUGIN_NAME, 0, "debug category for " PLUGIN_NAME " element"));
+
+#define KMS_RING_FANOUT_GET_PRIVATE(obj) ( \
+  G_TYPE_INSTANCE_GET_PRIVATE (            \
+    (obj),                                 \
+    KMS_TYPE_RING_FANOUT,                  \
+    KmsRingFanoutPrivate                   \
+  )                                        \
+)
+
+#define KMS_RING_FANOUT_LOCK(obj) \
+  (g_mutex_lock (&KMS_RING_FANOUT (obj)->priv->mutex))
+
+#define KMS_RING_FANOUT_UNLOCK(obj) \
+  (g_mutex_unlock (&KMS_RING_FANOUT (obj)->priv->mutex))
+
+enum
+{
+  PROP_0,
+  PROP_RING_SIZE,
+  PROP_WORKERS,
+  N_PROPERTIES
+};
+
+/*
+ * A consumer reads the ring through its own cursor. It is scheduled in the
+ * worker pool at most once at a time, so items are pushed in order.
+ */
+typedef struct _RingConsumer
+{
+  gint ref;
+  GstPad *pad;
+  guint64 cursor;
+  gboolean scheduled;
+  gboolean waiting_keyframe;
+  gboolean removed;
+} RingConsumer;
+
+/* Serialized event overwritten in the ring while a consumer still had to
+ * read it */
+typedef struct _EvictedEvent
+{
+  guint64 seq;
+  GstEvent *event;
+} EvictedEvent;
+
+struct _KmsRingFanoutPrivate
+{
+  GMutex mutex;
+  GstPad *sinkpad;
+
+  /* Buffers and serialized events, item n is at ring[n % ring_size] */
+  GstMiniObject **ring;
+  guint ring_size;
+  guint64 write_seq;
+  /* EvictedEvent sorted by seq. Overrun consumers only skip buffers, the
+   * events they missed are delivered from here */
+  GQueue evicted;
+
+  GHashTable *consumers;
+  GThreadPool *pool;
+  guint workers;
+  guint pad_count;
+  gboolean flushing;
+};
+
+static RingConsumer *
+ring_consumer_ref (RingConsumer * consumer)
+{
+  g_atomic_int_inc (&consumer->ref);
+
+  return consumer;
+}
+
+static void
+ring_consumer_unref (gpointer data)
+{
+  RingConsumer *consumer = data;
+
+  if (!g_atomic_int_dec_and_test (&consumer->ref)) {
+    return;
+  }
+
+  g_object_unref (consumer->pad);
+  g_slice_free (RingConsumer, consumer);
+}
+
+static inline gboolean
+is_keyframe (GstMiniObject * item)
+{
+  return GST_IS_BUFFER (item) &&
+      !GST_BUFFER_FLAG_IS_SET (GST_BUFFER_CAST (item),
+      GST_BUFFER_FLAG_DELTA_UNIT);
+}
+
+static void
+evicted_event_free (gpointer data)
+{
+  EvictedEvent *evicted = data;
+
+  gst_event_unref (evicted->event);
+  g_slice_free (EvictedEvent, evicted);
+}
+
+static inline guint64
+kms_ring_fanout_oldest_seq (KmsRingFanout * self)
+{
+  if (self->priv->write_seq > self->priv->ring_size) {
+    return self->priv->write_seq - self->priv->ring_size;
+  }
+
+  return 0;
+}
+
+/* Call with the lock held */
+static void
+kms_ring_fanout_clear_ring (KmsRingFanout * self)
+{
+  GHashTableIter iter;
+  gpointer value;
+  guint i;
+
+  for (i = 0; i < self->priv->ring_size; i++) {
+    if (self->priv->ring[i] != NULL) {
+      gst_mini_object_unref (self->priv->ring[i]);
+      self->priv->ring[i] = NULL;
+    }
+  }
+
+  /* Nothing left to read, new data starts at write_seq */
+  self->priv->write_seq += self->priv->ring_size;
+  g_queue_free_full (&self->priv->evicted, evicted_event_free);
+  g_queue_init (&self->priv->evicted);
+
+  g_hash_table_iter_init (&iter, self->priv->consumers);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    RingConsumer *consumer = value;
+
+    consumer->cursor = self->priv->write_seq;
+    consumer->waiting_keyframe = TRUE;
+  }
+}
+
+/* Call with the lock held */
+static EvictedEvent *
+kms_ring_fanout_find_evicted (KmsRingFanout * self, guint64 seq)
+{
+  GList *l;
+
+  for (l = self->priv->evicted.head; l != NULL; l = l->next) {
+    EvictedEvent *evicted = l->data;
+
+    if (evicted->seq >= seq) {
+      return evicted;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Returns the next item for the consumer, NULL if it was skipped. A consumer
+ * overrun by the writer still gets the events it missed, then drops buffers
+ * up to the next keyframe.
+ * Call with the lock held.
+ */
+static GstMiniObject *
+kms_ring_fanout_next_item (KmsRingFanout * self, RingConsumer * consumer,
+    gboolean * request_keyframe)
+{
+  guint64 oldest = kms_ring_fanout_oldest_seq (self);
+  GstMiniObject *item;
+
+  if (consumer->cursor < oldest) {
+    EvictedEvent *evicted = kms_ring_fanout_find_evicted (self,
+        consumer->cursor);
+    guint64 seq;
+
+    if (evicted != NULL) {
+      consumer->cursor = evicted->seq + 1;
+
+      return gst_mini_object_ref (GST_MINI_OBJECT_CAST (evicted->event));
+    }
+
+    GST_DEBUG_OBJECT (consumer->pad, "Slow consumer, %" G_GUINT64_FORMAT
+        " items lost", oldest - consumer->cursor);
+
+    consumer->cursor = oldest;
+    consumer->waiting_keyframe = TRUE;
+    *request_keyframe = TRUE;
+
+    for (seq = oldest; seq < self->priv->write_seq; seq++) {
+      if (is_keyframe (self->priv->ring[seq % self->priv->ring_size])) {
+        *request_keyframe = FALSE;
+        break;
+      }
+    }
+  }
+
+  item = self->priv->ring[consumer->cursor % self->priv->ring_size];
+  consumer->cursor++;
+
+  if (consumer->waiting_keyframe && GST_IS_BUFFER (item)) {
+    if (!is_keyframe (item)) {
+      return NULL;
+    }
+
+    consumer->waiting_keyframe = FALSE;
+  }
+
+  return gst_mini_object_ref (item);
+}
+
+static void
+kms_ring_fanout_push_item (RingConsumer * consumer, GstMiniObject * item)
+{
+  if (GST_IS_BUFFER (item)) {
+    GstFlowReturn ret = gst_pad_push (consumer->pad, GST_BUFFER_CAST (item));
+
+    if (ret != GST_FLOW_OK && ret != GST_FLOW_FLUSHING) {
+      GST_LOG_OBJECT (consumer->pad, "Push returned: %s",
+          gst_flow_get_name (ret));
+    }
+  } else {
+    gst_pad_push_event (consumer->pad, GST_EVENT_CAST (item));
+  }
+}
+
+static void
+kms_ring_fanout_deliver (gpointer data, gpointer user_data)
+{
+  RingConsumer *consumer = data;
+  KmsRingFanout *self = user_data;
+  gboolean request_keyframe = FALSE;
+  guint delivered = 0;
+
+  KMS_RING_FANOUT_LOCK (self);
+
+  while (!consumer->removed && !self->priv->flushing &&
+      consumer->cursor < self->priv->write_seq && delivered < DELIVERY_BATCH) {
+    GstMiniObject *item;
+
+    item = kms_ring_fanout_next_item (self, consumer, &request_keyframe);
+
+    if (item == NULL) {
+      continue;
+    }
+
+    KMS_RING_FANOUT_UNLOCK (self);
+
+    kms_ring_fanout_push_item (consumer, item);
+    delivered++;
+
+    KMS_RING_FANOUT_LOCK (self);
+  }
+
+  if (!consumer->removed && !self->priv->flushing &&
+      consumer->cursor < self->priv->write_seq) {
+    /* Still behind, let other consumers use the worker first */
+    g_thread_pool_push (self->priv->pool, consumer, NULL);
+    KMS_RING_FANOUT_UNLOCK (self);
+  } else {
+    consumer->scheduled = FALSE;
+    KMS_RING_FANOUT_UNLOCK (self);
+    ring_consumer_unref (consumer);
+  }
+
+  if (request_keyframe) {
+    kms_utils_request_keyframe (self->priv->sinkpad, TRUE);
+  }
+}
+
+/*
+ * Keeps an event about to be overwritten while some consumer has not read
+ * it yet, and drops the ones every consumer is past.
+ * Call with the lock held.
+ */
+static void
+kms_ring_fanout_evict (KmsRingFanout * self, guint64 seq, GstEvent * event)
+{
+  guint64 min_cursor = self->priv->write_seq;
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, self->priv->consumers);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    RingConsumer *consumer = value;
+
+    min_cursor = MIN (min_cursor, consumer->cursor);
+  }
+
+  while (!g_queue_is_empty (&self->priv->evicted)) {
+    EvictedEvent *evicted = g_queue_peek_head (&self->priv->evicted);
+
+    if (evicted->seq >= min_cursor) {
+      break;
+    }
+
+    evicted_event_free (g_queue_pop_head (&self->priv->evicted));
+  }
+
+  if (seq >= min_cursor) {
+    EvictedEvent *evicted = g_slice_new (EvictedEvent);
+
+    evicted->seq = seq;
+    evicted->event = event;
+    g_queue_push_tail (&self->priv->evicted, evicted);
+  } else {
+    gst_event_unref (event);
+  }
+}
+
+/* Call with the lock held */
+static void
+kms_ring_fanout_store (KmsRingFanout * self, GstMiniObject * item)
+{
+  guint index = self->priv->write_seq % self->priv->ring_size;
+  GstMiniObject *old = self->priv->ring[index];
+  GHashTableIter iter;
+  gpointer value;
+
+  if (old != NULL && GST_IS_EVENT (old)) {
+    kms_ring_fanout_evict (self,
+        self->priv->write_seq - self->priv->ring_size, GST_EVENT_CAST (old));
+  } else if (old != NULL) {
+    gst_mini_object_unref (old);
+  }
+
+  self->priv->ring[index] = item;
+  self->priv->write_seq++;
+
+  g_hash_table_iter_init (&iter, self->priv->consumers);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    RingConsumer *consumer = value;
+
+    if (!consumer->scheduled) {
+      consumer->scheduled = TRUE;
+      g_thread_pool_push (self->priv->pool, ring_consumer_ref (consumer),
+          NULL);
+    }
+  }
+}
+
+static GstFlowReturn
+kms_ring_fanout_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  KmsRingFanout *self = KMS_RING_FANOUT (parent);
+
+  KMS_RING_FANOUT_LOCK (self);
+
+  if (self->priv->flushing) {
+    KMS_RING_FANOUT_UNLOCK (self);
+    gst_buffer_unref (buffer);
+    return GST_FLOW_FLUSHING;
+  }
+
+  kms_ring_fanout_store (self, GST_MINI_OBJECT_CAST (buffer));
+
+  KMS_RING_FANOUT_UNLOCK (self);
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+kms_ring_fanout_sink_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  KmsRingFanout *self = KMS_RING_FANOUT (parent);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      KMS_RING_FANOUT_LOCK (self);
+      self->priv->flushing = TRUE;
+      KMS_RING_FANOUT_UNLOCK (self);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      KMS_RING_FANOUT_LOCK (self);
+      kms_ring_fanout_clear_ring (self);
+      self->priv->flushing = FALSE;
+      KMS_RING_FANOUT_UNLOCK (self);
+      break;
+    default:
+      if (GST_EVENT_IS_SERIALIZED (event)) {
+        /* Keep the order with buffers, consumers get it from the ring */
+        KMS_RING_FANOUT_LOCK (self);
+        kms_ring_fanout_store (self, GST_MINI_OBJECT_CAST (event));
+        KMS_RING_FANOUT_UNLOCK (self);
+        return TRUE;
+      }
+      break;
+  }
+
+  return gst_pad_event_default (pad, parent, event);
+}
+
+static gboolean
+kms_ring_fanout_sink_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_ALLOCATION:
+      /* Buffers are shared by all consumers, no downstream pool is used */
+      return FALSE;
+    default:
+      return gst_pad_query_default (pad, parent, query);
+  }
+}
+
+static gboolean
+copy_sticky_event (GstPad * pad, GstEvent ** event, gpointer srcpad)
+{
+  gst_pad_store_sticky_event (GST_PAD (srcpad), *event);
+
+  return TRUE;
+}
+
+static GstPad *
+kms_ring_fanout_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps)
+{
+  KmsRingFanout *self = KMS_RING_FANOUT (element);
+  RingConsumer *consumer;
+  gchar *pad_name;
+  GstPad *pad;
+
+  KMS_RING_FANOUT_LOCK (self);
+  pad_name = g_strdup_printf ("src_%u", self->priv->pad_count++);
+  KMS_RING_FANOUT_UNLOCK (self);
+
+  pad = gst_pad_new_from_template (templ, pad_name);
+  g_free (pad_name);
+
+  if (!gst_element_add_pad (element, pad)) {
+    g_object_unref (pad);
+    return NULL;
+  }
+
+  consumer = g_slice_new0 (RingConsumer);
+  consumer->ref = 1;
+  consumer->pad = g_object_ref (pad);
+  consumer->waiting_keyframe = TRUE;
+
+  KMS_RING_FANOUT_LOCK (self);
+  gst_pad_sticky_events_foreach (self->priv->sinkpad, copy_sticky_event, pad);
+  consumer->cursor = self->priv->write_seq;
+  g_hash_table_insert (self->priv->consumers, pad, consumer);
+  KMS_RING_FANOUT_UNLOCK (self);
+
+  kms_utils_request_keyframe (self->priv->sinkpad, TRUE);
+
+  return pad;
+}
+
+static void
+kms_ring_fanout_release_pad (GstElement * element, GstPad * pad)
+{
+  KmsRingFanout *self = KMS_RING_FANOUT (element);
+  RingConsumer *consumer;
+
+  KMS_RING_FANOUT_LOCK (self);
+  consumer = g_hash_table_lookup (self->priv->consumers, pad);
+  if (consumer != NULL) {
+    consumer->removed = TRUE;
+    g_hash_table_remove (self->priv->consumers, pad);
+  }
+  KMS_RING_FANOUT_UNLOCK (self);
+
+  gst_pad_set_active (pad, FALSE);
+  gst_element_remove_pad (element, pad);
+}
+
+static void
+kms_ring_fanout_resize (KmsRingFanout * self, guint ring_size)
+{
+  KMS_RING_FANOUT_LOCK (self);
+
+  if (self->priv->ring != NULL) {
+    kms_ring_fanout_clear_ring (self);
+    g_free (self->priv->ring);
+  }
+
+  self->priv->ring_size = ring_size;
+  self->priv->ring = g_new0 (GstMiniObject *, ring_size);
+
+  KMS_RING_FANOUT_UNLOCK (self);
+}
+
+static void
+kms_ring_fanout_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  KmsRingFanout *self = KMS_RING_FANOUT (object);
+
+  switch (property_id) {
+    case PROP_RING_SIZE:
+      kms_ring_fanout_resize (self, g_value_get_uint (value));
+      break;
+    case PROP_WORKERS:
+      KMS_RING_FANOUT_LOCK (self);
+      self->priv->workers = g_value_get_uint (value);
+      g_thread_pool_set_max_threads (self->priv->pool, self->priv->workers,
+          NULL);
+      KMS_RING_FANOUT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+kms_ring_fanout_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  KmsRingFanout *self = KMS_RING_FANOUT (object);
+
+  switch (property_id) {
+    case PROP_RING_SIZE:
+      KMS_RING_FANOUT_LOCK (self);
+      g_value_set_uint (value, self->priv->ring_size);
+      KMS_RING_FANOUT_UNLOCK (self);
+      break;
+    case PROP_WORKERS:
+      KMS_RING_FANOUT_LOCK (self);
+      g_value_set_uint (value, self->priv->workers);
+      KMS_RING_FANOUT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static GstStateChangeReturn
+kms_ring_fanout_change_state (GstElement * element, GstStateChange transition)
+{
+  KmsRingFanout *self = KMS_RING_FANOUT (element);
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      KMS_RING_FANOUT_LOCK (self);
+      self->priv->flushing = FALSE;
+      KMS_RING_FANOUT_UNLOCK (self);
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      KMS_RING_FANOUT_LOCK (self);
+      self->priv->flushing = TRUE;
+      kms_ring_fanout_clear_ring (self);
+      KMS_RING_FANOUT_UNLOCK (self);
+      break;
+    default:
+      break;
+  }
+
+  return GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+}
+
+static void
+kms_ring_fanout_finalize (GObject * object)
+{
+  KmsRingFanout *self = KMS_RING_FANOUT (object);
+
+  /* Wait for pending deliveries, they use the ring */
+  g_thread_pool_free (self->priv->pool, FALSE, TRUE);
+
+  kms_ring_fanout_clear_ring (self);
+  g_free (self->priv->ring);
+  g_hash_table_unref (self->priv->consumers);
+  g_mutex_clear (&self->priv->mutex);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+kms_ring_fanout_init (KmsRingFanout * self)
+{
+  self->priv = KMS_RING_FANOUT_GET_PRIVATE (self);
+
+  g_mutex_init (&self->priv->mutex);
+
+  self->priv->sinkpad = gst_pad_new_from_static_template (&sinktemplate,
+      "sink");
+  gst_pad_set_chain_function (self->priv->sinkpad,
+      GST_DEBUG_FUNCPTR (kms_ring_fanout_chain));
+  gst_pad_set_event_function (self->priv->sinkpad,
+      GST_DEBUG_FUNCPTR (kms_ring_fanout_sink_event));
+  gst_pad_set_query_function (self->priv->sinkpad,
+      GST_DEBUG_FUNCPTR (kms_ring_fanout_sink_query));
+  gst_element_add_pad (GST_ELEMENT (self), self->priv->sinkpad);
+
+  self->priv->consumers = g_hash_table_new_full (NULL, NULL, NULL,
+      ring_consumer_unref);
+  self->priv->workers = DEFAULT_WORKERS;
+  self->priv->pool = g_thread_pool_new (kms_ring_fanout_deliver, self,
+      DEFAULT_WORKERS, FALSE, NULL);
+  self->priv->flushing = TRUE;
+  self->priv->ring_size = DEFAULT_RING_SIZE;
+  self->priv->ring = g_new0 (GstMiniObject *, DEFAULT_RING_SIZE);
+  g_queue_init (&self->priv->evicted);
+}
+
+static void
+kms_ring_fanout_class_init (KmsRingFanoutClass * klass)
+{
+  GstElementClass *gstelement_class;
+  GObjectClass *gobject_class;
+
+  gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->finalize = kms_ring_fanout_finalize;
+  gobject_class->set_property = kms_ring_fanout_set_property;
+  gobject_class->get_property = kms_ring_fanout_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_RING_SIZE,
+      g_param_spec_uint ("ring-size", "Ring size",
+          "Buffers and events kept for the consumers, slower consumers skip "
+          "to the next keyframe", 2, G_MAXUINT16, DEFAULT_RING_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_WORKERS,
+      g_param_spec_uint ("workers", "Workers",
+          "Threads delivering data to the consumers", 1, G_MAXUINT16,
+          DEFAULT_WORKERS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  gstelement_class = GST_ELEMENT_CLASS (klass);
+
+  gstelement_class->change_state =
+      GST_DEBUG_FUNCPTR (kms_ring_fanout_change_state);
+  gstelement_class->request_new_pad =
+      GST_DEBUG_FUNCPTR (kms_ring_fanout_request_new_pad);
+  gstelement_class->release_pad =
+      GST_DEBUG_FUNCPTR (kms_ring_fanout_release_pad);
+
+  gst_element_class_set_details_simple (gstelement_class,
+      "Ring fan-out",
+      "Generic",
+      "Distributes buffers to many consumers from one shared ring",
+      "Kurento <kurento@googlegroups.com>");
+
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&srctemplate));
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&sinktemplate));
+
+  g_type_class_add_private (klass, sizeof (KmsRingFanoutPrivate));
+}
+
+gboolean
+kms_ring_fanout_plugin_init (GstPlugin * plugin)
+{
+  return gst_element_register (plugin, PLUGIN_NAME, GST_RANK_NONE,
+      KMS_TYPE_RING_FANOUT);
+}
@@ -0,0 +1,55 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef __KMS_RING_FANOUT_H__
+#define __KMS_RING_FANOUT_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+#define KMS_TYPE_RING_FANOUT \
+  (kms_ring_fanout_get_type())
+#define KMS_RING_FANOUT(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),KMS_TYPE_RING_FANOUT,KmsRingFanout))
+#define KMS_RING_FANOUT_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),KMS_TYPE_RING_FANOUT,KmsRingFanoutClass))
+#define KMS_IS_RING_FANOUT(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),KMS_TYPE_RING_FANOUT))
+#define KMS_IS_RING_FANOUT_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),KMS_TYPE_RING_FANOUT))
+#define KMS_RING_FANOUT_CAST(obj) ((KmsRingFanout*)(obj))
+
+typedef struct _KmsRingFanout KmsRingFanout;
+typedef struct _KmsRingFanoutClass KmsRingFanoutClass;
+typedef struct _KmsRingFanoutPrivate KmsRingFanoutPrivate;
+
+struct _KmsRingFanout
+{
+  GstElement element;
+
+  KmsRingFanoutPrivate *priv;
+};
+
+struct _KmsRingFanoutClass
+{
+  GstElementClass parent_class;
+};
+
+GType kms_ring_fanout_get_type (void);
+
+gboolean kms_ring_fanout_plugin_init (GstPlugin * plugin);
+
+G_END_DECLS
+#endif /* __KMS_RING_FANOUT_H__ */
@@ -0,0 +1,122 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "kmsscaletreebin.h"
+
+#define GST_DEFAULT_NAME "scaletreebin"
+#define GST_CAT_DEFAULT kms_scale_tree_bin_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+#define kms_scale_tree_bin_parent_class parent_class
+G_DEFINE_TYPE (KmsScaleTreeBin, kms_scale_tree_bin, KMS_TYPE_TREE_BIN);
+
+#define KMS_SCALE_TREE_BIN_GET_PRIVATE(obj) ( \
+  G_TYPE_INSTANCE_GET_PRIVATE (               \
+    (obj),                                    \
+    KMS_TYPE_SCALE_TREE_BIN,                  \
+    KmsScaleTreeBinPrivate                    \
+  )                                           \
+)
+
+/* Format accepted by the usual encoders, so their own converters are
+ * passthrough */
+#define LAYER_FORMAT "I420"
+
+struct _KmsScaleTreeBinPrivate
+{
+  gint width;
+  gint height;
+};
+
+static void
+kms_scale_tree_bin_configure (KmsScaleTreeBin * self, gint width, gint height)
+{
+  KmsTreeBin *tree_bin = KMS_TREE_BIN (self);
+  GstElement *convert, *scale, *filter, *output_tee;
+  GstCaps *caps;
+
+  self->priv->width = width;
+  self->priv->height = height;
+
+  convert = gst_element_factory_make ("videoconvert", NULL);
+  scale = gst_element_factory_make ("videoscale", NULL);
+  filter = gst_element_factory_make ("capsfilter", NULL);
+
+  caps = gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING,
+      LAYER_FORMAT, "width", G_TYPE_INT, width, "height", G_TYPE_INT, height,
+      NULL);
+  g_object_set (filter, "caps", caps, NULL);
+  GST_DEBUG_OBJECT (self, "Layer caps: %" GST_PTR_FORMAT, caps);
+  gst_caps_unref (caps);
+
+  gst_bin_add_many (GST_BIN (self), convert, scale, filter, NULL);
+  gst_element_sync_state_with_parent (filter);
+  gst_element_sync_state_with_parent (scale);
+  gst_element_sync_state_with_parent (convert);
+
+  kms_tree_bin_set_input_element (tree_bin, convert);
+  output_tee = kms_tree_bin_get_output_tee (tree_bin);
+  gst_element_link_many (convert, scale, filter, output_tee, NULL);
+}
+
+KmsScaleTreeBin *
+kms_scale_tree_bin_new (gint width, gint height)
+{
+  GObject *scale;
+
+  scale = g_object_new (KMS_TYPE_SCALE_TREE_BIN, NULL);
+  kms_scale_tree_bin_configure (KMS_SCALE_TREE_BIN (scale), width, height);
+
+  return KMS_SCALE_TREE_BIN (scale);
+}
+
+gint
+kms_scale_tree_bin_get_width (KmsScaleTreeBin * self)
+{
+  return self->priv->width;
+}
+
+gint
+kms_scale_tree_bin_get_height (KmsScaleTreeBin * self)
+{
+  return self->priv->height;
+}
+
+static void
+kms_scale_tree_bin_init (KmsScaleTreeBin * self)
+{
+  self->priv = KMS_SCALE_TREE_BIN_GET_PRIVATE (self);
+}
+
+static void
+kms_scale_tree_bin_class_init (KmsScaleTreeBinClass * klass)
+{
+  GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+
+  gst_element_class_set_details_simple (gstelement_class,
+      "ScaleTreeBin",
+      "Generic",
+      "Bin to scale and distribute one layer of raw video.",
+      "Kurento <kurento@googlegroups.com>");
+
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+      GST_DEFAULT_NAME);
+
+  g_type_class_add_private (klass, sizeof (KmsScaleTreeBinPrivate));
+}
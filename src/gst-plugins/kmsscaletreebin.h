@@ -0,0 +1,62 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef __KMS_SCALE_TREE_BIN_H__
+#define __KMS_SCALE_TREE_BIN_H__
+
+#include "kmstreebin.h"
+
+G_BEGIN_DECLS
+/* #defines don't like whitespacey bits */
+#define KMS_TYPE_SCALE_TREE_BIN \
+  (kms_scale_tree_bin_get_type())
+#define KMS_SCALE_TREE_BIN(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),KMS_TYPE_SCALE_TREE_BIN,KmsScaleTreeBin))
+#define KMS_SCALE_TREE_BIN_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),KMS_TYPE_SCALE_TREE_BIN,KmsScaleTreeBinClass))
+#define KMS_IS_SCALE_TREE_BIN(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),KMS_TYPE_SCALE_TREE_BIN))
+#define KMS_IS_SCALE_TREE_BIN_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),KMS_TYPE_SCALE_TREE_BIN))
+#define KMS_SCALE_TREE_BIN_CAST(obj) ((KmsScaleTreeBin*)(obj))
+
+typedef struct _KmsScaleTreeBin KmsScaleTreeBin;
+typedef struct _KmsScaleTreeBinClass KmsScaleTreeBinClass;
+typedef struct _KmsScaleTreeBinPrivate KmsScaleTreeBinPrivate;
+
+struct _KmsScaleTreeBin
+{
+  KmsTreeBin parent;
+
+  /*< private > */
+  KmsScaleTreeBinPrivate *priv;
+};
+
+struct _KmsScaleTreeBinClass
+{
+  KmsTreeBinClass parent_class;
+};
+
+GType kms_scale_tree_bin_get_type (void);
+
+/* One layer of a resolution pyramid: converts raw video to the encoders
+ * input format and scales it to width x height */
+KmsScaleTreeBin * kms_scale_tree_bin_new (gint width, gint height);
+
+gint kms_scale_tree_bin_get_width (KmsScaleTreeBin * self);
+gint kms_scale_tree_bin_get_height (KmsScaleTreeBin * self);
+
+G_END_DECLS
+#endif /* __KMS_SCALE_TREE_BIN_H__ */
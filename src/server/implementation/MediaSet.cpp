@@ -39,16 +39,79 @@ struct functor_trait<Functor, false> {
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define GST_DEFAULT_NAME "KurentoMediaSet"
 
-const int MEDIASET_THREADS_DEFAULT = 1;
+const int MEDIASET_THREADS_DEFAULT = 4;
+const int MEDIASET_MAX_THREADS_DEFAULT = 32;
+const int MEDIASET_SHARDS_DEFAULT = 64;
+const int MEDIASET_OBJECT_PARTITIONS_DEFAULT = 256;
 
 namespace kurento
 {
 
-static const std::chrono::seconds COLLECTOR_INTERVAL = std::chrono::seconds (
-      240);
+static const std::chrono::seconds SESSION_TIMEOUT_DEFAULT =
+  std::chrono::seconds (480);
 
 static std::shared_ptr<MediaSet> mediaSet;
 
+MediaObjectTable::MediaObjectTable (size_t n) : partitions (n > 0 ? n : 1)
+{
+  for (Partition &partition : partitions) {
+    partition.map = std::make_shared<const Map> ();
+  }
+}
+
+std::shared_ptr<MediaObjectImpl>
+MediaObjectTable::find (const std::string &id)
+{
+  std::shared_ptr<const Map> snapshot = std::atomic_load (&get (id).map);
+  auto it = snapshot->find (id);
+
+  if (it == snapshot->end() ) {
+    return std::shared_ptr<MediaObjectImpl> ();
+  }
+
+  return it->second.lock();
+}
+
+void
+MediaObjectTable::insert (const std::string &id,
+                          std::shared_ptr<MediaObjectImpl> mediaObject)
+{
+  Partition &partition = get (id);
+  std::unique_lock <std::mutex> lock (partition.mutex);
+  std::shared_ptr<Map> map = std::make_shared<Map> (*partition.map);
+
+  (*map) [id] = std::weak_ptr<MediaObjectImpl> (mediaObject);
+  std::atomic_store (&partition.map, std::shared_ptr<const Map> (map) );
+}
+
+void
+MediaObjectTable::erase (const std::string &id)
+{
+  Partition &partition = get (id);
+  std::unique_lock <std::mutex> lock (partition.mutex);
+
+  if (partition.map->find (id) == partition.map->end() ) {
+    return;
+  }
+
+  std::shared_ptr<Map> map = std::make_shared<Map> (*partition.map);
+
+  map->erase (id);
+  std::atomic_store (&partition.map, std::shared_ptr<const Map> (map) );
+}
+
+size_t
+MediaObjectTable::size ()
+{
+  size_t count = 0;
+
+  for (Partition &partition : partitions) {
+    count += std::atomic_load (&partition.map)->size();
+  }
+
+  return count;
+}
+
 void
 delete_media_set (MediaSet *ms)
 {
@@ -72,60 +135,135 @@ MediaSet::getMediaSet()
   return mediaSet;
 }
 
+static int
+getEnvThreads (const char *name, int defaultValue)
+{
+  const char *threads = getenv (name);
+
+  if (threads != NULL && atoi (threads) > 0) {
+    return atoi (threads);
+  }
+
+  return defaultValue;
+}
+
 void MediaSet::doGarbageCollection ()
 {
-  std::unique_lock <std::recursive_mutex> lock (recMutex);
-  auto sessions = sessionInUse;
+  std::unique_lock <std::mutex> lock (collectorMutex);
 
-  lock.unlock();
+  while (!terminated) {
+    if (sessionChecks.empty() ) {
+      collectorCond.wait (lock);
+      continue;
+    }
 
-  GST_DEBUG ("Running garbage collector");
+    SessionCheck check = sessionChecks.top();
 
-  for (auto it : sessions) {
-    if (it.second) {
-      lock.lock();
-      sessionInUse[it.first] = false;
-      lock.unlock();
-    } else {
-      GST_WARNING ("Session timeout: %s", it.first.c_str() );
-      unrefSession (it.first);
+    if (std::chrono::steady_clock::now() < check.first) {
+      collectorCond.wait_until (lock, check.first);
+      continue;
+    }
+
+    sessionChecks.pop();
+    lock.unlock();
+
+    try {
+      checkSession (check);
+    } catch (...) {
+      GST_ERROR ("Error during garbage collection");
     }
+
+    lock.lock();
   }
 }
 
-MediaSet::MediaSet()
+void
+MediaSet::checkSession (const SessionCheck &check)
 {
-  terminated = false;
+  auto &shard = sessionInUse.get (check.second);
+  std::unique_lock <std::mutex> lock (shard.mutex);
+  auto it = shard.map.find (check.second);
 
-  workers = std::shared_ptr<WorkerPool> (new WorkerPool (
-      MEDIASET_THREADS_DEFAULT) );
+  if (it == shard.map.end() || it->second.scheduled != check.first) {
+    /* Session already released or stale entry */
+    return;
+  }
+
+  TimePoint deadline = it->second.lastKeepAlive + std::chrono::milliseconds (
+                         sessionTimeout);
 
-  thread = std::thread ( [&] () {
-    std::unique_lock <std::recursive_mutex> lock (recMutex);
+  if (deadline > std::chrono::steady_clock::now() ) {
+    it->second.scheduled = deadline;
+    lock.unlock();
 
+    scheduleSessionCheck (SessionCheck (deadline, check.second) );
+    return;
+  }
 
-    while (waitCond.wait_for (recMutex,
-                              COLLECTOR_INTERVAL) == std::cv_status::timeout) {
-      if (terminated) {
-        return;
-      }
+  shard.map.erase (it);
+  lock.unlock();
 
-      try {
-        doGarbageCollection();
-      } catch (...) {
-        GST_ERROR ("Error during garbage collection");
-      }
+  GST_WARNING ("Session timeout: %s", check.second.c_str() );
+  workers->post (std::bind (&MediaSet::unrefSession, this, check.second) );
+}
+
+void
+MediaSet::scheduleSessionCheck (const SessionCheck &check)
+{
+  std::unique_lock <std::mutex> lock (collectorMutex);
+
+  if (sessionChecks.empty() || check < sessionChecks.top() ) {
+    collectorCond.notify_all();
+  }
+
+  sessionChecks.push (check);
+}
+
+void
+MediaSet::setSessionTimeout (std::chrono::milliseconds timeout)
+{
+  std::unique_lock <std::mutex> lock (collectorMutex);
+
+  sessionTimeout = timeout.count();
+
+  /* Reschedule every session with the new timeout */
+  sessionChecks = decltype (sessionChecks) ();
+
+  for (auto &shard : sessionInUse.all() ) {
+    std::unique_lock <std::mutex> shardLock (shard.mutex);
+
+    for (auto &it : shard.map) {
+      it.second.scheduled = it.second.lastKeepAlive + timeout;
+      sessionChecks.push (SessionCheck (it.second.scheduled, it.first) );
     }
+  }
+
+  collectorCond.notify_all();
+}
 
-  });
+MediaSet::MediaSet() : objectsMap (MEDIASET_OBJECT_PARTITIONS_DEFAULT),
+  sessionInUse (MEDIASET_SHARDS_DEFAULT),
+  eventHandler (MEDIASET_SHARDS_DEFAULT)
+{
+  terminated = false;
+  sessionTimeout = std::chrono::duration_cast<std::chrono::milliseconds>
+                   (SESSION_TIMEOUT_DEFAULT).count();
+
+  workers = std::shared_ptr<WorkerPool> (new WorkerPool (
+      getEnvThreads ("MEDIASET_THREADS", MEDIASET_THREADS_DEFAULT),
+      getEnvThreads ("MEDIASET_MAX_THREADS", MEDIASET_MAX_THREADS_DEFAULT) ) );
+
+  thread = std::thread (std::bind (&MediaSet::doGarbageCollection, this) );
 }
 
 MediaSet::~MediaSet ()
 {
   std::unique_lock <std::recursive_mutex> lock (recMutex);
+  size_t objects = objectsMap.size();
+  size_t sessions = sessionInUse.size();
 
-  if (!objectsMap.empty() ) {
-    std::cerr << "Warning: Still " + std::to_string (objectsMap.size() ) +
+  if (objects > 0) {
+    std::cerr << "Warning: Still " + std::to_string (objects) +
               " object/s alive" << std::endl;
   }
 
@@ -134,8 +272,8 @@ MediaSet::~MediaSet ()
               " session/s alive" << std::endl;
   }
 
-  if (!sessionInUse.empty() ) {
-    std::cerr << "Warning: Still " + std::to_string (sessionInUse.size() ) +
+  if (sessions > 0) {
+    std::cerr << "Warning: Still " + std::to_string (sessions) +
               " session/s with timeout" << std::endl;
   }
 
@@ -150,11 +288,13 @@ MediaSet::~MediaSet ()
   childrenMap.clear();
   sessionMap.clear();
 
-  terminated = true;
-  waitCond.notify_all();
-
   lock.unlock();
 
+  std::unique_lock <std::mutex> collectorLock (collectorMutex);
+  terminated = true;
+  collectorCond.notify_all();
+  collectorLock.unlock();
+
   if (std::this_thread::get_id() != thread.get_id() ) {
     thread.join();
   }
@@ -195,7 +335,7 @@ MediaSet::ref (MediaObjectImpl *mediaObjectPtr)
     });
   }
 
-  objectsMap[mediaObject->getId()] = std::weak_ptr<MediaObjectImpl> (mediaObject);
+  objectsMap.insert (mediaObject->getId(), mediaObject);
 
   if (mediaObject->getParent() ) {
     std::shared_ptr<MediaObjectImpl> parent = std::dynamic_pointer_cast
@@ -250,18 +390,55 @@ MediaSet::keepAliveSession (const std::string &sessionId)
 void
 MediaSet::keepAliveSession (const std::string &sessionId, bool create)
 {
-  std::unique_lock <std::recursive_mutex> lock (recMutex);
+  auto &shard = sessionInUse.get (sessionId);
+  std::unique_lock <std::mutex> lock (shard.mutex);
+  TimePoint now = std::chrono::steady_clock::now();
 
-  auto it = sessionInUse.find (sessionId);
+  auto it = shard.map.find (sessionId);
 
-  if (it == sessionInUse.end() ) {
+  if (it == shard.map.end() ) {
     if (create) {
-      sessionInUse[sessionId] = true;
+      SessionKeepAlive &keepAlive = shard.map[sessionId];
+
+      keepAlive.lastKeepAlive = now;
+      keepAlive.scheduled = now + std::chrono::milliseconds (sessionTimeout);
+
+      SessionCheck check (keepAlive.scheduled, sessionId);
+
+      lock.unlock();
+      scheduleSessionCheck (check);
     } else {
       throw KurentoException (INVALID_SESSION, "Invalid session");
     }
   } else {
-    it->second = true;
+    it->second.lastKeepAlive = now;
+  }
+}
+
+void
+MediaSet::eraseSession (const std::string &sessionId)
+{
+  SessionEventHandlers handlers;
+
+  sessionMap.erase (sessionId);
+
+  {
+    auto &shard = sessionInUse.get (sessionId);
+    std::unique_lock <std::mutex> lock (shard.mutex);
+
+    shard.map.erase (sessionId);
+  }
+
+  {
+    auto &shard = eventHandler.get (sessionId);
+    std::unique_lock <std::mutex> lock (shard.mutex);
+    auto it = shard.map.find (sessionId);
+
+    if (it != shard.map.end() ) {
+      /* Handlers are destroyed after releasing the partition lock */
+      handlers = std::move (it->second);
+      shard.map.erase (it);
+    }
   }
 }
 
@@ -269,6 +446,7 @@ void
 MediaSet::releaseSession (const std::string &sessionId)
 {
   std::unique_lock <std::recursive_mutex> lock (recMutex);
+  ReleaseBatch batch;
 
   auto it = sessionMap.find (sessionId);
 
@@ -276,21 +454,21 @@ MediaSet::releaseSession (const std::string &sessionId)
     auto objects = it->second;
 
     for (auto it2 : objects) {
-      release (it2.second);
+      release (it2.second, batch);
     }
   }
 
-  sessionMap.erase (sessionId);
-  sessionInUse.erase (sessionId);
-  eventHandler.erase (sessionId);
+  eraseSession (sessionId);
   lock.unlock ();
 
+  postRelease (batch);
 }
 
 void
 MediaSet::unrefSession (const std::string &sessionId)
 {
   std::unique_lock <std::recursive_mutex> lock (recMutex);
+  ReleaseBatch batch;
 
   auto it = sessionMap.find (sessionId);
 
@@ -298,26 +476,109 @@ MediaSet::unrefSession (const std::string &sessionId)
     auto objects = it->second;
 
     for (auto it2 : objects) {
-      unref (sessionId, it2.second);
+      unref (sessionId, it2.second, batch);
     }
   }
 
-  sessionMap.erase (sessionId);
-  sessionInUse.erase (sessionId);
-  eventHandler.erase (sessionId);
+  eraseSession (sessionId);
 
   lock.unlock();
+
+  postRelease (batch);
 }
 
 static void
-call_release (std::shared_ptr<MediaObjectImpl> mediaObject)
+call_release (std::vector<std::shared_ptr<MediaObjectImpl>> mediaObjects)
+{
+  for (auto mediaObject : mediaObjects) {
+    mediaObject->release();
+  }
+}
+
+static std::string
+get_pipeline_id (std::shared_ptr<MediaObjectImpl> mediaObject)
+{
+  std::shared_ptr<MediaObjectImpl> pipeline;
+
+  pipeline = std::dynamic_pointer_cast<MediaObjectImpl>
+             (mediaObject->getMediaPipeline() );
+
+  if (!pipeline) {
+    return "";
+  }
+
+  return pipeline->getId();
+}
+
+void
+MediaSet::addToBatch (ReleaseBatch &batch,
+                      std::shared_ptr<MediaObjectImpl> mediaObject)
 {
-  mediaObject->release();
+  auto &objects = batch[get_pipeline_id (mediaObject)];
+
+  /* Pipeline goes first: stopping it stops all its elements at once */
+  if (std::dynamic_pointer_cast<MediaPipelineImpl> (mediaObject) ) {
+    objects.insert (objects.begin(), mediaObject);
+  } else {
+    objects.push_back (mediaObject);
+  }
+}
+
+void
+MediaSet::runReleases (const std::string &pipelineId)
+{
+  std::unique_lock <std::mutex> lock (releaseMutex);
+  auto &pending = pendingReleases[pipelineId];
+
+  while (!pending.empty() ) {
+    std::vector<std::shared_ptr<MediaObjectImpl>> objects = pending.front();
+
+    lock.unlock();
+    call_release (objects);
+    lock.lock();
+
+    pending.pop_front();
+  }
+
+  pendingReleases.erase (pipelineId);
+}
+
+void
+MediaSet::postRelease (ReleaseBatch &batch)
+{
+  for (auto it : batch) {
+    std::unique_lock <std::mutex> lock (releaseMutex);
+    auto &pending = pendingReleases[it.first];
+    bool running = !pending.empty();
+
+    GST_DEBUG ("Releasing %" G_GSIZE_FORMAT " object/s of pipeline %s",
+               it.second.size(), it.first.c_str() );
+    pending.push_back (it.second);
+    lock.unlock();
+
+    /* Otherwise the running task picks it up when done */
+    if (!running) {
+      workers->post (std::bind (&MediaSet::runReleases, this, it.first) );
+    }
+  }
+
+  batch.clear();
 }
 
 void
 MediaSet::unref (const std::string &sessionId,
                  std::shared_ptr< MediaObjectImpl > mediaObject)
+{
+  ReleaseBatch batch;
+
+  unref (sessionId, mediaObject, batch);
+  postRelease (batch);
+}
+
+void
+MediaSet::unref (const std::string &sessionId,
+                 std::shared_ptr< MediaObjectImpl > mediaObject,
+                 ReleaseBatch &batch)
 {
   std::unique_lock <std::recursive_mutex> lock (recMutex);
   bool released = false;
@@ -359,7 +620,7 @@ MediaSet::unref (const std::string &sessionId,
         auto childMap = childrenIt->second;
 
         for (auto child : childMap) {
-          unref (sessionId, child.second);
+          unref (sessionId, child.second, batch);
         }
       }
 
@@ -367,15 +628,11 @@ MediaSet::unref (const std::string &sessionId,
     }
   }
 
-  auto eventIt = eventHandler.find (sessionId);
-
-  if (eventIt != eventHandler.end() ) {
-    eventIt->second.erase (mediaObject->getId() );
-  }
+  removeEventHandlers (sessionId, mediaObject->getId() );
 
   if (released) {
     objectsMap.erase (mediaObject->getId() );
-    workers->post ( std::bind (call_release, mediaObject) );
+    addToBatch (batch, mediaObject);
   }
 
   lock.unlock();
@@ -406,16 +663,13 @@ async_delete (MediaObjectImpl *mediaObject, std::string id)
 
 void MediaSet::releasePointer (MediaObjectImpl *mediaObject)
 {
-  std::unique_lock <std::recursive_mutex> lock (recMutex);
   std::string id = mediaObject->getId();
 
-  objectsMap.erase (id );
-
-  lock.unlock();
+  objectsMap.erase (id);
 
   workers->post ( std::bind ( async_delete, mediaObject, id ) );
 
-  lock.lock ();
+  std::unique_lock <std::recursive_mutex> lock (recMutex);
 
   if (this->serverManager) {
     lock.unlock ();
@@ -426,6 +680,15 @@ void MediaSet::releasePointer (MediaObjectImpl *mediaObject)
 }
 
 void MediaSet::release (std::shared_ptr< MediaObjectImpl > mediaObject)
+{
+  ReleaseBatch batch;
+
+  release (mediaObject, batch);
+  postRelease (batch);
+}
+
+void MediaSet::release (std::shared_ptr< MediaObjectImpl > mediaObject,
+                        ReleaseBatch &batch)
 {
   std::unique_lock <std::recursive_mutex> lock (recMutex);
 
@@ -439,7 +702,7 @@ void MediaSet::release (std::shared_ptr< MediaObjectImpl > mediaObject)
   auto sessions = it->second;
 
   for (auto it2 : sessions) {
-    unref (it2, mediaObject);
+    unref (it2, mediaObject, batch);
   }
 
   objectsMap.erase (mediaObject->getId() );
@@ -471,22 +734,8 @@ MediaSet::getMediaObject (const std::string &mediaObjectRef)
                             "object without committing the transaction.");
   }
 
-  std::shared_ptr <MediaObjectImpl> objectLocked;
-  std::unique_lock <std::recursive_mutex> lock (recMutex);
-
-  auto it = objectsMap.find (mediaObjectRef);
-
-  if (it == objectsMap.end() ) {
-    throw KurentoException (MEDIA_OBJECT_NOT_FOUND,
-                            "Object '" + mediaObjectRef + "' not found");
-  }
-
-  try {
-    objectLocked = it->second.lock();
-  } catch (...) {
-    throw KurentoException (MEDIA_OBJECT_NOT_FOUND,
-                            "Object '" + mediaObjectRef + "' not found");
-  }
+  std::shared_ptr <MediaObjectImpl> objectLocked =
+    objectsMap.find (mediaObjectRef);
 
   if (!objectLocked) {
     throw KurentoException (MEDIA_OBJECT_NOT_FOUND,
@@ -512,9 +761,14 @@ MediaSet::addEventHandler (const std::string &sessionId,
                            const std::string &subscriptionId,
                            std::shared_ptr<EventHandler> handler)
 {
-  std::unique_lock <std::recursive_mutex> lock (recMutex);
+  std::shared_ptr<EventHandler> old;
+  auto &shard = eventHandler.get (sessionId);
+  std::unique_lock <std::mutex> lock (shard.mutex);
+  auto &handlerRef = shard.map[sessionId][objectId][subscriptionId];
 
-  eventHandler[sessionId][objectId][subscriptionId] = handler;
+  old = handlerRef;
+  handlerRef = handler;
+  lock.unlock();
 }
 
 void
@@ -522,16 +776,46 @@ MediaSet::removeEventHandler (const std::string &sessionId,
                               const std::string &objectId,
                               const std::string &handlerId)
 {
-  std::unique_lock <std::recursive_mutex> lock (recMutex);
-  auto it = eventHandler.find (sessionId);
+  std::shared_ptr<EventHandler> old;
+  auto &shard = eventHandler.get (sessionId);
+  std::unique_lock <std::mutex> lock (shard.mutex);
+  auto it = shard.map.find (sessionId);
 
-  if (it != eventHandler.end() ) {
-    auto it2 = eventHandler[sessionId].find (objectId);
+  if (it != shard.map.end() ) {
+    auto it2 = it->second.find (objectId);
 
-    if (it2 != eventHandler[sessionId].end() ) {
-      it2->second.erase (handlerId);
+    if (it2 != it->second.end() ) {
+      auto it3 = it2->second.find (handlerId);
+
+      if (it3 != it2->second.end() ) {
+        old = it3->second;
+        it2->second.erase (it3);
+      }
     }
   }
+
+  lock.unlock();
+}
+
+void
+MediaSet::removeEventHandlers (const std::string &sessionId,
+                               const std::string &objectId)
+{
+  std::unordered_map<std::string, std::shared_ptr<EventHandler>> handlers;
+  auto &shard = eventHandler.get (sessionId);
+  std::unique_lock <std::mutex> lock (shard.mutex);
+  auto it = shard.map.find (sessionId);
+
+  if (it != shard.map.end() ) {
+    auto it2 = it->second.find (objectId);
+
+    if (it2 != it->second.end() ) {
+      handlers = std::move (it2->second);
+      it->second.erase (it2);
+    }
+  }
+
+  lock.unlock();
 }
 
 void
@@ -548,12 +832,13 @@ MediaSet::checkEmpty()
 bool
 MediaSet::empty()
 {
-  return objectsMap.empty();
+  return objectsMap.size() == 0;
 }
 
 std::vector<std::string>
 MediaSet::getSessions ()
 {
+  std::unique_lock <std::recursive_mutex> lock (recMutex);
   std::vector<std::string> ret (sessionMap.size () );
 
   for (auto it : sessionMap) {
@@ -565,7 +850,7 @@ MediaSet::getSessions ()
 
 static void
 store_pipelines (std::list<std::shared_ptr<MediaObjectImpl>> &list,
-                 std::map<std::string, std::shared_ptr<MediaObjectImpl>> &map)
+                 std::unordered_map<std::string, std::shared_ptr<MediaObjectImpl>> &map)
 {
   for (auto it : map) {
     if (std::dynamic_pointer_cast <MediaPipelineImpl> (it.second) ) {
@@ -577,6 +862,7 @@ store_pipelines (std::list<std::shared_ptr<MediaObjectImpl>> &list,
 std::list<std::shared_ptr<MediaObjectImpl>>
     MediaSet::getPipelines (const std::string &sessionId)
 {
+  std::unique_lock <std::recursive_mutex> lock (recMutex);
   std::list<std::shared_ptr<MediaObjectImpl>> ret;
 
   try {
@@ -597,6 +883,7 @@ std::list<std::shared_ptr<MediaObjectImpl>>
 std::list<std::shared_ptr<MediaObjectImpl>>
     MediaSet::getChilds (std::shared_ptr<MediaObjectImpl> obj)
 {
+  std::unique_lock <std::recursive_mutex> lock (recMutex);
   std::list<std::shared_ptr<MediaObjectImpl>> ret;
 
   try {
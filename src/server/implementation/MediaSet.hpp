@@ -19,12 +19,17 @@
 #include <MediaObjectImpl.hpp>
 
 #include <unordered_set>
+#include <unordered_map>
 #include <map>
+#include <vector>
 #include <memory>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
 #include <atomic>
+#include <chrono>
+#include <queue>
+#include <deque>
 
 #include "WorkerPool.hpp"
 
@@ -33,8 +38,85 @@ namespace kurento
 
 typedef struct _KeepAliveData KeepAliveData;
 
+/*
+ * Hash partitioned map. Each partition has its own lock so operations on keys
+ * that fall in different partitions do not contend. Partition locks are leaf
+ * locks: no other lock must be acquired while one of them is held.
+ */
+template <typename Value>
+class MediaSetShards
+{
+public:
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<std::string, Value> map;
+  };
+
+  MediaSetShards (size_t n) : shards (n > 0 ? n : 1) {}
+
+  Shard &get (const std::string &key)
+  {
+    return shards[hasher (key) % shards.size()];
+  }
+
+  std::vector<Shard> &all ()
+  {
+    return shards;
+  }
+
+  size_t size ()
+  {
+    size_t count = 0;
+
+    for (Shard &shard : shards) {
+      std::unique_lock <std::mutex> lock (shard.mutex);
+
+      count += shard.map.size();
+    }
+
+    return count;
+  }
+
+private:
+  std::vector<Shard> shards;
+  std::hash<std::string> hasher;
+};
+
 class ServerManagerImpl;
 
+/*
+ * Copy-on-write table of live objects. Lookups read an immutable snapshot of
+ * the partition and never block; writers serialize on the partition mutex and
+ * publish a new version of it.
+ */
+class MediaObjectTable
+{
+public:
+  typedef std::unordered_map<std::string, std::weak_ptr<MediaObjectImpl>> Map;
+
+  MediaObjectTable (size_t n);
+
+  std::shared_ptr<MediaObjectImpl> find (const std::string &id);
+  void insert (const std::string &id,
+               std::shared_ptr<MediaObjectImpl> mediaObject);
+  void erase (const std::string &id);
+  size_t size ();
+
+private:
+  struct Partition {
+    std::mutex mutex;
+    std::shared_ptr<const Map> map;
+  };
+
+  Partition &get (const std::string &id)
+  {
+    return partitions[hasher (id) % partitions.size()];
+  }
+
+  std::vector<Partition> partitions;
+  std::hash<std::string> hasher;
+};
+
 class MediaSet
 {
 public:
@@ -61,6 +143,9 @@ public:
   void unrefSession (const std::string &sessionId);
   void keepAliveSession (const std::string &sessionId);
 
+  /* Sessions without keep-alive during this period are released */
+  void setSessionTimeout (std::chrono::milliseconds timeout);
+
   void release (std::shared_ptr<MediaObjectImpl> mediaObject);
   void release (const std::string &mediaObjectRef);
 
@@ -85,9 +170,37 @@ public:
 
 private:
 
+  typedef std::chrono::steady_clock::time_point TimePoint;
+  typedef std::pair<TimePoint, std::string> SessionCheck;
+
+  struct SessionKeepAlive {
+    TimePoint lastKeepAlive;
+    /* Time of the only valid entry of this session in sessionChecks */
+    TimePoint scheduled;
+  };
+
+  /* Objects released together, grouped by the id of their pipeline */
+  typedef std::unordered_map<std::string, std::vector<std::shared_ptr<MediaObjectImpl>>>
+  ReleaseBatch;
+
+  void unref (const std::string &sessionId,
+              std::shared_ptr<MediaObjectImpl> mediaObject, ReleaseBatch &batch);
+  void release (std::shared_ptr<MediaObjectImpl> mediaObject,
+                ReleaseBatch &batch);
+  void addToBatch (ReleaseBatch &batch,
+                   std::shared_ptr<MediaObjectImpl> mediaObject);
+  void postRelease (ReleaseBatch &batch);
+  void runReleases (const std::string &pipelineId);
+
   void keepAliveSession (const std::string &sessionId, bool create);
+  void scheduleSessionCheck (const SessionCheck &check);
+  void checkSession (const SessionCheck &check);
   void doGarbageCollection ();
 
+  void eraseSession (const std::string &sessionId);
+  void removeEventHandlers (const std::string &sessionId,
+                            const std::string &objectId);
+
   std::thread thread;
 
   void releasePointer (MediaObjectImpl *obj);
@@ -96,28 +209,49 @@ private:
 
   MediaSet ();
 
+  /* Protects the object hierarchy: sessionMap, childrenMap and
+   * reverseSessionMap. Partition locks may be taken while holding it,
+   * never the other way around. */
   std::recursive_mutex recMutex;
-  std::condition_variable_any waitCond;
   std::atomic<bool> terminated;
 
+  /* Expiry min-heap, entries are validated lazily when they are popped.
+   * Partition locks may be taken while holding collectorMutex. */
+  std::mutex collectorMutex;
+  std::condition_variable collectorCond;
+  std::priority_queue<SessionCheck, std::vector<SessionCheck>, std::greater<SessionCheck>>
+  sessionChecks;
+  /* ms */
+  std::atomic<int> sessionTimeout;
+
   std::shared_ptr <ServerManagerImpl> serverManager;
 
-  std::map<std::string, std::weak_ptr <MediaObjectImpl>> objectsMap;
+  MediaObjectTable objectsMap;
 
-  std::map<std::string, std::map <std::string, std::shared_ptr <MediaObjectImpl>>>
+  std::unordered_map<std::string, std::unordered_map <std::string, std::shared_ptr <MediaObjectImpl>>>
   childrenMap;
 
-  std::map<std::string, std::map <std::string, std::shared_ptr<MediaObjectImpl>>>
+  std::unordered_map<std::string, std::unordered_map <std::string, std::shared_ptr<MediaObjectImpl>>>
   sessionMap;
 
-  std::map<std::string, bool> sessionInUse;
-  std::map<std::string, std::map<std::string, std::map<std::string, std::shared_ptr<EventHandler>>>>
-  eventHandler;
+  MediaSetShards<SessionKeepAlive> sessionInUse;
 
-  std::map<std::string, std::unordered_set<std::string>> reverseSessionMap;
+  typedef std::unordered_map<std::string, std::unordered_map<std::string, std::shared_ptr<EventHandler>>>
+  SessionEventHandlers;
+  MediaSetShards<SessionEventHandlers> eventHandler;
+
+  std::unordered_map<std::string, std::unordered_set<std::string>>
+  reverseSessionMap;
 
   std::shared_ptr<WorkerPool> workers;
 
+  /* Batches of a pipeline waiting for an earlier one to finish. A pipeline
+   * has an entry while one of its batches is running, so releases of the
+   * same pipeline never run in parallel. */
+  std::mutex releaseMutex;
+  std::unordered_map<std::string, std::deque<std::vector<std::shared_ptr<MediaObjectImpl>>>>
+  pendingReleases;
+
   class StaticConstructor
   {
   public:
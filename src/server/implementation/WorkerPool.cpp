@@ -21,108 +21,426 @@
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define GST_DEFAULT_NAME "KurentoWorkerPool"
 
-const int WORKER_THREADS_TIMEOUT = 3; /* seconds */
+const int WORKER_THREADS_MAX_DEFAULT = 32;
 
 namespace kurento
 {
 
-static void
-workerThreadLoop ( boost::shared_ptr< boost::asio::io_service > io_service )
+static thread_local WorkerPool *currentPool = NULL;
+static thread_local size_t currentWorker = 0;
+
+WorkerPool::WorkerPool (int threads) : WorkerPool (threads,
+      std::max (threads, WORKER_THREADS_MAX_DEFAULT) )
 {
-  bool running = true;
+}
 
-  while (running) {
-    try {
-      GST_DEBUG ("Working thread starting");
-      io_service->run();
-      running = false;
-    } catch (std::exception &e) {
-      GST_ERROR ("Unexpected error while running the server: %s", e.what() );
-    } catch (...) {
-      GST_ERROR ("Unexpected error while running the server");
+WorkerPool::WorkerPool (int minThreads, int maxThreads,
+                        std::chrono::milliseconds idleTimeout,
+                        std::chrono::milliseconds watchInterval,
+                        std::chrono::milliseconds shutdownTimeout) :
+  workers (std::max (std::max (minThreads, maxThreads), 1) ),
+  minThreads (std::max (minThreads, 1) ), idleTimeout (idleTimeout),
+  watchInterval (watchInterval), shutdownTimeout (shutdownTimeout)
+{
+  nWorkers = 0;
+  nextWorker = 0;
+  pending = 0;
+  sleeping = 0;
+  running = true;
+  abandoning = false;
+  alive = 0;
+  spawned = 0;
+  retired = 0;
+  saturations = 0;
+  executed = 0;
+  stolen = 0;
+  totalLatency = 0;
+  maxLatency = 0;
+
+  for (size_t i = 0; i < this->minThreads; i++) {
+    spawnWorker ();
+  }
+
+  watcher = std::thread (std::bind (&WorkerPool::watcherLoop, this) );
+}
+
+WorkerPool::~WorkerPool()
+{
+  std::unique_lock <std::mutex> lock (mutex);
+  /* The pool may be destroyed from one of its own tasks */
+  size_t self = currentPool == this ? 1 : 0;
+
+  running = false;
+  cond.notify_all();
+  watcherCond.notify_all();
+  lock.unlock();
+
+  watcher.join();
+
+  /* Threads keep running pending tasks until the queues are empty */
+  lock.lock();
+
+  if (!exitCond.wait_for (lock, shutdownTimeout, [this, self] () {
+  return alive == self;
+}) ) {
+    size_t dropped = 0;
+
+    abandoning = true;
+    lock.unlock();
+
+    for (auto &worker : workers) {
+      if (!worker) {
+        continue;
+      }
+
+      std::unique_lock <std::mutex> workerLock (worker->mutex);
+      dropped += worker->tasks.size();
+      pending -= worker->tasks.size();
+      worker->tasks.clear();
     }
+
+    GST_WARNING ("Worker pool not finished after %" G_GINT64_FORMAT
+                 " ms, dropping %" G_GSIZE_FORMAT " pending tasks",
+                 (gint64) shutdownTimeout.count(), dropped);
+  } else {
+    lock.unlock();
   }
 
-  GST_DEBUG ("Working thread finished");
+  /* Retired threads may still be joinable in unused slots */
+  for (auto &worker : workers) {
+    bool stuck;
+
+    if (!worker || !worker->thread.joinable() ) {
+      continue;
+    }
+
+    std::unique_lock <std::mutex> workerLock (worker->mutex);
+
+    if (worker->thread.get_id() == std::this_thread::get_id() ) {
+      worker->abandoned = true;
+      workerLock.unlock();
+      worker->thread.detach();
+      continue;
+    }
+
+    stuck = worker->inTask;
+    worker->abandoned = stuck;
+    workerLock.unlock();
+
+    if (stuck) {
+      GST_ERROR ("Worker thread stuck in a task, detaching it");
+      worker->thread.detach();
+    } else {
+      worker->thread.join();
+    }
+  }
 }
 
-WorkerPool::WorkerPool (int threads)
+bool
+WorkerPool::spawnWorker ()
 {
-  /* Prepare watcher */
-  watcher_service = boost::shared_ptr< boost::asio::io_service >
-                    ( new boost::asio::io_service () );
-  watcher_work = std::shared_ptr< boost::asio::io_service::work >
-                 ( new boost::asio::io_service::work (*watcher_service) );
-  watcher = std::thread (std::bind (&workerThreadLoop, watcher_service) );
-
-  /* Prepare pool of threads */
-  io_service = boost::shared_ptr< boost::asio::io_service >
-               ( new boost::asio::io_service () );
-  work = std::shared_ptr< boost::asio::io_service::work >
-         ( new boost::asio::io_service::work (*io_service) );
-
-  for (int i = 0; i < threads; i++) {
-    workers.push_back (std::thread (std::bind (&workerThreadLoop, io_service) ) );
+  std::unique_lock <std::mutex> lock (mutex);
+  size_t index = nWorkers;
+
+  if (index >= workers.size() ) {
+    saturations++;
+    statsCond.notify_all();
+    GST_WARNING ("Worker pool saturated: %" G_GSIZE_FORMAT
+                 " threads busy, not spawning more", workers.size() );
+    return false;
+  }
+
+  if (workers[index]) {
+    /* Slot of a retired thread, it has already left its loop and does not
+     * take mutex any more. Worker is reused because enqueue may still be
+     * holding a reference to it */
+    Worker &worker = *workers[index];
+
+    worker.thread.join();
+
+    std::unique_lock <std::mutex> workerLock (worker.mutex);
+    worker.retired = false;
+    worker.busy = false;
+    worker.lastHeartbeat = worker.heartbeat;
+  } else {
+    workers[index].reset (new Worker () );
   }
+
+  /* Counted before the thread can run anything, threads below minThreads
+   * are the initial ones */
+  if (index >= minThreads) {
+    spawned++;
+  }
+
+  workers[index]->thread = std::thread (std::bind (&WorkerPool::workerLoop, this,
+                                        workers[index], index) );
+  nWorkers = index + 1;
+  alive++;
+  statsCond.notify_all();
+
+  return true;
 }
 
-WorkerPool::~WorkerPool()
+void
+WorkerPool::enqueue (std::function<void ()> func)
 {
-  watcher_service->stop();
-  io_service->stop();
+  size_t index;
 
-  watcher.join();
+  if (currentPool == this) {
+    /* Tasks posted from a worker go to its own queue */
+    index = currentWorker;
+  } else {
+    index = nextWorker++ % nWorkers;
+  }
+
+  std::unique_lock <std::mutex> lock (workers[index]->mutex);
+
+  if (workers[index]->retired) {
+    /* First worker never retires */
+    lock.unlock();
+    index = 0;
+    lock = std::unique_lock <std::mutex> (workers[index]->mutex);
+  }
+
+  pending++;
+  workers[index]->tasks.push_back (Task {func, std::chrono::steady_clock::now() });
+  lock.unlock();
 
-  for (uint i = 0; i < workers.size (); i++) {
-    workers[i].join();
+  if (sleeping > 0) {
+    std::unique_lock <std::mutex> sleepLock (mutex);
+
+    cond.notify_one();
   }
 }
 
-static void
-async_worker_test (std::shared_ptr<std::atomic<bool>> alive)
+bool
+WorkerPool::dequeue (size_t index, Task &task)
 {
-  *alive = true;
+  size_t n = nWorkers;
+
+  for (size_t i = 0; i < n; i++) {
+    Worker &worker = *workers[ (index + i) % n];
+    std::unique_lock <std::mutex> lock (worker.mutex);
+
+    if (worker.tasks.empty() ) {
+      continue;
+    }
+
+    task = std::move (worker.tasks.front() );
+    worker.tasks.pop_front();
+    pending--;
+
+    if (i != 0) {
+      stolen++;
+    }
+
+    return true;
+  }
+
+  return false;
 }
 
 void
-WorkerPool::checkWorkers ()
+WorkerPool::workerExited ()
+{
+  std::unique_lock <std::mutex> lock (mutex);
+
+  alive--;
+  exitCond.notify_all();
+}
+
+void
+WorkerPool::workerLoop (std::shared_ptr<Worker> worker, size_t index)
 {
-  std::shared_ptr<std::atomic<bool>> alive;
+  bool retired = false;
 
-  alive = std::shared_ptr<std::atomic<bool>> ( new std::atomic<bool> (false) );
+  currentPool = this;
+  currentWorker = index;
 
-  io_service->post (std::bind (&async_worker_test, alive) );
+  GST_DEBUG ("Working thread starting");
 
-  boost::shared_ptr< boost::asio::deadline_timer > timer (
-    new boost::asio::deadline_timer ( *watcher_service ) );
+  while ( (running || pending > 0) && !abandoning) {
+    Task task;
 
-  timer->expires_from_now ( boost::posix_time::seconds (
-                              WORKER_THREADS_TIMEOUT) );
-  timer->async_wait ( [timer, alive,
-  this] (const boost::system::error_code & error) {
-    if (error) {
-      GST_ERROR ("ERROR: %s", error.message().c_str() );
-      return;
+    if (!dequeue (index, task) ) {
+      std::unique_lock <std::mutex> lock (mutex);
+      bool woken;
+
+      sleeping++;
+      woken = cond.wait_for (lock, idleTimeout,
+      [this] () {
+        return pending > 0 || !running;
+      });
+      sleeping--;
+
+      if (!woken && retireWorker (index) ) {
+        retired = true;
+        break;
+      }
+
+      continue;
+    }
+
+    uint64_t latency = std::chrono::duration_cast<std::chrono::microseconds>
+                       (std::chrono::steady_clock::now() - task.posted).count();
+    uint64_t max = maxLatency;
+
+    totalLatency += latency;
+
+    while (latency > max && !maxLatency.compare_exchange_weak (max, latency) ) {
+    }
+
+    std::unique_lock <std::mutex> workerLock (worker->mutex);
+
+    if (abandoning) {
+      /* Shutdown timed out while this task was being dequeued */
+      break;
+    }
+
+    worker->inTask = true;
+    workerLock.unlock();
+
+    worker->busy = true;
+
+    try {
+      task.func ();
+    } catch (std::exception &e) {
+      GST_ERROR ("Unexpected error while running the server: %s", e.what() );
+    } catch (...) {
+      GST_ERROR ("Unexpected error while running the server");
     }
 
-    if (*alive) {
+    workerLock.lock();
+
+    if (worker->abandoned) {
+      /* Detached by the destructor, the pool may not exist any more */
       return;
     }
 
-    GST_WARNING ("Worker threads locked. Spawning a new one.");
+    worker->inTask = false;
+    workerLock.unlock();
 
-    mutex.lock();
+    worker->busy = false;
+    worker->heartbeat++;
+    executed++;
+  }
 
-    workers.push_back (std::thread (std::bind (&workerThreadLoop, io_service) ) );
+  GST_DEBUG ("Working thread finished");
 
-    mutex.unlock();
-  });
+  /* Retired threads are already accounted for, taking mutex here would
+   * deadlock with spawnWorker joining this thread to reuse its slot */
+  if (!retired) {
+    workerExited ();
+  }
+}
+
+/* Called with mutex held */
+bool
+WorkerPool::retireWorker (size_t index)
+{
+  std::deque<Task> tasks;
+
+  if (index + 1 != nWorkers || index < minThreads || pending > 0) {
+    return false;
+  }
+
+  nWorkers = index;
+
+  std::unique_lock <std::mutex> lock (workers[index]->mutex);
+  workers[index]->retired = true;
+  tasks.swap (workers[index]->tasks);
+  lock.unlock();
+
+  if (!tasks.empty() ) {
+    /* Posted while retiring, hand them to the first worker */
+    std::unique_lock <std::mutex> firstLock (workers[0]->mutex);
+
+    for (auto &task : tasks) {
+      workers[0]->tasks.push_back (std::move (task) );
+    }
+  }
+
+  retired++;
+  alive--;
+  exitCond.notify_all();
+  statsCond.notify_all();
+  GST_DEBUG ("Retiring idle thread, %" G_GSIZE_FORMAT " threads left",
+             index);
+
+  return true;
+}
+
+void
+WorkerPool::checkWorkers ()
+{
+  size_t n = nWorkers;
+  bool locked = true;
+
+  for (size_t i = 0; i < n; i++) {
+    Worker &worker = *workers[i];
+    uint64_t heartbeat = worker.heartbeat;
+
+    if (!worker.busy || heartbeat != worker.lastHeartbeat) {
+      locked = false;
+    }
+
+    worker.lastHeartbeat = heartbeat;
+  }
+
+  if (locked && pending > 0) {
+    GST_WARNING ("Worker threads locked. Spawning a new one.");
+
+    spawnWorker ();
+  }
 }
 
 void
-WorkerPool::setWatcher ()
+WorkerPool::watcherLoop ()
 {
-  watcher_service->post (std::bind (&WorkerPool::checkWorkers, this) );
+  std::unique_lock <std::mutex> lock (mutex);
+
+  while (running) {
+    watcherCond.wait_for (lock, watchInterval);
+
+    if (!running) {
+      break;
+    }
+
+    lock.unlock();
+    checkWorkers ();
+    lock.lock();
+  }
+}
+
+WorkerPool::Stats
+WorkerPool::getStats ()
+{
+  Stats stats;
+  uint64_t tasks = executed;
+
+  stats.threads = nWorkers;
+  stats.spawnedThreads = spawned;
+  stats.retiredThreads = retired;
+  stats.saturationEvents = saturations;
+  stats.queueDepth = pending;
+  stats.executedTasks = tasks;
+  stats.stolenTasks = stolen;
+  stats.averageLatency = std::chrono::microseconds (tasks > 0 ?
+                         totalLatency / tasks : 0);
+  stats.maxLatency = std::chrono::microseconds (maxLatency);
+
+  return stats;
+}
+
+bool
+WorkerPool::waitForStats (std::function<bool (const Stats &) > pred,
+                          std::chrono::milliseconds timeout)
+{
+  std::unique_lock <std::mutex> lock (mutex);
+
+  return statsCond.wait_for (lock, timeout, [this, &pred] () {
+    return pred (getStats () );
+  });
 }
 
 WorkerPool::StaticConstructor WorkerPool::staticConstructor;
@@ -18,38 +18,127 @@
 
 #include <mutex>
 #include <thread>
-#include <boost/asio.hpp>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
 
 namespace kurento
 {
 
+/*
+ * Pool of threads with one task queue per thread. Idle threads steal work
+ * from the other queues. A watcher samples a per-thread heartbeat and spawns
+ * a new thread when every thread is stuck while tasks are waiting, up to
+ * maxThreads. Threads above minThreads retire after being idle for a while.
+ *
+ * On destruction pending tasks are still run. Whatever is left after
+ * shutdownTimeout is dropped and threads stuck in a task are detached.
+ */
 class WorkerPool
 {
 public:
+  struct Stats {
+    size_t threads;
+    size_t spawnedThreads;
+    size_t retiredThreads;
+    size_t saturationEvents;
+    size_t queueDepth;
+    uint64_t executedTasks;
+    uint64_t stolenTasks;
+    std::chrono::microseconds averageLatency;
+    std::chrono::microseconds maxLatency;
+  };
+
   WorkerPool (int threads);
+  WorkerPool (int minThreads, int maxThreads,
+              std::chrono::milliseconds idleTimeout = std::chrono::seconds (60),
+              std::chrono::milliseconds watchInterval = std::chrono::seconds (3),
+              std::chrono::milliseconds shutdownTimeout = std::chrono::seconds (5) );
   ~WorkerPool();
 
   template <typename CompletionHandler>
-  BOOST_ASIO_INITFN_RESULT_TYPE (CompletionHandler, void () )
-  post (BOOST_ASIO_MOVE_ARG (CompletionHandler) handler)
+  void post (CompletionHandler handler)
   {
-    setWatcher();
-    return io_service->post (handler);
+    enqueue (std::function<void ()> (handler) );
   }
 
+  Stats getStats ();
+
+  /* Waits until pred holds. Checked when threads are spawned or retired and
+   * on saturation */
+  bool waitForStats (std::function<bool (const Stats &) > pred,
+                     std::chrono::milliseconds timeout);
+
 private:
-  void setWatcher();
-  void checkWorkers();
+  typedef std::chrono::steady_clock::time_point TimePoint;
 
-  boost::shared_ptr< boost::asio::io_service > io_service;
-  std::shared_ptr< boost::asio::io_service::work > work;
-  std::vector<std::thread> workers;
+  struct Task {
+    std::function<void ()> func;
+    TimePoint posted;
+  };
 
-  boost::shared_ptr< boost::asio::io_service > watcher_service;
-  std::shared_ptr< boost::asio::io_service::work > watcher_work;
-  std::thread watcher;
+  struct Worker {
+    Worker () : retired (false), inTask (false), abandoned (false),
+      heartbeat (0), busy (false), lastHeartbeat (0) {}
+
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    /* Protected by mutex, tasks are redirected once set */
+    bool retired;
+    /* Protected by mutex. A thread abandoned while in a task must not touch
+     * the pool again, it may be gone already */
+    bool inTask;
+    bool abandoned;
+    std::atomic<uint64_t> heartbeat;
+    std::atomic<bool> busy;
+    /* Only accessed by the watcher thread */
+    uint64_t lastHeartbeat;
+    std::thread thread;
+  };
+
+  void enqueue (std::function<void ()> func);
+  bool dequeue (size_t index, Task &task);
+  void workerLoop (std::shared_ptr<Worker> worker, size_t index);
+  void workerExited ();
+  void watcherLoop ();
+  void checkWorkers ();
+  bool spawnWorker ();
+  bool retireWorker (size_t index);
+
+  /* Fixed capacity of maxThreads, only the first nWorkers slots are in use.
+   * Only the last worker can retire so the used slots stay contiguous. */
+  std::vector<std::shared_ptr<Worker>> workers;
+  size_t minThreads;
+  std::chrono::milliseconds idleTimeout;
+  std::chrono::milliseconds watchInterval;
+  std::chrono::milliseconds shutdownTimeout;
+  std::atomic<size_t> nWorkers;
+  std::atomic<size_t> nextWorker;
+  std::atomic<size_t> pending;
+  std::atomic<size_t> sleeping;
+  std::atomic<bool> running;
+  std::atomic<bool> abandoning;
 
   std::mutex mutex;
+  std::condition_variable cond;
+  std::condition_variable watcherCond;
+  /* Protected by mutex */
+  size_t alive;
+  std::condition_variable exitCond;
+  std::condition_variable statsCond;
+  std::thread watcher;
+
+  std::atomic<size_t> spawned;
+  std::atomic<size_t> retired;
+  std::atomic<size_t> saturations;
+  std::atomic<uint64_t> executed;
+  std::atomic<uint64_t> stolen;
+  std::atomic<uint64_t> totalLatency;
+  std::atomic<uint64_t> maxLatency;
 
   class StaticConstructor
   {
@@ -2,8 +2,12 @@
 
 #include <gst/gst.h>
 #include "BaseRtpEndpointImpl.hpp"
+#include <RtpStats.hpp>
+#include <MediaType.hpp>
 #include <jsonrpc/JsonSerializer.hpp>
 #include <KurentoException.hpp>
+#include "kmsjitterbufferprofile.h"
+#include "kmscongestioncontrol.h"
 
 #define GST_CAT_DEFAULT kurento_base_rtp_endpoint_impl
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
@@ -51,6 +55,200 @@ void BaseRtpEndpointImpl::setMaxVideoSendBandwidth (int maxVideoSendBandwidth)
   g_object_set (element, "max-video-send-bandwidth", maxVideoSendBandwidth, NULL);
 }
 
+std::shared_ptr<CongestionControl>
+BaseRtpEndpointImpl::getCongestionControl ()
+{
+  KmsCongestionControl type;
+
+  g_object_get (element, "congestion-control", &type, NULL);
+
+  switch (type) {
+  case KMS_CONGESTION_CONTROL_DELAY:
+    return std::shared_ptr<CongestionControl> (new CongestionControl (
+             CongestionControl::DELAY) );
+
+  default:
+    return std::shared_ptr<CongestionControl> (new CongestionControl (
+             CongestionControl::LOSS) );
+  }
+}
+
+void
+BaseRtpEndpointImpl::setCongestionControl (std::shared_ptr<CongestionControl>
+    congestionControl)
+{
+  KmsCongestionControl type;
+
+  switch (congestionControl->getValue () ) {
+  case CongestionControl::LOSS:
+    type = KMS_CONGESTION_CONTROL_LOSS;
+    break;
+
+  case CongestionControl::DELAY:
+    type = KMS_CONGESTION_CONTROL_DELAY;
+    break;
+
+  default:
+    throw KurentoException (MEDIA_OBJECT_ILLEGAL_PARAM_ERROR,
+                            "Invalid congestion control");
+  }
+
+  g_object_set (element, "congestion-control", type, NULL);
+}
+
+std::shared_ptr<JitterBufferProfile>
+BaseRtpEndpointImpl::getJitterBufferProfile ()
+{
+  KmsJitterBufferProfile profile;
+
+  g_object_get (element, "jitter-buffer-profile", &profile, NULL);
+
+  switch (profile) {
+  case KMS_JITTER_BUFFER_PROFILE_INTERACTIVE:
+    return std::shared_ptr<JitterBufferProfile> (new JitterBufferProfile (
+             JitterBufferProfile::INTERACTIVE) );
+
+  case KMS_JITTER_BUFFER_PROFILE_ADAPTIVE:
+    return std::shared_ptr<JitterBufferProfile> (new JitterBufferProfile (
+             JitterBufferProfile::ADAPTIVE) );
+
+  default:
+    return std::shared_ptr<JitterBufferProfile> (new JitterBufferProfile (
+             JitterBufferProfile::BUFFERED) );
+  }
+}
+
+void
+BaseRtpEndpointImpl::setJitterBufferProfile (std::shared_ptr<JitterBufferProfile>
+    jitterBufferProfile)
+{
+  KmsJitterBufferProfile profile;
+
+  switch (jitterBufferProfile->getValue () ) {
+  case JitterBufferProfile::INTERACTIVE:
+    profile = KMS_JITTER_BUFFER_PROFILE_INTERACTIVE;
+    break;
+
+  case JitterBufferProfile::ADAPTIVE:
+    profile = KMS_JITTER_BUFFER_PROFILE_ADAPTIVE;
+    break;
+
+  case JitterBufferProfile::BUFFERED:
+    profile = KMS_JITTER_BUFFER_PROFILE_BUFFERED;
+    break;
+
+  default:
+    throw KurentoException (MEDIA_OBJECT_ILLEGAL_PARAM_ERROR,
+                            "Invalid jitter buffer profile");
+  }
+
+  g_object_set (element, "jitter-buffer-profile", profile, NULL);
+}
+
+int BaseRtpEndpointImpl::getJitterBufferLatency ()
+{
+  int jitterBufferLatency;
+
+  g_object_get (element, "jitter-buffer-latency", &jitterBufferLatency, NULL);
+
+  return jitterBufferLatency;
+}
+
+void BaseRtpEndpointImpl::setJitterBufferLatency (int jitterBufferLatency)
+{
+  g_object_set (element, "jitter-buffer-latency", jitterBufferLatency, NULL);
+}
+
+int BaseRtpEndpointImpl::getJitterBufferMinLatency ()
+{
+  int jitterBufferMinLatency;
+
+  g_object_get (element, "jitter-buffer-min-latency", &jitterBufferMinLatency,
+                NULL);
+
+  return jitterBufferMinLatency;
+}
+
+void BaseRtpEndpointImpl::setJitterBufferMinLatency (int jitterBufferMinLatency)
+{
+  g_object_set (element, "jitter-buffer-min-latency", jitterBufferMinLatency,
+                NULL);
+}
+
+static std::shared_ptr<RtpStats>
+createRtpStats (const GstStructure *stats, MediaType::type mediaType)
+{
+  guint ssrc = 0, fractionLost = 0, jitter = 0, rtt = 0;
+  guint nacks = 0, plis = 0, firs = 0, remb = 0, jbLatency = 0;
+  guint64 packets = 0, bytes = 0, late = 0;
+  gint packetsLost = 0;
+
+  gst_structure_get_uint (stats, "ssrc", &ssrc);
+  gst_structure_get_uint64 (stats, "packets", &packets);
+  gst_structure_get_uint64 (stats, "bytes", &bytes);
+  gst_structure_get_int (stats, "packets-lost", &packetsLost);
+  gst_structure_get_uint (stats, "fraction-lost", &fractionLost);
+  gst_structure_get_uint (stats, "jitter", &jitter);
+  gst_structure_get_uint (stats, "round-trip-time", &rtt);
+  gst_structure_get_uint (stats, "nack-count", &nacks);
+  gst_structure_get_uint (stats, "pli-count", &plis);
+  gst_structure_get_uint (stats, "fir-count", &firs);
+  gst_structure_get_uint (stats, "remb", &remb);
+  gst_structure_get_uint (stats, "jitter-buffer-latency", &jbLatency);
+  gst_structure_get_uint64 (stats, "late-packets", &late);
+
+  return std::shared_ptr<RtpStats> (new RtpStats (std::to_string (ssrc),
+                                    std::shared_ptr<MediaType> (new MediaType (mediaType) ),
+                                    gst_structure_has_name (stats, "inbound-rtp"), packets, bytes,
+                                    packetsLost, fractionLost, jitter, rtt, nacks, plis, firs, remb,
+                                    jbLatency, late) );
+}
+
+static void
+collectSessionStats (const GstStructure *rtpStats, const gchar *media,
+                     MediaType::type mediaType,
+                     std::vector<std::shared_ptr<RtpStats>> &ret)
+{
+  const GstStructure *session;
+  const GValue *value;
+  gint i, n;
+
+  value = gst_structure_get_value (rtpStats, media);
+
+  if (value == NULL || !GST_VALUE_HOLDS_STRUCTURE (value) ) {
+    return;
+  }
+
+  session = gst_value_get_structure (value);
+  n = gst_structure_n_fields (session);
+
+  for (i = 0; i < n; i++) {
+    value = gst_structure_get_value (session,
+                                     gst_structure_nth_field_name (session, i) );
+
+    if (GST_VALUE_HOLDS_STRUCTURE (value) ) {
+      ret.push_back (createRtpStats (gst_value_get_structure (value),
+                                     mediaType) );
+    }
+  }
+}
+
+std::vector<std::shared_ptr<RtpStats>>
+    BaseRtpEndpointImpl::getStats ()
+{
+  std::vector<std::shared_ptr<RtpStats>> ret;
+  GstStructure *rtpStats;
+
+  g_object_get (element, "stats", &rtpStats, NULL);
+
+  collectSessionStats (rtpStats, "audio", MediaType::AUDIO, ret);
+  collectSessionStats (rtpStats, "video", MediaType::VIDEO, ret);
+
+  gst_structure_free (rtpStats);
+
+  return ret;
+}
+
 BaseRtpEndpointImpl::StaticConstructor BaseRtpEndpointImpl::staticConstructor;
 
 BaseRtpEndpointImpl::StaticConstructor::StaticConstructor()
@@ -11,6 +11,7 @@
 namespace kurento
 {
 class BaseRtpEndpointImpl;
+class RtpStats;
 } /* kurento */
 
 namespace kurento
@@ -40,6 +41,22 @@ public:
   virtual int getMaxVideoSendBandwidth ();
   virtual void setMaxVideoSendBandwidth (int maxVideoSendBandwidth);
 
+  virtual std::shared_ptr<CongestionControl> getCongestionControl ();
+  virtual void setCongestionControl (std::shared_ptr<CongestionControl>
+                                     congestionControl);
+
+  virtual std::shared_ptr<JitterBufferProfile> getJitterBufferProfile ();
+  virtual void setJitterBufferProfile (std::shared_ptr<JitterBufferProfile>
+                                       jitterBufferProfile);
+
+  virtual int getJitterBufferLatency ();
+  virtual void setJitterBufferLatency (int jitterBufferLatency);
+
+  virtual int getJitterBufferMinLatency ();
+  virtual void setJitterBufferMinLatency (int jitterBufferMinLatency);
+
+  virtual std::vector<std::shared_ptr<RtpStats>> getStats ();
+
   /* Next methods are automatically implemented by code generator */
   virtual bool connect (const std::string &eventType,
                         std::shared_ptr<EventHandler> handler);
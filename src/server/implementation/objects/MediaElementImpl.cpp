@@ -12,6 +12,7 @@
 #include <MediaSet.hpp>
 #include <gst/gst.h>
 #include <ElementConnectionData.hpp>
+#include <WorkerPool.hpp>
 #include "kmselement.h"
 
 #define GST_CAT_DEFAULT kurento_media_element_impl
@@ -119,6 +120,21 @@ public:
     return sinkPadName;
   }
 
+  std::shared_ptr<MediaType> getType ()
+  {
+    return type;
+  }
+
+  const std::string &getSourceDescription ()
+  {
+    return sourceDescription;
+  }
+
+  const std::string &getSinkDescription ()
+  {
+    return sinkDescription;
+  }
+
   GstPad *getSinkPad ()
   {
     std::shared_ptr <MediaElementImpl> sinkLocked = getSink ();
@@ -188,21 +204,11 @@ convertMediaType (std::shared_ptr<MediaType> mediaType)
 }
 
 void
-_media_element_impl_bus_message (GstBus *bus, GstMessage *message,
-                                 gpointer data)
+MediaElementImpl::busMessage (GstMessage *message)
 {
   if (message->type == GST_MESSAGE_ERROR) {
     GError *err = NULL;
     gchar *debug = NULL;
-    MediaElementImpl *elem = reinterpret_cast <MediaElementImpl *> (data);
-
-    if (elem == NULL) {
-      return;
-    }
-
-    if (message->src != GST_OBJECT (elem->element) ) {
-      return;
-    }
 
     GST_ERROR ("MediaElement error: %" GST_PTR_FORMAT, message);
     gst_message_parse_error (message, &err, &debug);
@@ -213,10 +219,10 @@ _media_element_impl_bus_message (GstBus *bus, GstMessage *message,
     }
 
     try {
-      Error error (elem->shared_from_this(), errorMessage , 0,
+      Error error (shared_from_this(), errorMessage , 0,
                    "UNEXPECTED_ELEMENT_ERROR");
 
-      elem->signalError (error);
+      signalError (error);
     } catch (std::bad_weak_ptr &e) {
     }
 
@@ -234,56 +240,31 @@ _media_element_pad_added (GstElement *elem, GstPad *pad, gpointer data)
 
   if (GST_PAD_IS_SRC (pad) ) {
     std::unique_lock<std::recursive_mutex> lock (self->sinksMutex);
-    std::shared_ptr<MediaType> type;
-    //FIXME: This method of pad recognition should change as well as pad names
+    auto it = self->sinksByPad.find (GST_OBJECT_NAME (pad) );
 
-    if (g_str_has_prefix (GST_OBJECT_NAME (pad), "audio") ) {
-      type = std::shared_ptr<MediaType> (new MediaType (MediaType::AUDIO) );
-    } else if (g_str_has_prefix (GST_OBJECT_NAME (pad), "video") ) {
-      type = std::shared_ptr<MediaType> (new MediaType (MediaType::VIDEO) );
-    } else {
-      type = std::shared_ptr<MediaType> (new MediaType (MediaType::DATA) );
-    }
-
-    try {
-      auto connections = self->sinks.at (type).at ("");
+    if (it != self->sinksByPad.end () ) {
+      std::shared_ptr<ElementConnectionDataInternal> connection = it->second;
+      std::shared_ptr<MediaElementImpl> sink = connection->getSink ();
 
-      for (auto it : connections) {
-        if (g_strcmp0 (GST_OBJECT_NAME (pad), it->getSourcePadName() ) == 0) {
-          std::unique_lock<std::recursive_mutex> sinkLock (it->getSink()->sourcesMutex);
+      if (sink) {
+        std::unique_lock<std::recursive_mutex> sinkLock (sink->sourcesMutex);
 
-          self->performConnection (it);
-        }
+        self->performConnection (connection);
       }
-    } catch (std::out_of_range) {
-
     }
   } else {
     std::unique_lock<std::recursive_mutex> lock (self->sourcesMutex);
-    std::shared_ptr<MediaType> type;
+    auto it = self->sourcesByPad.find (GST_OBJECT_NAME (pad) );
 
-    if (g_str_has_prefix (GST_OBJECT_NAME (pad), "sink_audio") ) {
-      type = std::shared_ptr<MediaType> (new MediaType (MediaType::AUDIO) );
-    } else if (g_str_has_prefix (GST_OBJECT_NAME (pad), "sink_video") ) {
-      type = std::shared_ptr<MediaType> (new MediaType (MediaType::VIDEO) );
-    } else {
-      type = std::shared_ptr<MediaType> (new MediaType (MediaType::DATA) );
-    }
-
-    try {
-      auto sourceData = self->sources.at (type).at ("");
-      auto source = sourceData->getSource();
+    if (it != self->sourcesByPad.end () ) {
+      std::shared_ptr<ElementConnectionDataInternal> connection = it->second;
+      std::shared_ptr<MediaElementImpl> source = connection->getSource ();
 
       if (source) {
-        if (g_strcmp0 (GST_OBJECT_NAME (pad),
-                       sourceData->getSinkPadName().c_str() ) == 0) {
-          std::unique_lock<std::recursive_mutex> sourceLock (source->sinksMutex);
+        std::unique_lock<std::recursive_mutex> sourceLock (source->sinksMutex);
 
-          source->performConnection (sourceData);
-        }
+        source->performConnection (connection);
       }
-    } catch (std::out_of_range) {
-
     }
   }
 }
@@ -303,10 +284,15 @@ MediaElementImpl::MediaElementImpl (const boost::property_tree::ptree &config,
                             "Cannot create gstreamer element: " + factoryName);
   }
 
-  bus = gst_pipeline_get_bus (GST_PIPELINE (pipe->getPipeline () ) );
-  handlerId = g_signal_connect (bus, "message",
-                                G_CALLBACK (_media_element_impl_bus_message), this);
+  pipe->addBusHandler (GST_OBJECT (element), GST_MESSAGE_ERROR,
+                       std::bind (&MediaElementImpl::busMessage, this,
+                                  std::placeholders::_1) );
 
+  if (pipe->getEncoderConfig () != NULL &&
+      g_object_class_find_property (G_OBJECT_GET_CLASS (element),
+                                    "encoder-config") != NULL) {
+    g_object_set (element, "encoder-config", pipe->getEncoderConfig (), NULL);
+  }
 
   padAddedHandlerId = g_signal_connect (element, "pad_added",
                                         G_CALLBACK (_media_element_pad_added), this);
@@ -326,14 +312,13 @@ MediaElementImpl::~MediaElementImpl ()
 
   pipe = std::dynamic_pointer_cast<MediaPipelineImpl> (getMediaPipeline() );
 
+  pipe->removeBusHandler (GST_OBJECT (element) );
+
   gst_element_set_locked_state (element, TRUE);
   gst_element_set_state (element, GST_STATE_NULL);
   gst_bin_remove (GST_BIN ( pipe->getPipeline() ), element);
   g_signal_handler_disconnect (element, padAddedHandlerId);
   g_object_unref (element);
-
-  g_signal_handler_disconnect (bus, handlerId);
-  g_object_unref (bus);
 }
 
 void
@@ -364,19 +349,140 @@ void MediaElementImpl::disconnectAll ()
   }
 }
 
+std::shared_ptr<const MediaElementImpl::ConnectionList>
+MediaElementImpl::getSourcesSnapshot ()
+{
+  std::unique_lock<std::recursive_mutex> lock (sourcesMutex);
+
+  if (!sourcesSnapshot) {
+    std::shared_ptr<ConnectionList> snapshot (new ConnectionList () );
+
+    snapshot->reserve (sources.size () );
+
+    for (const auto &it : sources) {
+      snapshot->push_back (it.second);
+    }
+
+    sourcesSnapshot = snapshot;
+  }
+
+  return sourcesSnapshot;
+}
+
+std::shared_ptr<const MediaElementImpl::ConnectionList>
+MediaElementImpl::getSinksSnapshot ()
+{
+  std::unique_lock<std::recursive_mutex> lock (sinksMutex);
+
+  if (!sinksSnapshot) {
+    std::shared_ptr<ConnectionList> snapshot (new ConnectionList () );
+
+    snapshot->reserve (sinksByPad.size () );
+
+    for (const auto &it : sinks) {
+      snapshot->insert (snapshot->end (), it.second.begin (), it.second.end () );
+    }
+
+    sinksSnapshot = snapshot;
+  }
+
+  return sinksSnapshot;
+}
+
+/* Called with sinksMutex held */
+void
+MediaElementImpl::addSinkConnection (std::shared_ptr
+                                     <ElementConnectionDataInternal> data)
+{
+  ConnectionKey key (data->getType ()->getValue (),
+                     data->getSourceDescription () );
+
+  sinks[key].insert (data);
+  sinksByPad[data->getSourcePadName ()] = data;
+  sinksSnapshot.reset ();
+}
+
+/* Called with sinksMutex held */
+void
+MediaElementImpl::removeSinkConnection (std::shared_ptr
+                                        <ElementConnectionDataInternal> data)
+{
+  ConnectionKey key (data->getType ()->getValue (),
+                     data->getSourceDescription () );
+  auto it = sinks.find (key);
+
+  if (it != sinks.end () ) {
+    it->second.erase (data);
+
+    if (it->second.empty () ) {
+      sinks.erase (it);
+    }
+  }
+
+  auto padIt = sinksByPad.find (data->getSourcePadName () );
+
+  if (padIt != sinksByPad.end () && padIt->second == data) {
+    sinksByPad.erase (padIt);
+  }
+
+  sinksSnapshot.reset ();
+}
+
+/* Called with sourcesMutex held */
+void
+MediaElementImpl::setSourceConnection (std::shared_ptr
+                                       <ElementConnectionDataInternal> data)
+{
+  ConnectionKey key (data->getType ()->getValue (),
+                     data->getSinkDescription () );
+  auto it = sources.find (key);
+
+  if (it != sources.end () ) {
+    sourcesByPad.erase (it->second->getSinkPadName () );
+  }
+
+  sources[key] = data;
+  sourcesByPad[data->getSinkPadName ()] = data;
+  sourcesSnapshot.reset ();
+}
+
+/* Called with sourcesMutex held, only removes connections from source */
+std::shared_ptr<ElementConnectionDataInternal>
+MediaElementImpl::removeSourceConnection (MediaElementImpl *source,
+    std::shared_ptr<MediaType> mediaType, const std::string &description)
+{
+  std::shared_ptr<ElementConnectionDataInternal> data;
+  auto it = sources.find (ConnectionKey (mediaType->getValue (), description) );
+
+  if (it == sources.end () || it->second->getSource ().get () != source) {
+    return data;
+  }
+
+  data = it->second;
+  sources.erase (it);
+  sourcesByPad.erase (data->getSinkPadName () );
+  sourcesSnapshot.reset ();
+
+  return data;
+}
+
+static void
+appendConnection (std::vector<std::shared_ptr<ElementConnectionData>> &ret,
+                  std::shared_ptr<ElementConnectionDataInternal> data)
+{
+  try {
+    ret.push_back (data->toInterface() );
+  } catch (KurentoException) {
+  }
+}
+
 std::vector<std::shared_ptr<ElementConnectionData>>
     MediaElementImpl::getSourceConnections ()
 {
-  std::unique_lock<std::recursive_mutex> lock (sourcesMutex);
   std::vector<std::shared_ptr<ElementConnectionData>> ret;
 
-  for (auto it : sources) {
-    for (auto it2 : it.second) {
-      try {
-        ret.push_back (it2.second->toInterface() );
-      } catch (KurentoException) {
-      }
-    }
+  for (auto data : *getSourcesSnapshot () ) {
+    appendConnection (ret, data);
   }
 
   return ret;
@@ -386,19 +492,12 @@ std::vector<std::shared_ptr<ElementConnectionData>>
     MediaElementImpl::getSourceConnections (
       std::shared_ptr<MediaType> mediaType)
 {
-  std::unique_lock<std::recursive_mutex> lock (sourcesMutex);
   std::vector<std::shared_ptr<ElementConnectionData>> ret;
 
-  try {
-    for (auto it : sources.at (mediaType) ) {
-      try {
-        ret.push_back (it.second->toInterface() );
-      } catch (KurentoException) {
-
-      }
+  for (auto data : *getSourcesSnapshot () ) {
+    if (data->getType ()->getValue () == mediaType->getValue () ) {
+      appendConnection (ret, data);
     }
-  } catch (std::out_of_range) {
-
   }
 
   return ret;
@@ -408,15 +507,13 @@ std::vector<std::shared_ptr<ElementConnectionData>>
     MediaElementImpl::getSourceConnections (
       std::shared_ptr<MediaType> mediaType, const std::string &description)
 {
-  std::unique_lock<std::recursive_mutex> lock (sourcesMutex);
   std::vector<std::shared_ptr<ElementConnectionData>> ret;
 
-  try {
-    ret.push_back (sources.at (mediaType).at (description)->toInterface() );
-  } catch (KurentoException) {
-
-  } catch (std::out_of_range) {
-
+  for (auto data : *getSourcesSnapshot () ) {
+    if (data->getType ()->getValue () == mediaType->getValue ()
+        && data->getSinkDescription () == description) {
+      appendConnection (ret, data);
+    }
   }
 
   return ret;
@@ -425,19 +522,10 @@ std::vector<std::shared_ptr<ElementConnectionData>>
 std::vector<std::shared_ptr<ElementConnectionData>>
     MediaElementImpl::getSinkConnections ()
 {
-  std::unique_lock<std::recursive_mutex> lock (sinksMutex);
   std::vector<std::shared_ptr<ElementConnectionData>> ret;
 
-  for (auto it : sinks) {
-    for (auto it2 : it.second) {
-      for (auto it3 : it2.second) {
-        try {
-          ret.push_back (it3->toInterface() );
-        } catch (KurentoException) {
-
-        }
-      }
-    }
+  for (auto data : *getSinksSnapshot () ) {
+    appendConnection (ret, data);
   }
 
   return ret;
@@ -447,21 +535,12 @@ std::vector<std::shared_ptr<ElementConnectionData>>
     MediaElementImpl::getSinkConnections (
       std::shared_ptr<MediaType> mediaType)
 {
-  std::unique_lock<std::recursive_mutex> lock (sinksMutex);
   std::vector<std::shared_ptr<ElementConnectionData>> ret;
 
-  try {
-    for (auto it : sinks.at (mediaType) ) {
-      for (auto it3 : it.second) {
-        try {
-          ret.push_back (it3->toInterface() );
-        } catch (KurentoException) {
-
-        }
-      }
+  for (auto data : *getSinksSnapshot () ) {
+    if (data->getType ()->getValue () == mediaType->getValue () ) {
+      appendConnection (ret, data);
     }
-  } catch (std::out_of_range) {
-
   }
 
   return ret;
@@ -471,19 +550,13 @@ std::vector<std::shared_ptr<ElementConnectionData>>
     MediaElementImpl::getSinkConnections (
       std::shared_ptr<MediaType> mediaType, const std::string &description)
 {
-  std::unique_lock<std::recursive_mutex> lock (sinksMutex);
   std::vector<std::shared_ptr<ElementConnectionData>> ret;
 
-  try {
-    for (auto it : sinks.at (mediaType).at (description) ) {
-      try {
-        ret.push_back (it->toInterface() );
-      } catch (KurentoException) {
-
-      }
+  for (auto data : *getSinksSnapshot () ) {
+    if (data->getType ()->getValue () == mediaType->getValue ()
+        && data->getSourceDescription () == description) {
+      appendConnection (ret, data);
     }
-  } catch (std::out_of_range) {
-
   }
 
   return ret;
@@ -516,8 +589,6 @@ void MediaElementImpl::connect (std::shared_ptr<MediaElement> sink,
                                 const std::string &sourceMediaDescription,
                                 const std::string &sinkMediaDescription)
 {
-  KmsElementPadType type;
-  gchar *padName;
   std::shared_ptr<MediaElementImpl> sinkImpl =
     std::dynamic_pointer_cast<MediaElementImpl> (sink);
 
@@ -528,6 +599,194 @@ void MediaElementImpl::connect (std::shared_ptr<MediaElement> sink,
 
   std::unique_lock<std::recursive_mutex> lock (sinksMutex);
   std::unique_lock<std::recursive_mutex> sinkLock (sinkImpl->sourcesMutex);
+
+  performConnection (prepareConnection (sinkImpl, mediaType,
+                                        sourceMediaDescription,
+                                        sinkMediaDescription) );
+}
+
+static std::shared_ptr<WorkerPool>
+getLinkWorkers ()
+{
+  static std::shared_ptr<WorkerPool> workers (new WorkerPool (1) );
+
+  return workers;
+}
+
+std::shared_future<void>
+MediaElementImpl::connectAsync (const
+                                std::vector<std::shared_ptr<MediaElementImpl>> &sources,
+                                const std::vector<std::shared_ptr<MediaElementImpl>> &sinks,
+                                std::shared_ptr<MediaType> mediaType,
+                                std::function<void (int) > onComplete)
+{
+  std::vector<std::shared_ptr<MediaType>> types;
+  std::vector<std::shared_ptr<MediaElementImpl>> pairSources;
+  std::vector<std::vector<std::shared_ptr<MediaElementImpl>>> pairSinks;
+  std::set<std::string> sinkIds;
+  std::vector<std::shared_ptr<MediaElementImpl>> linkSources;
+  std::vector<std::shared_ptr<ElementConnectionDataInternal>> connections;
+  std::shared_ptr<std::promise<void>> done (new std::promise<void> () );
+  std::shared_future<void> future (done->get_future () );
+
+  if (mediaType) {
+    types.push_back (mediaType);
+  } else {
+    // Until mediaDescriptions are really used, we just connect audio an video
+    types.push_back (std::shared_ptr<MediaType> (new MediaType (
+                       MediaType::AUDIO) ) );
+    types.push_back (std::shared_ptr<MediaType> (new MediaType (
+                       MediaType::VIDEO) ) );
+  }
+
+  if (sources.size() != sinks.size() ) {
+    throw KurentoException (MEDIA_OBJECT_ILLEGAL_PARAM_ERROR,
+                            "Sources and sinks must have the same length");
+  }
+
+  /* Everything is checked before any pad is requested */
+  for (size_t i = 0; i < sources.size(); i++) {
+    std::shared_ptr<MediaElementImpl> source = sources[i];
+    std::shared_ptr<MediaElementImpl> sink = sinks[i];
+    size_t j;
+
+    if (source->getMediaPipeline ()->getId () !=
+        sink->getMediaPipeline ()->getId () ||
+        source->getMediaPipeline ()->getId () !=
+        sources.front()->getMediaPipeline ()->getId () ) {
+      throw KurentoException (CONNECT_ERROR,
+                              "Media elements does not share pipeline");
+    }
+
+    if (source == sink) {
+      GST_DEBUG ("Skipping connection of %s to itself",
+                 source->getName ().c_str () );
+      continue;
+    }
+
+    /* A sink takes one source per media type, a later pair would just
+     * replace the connection of the previous one */
+    if (!sinkIds.insert (sink->getId () ).second) {
+      throw KurentoException (CONNECT_ERROR, "Sink " + sink->getName () +
+                              " appears in more than one pair");
+    }
+
+    for (j = 0; j < pairSources.size(); j++) {
+      if (pairSources[j] == source) {
+        break;
+      }
+    }
+
+    if (j == pairSources.size() ) {
+      pairSources.push_back (source);
+      pairSinks.push_back (std::vector<std::shared_ptr<MediaElementImpl>> () );
+    }
+
+    pairSinks[j].push_back (sink);
+  }
+
+  if (pairSources.empty () ) {
+    done->set_value ();
+
+    if (onComplete) {
+      onComplete (0);
+    }
+
+    return future;
+  }
+
+  /* Request every pad of a source in one pass, links are done later */
+  try {
+    for (size_t i = 0; i < pairSources.size(); i++) {
+      std::shared_ptr<MediaElementImpl> source = pairSources[i];
+      std::unique_lock<std::recursive_mutex> lock (source->sinksMutex);
+
+      for (auto sink : pairSinks[i]) {
+        std::unique_lock<std::recursive_mutex> sinkLock (sink->sourcesMutex);
+
+        for (auto type : types) {
+          connections.push_back (source->prepareConnection (sink, type, "", "") );
+          linkSources.push_back (source);
+        }
+      }
+    }
+  } catch (...) {
+    /* Connections already prepared would never be linked */
+    for (size_t i = connections.size(); i > 0; i--) {
+      std::shared_ptr<ElementConnectionDataInternal> data = connections[i - 1];
+
+      linkSources[i - 1]->disconnect (data->getSink (), data->getType (),
+                                      data->getSourceDescription (),
+                                      data->getSinkDescription () );
+    }
+
+    throw;
+  }
+
+  getLinkWorkers ()->post ([linkSources, connections, done, onComplete] () {
+    size_t connected = connections.size ();
+
+    try {
+      for (size_t i = 0; i < connections.size(); i++) {
+        linkSources[i]->completeConnection (connections[i]);
+      }
+
+      done->set_value ();
+    } catch (...) {
+      /* Links already done and pads not linked yet are all undone */
+      for (size_t i = connections.size(); i > 0; i--) {
+        std::shared_ptr<ElementConnectionDataInternal> data = connections[i - 1];
+
+        try {
+          linkSources[i - 1]->disconnect (data->getSink (), data->getType (),
+                                          data->getSourceDescription (),
+                                          data->getSinkDescription () );
+        } catch (...) {
+          GST_WARNING ("Cannot undo connection of %s",
+                       linkSources[i - 1]->getName ().c_str () );
+        }
+      }
+
+      connected = 0;
+      done->set_exception (std::current_exception () );
+    }
+
+    if (onComplete) {
+      onComplete (connected);
+    }
+  });
+
+  return future;
+}
+
+void
+MediaElementImpl::completeConnection (std::shared_ptr
+                                      <ElementConnectionDataInternal> data)
+{
+  std::shared_ptr<MediaElementImpl> sink = data->getSink ();
+
+  if (!sink) {
+    return;
+  }
+
+  std::unique_lock<std::recursive_mutex> lock (sinksMutex);
+  std::unique_lock<std::recursive_mutex> sinkLock (sink->sourcesMutex);
+
+  performConnection (data);
+}
+
+/* Called with sinksMutex and sink's sourcesMutex held */
+std::shared_ptr <ElementConnectionDataInternal>
+MediaElementImpl::prepareConnection (std::shared_ptr<MediaElementImpl>
+                                     sinkImpl,
+                                     std::shared_ptr<MediaType> mediaType,
+                                     const std::string &sourceMediaDescription,
+                                     const std::string &sinkMediaDescription)
+{
+  KmsElementPadType type;
+  gchar *padName;
+  std::shared_ptr<MediaElement> sink =
+    std::dynamic_pointer_cast<MediaElement> (sinkImpl);
   std::vector <std::shared_ptr <ElementConnectionData>> connections;
   std::shared_ptr <ElementConnectionDataInternal> connectionData (
     new ElementConnectionDataInternal (std::dynamic_pointer_cast<MediaElement>
@@ -561,10 +820,10 @@ void MediaElementImpl::connect (std::shared_ptr<MediaElement> sink,
 
   connectionData->setSourcePadName (padName);
 
-  sinks[mediaType][sourceMediaDescription].insert (connectionData);
-  sinkImpl->sources[mediaType][sinkMediaDescription] = connectionData;
+  addSinkConnection (connectionData);
+  sinkImpl->setSourceConnection (connectionData);
 
-  performConnection (connectionData);
+  return connectionData;
 }
 
 void
@@ -650,21 +909,21 @@ void MediaElementImpl::disconnect (std::shared_ptr<MediaElement> sink,
              sink->getName ().c_str (), mediaType->getString ().c_str (),
              sourceMediaDescription.c_str(), sinkMediaDescription.c_str() );
 
-  try {
-    std::shared_ptr<ElementConnectionDataInternal> connectionData;
-    gboolean ret;
-
-    connectionData = sinkImpl->sources.at (mediaType).at (sourceMediaDescription);
-    sinkImpl->sources.at (mediaType).erase (sourceMediaDescription);
-    sinks.at (mediaType).at (sinkMediaDescription).erase (connectionData);
+  std::shared_ptr<ElementConnectionDataInternal> connectionData;
+  gboolean ret;
 
-    // TODO: If pad exists, it should be blocked before release it
-    g_signal_emit_by_name (getGstreamerElement (), "release-requested-srcpad",
-                           connectionData->getSourcePadName (), &ret, NULL);
-  } catch (std::out_of_range) {
+  connectionData = sinkImpl->removeSourceConnection (this, mediaType,
+                   sinkMediaDescription);
 
+  if (!connectionData) {
+    return;
   }
 
+  removeSinkConnection (connectionData);
+
+  // TODO: If pad exists, it should be blocked before release it
+  g_signal_emit_by_name (getGstreamerElement (), "release-requested-srcpad",
+                         connectionData->getSourcePadName (), &ret, NULL);
 }
 
 void MediaElementImpl::setAudioFormat (std::shared_ptr<AudioCaps> caps)
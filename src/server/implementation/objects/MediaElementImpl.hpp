@@ -8,6 +8,10 @@
 #include <gst/gst.h>
 #include <mutex>
 #include <set>
+#include <future>
+#include <functional>
+#include <vector>
+#include <unordered_map>
 
 namespace kurento
 {
@@ -70,6 +74,21 @@ public:
                         std::shared_ptr<MediaType> mediaType,
                         const std::string &sourceMediaDescription,
                         const std::string &sinkMediaDescription);
+
+  /* Connects sources[i] to sinks[i]. Pairs are validated before any pad is
+   * requested: pairs of an element with itself are skipped and a sink may
+   * appear only once. Source pads are requested in one pass per source and
+   * links are completed asynchronously. The returned future is ready, and
+   * onComplete is called with the number of connections, when all links
+   * have been attempted. If a link fails, every connection of the call is
+   * undone, the future holds the error and onComplete gets 0. If mediaType
+   * is null, audio and video are connected. */
+  static std::shared_future<void> connectAsync (
+    const std::vector<std::shared_ptr<MediaElementImpl>> &sources,
+    const std::vector<std::shared_ptr<MediaElementImpl>> &sinks,
+    std::shared_ptr<MediaType> mediaType,
+    std::function<void (int) > onComplete = nullptr);
+
   virtual void disconnect (std::shared_ptr<MediaElement> sink);
   virtual void disconnect (std::shared_ptr<MediaElement> sink,
                            std::shared_ptr<MediaType> mediaType);
@@ -97,23 +116,64 @@ public:
 
 protected:
   GstElement *element;
-  GstBus *bus;
-  gulong handlerId;
 
 private:
   std::recursive_mutex sourcesMutex;
   std::recursive_mutex sinksMutex;
 
-  std::map<std::shared_ptr <MediaType>, std::map<std::string,
-      std::shared_ptr<ElementConnectionDataInternal>>, MediaTypeCmp> sources;
-  std::map<std::shared_ptr <MediaType>, std::map<std::string,
-      std::set<std::shared_ptr<ElementConnectionDataInternal>>>, MediaTypeCmp>
+  /* Media type value and description */
+  typedef std::pair<int, std::string> ConnectionKey;
+
+  struct ConnectionKeyHash {
+    size_t operator() (const ConnectionKey &key) const
+    {
+      return std::hash<std::string> () (key.second) * 31 + key.first;
+    }
+  };
+
+  typedef std::vector<std::shared_ptr<ElementConnectionDataInternal>>
+      ConnectionList;
+
+  /* Protected by sourcesMutex, keyed by the sink description */
+  std::unordered_map<ConnectionKey,
+      std::shared_ptr<ElementConnectionDataInternal>, ConnectionKeyHash> sources;
+  /* Protected by sourcesMutex, keyed by the sink pad name */
+  std::unordered_map<std::string,
+      std::shared_ptr<ElementConnectionDataInternal>> sourcesByPad;
+  /* Protected by sourcesMutex, rebuilt on demand after a change */
+  std::shared_ptr<const ConnectionList> sourcesSnapshot;
+
+  /* Protected by sinksMutex, keyed by the source description */
+  std::unordered_map<ConnectionKey,
+      std::set<std::shared_ptr<ElementConnectionDataInternal>>, ConnectionKeyHash>
       sinks;
+  /* Protected by sinksMutex, keyed by the source pad name */
+  std::unordered_map<std::string,
+      std::shared_ptr<ElementConnectionDataInternal>> sinksByPad;
+  /* Protected by sinksMutex, rebuilt on demand after a change */
+  std::shared_ptr<const ConnectionList> sinksSnapshot;
 
   gulong padAddedHandlerId;
 
   void disconnectAll();
+  void busMessage (GstMessage *message);
   void performConnection (std::shared_ptr <ElementConnectionDataInternal> data);
+  std::shared_ptr <ElementConnectionDataInternal> prepareConnection (
+    std::shared_ptr<MediaElementImpl> sinkImpl,
+    std::shared_ptr<MediaType> mediaType,
+    const std::string &sourceMediaDescription,
+    const std::string &sinkMediaDescription);
+  void completeConnection (std::shared_ptr <ElementConnectionDataInternal> data);
+
+  std::shared_ptr<const ConnectionList> getSourcesSnapshot ();
+  std::shared_ptr<const ConnectionList> getSinksSnapshot ();
+  void addSinkConnection (std::shared_ptr<ElementConnectionDataInternal> data);
+  void removeSinkConnection (std::shared_ptr<ElementConnectionDataInternal>
+                             data);
+  void setSourceConnection (std::shared_ptr<ElementConnectionDataInternal> data);
+  std::shared_ptr<ElementConnectionDataInternal> removeSourceConnection (
+    MediaElementImpl *source, std::shared_ptr<MediaType> mediaType,
+    const std::string &description);
 
   class StaticConstructor
   {
@@ -123,8 +183,6 @@ private:
 
   static StaticConstructor staticConstructor;
 
-  friend void _media_element_impl_bus_message (GstBus *bus, GstMessage *message,
-      gpointer data);
   friend void _media_element_pad_added (GstElement *elem, GstPad *pad,
                                         gpointer data);
 };
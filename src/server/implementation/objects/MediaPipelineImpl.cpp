@@ -1,6 +1,8 @@
 #include <gst/gst.h>
 #include <MediaPipelineImplFactory.hpp>
 #include "MediaPipelineImpl.hpp"
+#include "MediaElementImpl.hpp"
+#include "MediaType.hpp"
 #include <jsonrpc/JsonSerializer.hpp>
 #include <KurentoException.hpp>
 #include <gst/gst.h>
@@ -21,9 +23,41 @@ bus_message_adaptor (GstBus *bus, GstMessage *message, gpointer data)
   (*func) (message);
 }
 
+void
+MediaPipelineImpl::addBusHandler (GstObject *object, GstMessageType types,
+                                  BusMessageHandler handler)
+{
+  std::unique_lock<std::recursive_mutex> lock (busMutex);
+  BusHandler &busHandler = busHandlers[object];
+
+  busHandler.types = types;
+  busHandler.handler = handler;
+}
+
+void
+MediaPipelineImpl::removeBusHandler (GstObject *object)
+{
+  /* Waits for the handler to finish if it is being dispatched */
+  std::unique_lock<std::recursive_mutex> lock (busMutex);
+
+  busHandlers.erase (object);
+}
+
 void
 MediaPipelineImpl::busMessage (GstMessage *message)
 {
+  std::unique_lock<std::recursive_mutex> lock (busMutex);
+  auto it = busHandlers.find (GST_MESSAGE_SRC (message) );
+
+  if (it != busHandlers.end() &&
+      (it->second.types & GST_MESSAGE_TYPE (message) ) ) {
+    BusMessageHandler handler = it->second.handler;
+
+    handler (message);
+  }
+
+  lock.unlock();
+
   switch (message->type) {
   case GST_MESSAGE_ERROR: {
     GError *err = NULL;
@@ -57,6 +91,76 @@ MediaPipelineImpl::busMessage (GstMessage *message)
   }
 }
 
+#define ENCODER_CONFIG_KEY "modules.kurento.MediaPipeline.encoder"
+#define AUTO_VALUE "auto"
+
+/* Lists of values, like bitrateLadder, are stored as arrays of integers */
+static void
+setEncoderConfigArray (GstStructure *encoderConfig, const std::string &name,
+                       const boost::property_tree::ptree &values)
+{
+  GValue array = G_VALUE_INIT;
+
+  g_value_init (&array, GST_TYPE_ARRAY);
+
+  for (auto &it : values) {
+    GValue value = G_VALUE_INIT;
+
+    try {
+      g_value_init (&value, G_TYPE_INT);
+      g_value_set_int (&value, it.second.get_value<int> () );
+      gst_value_array_append_value (&array, &value);
+    } catch (boost::property_tree::ptree_bad_data &e) {
+      GST_WARNING ("Ignoring invalid value in encoder setting %s: %s",
+                   name.c_str(), it.second.data().c_str() );
+    }
+
+    g_value_unset (&value);
+  }
+
+  gst_structure_set_value (encoderConfig, name.c_str(), &array);
+  g_value_unset (&array);
+}
+
+static GstStructure *
+createEncoderConfig (const boost::property_tree::ptree &config)
+{
+  boost::optional<const boost::property_tree::ptree &> encoder;
+  GstStructure *encoderConfig;
+
+  encoder = config.get_child_optional (ENCODER_CONFIG_KEY);
+
+  if (!encoder) {
+    return NULL;
+  }
+
+  encoderConfig = gst_structure_new_empty ("encoder-config");
+
+  for (auto &it : *encoder) {
+    if (!it.second.empty() ) {
+      setEncoderConfigArray (encoderConfig, it.first, it.second);
+      continue;
+    }
+
+    try {
+      gst_structure_set (encoderConfig, it.first.c_str(), G_TYPE_INT,
+                         it.second.get_value<int> (), NULL);
+    } catch (boost::property_tree::ptree_bad_data &e) {
+      if (it.second.data() == AUTO_VALUE) {
+        /* Encoders choose the value themselves when it is 0 */
+        gst_structure_set (encoderConfig, it.first.c_str(), G_TYPE_INT, 0, NULL);
+      } else {
+        GST_WARNING ("Ignoring invalid encoder setting %s: %s", it.first.c_str(),
+                     it.second.data().c_str() );
+      }
+    }
+  }
+
+  GST_DEBUG ("Encoder configuration: %" GST_PTR_FORMAT, encoderConfig);
+
+  return encoderConfig;
+}
+
 MediaPipelineImpl::MediaPipelineImpl (const boost::property_tree::ptree &config)
   : MediaObjectImpl (config)
 {
@@ -69,6 +173,8 @@ MediaPipelineImpl::MediaPipelineImpl (const boost::property_tree::ptree &config)
                             "Cannot create gstreamer pipeline");
   }
 
+  encoderConfig = createEncoderConfig (config);
+
   g_object_set (G_OBJECT (pipeline), "async-handling", TRUE, NULL);
   gst_element_set_state (pipeline, GST_STATE_PLAYING);
 
@@ -90,6 +196,71 @@ MediaPipelineImpl::~MediaPipelineImpl ()
   g_object_unref (bus);
   gst_element_set_state (pipeline, GST_STATE_NULL);
   g_object_unref (pipeline);
+
+  if (encoderConfig != NULL) {
+    gst_structure_free (encoderConfig);
+  }
+}
+
+static std::vector<std::shared_ptr<MediaElementImpl>>
+toImpl (const std::vector<std::shared_ptr<MediaElement>> &elements)
+{
+  std::vector<std::shared_ptr<MediaElementImpl>> ret;
+
+  for (auto element : elements) {
+    ret.push_back (std::dynamic_pointer_cast<MediaElementImpl> (element) );
+  }
+
+  return ret;
+}
+
+void
+MediaPipelineImpl::connectElements (const
+                                    std::vector<std::shared_ptr<MediaElement>> &sources,
+                                    const std::vector<std::shared_ptr<MediaElement>> &sinks)
+{
+  connectElements (sources, sinks, std::shared_ptr<MediaType> () );
+}
+
+void
+MediaPipelineImpl::connectElements (const
+                                    std::vector<std::shared_ptr<MediaElement>> &sources,
+                                    const std::vector<std::shared_ptr<MediaElement>> &sinks,
+                                    std::shared_ptr<MediaType> mediaType)
+{
+  for (auto element : sources) {
+    if (element->getMediaPipeline ()->getId () != getId () ) {
+      throw KurentoException (CONNECT_ERROR,
+                              "Media elements does not belong to this pipeline");
+    }
+  }
+
+  std::weak_ptr<MediaObject> weakPipeline = shared_from_this ();
+
+  /* Links are completed asynchronously, ElementsConnected is raised when
+   * they are done */
+  MediaElementImpl::connectAsync (toImpl (sources), toImpl (sinks), mediaType,
+  [this, weakPipeline] (int connections) {
+    std::shared_ptr<MediaObject> pipeline = weakPipeline.lock ();
+
+    if (!pipeline) {
+      return;
+    }
+
+    ElementsConnected event (pipeline, ElementsConnected::getName (),
+                             connections);
+    signalElementsConnected (event);
+  });
+}
+
+void
+MediaPipelineImpl::release ()
+{
+  /* Elements released with the pipeline do not need to change state one by
+   * one, they are stopped here all at once */
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  MediaObjectImpl::release();
 }
 
 MediaObjectImpl *
@@ -6,11 +6,16 @@
 #include <EventHandler.hpp>
 #include <gst/gst.h>
 #include <boost/property_tree/ptree.hpp>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
 
 namespace kurento
 {
 
 class MediaPipelineImpl;
+class MediaElement;
+class MediaType;
 
 void Serialize (std::shared_ptr<MediaPipelineImpl> &object,
                 JsonSerializer &serializer);
@@ -29,6 +34,31 @@ public:
     return pipeline;
   }
 
+  virtual void release ();
+
+  virtual void connectElements (const std::vector<std::shared_ptr<MediaElement>>
+                                &sources,
+                                const std::vector<std::shared_ptr<MediaElement>> &sinks);
+  virtual void connectElements (const std::vector<std::shared_ptr<MediaElement>>
+                                &sources,
+                                const std::vector<std::shared_ptr<MediaElement>> &sinks,
+                                std::shared_ptr<MediaType> mediaType);
+
+  typedef std::function<void (GstMessage *) > BusMessageHandler;
+
+  /* Bus messages of any of the given types posted by object are delivered
+   * to handler. Only one handler per object is allowed. */
+  void addBusHandler (GstObject *object, GstMessageType types,
+                      BusMessageHandler handler);
+  void removeBusHandler (GstObject *object);
+
+  /* Encoder settings for the elements of this pipeline, read from the
+   * "encoder" section of the MediaPipeline configuration. May be NULL. */
+  const GstStructure *getEncoderConfig ()
+  {
+    return encoderConfig;
+  }
+
   /* Next methods are automatically implemented by code generator */
   virtual bool connect (const std::string &eventType,
                         std::shared_ptr<EventHandler> handler);
@@ -42,10 +72,19 @@ public:
 private:
 
   GstElement *pipeline;
+  GstStructure *encoderConfig;
 
   std::function<void (GstMessage *) > busMessagePointer;
   void busMessage (GstMessage *message);
 
+  struct BusHandler {
+    GstMessageType types;
+    BusMessageHandler handler;
+  };
+
+  std::recursive_mutex busMutex;
+  std::unordered_map<GstObject *, BusHandler> busHandlers;
+
   class StaticConstructor
   {
   public:
@@ -0,0 +1,178 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <gst/check/gstcheck.h>
+#include <gst/gst.h>
+#include <glib.h>
+
+/*
+ * Encoding throughput and latency of agnosticbin for several encoder-config
+ * values. Figures are printed, nothing is compared.
+ */
+
+static gboolean
+quit_main_loop_idle (gpointer data)
+{
+  GMainLoop *loop = data;
+
+  g_main_loop_quit (loop);
+  return FALSE;
+}
+
+#define BENCHMARK_FRAMES 90
+#define BENCHMARK_FRAMERATE 30
+typedef struct _EncoderBenchmark
+{
+  GMainLoop *loop;
+  gint64 input_time[2 * BENCHMARK_FRAMES];
+  gint64 first_output;
+  gint64 last_output;
+  gint64 total_latency;
+  gint frames;
+} EncoderBenchmark;
+
+static guint
+benchmark_frame_index (GstBuffer * buffer)
+{
+  return gst_util_uint64_scale (GST_BUFFER_PTS (buffer), BENCHMARK_FRAMERATE,
+      GST_SECOND) % (2 * BENCHMARK_FRAMES);
+}
+
+static GstPadProbeReturn
+benchmark_input_probe (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  EncoderBenchmark *bench = data;
+  GstBuffer *buffer = gst_pad_probe_info_get_buffer (info);
+
+  bench->input_time[benchmark_frame_index (buffer)] = g_get_monotonic_time ();
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstFlowReturn
+benchmark_new_sample (GstElement * appsink, gpointer data)
+{
+  EncoderBenchmark *bench = data;
+  gint64 now = g_get_monotonic_time ();
+  GstSample *sample;
+
+  g_signal_emit_by_name (appsink, "pull-sample", &sample);
+
+  if (bench->frames < BENCHMARK_FRAMES) {
+    GstBuffer *buffer = gst_sample_get_buffer (sample);
+
+    if (bench->frames == 0) {
+      bench->first_output = now;
+    }
+
+    bench->last_output = now;
+    bench->total_latency += now -
+        bench->input_time[benchmark_frame_index (buffer)];
+
+    if (++bench->frames == BENCHMARK_FRAMES) {
+      g_idle_add (quit_main_loop_idle, bench->loop);
+    }
+  }
+
+  gst_sample_unref (sample);
+
+  return GST_FLOW_OK;
+}
+
+static void
+run_encoder_benchmark (const gchar * config_str)
+{
+  GstElement *pipeline = gst_pipeline_new (__FUNCTION__);
+  GstElement *videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  GstElement *capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  GstElement *agnosticbin = gst_element_factory_make ("agnosticbin", NULL);
+  GstElement *appsink = gst_element_factory_make ("appsink", NULL);
+  GstStructure *config = gst_structure_from_string (config_str, NULL);
+  GstCaps *raw_caps, *enc_caps;
+  EncoderBenchmark bench = { 0 };
+  GstPad *sink;
+
+  bench.loop = g_main_loop_new (NULL, TRUE);
+
+  raw_caps =
+      gst_caps_from_string ("video/x-raw,width=1280,height=720,framerate=30/1");
+  enc_caps = gst_caps_from_string ("video/x-vp8");
+  g_object_set (capsfilter, "caps", raw_caps, NULL);
+  g_object_set (appsink, "caps", enc_caps, "emit-signals", TRUE, "sync", FALSE,
+      "async", FALSE, NULL);
+  g_object_set (agnosticbin, "encoder-config", config, NULL);
+  gst_caps_unref (raw_caps);
+  gst_caps_unref (enc_caps);
+  gst_structure_free (config);
+
+  g_signal_connect (appsink, "new-sample", G_CALLBACK (benchmark_new_sample),
+      &bench);
+
+  sink = gst_element_get_static_pad (agnosticbin, "sink");
+  gst_pad_add_probe (sink, GST_PAD_PROBE_TYPE_BUFFER, benchmark_input_probe,
+      &bench, NULL);
+  g_object_unref (sink);
+
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, capsfilter, agnosticbin,
+      appsink, NULL);
+  fail_unless (gst_element_link_many (videotestsrc, capsfilter, agnosticbin,
+          appsink, NULL));
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_main_loop_run (bench.loop);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  fail_unless (bench.frames == BENCHMARK_FRAMES);
+  g_print ("%s: %.1f fps, average latency %" G_GINT64_FORMAT " ms\n",
+      config_str, BENCHMARK_FRAMES * 1000000.0 /
+      MAX (bench.last_output - bench.first_output, 1),
+      bench.total_latency / BENCHMARK_FRAMES / 1000);
+
+  g_object_unref (pipeline);
+  g_main_loop_unref (bench.loop);
+}
+
+GST_START_TEST (encoder_config_benchmark)
+{
+  GstElementFactory *vp8enc = gst_element_factory_find ("vp8enc");
+
+  if (vp8enc == NULL) {
+    GST_WARNING ("vp8enc not available, skipping benchmark");
+    return;
+  }
+
+  gst_object_unref (vp8enc);
+
+  run_encoder_benchmark ("encoder-config, threads=(int)1");
+  run_encoder_benchmark ("encoder-config, threads=(int)0");
+  run_encoder_benchmark ("encoder-config, threads=(int)0, cpu-used=(int)8, "
+      "keyframe-interval=(int)60");
+}
+
+GST_END_TEST
+
+static Suite *
+agnosticbin_encoder_suite (void)
+{
+  Suite *s = suite_create ("agnosticbin_encoder");
+  TCase *tc_chain = tcase_create ("benchmark");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, encoder_config_benchmark);
+
+  return s;
+}
+
+GST_CHECK_MAIN (agnosticbin_encoder);
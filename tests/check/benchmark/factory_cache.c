@@ -0,0 +1,112 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#include "kmsutils.h"
+
+#include <gst/check/gstcheck.h>
+#include <gst/gst.h>
+#include <glib.h>
+
+/*
+ * Cost of creating an encoder branch with and without the element factory
+ * cache. Figures are printed, nothing is compared.
+ */
+
+#define FACTORY_BENCHMARK_ITERATIONS 200
+static GstElementFactory *
+find_encoder_factory_uncached (const GstCaps * caps)
+{
+  GList *encoder_list, *filtered_list, *l;
+  GstElementFactory *factory = NULL;
+
+  encoder_list =
+      gst_element_factory_list_get_elements (GST_ELEMENT_FACTORY_TYPE_ENCODER,
+      GST_RANK_NONE);
+  filtered_list =
+      gst_element_factory_list_filter (encoder_list, caps, GST_PAD_SRC, FALSE);
+
+  for (l = filtered_list; l != NULL && factory == NULL; l = l->next) {
+    if (kms_utils_factory_has_two_pad_templates (l->data)) {
+      factory = gst_object_ref (l->data);
+    }
+  }
+
+  gst_plugin_feature_list_free (filtered_list);
+  gst_plugin_feature_list_free (encoder_list);
+
+  return factory;
+}
+
+GST_START_TEST (factory_cache_benchmark)
+{
+  GstCaps *caps = gst_caps_from_string ("video/x-vp8");
+  GstElementFactory *factory;
+  GstClockTime start, uncached_time, cached_time;
+  gint i;
+
+  factory = find_encoder_factory_uncached (caps);
+
+  if (factory == NULL) {
+    GST_WARNING ("No vp8 encoder available, skipping benchmark");
+    gst_caps_unref (caps);
+    return;
+  }
+
+  gst_object_unref (factory);
+
+  /* Branch creation: resolve the factory and instantiate the encoder */
+  start = kms_utils_get_time_nsecs ();
+  for (i = 0; i < FACTORY_BENCHMARK_ITERATIONS; i++) {
+    factory = find_encoder_factory_uncached (caps);
+
+    gst_object_unref (gst_element_factory_create (factory, NULL));
+    gst_object_unref (factory);
+  }
+  uncached_time = kms_utils_get_time_nsecs () - start;
+
+  start = kms_utils_get_time_nsecs ();
+  for (i = 0; i < FACTORY_BENCHMARK_ITERATIONS; i++) {
+    factory =
+        kms_utils_get_element_factory_for_caps
+        (GST_ELEMENT_FACTORY_TYPE_ENCODER, NULL, caps,
+        kms_utils_factory_has_two_pad_templates);
+
+    gst_object_unref (gst_element_factory_create (factory, NULL));
+    gst_object_unref (factory);
+  }
+  cached_time = kms_utils_get_time_nsecs () - start;
+
+  g_print ("Encoder creation without cache: %" GST_TIME_FORMAT
+      " per branch, with cache: %" GST_TIME_FORMAT " per branch\n",
+      GST_TIME_ARGS (uncached_time / FACTORY_BENCHMARK_ITERATIONS),
+      GST_TIME_ARGS (cached_time / FACTORY_BENCHMARK_ITERATIONS));
+
+  gst_caps_unref (caps);
+}
+
+GST_END_TEST
+
+static Suite *
+factory_cache_suite (void)
+{
+  Suite *s = suite_create ("factory_cache");
+  TCase *tc_chain = tcase_create ("benchmark");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, factory_cache_benchmark);
+
+  return s;
+}
+
+GST_CHECK_MAIN (factory_cache);
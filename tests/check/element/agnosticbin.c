@@ -983,6 +983,560 @@ GST_START_TEST (create_test)
   g_object_unref (agnosticbin);
 }
 
+GST_END_TEST
+#define LAYER_SAMPLES 10
+static GstFlowReturn
+layer_new_sample (GstElement * appsink, gpointer data)
+{
+  gint *pending = data;
+  int *count = g_object_get_data (G_OBJECT (appsink), COUNT_KEY);
+  GstStructure *st;
+  GstSample *sample;
+  gint width, expected;
+
+  g_signal_emit_by_name (appsink, "pull-sample", &sample);
+
+  st = gst_caps_get_structure (gst_sample_get_caps (sample), 0);
+  expected = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (appsink), "width"));
+  fail_unless (gst_structure_get_int (st, "width", &width));
+  fail_unless (width == expected);
+
+  gst_sample_unref (sample);
+
+  if (g_atomic_int_add (count, 1) == LAYER_SAMPLES &&
+      g_atomic_int_dec_and_test (pending)) {
+    g_idle_add (quit_main_loop_idle, loop);
+  }
+
+  return GST_FLOW_OK;
+}
+
+static GstElement *
+add_layer_sink (GstElement * pipeline, GstElement * agnosticbin, gint width,
+    gint height, gint * pending)
+{
+  GstElement *appsink = gst_element_factory_make ("appsink", NULL);
+  GstCaps *caps = gst_caps_new_simple ("video/x-vp8", "width", G_TYPE_INT,
+      width, "height", G_TYPE_INT, height, NULL);
+
+  g_object_set (appsink, "caps", caps, "emit-signals", TRUE, "sync", FALSE,
+      "async", FALSE, NULL);
+  gst_caps_unref (caps);
+
+  g_object_set_data_full (G_OBJECT (appsink), COUNT_KEY, g_malloc0 (sizeof
+          (int)), g_free);
+  g_object_set_data (G_OBJECT (appsink), "width", GINT_TO_POINTER (width));
+  g_signal_connect (appsink, "new-sample", G_CALLBACK (layer_new_sample),
+      pending);
+
+  gst_bin_add (GST_BIN (pipeline), appsink);
+  fail_unless (gst_element_link (agnosticbin, appsink));
+
+  return appsink;
+}
+
+static void
+count_scale_layers (const GValue * item, gpointer data)
+{
+  gint *layers = data;
+  GstElement *element = g_value_get_object (item);
+
+  if (g_strcmp0 (G_OBJECT_TYPE_NAME (element), "KmsScaleTreeBin") == 0) {
+    (*layers)++;
+  }
+}
+
+GST_START_TEST (multi_resolution_output)
+{
+  GstElementFactory *vp8enc = gst_element_factory_find ("vp8enc");
+  GstElement *pipeline, *videotestsrc, *agnosticbin;
+  GstIterator *it;
+  gint pending = 3, layers = 0;
+
+  if (vp8enc == NULL) {
+    GST_WARNING ("vp8enc not available, skipping test");
+    return;
+  }
+
+  gst_object_unref (vp8enc);
+
+  loop = g_main_loop_new (NULL, TRUE);
+  pipeline = gst_pipeline_new (__FUNCTION__);
+  videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  agnosticbin = gst_element_factory_make ("agnosticbin", NULL);
+
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, agnosticbin, NULL);
+  fail_unless (gst_element_link (videotestsrc, agnosticbin));
+
+  add_layer_sink (pipeline, agnosticbin, 640, 480, &pending);
+  add_layer_sink (pipeline, agnosticbin, 320, 240, &pending);
+  add_layer_sink (pipeline, agnosticbin, 320, 240, &pending);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_timeout_add_seconds (10, timeout_check, pipeline);
+  g_main_loop_run (loop);
+
+  /* One layer per distinct resolution */
+  it = gst_bin_iterate_elements (GST_BIN (agnosticbin));
+  gst_iterator_foreach (it, count_scale_layers, &layers);
+  gst_iterator_free (it);
+  fail_unless (layers == 2);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  g_object_unref (pipeline);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST
+#define LADDER_SAMPLES 30
+#define REMB_KEY "remb"
+static GstFlowReturn
+ladder_new_sample (GstElement * appsink, gpointer data)
+{
+  gint *pending = data;
+  int *count = g_object_get_data (G_OBJECT (appsink), COUNT_KEY);
+  guint remb = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (appsink),
+          REMB_KEY));
+  GstSample *sample;
+  gint samples;
+
+  g_signal_emit_by_name (appsink, "pull-sample", &sample);
+  gst_sample_unref (sample);
+
+  samples = g_atomic_int_add (count, 1);
+
+  if (remb > 0 && samples == LADDER_SAMPLES / 3) {
+    GstPad *sink = gst_element_get_static_pad (appsink, "sink");
+    GstEvent *event = gst_event_new_custom (GST_EVENT_CUSTOM_UPSTREAM,
+        gst_structure_new ("REMB", "bitrate", G_TYPE_UINT, remb, "ssrc",
+            G_TYPE_UINT, 1, NULL));
+
+    gst_pad_push_event (sink, event);
+    g_object_unref (sink);
+  }
+
+  if (samples == LADDER_SAMPLES && g_atomic_int_dec_and_test (pending)) {
+    g_idle_add (quit_main_loop_idle, loop);
+  }
+
+  return GST_FLOW_OK;
+}
+
+static void
+add_ladder_sink (GstElement * pipeline, GstElement * agnosticbin, guint remb,
+    gint * pending)
+{
+  GstElement *appsink = gst_element_factory_make ("appsink", NULL);
+  GstCaps *caps = gst_caps_from_string ("video/x-vp8");
+
+  g_object_set (appsink, "caps", caps, "emit-signals", TRUE, "sync", FALSE,
+      "async", FALSE, NULL);
+  gst_caps_unref (caps);
+
+  g_object_set_data_full (G_OBJECT (appsink), COUNT_KEY, g_malloc0 (sizeof
+          (int)), g_free);
+  g_object_set_data (G_OBJECT (appsink), REMB_KEY, GUINT_TO_POINTER (remb));
+  g_signal_connect (appsink, "new-sample", G_CALLBACK (ladder_new_sample),
+      pending);
+
+  gst_bin_add (GST_BIN (pipeline), appsink);
+  gst_element_sync_state_with_parent (appsink);
+  fail_unless (gst_element_link (agnosticbin, appsink));
+}
+
+static void
+count_encoders (const GValue * item, gpointer data)
+{
+  gint *encoders = data;
+  GstElement *element = g_value_get_object (item);
+
+  if (g_strcmp0 (G_OBJECT_TYPE_NAME (element), "KmsEncTreeBin") == 0) {
+    (*encoders)++;
+  }
+}
+
+GST_START_TEST (bitrate_ladder)
+{
+  GstElementFactory *vp8enc = gst_element_factory_find ("vp8enc");
+  GstElement *pipeline, *videotestsrc, *agnosticbin;
+  GstStructure *config;
+  GstIterator *it;
+  gint pending = 3, encoders = 0;
+
+  if (vp8enc == NULL) {
+    GST_WARNING ("vp8enc not available, skipping test");
+    return;
+  }
+
+  gst_object_unref (vp8enc);
+
+  loop = g_main_loop_new (NULL, TRUE);
+  pipeline = gst_pipeline_new (__FUNCTION__);
+  videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  agnosticbin = gst_element_factory_make ("agnosticbin", NULL);
+
+  config = gst_structure_from_string ("encoder-config, "
+      "bitrate-ladder=(int)<100000, 400000, 1200000>", NULL);
+  g_object_set (agnosticbin, "encoder-config", config, NULL);
+  gst_structure_free (config);
+
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, agnosticbin, NULL);
+  fail_unless (gst_element_link (videotestsrc, agnosticbin));
+
+  /* Two subscribers stay on the lowest rung, one moves to the highest */
+  add_ladder_sink (pipeline, agnosticbin, 0, &pending);
+  add_ladder_sink (pipeline, agnosticbin, 50000, &pending);
+  add_ladder_sink (pipeline, agnosticbin, 2000000, &pending);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_timeout_add_seconds (10, timeout_check, pipeline);
+  g_main_loop_run (loop);
+
+  it = gst_bin_iterate_elements (GST_BIN (agnosticbin));
+  gst_iterator_foreach (it, count_encoders, &encoders);
+  gst_iterator_free (it);
+  fail_unless (encoders == 2);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  g_object_unref (pipeline);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST
+#define IDLE_SAMPLES 10
+static GstFlowReturn
+idle_new_sample (GstElement * appsink, gpointer data)
+{
+  GSourceFunc on_samples = data;
+  int *count = g_object_get_data (G_OBJECT (appsink), COUNT_KEY);
+  GstSample *sample;
+
+  g_signal_emit_by_name (appsink, "pull-sample", &sample);
+  gst_sample_unref (sample);
+
+  if (g_atomic_int_add (count, 1) == IDLE_SAMPLES) {
+    g_idle_add (on_samples, appsink);
+  }
+
+  return GST_FLOW_OK;
+}
+
+static GstElement *
+add_idle_sink (GstElement * pipeline, GstElement * agnosticbin,
+    GSourceFunc on_samples)
+{
+  GstElement *appsink = gst_element_factory_make ("appsink", NULL);
+  GstCaps *caps = gst_caps_from_string ("video/x-vp8");
+
+  g_object_set (appsink, "caps", caps, "emit-signals", TRUE, "sync", FALSE,
+      "async", FALSE, NULL);
+  gst_caps_unref (caps);
+
+  g_object_set_data_full (G_OBJECT (appsink), COUNT_KEY, g_malloc0 (sizeof
+          (int)), g_free);
+  g_signal_connect (appsink, "new-sample", G_CALLBACK (idle_new_sample),
+      on_samples);
+
+  gst_bin_add (GST_BIN (pipeline), appsink);
+  gst_element_sync_state_with_parent (appsink);
+  fail_unless (gst_element_link (agnosticbin, appsink));
+
+  return appsink;
+}
+
+static gboolean
+remove_idle_sink (gpointer data)
+{
+  GstElement *appsink = data;
+  GstElement *pipeline = GST_ELEMENT (GST_OBJECT_PARENT (appsink));
+  GstPad *sink = gst_element_get_static_pad (appsink, "sink");
+  GstPad *src = gst_pad_get_peer (sink);
+
+  gst_pad_unlink (src, sink);
+  gst_element_release_request_pad (GST_ELEMENT (GST_OBJECT_PARENT (src)), src);
+  g_object_unref (src);
+  g_object_unref (sink);
+
+  gst_element_set_locked_state (appsink, TRUE);
+  gst_element_set_state (appsink, GST_STATE_NULL);
+  gst_bin_remove (GST_BIN (pipeline), appsink);
+
+  /* Leave time for the branches to be reclaimed */
+  g_timeout_add_seconds (5, quit_main_loop_idle, loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+quit_on_samples (gpointer appsink)
+{
+  g_main_loop_quit (loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gint
+count_branches (GstElement * agnosticbin)
+{
+  GstIterator *it;
+  gint encoders = 0;
+
+  it = gst_bin_iterate_elements (GST_BIN (agnosticbin));
+  gst_iterator_foreach (it, count_encoders, &encoders);
+  gst_iterator_free (it);
+
+  return encoders;
+}
+
+GST_START_TEST (idle_branch_reclaim)
+{
+  GstElementFactory *vp8enc = gst_element_factory_find ("vp8enc");
+  GstElement *pipeline, *videotestsrc, *agnosticbin;
+
+  if (vp8enc == NULL) {
+    GST_WARNING ("vp8enc not available, skipping test");
+    return;
+  }
+
+  gst_object_unref (vp8enc);
+
+  loop = g_main_loop_new (NULL, TRUE);
+  pipeline = gst_pipeline_new (__FUNCTION__);
+  videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  agnosticbin = gst_element_factory_make ("agnosticbin", NULL);
+
+  g_object_set (agnosticbin, "idle-timeout", 1, NULL);
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, agnosticbin, NULL);
+  fail_unless (gst_element_link (videotestsrc, agnosticbin));
+
+  add_idle_sink (pipeline, agnosticbin, remove_idle_sink);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_timeout_add_seconds (15, timeout_check, pipeline);
+  g_main_loop_run (loop);
+
+  fail_unless (count_branches (agnosticbin) == 0);
+
+  /* A new consumer rebuilds the encoder */
+  add_idle_sink (pipeline, agnosticbin, quit_on_samples);
+  g_main_loop_run (loop);
+
+  fail_unless (count_branches (agnosticbin) == 1);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  g_object_unref (pipeline);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST
+#define N_SUBSCRIBERS 16
+GST_START_TEST (shared_encoder_subscribers)
+{
+  GstElementFactory *vp8enc = gst_element_factory_find ("vp8enc");
+  GstElement *pipeline, *videotestsrc, *agnosticbin;
+  gint pending = N_SUBSCRIBERS, i;
+  GTimer *timer;
+
+  if (vp8enc == NULL) {
+    GST_WARNING ("vp8enc not available, skipping test");
+    return;
+  }
+
+  gst_object_unref (vp8enc);
+
+  loop = g_main_loop_new (NULL, TRUE);
+  pipeline = gst_pipeline_new (__FUNCTION__);
+  videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  agnosticbin = gst_element_factory_make ("agnosticbin", NULL);
+
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, agnosticbin, NULL);
+  fail_unless (gst_element_link (videotestsrc, agnosticbin));
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  /* Subscribers with the same caps reuse the encoder */
+  timer = g_timer_new ();
+  for (i = 0; i < N_SUBSCRIBERS; i++) {
+    add_ladder_sink (pipeline, agnosticbin, 0, &pending);
+  }
+  GST_INFO ("Linked %d subscribers in %f s", N_SUBSCRIBERS,
+      g_timer_elapsed (timer, NULL));
+  g_timer_destroy (timer);
+
+  g_timeout_add_seconds (10, timeout_check, pipeline);
+  g_main_loop_run (loop);
+
+  fail_unless (count_branches (agnosticbin) == 1);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  g_object_unref (pipeline);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST
+static GstElement *failing_agnosticbin;
+static gint failing_branch_errors;
+
+static void
+failing_consumer_bus_msg (GstBus * bus, GstMessage * msg, gpointer pipe)
+{
+  GstObject *src = GST_MESSAGE_SRC (msg);
+
+  /* The failing consumer and the branch feeding it report the error */
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    if (g_strcmp0 (GST_OBJECT_NAME (src), "failing") == 0) {
+      GST_DEBUG ("Expected consumer error: %" GST_PTR_FORMAT, msg);
+      return;
+    }
+
+    if (gst_object_has_as_ancestor (src,
+            GST_OBJECT (failing_agnosticbin))) {
+      GST_DEBUG ("Expected branch error: %" GST_PTR_FORMAT, msg);
+      g_atomic_int_inc (&failing_branch_errors);
+      return;
+    }
+  }
+
+  bus_msg (bus, msg, pipe);
+}
+
+static void
+healthy_hand_off (GstElement * fakesink, GstBuffer * buf, GstPad * pad,
+    gpointer data)
+{
+  gint *count = data;
+
+  if (g_atomic_int_add (count, 1) == 100) {
+    g_object_set (G_OBJECT (fakesink), "signal-handoffs", FALSE, NULL);
+    g_idle_add (quit_main_loop_idle, loop);
+  }
+}
+
+GST_START_TEST (failing_consumer)
+{
+  GstElement *pipeline, *videotestsrc, *agnosticbin, *identity, *fakesink1,
+      *fakesink2;
+  GstPad *identity_sink, *failed_src, *target;
+  gint count = 0;
+  GstBus *bus;
+
+  loop = g_main_loop_new (NULL, TRUE);
+  pipeline = gst_pipeline_new (__FUNCTION__);
+  videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  agnosticbin = gst_element_factory_make ("agnosticbin", NULL);
+  identity = gst_element_factory_make ("identity", "failing");
+  fakesink1 = gst_element_factory_make ("fakesink", NULL);
+  fakesink2 = gst_element_factory_make ("fakesink", NULL);
+
+  failing_agnosticbin = agnosticbin;
+  failing_branch_errors = 0;
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gst_bus_add_signal_watch (bus);
+  g_signal_connect (bus, "message", G_CALLBACK (failing_consumer_bus_msg),
+      pipeline);
+
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, NULL);
+  g_object_set (G_OBJECT (identity), "error-after", 10, NULL);
+  g_object_set (G_OBJECT (fakesink1), "async", FALSE, "sync", FALSE, NULL);
+  g_object_set (G_OBJECT (fakesink2), "async", FALSE, "sync", FALSE,
+      "signal-handoffs", TRUE, NULL);
+  g_signal_connect (G_OBJECT (fakesink2), "handoff",
+      G_CALLBACK (healthy_hand_off), &count);
+
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, agnosticbin, identity,
+      fakesink1, fakesink2, NULL);
+  fail_unless (gst_element_link (videotestsrc, agnosticbin));
+  fail_unless (gst_element_link_many (agnosticbin, identity, fakesink1,
+          NULL));
+  fail_unless (gst_element_link (agnosticbin, fakesink2));
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_timeout_add_seconds (10, timeout_check, pipeline);
+  g_main_loop_run (loop);
+
+  fail_unless (g_atomic_int_get (&count) > 100);
+
+  /* The flow error reached the branch, which was detached from the output */
+  fail_unless (g_atomic_int_get (&failing_branch_errors) > 0);
+  identity_sink = gst_element_get_static_pad (identity, "sink");
+  failed_src = gst_pad_get_peer (identity_sink);
+  fail_unless (failed_src != NULL);
+  target = gst_ghost_pad_get_target (GST_GHOST_PAD (failed_src));
+  fail_unless (target == NULL);
+  g_object_unref (failed_src);
+  g_object_unref (identity_sink);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_bus_remove_signal_watch (bus);
+  g_object_unref (bus);
+  g_object_unref (pipeline);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST
+static GstStaticPadTemplate keyframe_stats_src =
+GST_STATIC_PAD_TEMPLATE ("src", GST_PAD_SRC, GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static void
+check_keyframe_stats (GstElement * agnosticbin, guint64 * last_requested)
+{
+  GstStructure *stats;
+  guint64 requested;
+
+  g_object_get (agnosticbin, "keyframe-stats", &stats, NULL);
+  fail_unless (stats != NULL);
+  fail_unless (gst_structure_get_uint64 (stats, "requested", &requested));
+  fail_unless (requested >= *last_requested);
+  *last_requested = requested;
+  gst_structure_free (stats);
+}
+
+GST_START_TEST (keyframe_stats_after_input_change)
+{
+  GstElement *agnosticbin = gst_element_factory_make ("agnosticbin", NULL);
+  GstCaps *caps;
+  GstPad *src;
+  guint64 requested = 0;
+  GstSegment segment;
+
+  src = gst_check_setup_src_pad (agnosticbin, &keyframe_stats_src);
+  gst_pad_set_active (src, TRUE);
+  gst_element_set_state (agnosticbin, GST_STATE_PLAYING);
+
+  check_keyframe_stats (agnosticbin, &requested);
+
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  fail_unless (gst_pad_push_event (src, gst_event_new_stream_start ("test")));
+
+  /* Each caps change reconfigures the input of the element */
+  caps = gst_caps_from_string ("video/x-vp8, width=(int)320, height=(int)240");
+  gst_pad_push_event (src, gst_event_new_caps (caps));
+  gst_caps_unref (caps);
+  gst_pad_push_event (src, gst_event_new_segment (&segment));
+  check_keyframe_stats (agnosticbin, &requested);
+
+  caps = gst_caps_from_string ("video/x-vp8, width=(int)640, height=(int)480");
+  gst_pad_push_event (src, gst_event_new_caps (caps));
+  gst_caps_unref (caps);
+  check_keyframe_stats (agnosticbin, &requested);
+
+  caps = gst_caps_from_string ("video/x-vp8, width=(int)320, height=(int)240");
+  gst_pad_push_event (src, gst_event_new_caps (caps));
+  gst_caps_unref (caps);
+  check_keyframe_stats (agnosticbin, &requested);
+
+  gst_element_set_state (agnosticbin, GST_STATE_NULL);
+  gst_pad_set_active (src, FALSE);
+  gst_check_teardown_src_pad (agnosticbin);
+  gst_object_unref (agnosticbin);
+}
+
 GST_END_TEST
 /*
  * End of test cases
@@ -1009,6 +1563,12 @@ agnostic2_suite (void)
   tcase_add_test (tc_chain, add_later);
   tcase_add_test (tc_chain, input_reconfiguration);
   tcase_add_test (tc_chain, encoded_input_n_encoded_output);
+  tcase_add_test (tc_chain, multi_resolution_output);
+  tcase_add_test (tc_chain, bitrate_ladder);
+  tcase_add_test (tc_chain, idle_branch_reclaim);
+  tcase_add_test (tc_chain, shared_encoder_subscribers);
+  tcase_add_test (tc_chain, failing_consumer);
+  tcase_add_test (tc_chain, keyframe_stats_after_input_change);
 
   return s;
 }
@@ -0,0 +1,238 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/check/gstcheck.h>
+#include <gst/gst.h>
+#include <glib.h>
+
+#define N_BUFFERS 300
+#define KEYFRAME_INTERVAL 10
+/* Buffers from this offset on are sent with new caps */
+#define CAPS_CHANGE_OFFSET (N_BUFFERS / 2)
+#define CONSUMER_KEY "consumer"
+
+typedef struct _ConsumerData
+{
+  guint64 last_offset;
+  guint count;
+  guint gaps;
+} ConsumerData;
+
+static void
+bus_msg (GstBus * bus, GstMessage * msg, gpointer data)
+{
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_EOS:
+      g_main_loop_quit (data);
+      break;
+    case GST_MESSAGE_ERROR:
+      fail ("Error received on bus");
+      break;
+    default:
+      break;
+  }
+}
+
+static void
+fakesink_hand_off (GstElement * fakesink, GstBuffer * buf, GstPad * pad,
+    gpointer data)
+{
+  ConsumerData *consumer = g_object_get_data (G_OBJECT (fakesink),
+      CONSUMER_KEY);
+  guint sleep_time = GPOINTER_TO_UINT (data);
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+
+  /* Events are never skipped, even by consumers that lose buffers */
+  fail_unless (caps != NULL);
+  fail_unless (gst_structure_has_field (gst_caps_get_structure (caps, 0),
+          "variant") == (GST_BUFFER_OFFSET (buf) >= CAPS_CHANGE_OFFSET));
+  gst_caps_unref (caps);
+
+  if (consumer->count == 0) {
+    fail_if (GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT));
+  } else if (GST_BUFFER_OFFSET (buf) != consumer->last_offset + 1) {
+    /* After losing data a consumer must resume on a keyframe */
+    fail_if (GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT));
+    consumer->gaps++;
+  }
+
+  consumer->last_offset = GST_BUFFER_OFFSET (buf);
+  consumer->count++;
+
+  if (sleep_time > 0) {
+    g_usleep (sleep_time);
+  }
+}
+
+static gboolean
+push_buffers (gpointer appsrc)
+{
+  GstFlowReturn ret;
+  guint i;
+
+  for (i = 0; i < N_BUFFERS; i++) {
+    GstBuffer *buffer = gst_buffer_new_allocate (NULL, 64, NULL);
+
+    if (i == CAPS_CHANGE_OFFSET) {
+      GstCaps *caps = gst_caps_from_string ("video/x-test, variant=(int)2");
+
+      g_object_set (appsrc, "caps", caps, NULL);
+      gst_caps_unref (caps);
+    }
+
+    GST_BUFFER_PTS (buffer) = i * 40 * GST_MSECOND;
+    GST_BUFFER_OFFSET (buffer) = i;
+
+    if (i % KEYFRAME_INTERVAL != 0) {
+      GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+
+    g_signal_emit_by_name (appsrc, "push-buffer", buffer, &ret);
+    gst_buffer_unref (buffer);
+  }
+
+  g_signal_emit_by_name (appsrc, "end-of-stream", &ret);
+
+  return G_SOURCE_REMOVE;
+}
+
+static GstElement *
+add_consumer (GstElement * pipeline, GstElement * fanout, guint sleep_time)
+{
+  GstElement *fakesink = gst_element_factory_make ("fakesink", NULL);
+
+  g_object_set (fakesink, "sync", FALSE, "async", FALSE, "signal-handoffs",
+      TRUE, NULL);
+  g_object_set_data_full (G_OBJECT (fakesink), CONSUMER_KEY,
+      g_new0 (ConsumerData, 1), g_free);
+  g_signal_connect (fakesink, "handoff", G_CALLBACK (fakesink_hand_off),
+      GUINT_TO_POINTER (sleep_time));
+
+  gst_bin_add (GST_BIN (pipeline), fakesink);
+  fail_unless (gst_element_link (fanout, fakesink));
+
+  return fakesink;
+}
+
+static void
+run_fanout (guint ring_size, guint n_consumers, GstElement ** sinks,
+    guint * sleep_times)
+{
+  GstElement *pipeline, *appsrc, *fanout;
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+  GstCaps *caps;
+  GstBus *bus;
+  guint i;
+
+  pipeline = gst_pipeline_new (__FUNCTION__);
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gst_bus_add_signal_watch (bus);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), loop);
+
+  appsrc = gst_element_factory_make ("appsrc", NULL);
+  fanout = gst_element_factory_make ("ringfanout", NULL);
+
+  caps = gst_caps_from_string ("video/x-test");
+  g_object_set (appsrc, "caps", caps, "format", GST_FORMAT_TIME, NULL);
+  gst_caps_unref (caps);
+  g_object_set (fanout, "ring-size", ring_size, NULL);
+
+  gst_bin_add_many (GST_BIN (pipeline), appsrc, fanout, NULL);
+  fail_unless (gst_element_link (appsrc, fanout));
+
+  for (i = 0; i < n_consumers; i++) {
+    sinks[i] = add_consumer (pipeline, fanout, sleep_times[i]);
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_idle_add (push_buffers, appsrc);
+
+  g_main_loop_run (loop);
+
+  for (i = 0; i < n_consumers; i++) {
+    g_object_ref (sinks[i]);
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_bus_remove_signal_watch (bus);
+  g_object_unref (bus);
+  g_object_unref (pipeline);
+  g_main_loop_unref (loop);
+}
+
+#define N_CONSUMERS 32
+
+GST_START_TEST (fan_out)
+{
+  GstElement *sinks[N_CONSUMERS];
+  guint sleep_times[N_CONSUMERS] = { 0 };
+  guint i;
+
+  /* Leave room for the serialized events too */
+  run_fanout (N_BUFFERS + 16, N_CONSUMERS, sinks, sleep_times);
+
+  /* The ring holds the whole stream, nothing can be lost */
+  for (i = 0; i < N_CONSUMERS; i++) {
+    ConsumerData *consumer = g_object_get_data (G_OBJECT (sinks[i]),
+        CONSUMER_KEY);
+
+    fail_unless (consumer->count == N_BUFFERS);
+    fail_unless (consumer->gaps == 0);
+    g_object_unref (sinks[i]);
+  }
+}
+
+GST_END_TEST;
+
+GST_START_TEST (slow_consumer)
+{
+  GstElement *sinks[2];
+  guint sleep_times[2] = { 0, 5000 };
+  ConsumerData *slow;
+
+  run_fanout (KEYFRAME_INTERVAL * 2, 2, sinks, sleep_times);
+
+  slow = g_object_get_data (G_OBJECT (sinks[1]), CONSUMER_KEY);
+  GST_INFO ("Slow consumer received %u buffers with %u gaps", slow->count,
+      slow->gaps);
+
+  /* Keyframe and caps checks are done on every received buffer */
+  fail_unless (slow->count > 0);
+  fail_unless (slow->last_offset >= CAPS_CHANGE_OFFSET);
+
+  g_object_unref (sinks[0]);
+  g_object_unref (sinks[1]);
+}
+
+GST_END_TEST;
+
+static Suite *
+ring_fanout_suite (void)
+{
+  Suite *s = suite_create ("kmsringfanout");
+  TCase *tc_chain = tcase_create ("element");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, fan_out);
+  tcase_add_test (tc_chain, slow_consumer);
+
+  return s;
+}
+
+GST_CHECK_MAIN (ring_fanout);
@@ -0,0 +1,370 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#include "kmsutils.h"
+#include "kmsremb.h"
+
+#include <gst/check/gstcheck.h>
+#include <gst/rtp/gstrtcpbuffer.h>
+#include <gst/rtp/gstrtpbuffer.h>
+#include <glib.h>
+#include <errno.h>
+
+#define WARMUP_BUFFERS 100
+#define COUNTED_BUFFERS 1000
+#define FRAME_DURATION (33 * GST_MSECOND)
+
+/*
+ * Counting allocator: the heap functions are interposed so that allocations
+ * made by the current thread can be counted while data flows.
+ */
+#ifdef __GLIBC__
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void *__libc_memalign (size_t alignment, size_t size);
+
+static __thread gboolean counting;
+static __thread guint allocations;
+
+void *
+malloc (size_t size)
+{
+  allocations += counting;
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+  allocations += counting;
+  return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+  allocations += counting;
+  return __libc_realloc (ptr, size);
+}
+
+int
+posix_memalign (void **memptr, size_t alignment, size_t size)
+{
+  allocations += counting;
+  *memptr = __libc_memalign (alignment, size);
+
+  return *memptr == NULL ? ENOMEM : 0;
+}
+
+static void
+start_counting (void)
+{
+  allocations = 0;
+  counting = TRUE;
+}
+
+static guint
+stop_counting (void)
+{
+  counting = FALSE;
+
+  return allocations;
+}
+
+#endif /* __GLIBC__ */
+
+static GstFlowReturn
+discard_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  gst_buffer_unref (buffer);
+
+  return GST_FLOW_OK;
+}
+
+static void
+start_stream (GstPad * src)
+{
+  GstCaps *caps = gst_caps_from_string ("video/x-vp8");
+  GstSegment segment;
+
+  gst_pad_push_event (src, gst_event_new_stream_start ("allocations"));
+  gst_pad_push_event (src, gst_event_new_caps (caps));
+  gst_caps_unref (caps);
+
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (src, gst_event_new_segment (&segment));
+}
+
+static GstBuffer **
+create_buffers (guint n)
+{
+  GstBuffer **buffers = g_new (GstBuffer *, n);
+  guint i;
+
+  for (i = 0; i < n; i++) {
+    buffers[i] = gst_buffer_new_allocate (NULL, 1000, NULL);
+    GST_BUFFER_PTS (buffers[i]) = i * FRAME_DURATION;
+
+    if (i % 100 != 0) {
+      GST_BUFFER_FLAG_SET (buffers[i], GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+  }
+
+  return buffers;
+}
+
+static void
+push_buffers (GstPad * src, GstBuffer ** buffers, guint first, guint last)
+{
+  guint i;
+
+  for (i = first; i < last; i++) {
+    fail_unless (gst_pad_push (src, buffers[i]) == GST_FLOW_OK);
+  }
+}
+
+GST_START_TEST (bitrate_filter_steady_state)
+{
+#ifdef __GLIBC__
+  GstElement *filter = gst_element_factory_make ("bitratefilter", NULL);
+  GstPad *src = gst_pad_new ("src", GST_PAD_SRC);
+  GstPad *sink = gst_pad_new ("sink", GST_PAD_SINK);
+  GstBuffer **buffers = create_buffers (WARMUP_BUFFERS + COUNTED_BUFFERS);
+  GstPad *filter_sink, *filter_src;
+
+  fail_unless (filter != NULL);
+  filter_sink = gst_element_get_static_pad (filter, "sink");
+  filter_src = gst_element_get_static_pad (filter, "src");
+
+  gst_pad_set_chain_function (sink, discard_chain);
+  gst_pad_set_active (src, TRUE);
+  gst_pad_set_active (sink, TRUE);
+  fail_unless (gst_pad_link (src, filter_sink) == GST_PAD_LINK_OK);
+  fail_unless (gst_pad_link (filter_src, sink) == GST_PAD_LINK_OK);
+  gst_element_set_state (filter, GST_STATE_PLAYING);
+
+  start_stream (src);
+  push_buffers (src, buffers, 0, WARMUP_BUFFERS);
+
+  start_counting ();
+  push_buffers (src, buffers, WARMUP_BUFFERS,
+      WARMUP_BUFFERS + COUNTED_BUFFERS);
+  fail_unless_equals_int (stop_counting (), 0);
+
+  gst_element_set_state (filter, GST_STATE_NULL);
+  gst_pad_set_active (src, FALSE);
+  gst_pad_set_active (sink, FALSE);
+  g_object_unref (filter_sink);
+  g_object_unref (filter_src);
+  g_object_unref (filter);
+  g_object_unref (src);
+  g_object_unref (sink);
+  g_free (buffers);
+#endif
+}
+
+GST_END_TEST
+#define N_REMB_EVENTS 100
+GST_START_TEST (pad_probes_steady_state)
+{
+#ifdef __GLIBC__
+  GstPad *src = gst_pad_new ("src", GST_PAD_SRC);
+  GstPad *sink = gst_pad_new ("sink", GST_PAD_SINK);
+  GstBuffer **buffers = create_buffers (WARMUP_BUFFERS + COUNTED_BUFFERS);
+  GstEvent *rembs[N_REMB_EVENTS];
+  KmsKeyframeCoordinator *coordinator;
+  RembEventManager *manager;
+  guint i;
+
+  gst_pad_set_chain_function (sink, discard_chain);
+  gst_pad_set_active (src, TRUE);
+  gst_pad_set_active (sink, TRUE);
+  fail_unless (gst_pad_link (src, sink) == GST_PAD_LINK_OK);
+
+  /* Probes installed by the kms elements on their pads */
+  kms_utils_drop_until_keyframe (sink, FALSE);
+  kms_utils_manage_gaps (sink);
+  coordinator = kms_utils_keyframe_coordinator_create (sink);
+  manager = kms_utils_remb_event_manager_create (src);
+
+  for (i = 0; i < N_REMB_EVENTS; i++) {
+    rembs[i] = kms_utils_remb_event_upstream_new (300000 + (i % 10) * 1000,
+        i % 2);
+  }
+
+  start_stream (src);
+  push_buffers (src, buffers, 0, WARMUP_BUFFERS);
+  gst_pad_push_event (sink, kms_utils_remb_event_upstream_new (300000, 0));
+  gst_pad_push_event (sink, kms_utils_remb_event_upstream_new (300000, 1));
+
+  start_counting ();
+  push_buffers (src, buffers, WARMUP_BUFFERS,
+      WARMUP_BUFFERS + COUNTED_BUFFERS);
+  for (i = 0; i < N_REMB_EVENTS; i++) {
+    gst_pad_push_event (sink, rembs[i]);
+  }
+  fail_unless_equals_int (stop_counting (), 0);
+
+  kms_utils_remb_event_manager_destroy (manager);
+  kms_utils_keyframe_coordinator_destroy (coordinator);
+  gst_pad_set_active (src, FALSE);
+  gst_pad_set_active (sink, FALSE);
+  g_object_unref (src);
+  g_object_unref (sink);
+  g_free (buffers);
+#endif
+}
+
+GST_END_TEST
+#define REMOTE_SSRC 1234
+#define WARMUP_RTCP 10
+#define COUNTED_RTCP 100
+static GstBuffer **
+create_rtp_buffers (guint n)
+{
+  GstBuffer **buffers = g_new (GstBuffer *, n);
+  guint i;
+
+  for (i = 0; i < n; i++) {
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+
+    buffers[i] = gst_rtp_buffer_new_allocate (1000, 0, 0);
+    gst_rtp_buffer_map (buffers[i], GST_MAP_WRITE, &rtp);
+    gst_rtp_buffer_set_ssrc (&rtp, REMOTE_SSRC);
+    gst_rtp_buffer_set_seq (&rtp, i);
+    gst_rtp_buffer_set_timestamp (&rtp, i * 3000);
+    gst_rtp_buffer_unmap (&rtp);
+    GST_BUFFER_PTS (buffers[i]) = i * FRAME_DURATION;
+  }
+
+  return buffers;
+}
+
+static GstBuffer *
+create_rtcp_rr (void)
+{
+  GstRTCPBuffer rtcp = { NULL, };
+  GstBuffer *buffer = gst_rtcp_buffer_new (1400);
+  GstRTCPPacket packet;
+
+  gst_rtcp_buffer_map (buffer, GST_MAP_READWRITE, &rtcp);
+  fail_unless (gst_rtcp_buffer_add_packet (&rtcp, GST_RTCP_TYPE_RR, &packet));
+  gst_rtcp_packet_rr_set_ssrc (&packet, REMOTE_SSRC + 1);
+  fail_unless (gst_rtcp_packet_add_rb (&packet, REMOTE_SSRC, 0, 0, 0, 0, 0,
+          0));
+  gst_rtcp_buffer_unmap (&rtcp);
+
+  return buffer;
+}
+
+static void
+send_rtcp (GObject * rtpsession, GstBuffer * rtcp)
+{
+  gboolean ret;
+
+  g_signal_emit_by_name (rtpsession, "on-sending-rtcp", rtcp, FALSE, &ret);
+}
+
+GST_START_TEST (remb_local_steady_state)
+{
+#ifdef __GLIBC__
+  GstElement *rtpbin = gst_element_factory_make ("rtpbin", NULL);
+  GstPad *src = gst_pad_new ("src", GST_PAD_SRC);
+  GstPad *sink = gst_pad_new ("sink", GST_PAD_SINK);
+  GstBuffer **buffers = create_rtp_buffers (WARMUP_BUFFERS + COUNTED_BUFFERS);
+  GstBuffer *rtcps[WARMUP_RTCP + COUNTED_RTCP];
+  guint buffers_per_rtcp = COUNTED_BUFFERS / COUNTED_RTCP;
+  GstRTCPBuffer rtcp = { NULL, };
+  GstRTCPPacket packet;
+  GObject *rtpsession;
+  KmsRembLocal *rl;
+  GstPad *pad;
+  guint i;
+
+  fail_unless (rtpbin != NULL);
+  pad = gst_element_get_request_pad (rtpbin, "send_rtp_sink_1");
+  g_object_unref (pad);
+  g_signal_emit_by_name (rtpbin, "get-internal-session", 1, &rtpsession);
+  fail_unless (rtpsession != NULL);
+
+  gst_pad_set_chain_function (sink, discard_chain);
+  gst_pad_set_active (src, TRUE);
+  gst_pad_set_active (sink, TRUE);
+  fail_unless (gst_pad_link (src, sink) == GST_PAD_LINK_OK);
+
+  rl = kms_remb_local_create (rtpsession, REMOTE_SSRC, 0,
+      KMS_CONGESTION_CONTROL_LOSS, sink);
+
+  for (i = 0; i < WARMUP_RTCP + COUNTED_RTCP; i++) {
+    rtcps[i] = create_rtcp_rr ();
+  }
+
+  start_stream (src);
+  for (i = 0; i < WARMUP_RTCP; i++) {
+    push_buffers (src, buffers, i * WARMUP_BUFFERS / WARMUP_RTCP,
+        (i + 1) * WARMUP_BUFFERS / WARMUP_RTCP);
+    send_rtcp (rtpsession, rtcps[i]);
+  }
+
+  start_counting ();
+  for (i = 0; i < COUNTED_RTCP; i++) {
+    guint first = WARMUP_BUFFERS + i * buffers_per_rtcp;
+
+    push_buffers (src, buffers, first, first + buffers_per_rtcp);
+    send_rtcp (rtpsession, rtcps[WARMUP_RTCP + i]);
+  }
+  fail_unless_equals_int (stop_counting (), 0);
+
+  /* The estimation must still be appended to the outgoing RTCP */
+  gst_rtcp_buffer_map (rtcps[WARMUP_RTCP + COUNTED_RTCP - 1], GST_MAP_READ,
+      &rtcp);
+  fail_unless (gst_rtcp_buffer_get_first_packet (&rtcp, &packet));
+  fail_unless (gst_rtcp_packet_move_to_next (&packet));
+  fail_unless (gst_rtcp_packet_get_type (&packet) == GST_RTCP_TYPE_PSFB);
+  gst_rtcp_buffer_unmap (&rtcp);
+
+  for (i = 0; i < WARMUP_RTCP + COUNTED_RTCP; i++) {
+    gst_buffer_unref (rtcps[i]);
+  }
+
+  kms_remb_local_destroy (rl);
+  g_object_unref (rtpsession);
+  gst_pad_set_active (src, FALSE);
+  gst_pad_set_active (sink, FALSE);
+  g_object_unref (src);
+  g_object_unref (sink);
+  g_object_unref (rtpbin);
+  g_free (buffers);
+#endif
+}
+
+GST_END_TEST
+/* Suite initialization */
+static Suite *
+allocations_suite (void)
+{
+  Suite *s = suite_create ("allocations");
+  TCase *tc_chain = tcase_create ("element");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, bitrate_filter_steady_state);
+  tcase_add_test (tc_chain, pad_probes_steady_state);
+  tcase_add_test (tc_chain, remb_local_steady_state);
+
+  return s;
+}
+
+GST_CHECK_MAIN (allocations);
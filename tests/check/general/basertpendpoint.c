@@ -0,0 +1,499 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmsbasertpendpoint.h"
+#include "kmsirtpconnection.h"
+
+#include <gst/check/gstcheck.h>
+#include <gst/rtp/gstrtpbuffer.h>
+#include <gst/rtp/gstrtcpbuffer.h>
+#include <gst/gst.h>
+#include <glib.h>
+
+#define SENT_SSRC 0x1234
+#define OTHER_SSRC 0x5678
+
+/* Connection with unlinked pads, nothing is ever sent through it */
+typedef struct _KmsTestRtpConnection
+{
+  GObject parent;
+
+  GstPad *rtp_sink, *rtp_src, *rtcp_sink, *rtcp_src;
+} KmsTestRtpConnection;
+
+typedef struct _KmsTestRtpConnectionClass
+{
+  GObjectClass parent_class;
+} KmsTestRtpConnectionClass;
+
+static GType kms_test_rtp_connection_get_type (void);
+
+static void kms_test_rtp_connection_interface_init (KmsIRtpConnectionInterface
+    * iface);
+
+G_DEFINE_TYPE_WITH_CODE (KmsTestRtpConnection, kms_test_rtp_connection,
+    G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (KMS_TYPE_I_RTP_CONNECTION,
+        kms_test_rtp_connection_interface_init));
+
+static GstPad *
+create_pad (const gchar * name, GstPadDirection direction)
+{
+  GstPad *pad = gst_pad_new (name, direction);
+
+  gst_object_ref_sink (pad);
+
+  return pad;
+}
+
+static void
+kms_test_rtp_connection_add (KmsIRtpConnection * base_conn, GstBin * bin,
+    gboolean local_offer)
+{
+}
+
+static GstPad *
+kms_test_rtp_connection_request_rtp_sink (KmsIRtpConnection * base_conn)
+{
+  return gst_object_ref (((KmsTestRtpConnection *) base_conn)->rtp_sink);
+}
+
+static GstPad *
+kms_test_rtp_connection_request_rtp_src (KmsIRtpConnection * base_conn)
+{
+  return gst_object_ref (((KmsTestRtpConnection *) base_conn)->rtp_src);
+}
+
+static GstPad *
+kms_test_rtp_connection_request_rtcp_sink (KmsIRtpConnection * base_conn)
+{
+  return gst_object_ref (((KmsTestRtpConnection *) base_conn)->rtcp_sink);
+}
+
+static GstPad *
+kms_test_rtp_connection_request_rtcp_src (KmsIRtpConnection * base_conn)
+{
+  return gst_object_ref (((KmsTestRtpConnection *) base_conn)->rtcp_src);
+}
+
+static void
+kms_test_rtp_connection_finalize (GObject * object)
+{
+  KmsTestRtpConnection *self = (KmsTestRtpConnection *) object;
+
+  gst_object_unref (self->rtp_sink);
+  gst_object_unref (self->rtp_src);
+  gst_object_unref (self->rtcp_sink);
+  gst_object_unref (self->rtcp_src);
+
+  G_OBJECT_CLASS (kms_test_rtp_connection_parent_class)->finalize (object);
+}
+
+static void
+kms_test_rtp_connection_class_init (KmsTestRtpConnectionClass * klass)
+{
+  G_OBJECT_CLASS (klass)->finalize = kms_test_rtp_connection_finalize;
+}
+
+static void
+kms_test_rtp_connection_interface_init (KmsIRtpConnectionInterface * iface)
+{
+  iface->add = kms_test_rtp_connection_add;
+  iface->request_rtp_sink = kms_test_rtp_connection_request_rtp_sink;
+  iface->request_rtp_src = kms_test_rtp_connection_request_rtp_src;
+  iface->request_rtcp_sink = kms_test_rtp_connection_request_rtcp_sink;
+  iface->request_rtcp_src = kms_test_rtp_connection_request_rtcp_src;
+}
+
+static void
+kms_test_rtp_connection_init (KmsTestRtpConnection * self)
+{
+  self->rtp_sink = create_pad ("rtp_sink", GST_PAD_SINK);
+  self->rtp_src = create_pad ("rtp_src", GST_PAD_SRC);
+  self->rtcp_sink = create_pad ("rtcp_sink", GST_PAD_SINK);
+  self->rtcp_src = create_pad ("rtcp_src", GST_PAD_SRC);
+}
+
+/* Endpoint without transport, only its RTP sessions are used */
+typedef struct _KmsTestRtpEndpoint
+{
+  KmsBaseRtpEndpoint parent;
+
+  KmsIRtpConnection *conn;
+} KmsTestRtpEndpoint;
+
+typedef struct _KmsTestRtpEndpointClass
+{
+  KmsBaseRtpEndpointClass parent_class;
+} KmsTestRtpEndpointClass;
+
+static GType kms_test_rtp_endpoint_get_type (void);
+
+G_DEFINE_TYPE (KmsTestRtpEndpoint, kms_test_rtp_endpoint,
+    KMS_TYPE_BASE_RTP_ENDPOINT);
+
+static KmsIRtpConnection *
+kms_test_rtp_endpoint_get_connection (KmsBaseRtpEndpoint * base_rtp_endpoint,
+    const gchar * name)
+{
+  KmsTestRtpEndpoint *self = (KmsTestRtpEndpoint *) base_rtp_endpoint;
+
+  /* Only the video media of the pattern is used */
+  if (g_strcmp0 (name, VIDEO_STREAM_NAME) != 0) {
+    return NULL;
+  }
+
+  if (self->conn == NULL) {
+    self->conn = g_object_new (kms_test_rtp_connection_get_type (), NULL);
+  }
+
+  return self->conn;
+}
+
+static void
+kms_test_rtp_endpoint_finalize (GObject * object)
+{
+  KmsTestRtpEndpoint *self = (KmsTestRtpEndpoint *) object;
+
+  g_clear_object (&self->conn);
+
+  G_OBJECT_CLASS (kms_test_rtp_endpoint_parent_class)->finalize (object);
+}
+
+static void
+kms_test_rtp_endpoint_class_init (KmsTestRtpEndpointClass * klass)
+{
+  KmsBaseRtpEndpointClass *base_rtp_class = KMS_BASE_RTP_ENDPOINT_CLASS (klass);
+
+  G_OBJECT_CLASS (klass)->finalize = kms_test_rtp_endpoint_finalize;
+
+  base_rtp_class->get_connection = kms_test_rtp_endpoint_get_connection;
+  base_rtp_class->create_connection = kms_test_rtp_endpoint_get_connection;
+}
+
+static void
+kms_test_rtp_endpoint_init (KmsTestRtpEndpoint * self)
+{
+}
+
+static const gchar *pattern_sdp_str = "v=0\r\n"
+    "o=- 0 0 IN IP4 0.0.0.0\r\n"
+    "s=TestSession\r\n"
+    "c=IN IP4 0.0.0.0\r\n"
+    "t=0 0\r\n"
+    "m=video 1 RTP/AVP 96\r\n" "a=rtpmap:96 VP8/90000\r\n";
+
+/* Creates an endpoint with its video session */
+static GstElement *
+create_endpoint (void)
+{
+  GstElement *endpoint = g_object_new (kms_test_rtp_endpoint_get_type (),
+      NULL);
+  GstSDPMessage *pattern, *offer = NULL;
+
+  fail_unless (gst_sdp_message_new (&pattern) == GST_SDP_OK);
+  fail_unless (gst_sdp_message_parse_buffer ((const guint8 *) pattern_sdp_str,
+          strlen (pattern_sdp_str), pattern) == GST_SDP_OK);
+  g_object_set (endpoint, "pattern-sdp", pattern, NULL);
+  gst_sdp_message_free (pattern);
+
+  /* There is no connection to put in the offer, but the session is created */
+  g_signal_emit_by_name (endpoint, "generate-offer", &offer);
+  if (offer != NULL) {
+    gst_sdp_message_free (offer);
+  }
+
+  return endpoint;
+}
+
+static const gchar *answer_sdp_str = "v=0\r\n"
+    "o=- 0 0 IN IP4 0.0.0.0\r\n"
+    "s=TestSession\r\n"
+    "c=IN IP4 0.0.0.0\r\n"
+    "t=0 0\r\n"
+    "m=video 1 RTP/AVP 96\r\n" "a=rtpmap:96 VP8/90000\r\n";
+
+/* Completes the negotiation started by create_endpoint */
+static void
+process_answer (GstElement * endpoint)
+{
+  GstSDPMessage *answer;
+
+  fail_unless (gst_sdp_message_new (&answer) == GST_SDP_OK);
+  fail_unless (gst_sdp_message_parse_buffer ((const guint8 *) answer_sdp_str,
+          strlen (answer_sdp_str), answer) == GST_SDP_OK);
+  g_signal_emit_by_name (endpoint, "process-answer", answer);
+  gst_sdp_message_free (answer);
+}
+
+static GstCaps *
+request_pt_map (GstElement * endpoint, guint pt)
+{
+  GstElement *rtpbin =
+      kms_base_rtp_endpoint_get_rtpbin (KMS_BASE_RTP_ENDPOINT (endpoint));
+  GstCaps *caps = NULL;
+
+  g_signal_emit_by_name (rtpbin, "request-pt-map", VIDEO_RTP_SESSION, pt,
+      &caps);
+  fail_unless (caps != NULL);
+
+  return caps;
+}
+
+static void
+check_feedback (const GstStructure * st, gboolean fir, gboolean pli)
+{
+  gboolean value;
+
+  fail_unless (gst_structure_get_boolean (st, "rtcp-fb-ccm-fir", &value));
+  fail_unless (value == fir);
+  fail_unless (gst_structure_get_boolean (st, "rtcp-fb-nack-pli", &value));
+  fail_unless (value == pli);
+}
+
+static GObject *
+get_video_session (GstElement * endpoint)
+{
+  GstElement *rtpbin =
+      kms_base_rtp_endpoint_get_rtpbin (KMS_BASE_RTP_ENDPOINT (endpoint));
+  GObject *rtpsession;
+
+  g_signal_emit_by_name (rtpbin, "get-internal-session", VIDEO_RTP_SESSION,
+      &rtpsession);
+  fail_unless (rtpsession != NULL);
+
+  return rtpsession;
+}
+
+static void
+send_rtp (GstElement * endpoint, guint ssrc)
+{
+  GstElement *rtpbin =
+      kms_base_rtp_endpoint_get_rtpbin (KMS_BASE_RTP_ENDPOINT (endpoint));
+  GstPad *pad = gst_element_get_static_pad (rtpbin, VIDEO_RTPBIN_SEND_RTP_SINK);
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  GstSegment segment;
+  GstBuffer *buffer;
+  GstCaps *caps;
+
+  fail_unless (pad != NULL);
+
+  caps = gst_caps_from_string ("application/x-rtp, media=(string)video, "
+      "clock-rate=(int)90000, encoding-name=(string)VP8, payload=(int)96");
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_send_event (pad, gst_event_new_stream_start ("test"));
+  gst_pad_send_event (pad, gst_event_new_caps (caps));
+  gst_pad_send_event (pad, gst_event_new_segment (&segment));
+  gst_caps_unref (caps);
+
+  buffer = gst_rtp_buffer_new_allocate (10, 0, 0);
+  gst_rtp_buffer_map (buffer, GST_MAP_WRITE, &rtp);
+  gst_rtp_buffer_set_ssrc (&rtp, ssrc);
+  gst_rtp_buffer_set_payload_type (&rtp, 96);
+  gst_rtp_buffer_unmap (&rtp);
+  GST_BUFFER_PTS (buffer) = 0;
+
+  /* Nothing is linked downstream, the session counts it anyway */
+  gst_pad_chain (pad, buffer);
+  g_object_unref (pad);
+}
+
+static void
+receive_feedback (GObject * rtpsession, guint type, guint fbtype,
+    guint media_ssrc, GstBuffer * fci)
+{
+  g_signal_emit_by_name (rtpsession, "on-feedback-rtcp", type, fbtype,
+      OTHER_SSRC, media_ssrc, fci);
+}
+
+static GstStructure *
+get_ssrc_stats (GstElement * endpoint, guint ssrc)
+{
+  GstStructure *stats, *ret = NULL;
+  const GstStructure *session;
+  const GValue *value;
+  gchar *name;
+
+  g_object_get (endpoint, "stats", &stats, NULL);
+  fail_unless (gst_structure_has_name (stats, "rtp-stats"));
+
+  value = gst_structure_get_value (stats, VIDEO_STREAM_NAME);
+  fail_unless (value != NULL && GST_VALUE_HOLDS_STRUCTURE (value));
+  session = gst_value_get_structure (value);
+
+  name = g_strdup_printf ("ssrc-%u", ssrc);
+  value = gst_structure_get_value (session, name);
+  if (value != NULL) {
+    ret = gst_structure_copy (gst_value_get_structure (value));
+  }
+  g_free (name);
+
+  gst_structure_free (stats);
+
+  return ret;
+}
+
+GST_START_TEST (stats_empty)
+{
+  GstElement *endpoint = g_object_new (kms_test_rtp_endpoint_get_type (),
+      NULL);
+  GstStructure *stats;
+
+  g_object_get (endpoint, "stats", &stats, NULL);
+  fail_unless (gst_structure_has_name (stats, "rtp-stats"));
+  fail_unless_equals_int (gst_structure_n_fields (stats), 0);
+  gst_structure_free (stats);
+
+  g_object_unref (endpoint);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (stats_per_ssrc)
+{
+  GstElement *endpoint = create_endpoint ();
+  GObject *rtpsession = get_video_session (endpoint);
+  GstStructure *ssrc_stats;
+  GstBuffer *fci;
+  guint8 fir[8] = { 0, };
+  guint64 packets;
+  guint count;
+
+  /* No RTCP is sent before PLAYING */
+  fail_unless (gst_element_set_state (endpoint, GST_STATE_PAUSED) !=
+      GST_STATE_CHANGE_FAILURE);
+
+  send_rtp (endpoint, SENT_SSRC);
+
+  receive_feedback (rtpsession, GST_RTCP_TYPE_PSFB, GST_RTCP_PSFB_TYPE_PLI,
+      SENT_SSRC, NULL);
+  receive_feedback (rtpsession, GST_RTCP_TYPE_RTPFB,
+      GST_RTCP_RTPFB_TYPE_NACK, SENT_SSRC, NULL);
+  /* Feedback about other streams is not counted for this one */
+  receive_feedback (rtpsession, GST_RTCP_TYPE_PSFB, GST_RTCP_PSFB_TYPE_PLI,
+      OTHER_SSRC, NULL);
+
+  /* FIR carries its targets in the FCI */
+  GST_WRITE_UINT32_BE (fir, SENT_SSRC);
+  fci = gst_buffer_new_wrapped (g_memdup (fir, sizeof (fir)), sizeof (fir));
+  receive_feedback (rtpsession, GST_RTCP_TYPE_PSFB, GST_RTCP_PSFB_TYPE_FIR, 0,
+      fci);
+  gst_buffer_unref (fci);
+
+  /* Built on the first read, before any RTCP */
+  ssrc_stats = get_ssrc_stats (endpoint, SENT_SSRC);
+  fail_unless (ssrc_stats != NULL);
+  fail_unless (gst_structure_has_name (ssrc_stats, "outbound-rtp"));
+  fail_unless (gst_structure_get_uint64 (ssrc_stats, "packets", &packets));
+  fail_unless_equals_uint64 (packets, 1);
+  fail_unless (gst_structure_get_uint (ssrc_stats, "pli-count", &count));
+  fail_unless_equals_int (count, 1);
+  fail_unless (gst_structure_get_uint (ssrc_stats, "nack-count", &count));
+  fail_unless_equals_int (count, 1);
+  fail_unless (gst_structure_get_uint (ssrc_stats, "fir-count", &count));
+  fail_unless_equals_int (count, 1);
+  gst_structure_free (ssrc_stats);
+
+  fail_unless (get_ssrc_stats (endpoint, OTHER_SSRC) == NULL);
+
+  /* Kept until the next RTCP interval */
+  receive_feedback (rtpsession, GST_RTCP_TYPE_PSFB, GST_RTCP_PSFB_TYPE_PLI,
+      SENT_SSRC, NULL);
+  ssrc_stats = get_ssrc_stats (endpoint, SENT_SSRC);
+  fail_unless (gst_structure_get_uint (ssrc_stats, "pli-count", &count));
+  fail_unless_equals_int (count, 1);
+  gst_structure_free (ssrc_stats);
+
+  g_object_unref (rtpsession);
+  gst_element_set_state (endpoint, GST_STATE_NULL);
+  g_object_unref (endpoint);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (pt_map)
+{
+  GstElement *endpoint = create_endpoint ();
+  const GstStructure *st;
+  GstCaps *caps;
+  gint value;
+
+  process_answer (endpoint);
+
+  /* Negotiated payload type */
+  caps = request_pt_map (endpoint, 96);
+  st = gst_caps_get_structure (caps, 0);
+  fail_unless (gst_structure_has_name (st, "application/x-rtp"));
+  fail_unless_equals_string (gst_structure_get_string (st, "media"),
+      VIDEO_STREAM_NAME);
+  fail_unless_equals_string (gst_structure_get_string (st, "encoding-name"),
+      "VP8-DRAFT-IETF-01");
+  fail_unless (gst_structure_get_int (st, "payload", &value));
+  fail_unless_equals_int (value, 96);
+  fail_unless (gst_structure_get_int (st, "clock-rate", &value));
+  fail_unless_equals_int (value, 90000);
+  check_feedback (st, FALSE, FALSE);
+  gst_caps_unref (caps);
+
+  /* Unknown payload types only get the payload and the feedback */
+  caps = request_pt_map (endpoint, 100);
+  st = gst_caps_get_structure (caps, 0);
+  fail_unless (gst_structure_get_int (st, "payload", &value));
+  fail_unless_equals_int (value, 100);
+  fail_if (gst_structure_has_field (st, "encoding-name"));
+  gst_caps_unref (caps);
+
+  /* Out of the table */
+  caps = request_pt_map (endpoint, 200);
+  st = gst_caps_get_structure (caps, 0);
+  fail_unless (gst_structure_get_int (st, "payload", &value));
+  fail_unless_equals_int (value, 200);
+  fail_if (gst_structure_has_field (st, "encoding-name"));
+  gst_caps_unref (caps);
+
+  /* Feedback set after the negotiation is seen by later requests */
+  g_object_set (endpoint, "rtcp-fir", TRUE, "rtcp-pli", TRUE, NULL);
+  caps = request_pt_map (endpoint, 96);
+  check_feedback (gst_caps_get_structure (caps, 0), TRUE, TRUE);
+  gst_caps_unref (caps);
+
+  gst_element_set_state (endpoint, GST_STATE_NULL);
+  g_object_unref (endpoint);
+}
+
+GST_END_TEST;
+
+static Suite *
+basertpendpoint_suite (void)
+{
+  Suite *s = suite_create ("basertpendpoint");
+  TCase *tc_chain = tcase_create ("stats");
+  TCase *tc_pt_map = tcase_create ("pt_map");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, stats_empty);
+  tcase_add_test (tc_chain, stats_per_ssrc);
+
+  suite_add_tcase (s, tc_pt_map);
+  tcase_add_test (tc_pt_map, pt_map);
+
+  return s;
+}
+
+GST_CHECK_MAIN (basertpendpoint);
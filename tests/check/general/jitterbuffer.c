@@ -0,0 +1,192 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmsjitterbufferprofile.h"
+
+#include <gst/check/gstcheck.h>
+#include <gst/gst.h>
+#include <glib.h>
+
+#define VIDEO_CLOCK_RATE 90000
+#define MIN_LATENCY 20
+#define MAX_LATENCY 1000
+
+/* jitter in ms, rtt in ms or 0 if there is no report block */
+static GstStructure *
+create_source_stats (guint jitter, guint rtt)
+{
+  GstStructure *stats;
+
+  stats = gst_structure_new ("application/x-rtp-source-stats",
+      "clock-rate", G_TYPE_INT, VIDEO_CLOCK_RATE,
+      "jitter", G_TYPE_UINT, jitter * VIDEO_CLOCK_RATE / 1000,
+      "have-rb", G_TYPE_BOOLEAN, rtt > 0, NULL);
+
+  if (rtt > 0) {
+    gst_structure_set (stats, "rb-round-trip", G_TYPE_UINT,
+        (guint) gst_util_uint64_scale_int_ceil (rtt, 65536, 1000), NULL);
+  }
+
+  return stats;
+}
+
+static guint
+get_latency (guint jitter, guint rtt, guint latency, gboolean retransmission,
+    guint min, guint max)
+{
+  GstStructure *stats = create_source_stats (jitter, rtt);
+  guint ret;
+
+  ret = kms_jitter_buffer_get_adaptive_latency (stats, latency,
+      retransmission, min, max);
+  gst_structure_free (stats);
+
+  return ret;
+}
+
+GST_START_TEST (grow_on_jitter_spike)
+{
+  /* Grows to 4 times the jitter at once */
+  fail_unless_equals_int (get_latency (100, 0, 100, FALSE, MIN_LATENCY,
+          MAX_LATENCY), 400);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (shrink_slowly)
+{
+  /* Moves 1/8 of the way to 4 times the jitter */
+  fail_unless_equals_int (get_latency (10, 0, 200, FALSE, MIN_LATENCY,
+          MAX_LATENCY), 180);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (clamp_to_bounds)
+{
+  fail_unless_equals_int (get_latency (1000, 0, 100, FALSE, MIN_LATENCY,
+          MAX_LATENCY), MAX_LATENCY);
+  /* Bounds can change while the buffer is running */
+  fail_unless_equals_int (get_latency (0, 0, 60, FALSE, 100, MAX_LATENCY),
+      100);
+  fail_unless_equals_int (get_latency (100, 0, 400, FALSE, MIN_LATENCY, 300),
+      300);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (ignore_small_changes)
+{
+  /* Target is 41 ms, not worth changing */
+  fail_unless_equals_int (get_latency (10, 0, 42, FALSE, MIN_LATENCY,
+          MAX_LATENCY), 0);
+  fail_unless_equals_int (get_latency (10, 0, 40, FALSE, MIN_LATENCY,
+          MAX_LATENCY), 0);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (round_trip_with_retransmission)
+{
+  /* Retransmitted packets need the round trip on top of the jitter */
+  fail_unless_equals_int (get_latency (10, 100, 100, TRUE, MIN_LATENCY,
+          MAX_LATENCY), 140);
+  /* Without retransmission target is 92 ms */
+  fail_unless_equals_int (get_latency (10, 100, 100, FALSE, MIN_LATENCY,
+          MAX_LATENCY), 0);
+  /* Without report block there is no round trip */
+  fail_unless_equals_int (get_latency (10, 0, 100, TRUE, MIN_LATENCY,
+          MAX_LATENCY), 0);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (incomplete_stats)
+{
+  GstStructure *stats;
+
+  stats = gst_structure_new ("application/x-rtp-source-stats",
+      "jitter", G_TYPE_UINT, 9000, NULL);
+  fail_unless_equals_int (kms_jitter_buffer_get_adaptive_latency (stats, 100,
+          FALSE, MIN_LATENCY, MAX_LATENCY), 0);
+
+  gst_structure_set (stats, "clock-rate", G_TYPE_INT, 0, NULL);
+  fail_unless_equals_int (kms_jitter_buffer_get_adaptive_latency (stats, 100,
+          FALSE, MIN_LATENCY, MAX_LATENCY), 0);
+
+  gst_structure_free (stats);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (adapt_jitterbuffer)
+{
+  GstElement *jitterbuffer = gst_element_factory_make ("rtpjitterbuffer",
+      NULL);
+  GstStructure *stats;
+  guint latency;
+
+  fail_unless (jitterbuffer != NULL);
+  g_object_set (jitterbuffer, "latency", 200, "do-retransmission", FALSE,
+      NULL);
+
+  stats = create_source_stats (100, 100);
+  fail_unless_equals_int (kms_jitter_buffer_adapt_latency (jitterbuffer,
+          stats, MIN_LATENCY, MAX_LATENCY), 400);
+  g_object_get (jitterbuffer, "latency", &latency, NULL);
+  fail_unless_equals_int (latency, 400);
+
+  /* Round trip is only added once retransmissions are enabled */
+  g_object_set (jitterbuffer, "do-retransmission", TRUE, NULL);
+  fail_unless_equals_int (kms_jitter_buffer_adapt_latency (jitterbuffer,
+          stats, MIN_LATENCY, MAX_LATENCY), 500);
+  g_object_get (jitterbuffer, "latency", &latency, NULL);
+  fail_unless_equals_int (latency, 500);
+
+  /* Unchanged latency is left alone */
+  fail_unless_equals_int (kms_jitter_buffer_adapt_latency (jitterbuffer,
+          stats, MIN_LATENCY, MAX_LATENCY), 0);
+  g_object_get (jitterbuffer, "latency", &latency, NULL);
+  fail_unless_equals_int (latency, 500);
+
+  gst_structure_free (stats);
+  g_object_unref (jitterbuffer);
+}
+
+GST_END_TEST;
+
+static Suite *
+jitterbuffer_suite (void)
+{
+  Suite *s = suite_create ("jitterbuffer");
+  TCase *tc_chain = tcase_create ("adaptive");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, grow_on_jitter_spike);
+  tcase_add_test (tc_chain, shrink_slowly);
+  tcase_add_test (tc_chain, clamp_to_bounds);
+  tcase_add_test (tc_chain, ignore_small_changes);
+  tcase_add_test (tc_chain, round_trip_with_retransmission);
+  tcase_add_test (tc_chain, incomplete_stats);
+  tcase_add_test (tc_chain, adapt_jitterbuffer);
+
+  return s;
+}
+
+GST_CHECK_MAIN (jitterbuffer);
@@ -0,0 +1,404 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmsremb.h"
+#include "kmsrtcp.h"
+
+#include <gst/check/gstcheck.h>
+#include <gst/rtp/gstrtpbuffer.h>
+#include <gst/rtp/gstrtcpbuffer.h>
+#include <gst/gst.h>
+#include <glib.h>
+
+/*
+ * Offline comparison of the REMB estimators: a sender that follows the
+ * REMB goes through a bottleneck with a drop-tail queue.
+ */
+
+#define SIM_DURATION (120 * GST_SECOND)
+#define SIM_WARMUP (20 * GST_SECOND)
+#define SIM_FRAME_RATE 30
+#define SIM_FRAME_DURATION (GST_SECOND / SIM_FRAME_RATE)
+#define SIM_RTCP_INTERVAL (RTCP_MIN_INTERVAL * GST_MSECOND)
+#define SIM_PROPAGATION (20 * GST_MSECOND)
+#define SIM_PAYLOAD_SIZE 1200
+#define SIM_HEADER_SIZE 12
+#define SIM_QUEUE_LIMIT 60000   /* bytes */
+#define SIM_QUEUE_PACKETS 1024
+#define SIM_START_BITRATE 300000        /* bps */
+#define SIM_MIN_BITRATE 30000   /* bps */
+#define SIM_VIDEO_CLOCK_RATE 90000
+
+typedef struct _SimLink
+{
+  guint capacity;
+  GstClockTime free_at;
+  GstClockTime departures[SIM_QUEUE_PACKETS];
+  guint sizes[SIM_QUEUE_PACKETS];
+  guint head;
+  guint len;
+  guint queued;
+} SimLink;
+
+typedef struct _SimResult
+{
+  gdouble delay;                /* ms */
+  gdouble loss;
+  gdouble bitrate;              /* bps */
+} SimResult;
+
+static void
+sim_link_drain (SimLink * link, GstClockTime now)
+{
+  while (link->len > 0 && link->departures[link->head] <= now) {
+    link->queued -= link->sizes[link->head];
+    link->head = (link->head + 1) % SIM_QUEUE_PACKETS;
+    link->len--;
+  }
+}
+
+/* Returns the time the packet leaves the bottleneck, or NONE if dropped */
+static GstClockTime
+sim_link_send (SimLink * link, GstClockTime now, guint size)
+{
+  guint tail;
+
+  sim_link_drain (link, now);
+
+  if (link->queued + size > SIM_QUEUE_LIMIT || link->len == SIM_QUEUE_PACKETS) {
+    return GST_CLOCK_TIME_NONE;
+  }
+
+  link->free_at = MAX (now, link->free_at) +
+      gst_util_uint64_scale (size * 8, GST_SECOND, link->capacity);
+
+  tail = (link->head + link->len) % SIM_QUEUE_PACKETS;
+  link->departures[tail] = link->free_at;
+  link->sizes[tail] = size;
+  link->len++;
+  link->queued += size;
+
+  return link->free_at;
+}
+
+static void
+simulate (KmsCongestionControl type, guint capacity, SimResult * result)
+{
+  KmsRembEstimator *est = kms_remb_estimator_create (type, 0);
+  SimLink *link = g_slice_new0 (SimLink);
+  guint64 bitrate = SIM_START_BITRATE;
+  guint64 sent = 0, lost = 0, rtcp_sent = 0, rtcp_lost = 0;
+  guint64 rtcp_bytes = 0, received_bytes = 0, n_delays = 0;
+  GstClockTime now, next_rtcp = SIM_RTCP_INTERVAL, delays = 0;
+  guint32 rtp_timestamp = 0;
+
+  link->capacity = capacity;
+
+  for (now = 0; now < SIM_DURATION; now += SIM_FRAME_DURATION) {
+    guint frame_size, n_packets, i;
+
+    while (next_rtcp <= now) {
+      guint fraction_lost = rtcp_sent > 0 ? rtcp_lost * 256 / rtcp_sent : 0;
+      guint64 recv_bitrate = gst_util_uint64_scale (rtcp_bytes * 8,
+          GST_SECOND, SIM_RTCP_INTERVAL);
+
+      if (kms_remb_estimator_update (est, next_rtcp, recv_bitrate,
+              fraction_lost)) {
+        bitrate = MAX (est->remb, SIM_MIN_BITRATE);
+      }
+
+      rtcp_sent = rtcp_lost = rtcp_bytes = 0;
+      next_rtcp += SIM_RTCP_INTERVAL;
+    }
+
+    frame_size = gst_util_uint64_scale (bitrate / 8, SIM_FRAME_DURATION,
+        GST_SECOND);
+    n_packets = (frame_size + SIM_PAYLOAD_SIZE - 1) / SIM_PAYLOAD_SIZE;
+
+    for (i = 0; i < n_packets; i++) {
+      guint size = frame_size / n_packets + SIM_HEADER_SIZE;
+      GstClockTime departure;
+
+      sent++;
+      rtcp_sent++;
+
+      departure = sim_link_send (link, now, size);
+      if (!GST_CLOCK_TIME_IS_VALID (departure)) {
+        lost++;
+        rtcp_lost++;
+        continue;
+      }
+
+      kms_remb_estimator_packet_received (est, departure + SIM_PROPAGATION,
+          rtp_timestamp);
+      rtcp_bytes += size;
+
+      if (now >= SIM_WARMUP) {
+        delays += departure - now;
+        n_delays++;
+        received_bytes += size;
+      }
+    }
+
+    rtp_timestamp += SIM_VIDEO_CLOCK_RATE / SIM_FRAME_RATE;
+  }
+
+  result->delay = (gdouble) delays / n_delays / GST_MSECOND;
+  result->loss = (gdouble) lost / sent;
+  result->bitrate = (gdouble) received_bytes * 8 * GST_SECOND /
+      (SIM_DURATION - SIM_WARMUP);
+
+  g_slice_free (SimLink, link);
+  kms_remb_estimator_destroy (est);
+}
+
+static void
+compare_estimators (guint capacity)
+{
+  SimResult loss, delay;
+
+  simulate (KMS_CONGESTION_CONTROL_LOSS, capacity, &loss);
+  simulate (KMS_CONGESTION_CONTROL_DELAY, capacity, &delay);
+
+  GST_INFO ("Capacity %u bps. Loss based: delay %.1f ms, loss %.4f, "
+      "bitrate %.0f bps. Delay based: delay %.1f ms, loss %.4f, bitrate %.0f "
+      "bps", capacity, loss.delay, loss.loss, loss.bitrate, delay.delay,
+      delay.loss, delay.bitrate);
+
+  /* Queues must stay short without giving up the available bandwidth */
+  fail_unless (delay.delay < loss.delay);
+  fail_unless (delay.loss <= loss.loss);
+  fail_unless (delay.bitrate > 0.7 * capacity);
+}
+
+GST_START_TEST (low_capacity)
+{
+  compare_estimators (500000);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (medium_capacity)
+{
+  compare_estimators (1000000);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (high_capacity)
+{
+  compare_estimators (1500000);
+}
+
+GST_END_TEST;
+
+/*
+ * KmsRembLocal fed from a pad carrying the remote stream and others of the
+ * same session.
+ */
+
+#define REMOTE_SSRC 1234
+#define OTHER_SSRC 5678
+#define RTP_PAYLOAD_SIZE 1000
+
+typedef struct _LocalTest
+{
+  GstElement *rtpbin;
+  GObject *rtpsession;
+  GstPad *src;
+  GstPad *sink;
+  KmsRembLocal *rl;
+  guint16 seq;
+} LocalTest;
+
+static GstFlowReturn
+discard_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  gst_buffer_unref (buffer);
+
+  return GST_FLOW_OK;
+}
+
+static void
+local_test_setup (LocalTest * test)
+{
+  GstCaps *caps = gst_caps_from_string ("application/x-rtp");
+  GstSegment segment;
+  GstPad *pad;
+
+  test->rtpbin = gst_element_factory_make ("rtpbin", NULL);
+  fail_unless (test->rtpbin != NULL);
+  pad = gst_element_get_request_pad (test->rtpbin, "send_rtp_sink_1");
+  g_object_unref (pad);
+  g_signal_emit_by_name (test->rtpbin, "get-internal-session", 1,
+      &test->rtpsession);
+  fail_unless (test->rtpsession != NULL);
+
+  test->src = gst_pad_new ("src", GST_PAD_SRC);
+  test->sink = gst_pad_new ("sink", GST_PAD_SINK);
+  gst_pad_set_chain_function (test->sink, discard_chain);
+  gst_pad_set_active (test->src, TRUE);
+  gst_pad_set_active (test->sink, TRUE);
+  fail_unless (gst_pad_link (test->src, test->sink) == GST_PAD_LINK_OK);
+
+  test->rl = kms_remb_local_create (test->rtpsession, REMOTE_SSRC, 0,
+      KMS_CONGESTION_CONTROL_LOSS, test->sink);
+  test->seq = 0;
+
+  gst_pad_push_event (test->src, gst_event_new_stream_start ("remb"));
+  gst_pad_push_event (test->src, gst_event_new_caps (caps));
+  gst_caps_unref (caps);
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (test->src, gst_event_new_segment (&segment));
+}
+
+static void
+local_test_teardown (LocalTest * test)
+{
+  kms_remb_local_destroy (test->rl);
+  g_object_unref (test->rtpsession);
+  gst_pad_set_active (test->src, FALSE);
+  gst_pad_set_active (test->sink, FALSE);
+  g_object_unref (test->src);
+  g_object_unref (test->sink);
+  g_object_unref (test->rtpbin);
+}
+
+/* Returns the payload size of the pushed buffer */
+static gsize
+push_rtp (LocalTest * test, guint ssrc)
+{
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  GstBuffer *buffer = gst_rtp_buffer_new_allocate (RTP_PAYLOAD_SIZE, 0, 0);
+  gsize size = RTP_PAYLOAD_SIZE;
+
+  gst_rtp_buffer_map (buffer, GST_MAP_WRITE, &rtp);
+  gst_rtp_buffer_set_ssrc (&rtp, ssrc);
+  gst_rtp_buffer_set_seq (&rtp, test->seq);
+  gst_rtp_buffer_set_timestamp (&rtp, test->seq * 3000);
+  gst_rtp_buffer_unmap (&rtp);
+  test->seq++;
+
+  fail_unless (gst_pad_push (test->src, buffer) == GST_FLOW_OK);
+
+  return size;
+}
+
+/* Sends an RR with a report block about rb_ssrc, returns if REMB was added */
+static gboolean
+send_rr (LocalTest * test, guint rb_ssrc, guint8 fraction_lost)
+{
+  GstRTCPBuffer rtcp = { NULL, };
+  GstBuffer *buffer = gst_rtcp_buffer_new (1400);
+  GstRTCPPacket packet;
+  gboolean ret;
+
+  gst_rtcp_buffer_map (buffer, GST_MAP_READWRITE, &rtcp);
+  fail_unless (gst_rtcp_buffer_add_packet (&rtcp, GST_RTCP_TYPE_RR, &packet));
+  gst_rtcp_packet_rr_set_ssrc (&packet, OTHER_SSRC + 1);
+  fail_unless (gst_rtcp_packet_add_rb (&packet, rb_ssrc, fraction_lost, 0, 0,
+          0, 0, 0));
+  gst_rtcp_buffer_unmap (&rtcp);
+
+  g_signal_emit_by_name (test->rtpsession, "on-sending-rtcp", buffer, FALSE,
+      &ret);
+
+  gst_rtcp_buffer_map (buffer, GST_MAP_READ, &rtcp);
+  ret = gst_rtcp_buffer_get_packet_count (&rtcp) > 1;
+  gst_rtcp_buffer_unmap (&rtcp);
+  gst_buffer_unref (buffer);
+
+  return ret;
+}
+
+GST_START_TEST (local_counts_remote_ssrc)
+{
+  LocalTest test;
+  gsize expected = 0;
+  guint i;
+
+  local_test_setup (&test);
+
+  for (i = 0; i < 10; i++) {
+    expected += push_rtp (&test, REMOTE_SSRC);
+    push_rtp (&test, OTHER_SSRC);
+  }
+
+  fail_unless_equals_uint64 ((gsize)
+      g_atomic_pointer_get (&test.rl->octets_received), expected);
+
+  local_test_teardown (&test);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (local_keeps_fraction_lost)
+{
+  LocalTest test;
+  guint i;
+
+  local_test_setup (&test);
+
+  /* First RTCP only starts measuring the bitrate */
+  for (i = 0; i < 10; i++) {
+    push_rtp (&test, REMOTE_SSRC);
+  }
+  fail_if (send_rr (&test, REMOTE_SSRC, 64));
+  fail_unless_equals_int (test.rl->fraction_lost, 64);
+  fail_unless_equals_int (g_atomic_int_get (&test.rl->remb_sent), 0);
+
+  /* No block about the remote SSRC, REMB is sent with the last one */
+  for (i = 0; i < 10; i++) {
+    push_rtp (&test, REMOTE_SSRC);
+  }
+  fail_unless (send_rr (&test, OTHER_SSRC, 0));
+  fail_unless_equals_int (test.rl->fraction_lost, 64);
+  fail_unless (g_atomic_int_get (&test.rl->remb_sent) > 0);
+
+  for (i = 0; i < 10; i++) {
+    push_rtp (&test, REMOTE_SSRC);
+  }
+  fail_unless (send_rr (&test, REMOTE_SSRC, 0));
+  fail_unless_equals_int (test.rl->fraction_lost, 0);
+
+  local_test_teardown (&test);
+}
+
+GST_END_TEST;
+
+static Suite *
+remb_suite (void)
+{
+  Suite *s = suite_create ("remb");
+  TCase *tc_chain = tcase_create ("estimators");
+  TCase *tc_local = tcase_create ("local");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, low_capacity);
+  tcase_add_test (tc_chain, medium_capacity);
+  tcase_add_test (tc_chain, high_capacity);
+
+  suite_add_tcase (s, tc_local);
+  tcase_add_test (tc_local, local_counts_remote_ssrc);
+  tcase_add_test (tc_local, local_keeps_fraction_lost);
+
+  return s;
+}
+
+GST_CHECK_MAIN (remb);
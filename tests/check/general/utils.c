@@ -34,6 +34,300 @@ GST_START_TEST (check_urls)
 
 }
 
+GST_END_TEST
+static GstElementFactory *
+find_encoder_factory_uncached (const GstCaps * caps)
+{
+  GList *encoder_list, *filtered_list, *l;
+  GstElementFactory *factory = NULL;
+
+  encoder_list =
+      gst_element_factory_list_get_elements (GST_ELEMENT_FACTORY_TYPE_ENCODER,
+      GST_RANK_NONE);
+  filtered_list =
+      gst_element_factory_list_filter (encoder_list, caps, GST_PAD_SRC, FALSE);
+
+  for (l = filtered_list; l != NULL && factory == NULL; l = l->next) {
+    if (kms_utils_factory_has_two_pad_templates (l->data)) {
+      factory = gst_object_ref (l->data);
+    }
+  }
+
+  gst_plugin_feature_list_free (filtered_list);
+  gst_plugin_feature_list_free (encoder_list);
+
+  return factory;
+}
+
+GST_START_TEST (factory_cache)
+{
+  GstCaps *caps = gst_caps_from_string ("video/x-vp8");
+  GstCaps *unknown = gst_caps_from_string ("video/x-unknown-codec");
+  GstElementFactory *cached, *uncached, *again;
+  gint i;
+
+  uncached = find_encoder_factory_uncached (caps);
+  cached =
+      kms_utils_get_element_factory_for_caps (GST_ELEMENT_FACTORY_TYPE_ENCODER,
+      NULL, caps, kms_utils_factory_has_two_pad_templates);
+  fail_unless (cached == uncached);
+
+  /* Later lookups are served from the cache with the same result */
+  again =
+      kms_utils_get_element_factory_for_caps (GST_ELEMENT_FACTORY_TYPE_ENCODER,
+      NULL, caps, kms_utils_factory_has_two_pad_templates);
+  fail_unless (again == cached);
+
+  /* Negative results are cached too and stay negative */
+  for (i = 0; i < 2; i++) {
+    fail_unless (kms_utils_get_element_factory_for_caps
+        (GST_ELEMENT_FACTORY_TYPE_ENCODER, NULL, unknown,
+            kms_utils_factory_has_two_pad_templates) == NULL);
+  }
+
+  if (again != NULL) {
+    gst_object_unref (again);
+  }
+
+  if (cached != NULL) {
+    gst_object_unref (cached);
+  }
+
+  if (uncached != NULL) {
+    gst_object_unref (uncached);
+  }
+
+  gst_caps_unref (unknown);
+  gst_caps_unref (caps);
+}
+
+GST_END_TEST
+GST_START_TEST (factory_cache_by_codec)
+{
+  GstCaps *caps96 =
+      gst_caps_from_string ("application/x-rtp, media=(string)video, "
+      "encoding-name=(string)VP8, payload=(int)96, clock-rate=(int)90000");
+  GstCaps *caps100 =
+      gst_caps_from_string ("application/x-rtp, media=(string)video, "
+      "encoding-name=(string)VP8, payload=(int)100, clock-rate=(int)90000");
+  GstElementFactory *factory96, *factory100;
+  GstElement *depayloader;
+
+  /* Payload types do not take part in the key */
+  factory96 =
+      kms_utils_get_element_factory_for_caps
+      (GST_ELEMENT_FACTORY_TYPE_DEPAYLOADER, caps96, NULL, NULL);
+  factory100 =
+      kms_utils_get_element_factory_for_caps
+      (GST_ELEMENT_FACTORY_TYPE_DEPAYLOADER, caps100, NULL, NULL);
+  fail_unless (factory96 == factory100);
+
+  depayloader =
+      kms_utils_create_element_for_caps (GST_ELEMENT_FACTORY_TYPE_DEPAYLOADER,
+      caps100, NULL, NULL);
+
+  if (factory96 == NULL) {
+    GST_WARNING ("No vp8 depayloader available");
+    fail_unless (depayloader == NULL);
+  } else {
+    fail_unless (depayloader != NULL);
+    fail_unless (gst_element_get_factory (depayloader) == factory96);
+    gst_object_unref (depayloader);
+    gst_object_unref (factory96);
+    gst_object_unref (factory100);
+  }
+
+  gst_caps_unref (caps96);
+  gst_caps_unref (caps100);
+}
+
+GST_END_TEST
+GST_START_TEST (bitrate_ladder_rungs)
+{
+  const guint rungs[] = { 150000, 500000, 1500000 };
+  guint n_rungs = G_N_ELEMENTS (rungs);
+
+  /* Moves up only once the next rung is exceeded by the margin */
+  fail_unless (kms_utils_bitrate_ladder_select_rung (rungs, n_rungs, 0, 520000,
+          10) == 0);
+  fail_unless (kms_utils_bitrate_ladder_select_rung (rungs, n_rungs, 0, 560000,
+          10) == 1);
+  fail_unless (kms_utils_bitrate_ladder_select_rung (rungs, n_rungs, 0,
+          5000000, 10) == 2);
+
+  /* Stays while the estimation is within the margin below the rung */
+  fail_unless (kms_utils_bitrate_ladder_select_rung (rungs, n_rungs, 1, 460000,
+          10) == 1);
+  fail_unless (kms_utils_bitrate_ladder_select_rung (rungs, n_rungs, 1, 440000,
+          10) == 0);
+  fail_unless (kms_utils_bitrate_ladder_select_rung (rungs, n_rungs, 2, 100000,
+          10) == 0);
+
+  /* The lowest rung is kept whatever the estimation is */
+  fail_unless (kms_utils_bitrate_ladder_select_rung (rungs, n_rungs, 0, 1000,
+          10) == 0);
+  fail_unless (kms_utils_bitrate_ladder_select_rung (rungs, n_rungs, 7, 1000,
+          10) == 0);
+}
+
+GST_END_TEST
+static gint keyframe_requests;
+
+static gboolean
+count_keyframe_requests (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  if (GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_UPSTREAM &&
+      gst_event_has_name (event, "GstForceKeyUnit")) {
+    keyframe_requests++;
+  }
+
+  gst_event_unref (event);
+
+  return TRUE;
+}
+
+static void
+push_caps (GstPad * src, const gchar * str)
+{
+  GstCaps *caps = gst_caps_from_string (str);
+
+  fail_unless (gst_pad_push_event (src, gst_event_new_caps (caps)));
+  gst_caps_unref (caps);
+}
+
+GST_START_TEST (keyframe_request_caps)
+{
+  GstPad *src = gst_pad_new ("src", GST_PAD_SRC);
+  GstPad *sink = gst_pad_new ("sink", GST_PAD_SINK);
+  GstCaps *caps;
+
+  caps = gst_caps_from_string ("video/x-raw,width=320");
+  fail_unless (kms_utils_caps_are_raw (caps));
+  gst_caps_unref (caps);
+  caps = gst_caps_from_string ("video/x-vp8");
+  fail_if (kms_utils_caps_are_raw (caps));
+  gst_caps_unref (caps);
+
+  gst_pad_set_event_function (src, count_keyframe_requests);
+  gst_pad_set_active (src, TRUE);
+  gst_pad_set_active (sink, TRUE);
+  fail_unless (gst_pad_link (src, sink) == GST_PAD_LINK_OK);
+
+  gst_pad_push_event (src, gst_event_new_stream_start ("test"));
+
+  /* Raw streams have no key frames to request */
+  push_caps (src, "video/x-raw");
+  kms_utils_request_keyframe (sink, FALSE);
+  fail_unless (keyframe_requests == 0);
+
+  /* Cached caps type follows caps changes */
+  push_caps (src, "video/x-vp8");
+  kms_utils_request_keyframe (sink, FALSE);
+  fail_unless (keyframe_requests == 1);
+
+  push_caps (src, "audio/x-raw");
+  kms_utils_request_keyframe (sink, FALSE);
+  fail_unless (keyframe_requests == 1);
+
+  gst_pad_set_active (src, FALSE);
+  gst_pad_set_active (sink, FALSE);
+  g_object_unref (src);
+  g_object_unref (sink);
+}
+
+GST_END_TEST
+static GstFlowReturn
+accept_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  gst_buffer_unref (buffer);
+
+  return GST_FLOW_OK;
+}
+
+static void
+push_frame (GstPad * src, gboolean keyframe)
+{
+  GstBuffer *buffer = gst_buffer_new ();
+
+  if (!keyframe) {
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+  }
+
+  fail_unless (gst_pad_push (src, buffer) == GST_FLOW_OK);
+}
+
+static void
+request_keyframe (GstPad * sink)
+{
+  GstStructure *st = gst_structure_new ("GstForceKeyUnit",
+      "all-headers", G_TYPE_BOOLEAN, FALSE, NULL);
+
+  gst_pad_push_event (sink, gst_event_new_custom (GST_EVENT_CUSTOM_UPSTREAM,
+          st));
+}
+
+#define N_REQUESTERS 100
+
+GST_START_TEST (keyframe_coordinator)
+{
+  GstPad *src = gst_pad_new ("src", GST_PAD_SRC);
+  GstPad *sink = gst_pad_new ("sink", GST_PAD_SINK);
+  KmsKeyframeCoordinator *coordinator;
+  guint64 requested, coalesced, sent;
+  GstSegment segment;
+  gint i;
+
+  keyframe_requests = 0;
+  gst_pad_set_event_function (src, count_keyframe_requests);
+  gst_pad_set_chain_function (sink, accept_chain);
+  gst_pad_set_active (src, TRUE);
+  gst_pad_set_active (sink, TRUE);
+  fail_unless (gst_pad_link (src, sink) == GST_PAD_LINK_OK);
+
+  gst_pad_push_event (src, gst_event_new_stream_start ("test"));
+  push_caps (src, "video/x-vp8");
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (src, gst_event_new_segment (&segment));
+
+  coordinator = kms_utils_keyframe_coordinator_create (sink);
+
+  /* A burst of consumers joining results in a single request */
+  for (i = 0; i < N_REQUESTERS; i++) {
+    request_keyframe (sink);
+  }
+
+  fail_unless (keyframe_requests == 1);
+  kms_utils_keyframe_coordinator_get_stats (coordinator, &requested,
+      &coalesced, &sent);
+  fail_unless (requested == N_REQUESTERS);
+  fail_unless (coalesced == N_REQUESTERS - 1);
+  fail_unless (sent == 1);
+
+  /* Requests right after the key frame wait for the window to expire */
+  push_frame (src, TRUE);
+  request_keyframe (sink);
+  request_keyframe (sink);
+  push_frame (src, FALSE);
+  fail_unless (keyframe_requests == 1);
+
+  g_usleep (G_USEC_PER_SEC);
+  push_frame (src, FALSE);
+  fail_unless (keyframe_requests == 2);
+
+  kms_utils_keyframe_coordinator_get_stats (coordinator, &requested,
+      &coalesced, &sent);
+  fail_unless (requested == N_REQUESTERS + 2);
+  fail_unless (coalesced == N_REQUESTERS + 1);
+  fail_unless (sent == 2);
+
+  kms_utils_keyframe_coordinator_destroy (coordinator);
+
+  gst_pad_set_active (src, FALSE);
+  gst_pad_set_active (sink, FALSE);
+  g_object_unref (src);
+  g_object_unref (sink);
+}
+
 GST_END_TEST
 /* Suite initialization */
 static Suite *
@@ -44,6 +338,11 @@ utils_suite (void)
 
   suite_add_tcase (s, tc_chain);
   tcase_add_test (tc_chain, check_urls);
+  tcase_add_test (tc_chain, factory_cache);
+  tcase_add_test (tc_chain, factory_cache_by_codec);
+  tcase_add_test (tc_chain, bitrate_ladder_rungs);
+  tcase_add_test (tc_chain, keyframe_request_caps);
+  tcase_add_test (tc_chain, keyframe_coordinator);
 
   return s;
 }
@@ -0,0 +1,192 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE BaseRtpEndpoint
+#include <boost/test/unit_test.hpp>
+#include <MediaPipelineImpl.hpp>
+#include <BaseRtpEndpointImpl.hpp>
+#include <RtpStats.hpp>
+#include <MediaType.hpp>
+#include <kmsbasertpendpoint.h>
+
+using namespace kurento;
+
+#define TEST_RTP_ENDPOINT "testrtpendpoint"
+#define LARGE_PACKETS ((G_GUINT64_CONSTANT (1) << 32) + 5)
+
+/* Endpoint reporting fixed statistics */
+typedef struct _KmsTestRtpEndpoint {
+  KmsBaseRtpEndpoint parent;
+} KmsTestRtpEndpoint;
+
+typedef struct _KmsTestRtpEndpointClass {
+  KmsBaseRtpEndpointClass parent_class;
+} KmsTestRtpEndpointClass;
+
+enum {
+  PROP_0,
+  PROP_STATS
+};
+
+static GType kms_test_rtp_endpoint_get_type (void);
+
+G_DEFINE_TYPE (KmsTestRtpEndpoint, kms_test_rtp_endpoint,
+               KMS_TYPE_BASE_RTP_ENDPOINT);
+
+static void
+set_session (GstStructure *stats, const gchar *session, GstStructure *ssrc,
+             guint ssrc_num)
+{
+  GstStructure *session_stats = gst_structure_new_empty (session);
+  gchar *name = g_strdup_printf ("ssrc-%u", ssrc_num);
+
+  if (gst_structure_has_field (stats, session) ) {
+    gst_structure_free (session_stats);
+    session_stats = gst_structure_copy (gst_value_get_structure (
+                                          gst_structure_get_value (stats, session) ) );
+  }
+
+  gst_structure_set (session_stats, name, GST_TYPE_STRUCTURE, ssrc, NULL);
+  gst_structure_set (stats, session, GST_TYPE_STRUCTURE, session_stats, NULL);
+
+  gst_structure_free (session_stats);
+  gst_structure_free (ssrc);
+  g_free (name);
+}
+
+static void
+kms_test_rtp_endpoint_get_property (GObject *object, guint property_id,
+                                    GValue *value, GParamSpec *pspec)
+{
+  GstStructure *stats;
+
+  if (property_id != PROP_STATS) {
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    return;
+  }
+
+  stats = gst_structure_new_empty ("rtp-stats");
+
+  set_session (stats, "video", gst_structure_new ("inbound-rtp",
+               "ssrc", G_TYPE_UINT, 1,
+               "packets", G_TYPE_UINT64, LARGE_PACKETS,
+               "bytes", G_TYPE_UINT64, LARGE_PACKETS * 1000,
+               "packets-lost", G_TYPE_INT, 4,
+               "fraction-lost", G_TYPE_UINT, 2,
+               "jitter", G_TYPE_UINT, 10,
+               "round-trip-time", G_TYPE_UINT, 0,
+               "nack-count", G_TYPE_UINT, 3,
+               "pli-count", G_TYPE_UINT, 2,
+               "fir-count", G_TYPE_UINT, 1,
+               "remb", G_TYPE_UINT, 300000,
+               "jitter-buffer-latency", G_TYPE_UINT, 120,
+               "late-packets", G_TYPE_UINT64, G_GUINT64_CONSTANT (7), NULL), 1);
+  set_session (stats, "video", gst_structure_new ("outbound-rtp",
+               "ssrc", G_TYPE_UINT, 2,
+               "packets", G_TYPE_UINT64, G_GUINT64_CONSTANT (10),
+               "bytes", G_TYPE_UINT64, G_GUINT64_CONSTANT (10000),
+               "round-trip-time", G_TYPE_UINT, 50,
+               "pli-count", G_TYPE_UINT, 5, NULL), 2);
+  set_session (stats, "audio", gst_structure_new ("inbound-rtp",
+               "ssrc", G_TYPE_UINT, 3,
+               "packets", G_TYPE_UINT64, G_GUINT64_CONSTANT (20), NULL), 3);
+
+  g_value_take_boxed (value, stats);
+}
+
+static void
+kms_test_rtp_endpoint_class_init (KmsTestRtpEndpointClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->get_property = kms_test_rtp_endpoint_get_property;
+  g_object_class_override_property (object_class, PROP_STATS, "stats");
+
+  gst_element_class_set_details_simple (GST_ELEMENT_CLASS (klass),
+                                        "Test RTP endpoint", "Test",
+                                        "RTP endpoint with fixed statistics", "Kurento");
+}
+
+static void
+kms_test_rtp_endpoint_init (KmsTestRtpEndpoint *self)
+{
+}
+
+static std::shared_ptr<RtpStats>
+findStats (const std::vector<std::shared_ptr<RtpStats>> &stats,
+           const std::string &ssrc)
+{
+  for (auto it : stats) {
+    if (it->getSsrc () == ssrc) {
+      return it;
+    }
+  }
+
+  BOOST_FAIL ("No stats for ssrc " + ssrc);
+
+  return nullptr;
+}
+
+BOOST_AUTO_TEST_CASE (get_stats)
+{
+  gst_init (NULL, NULL);
+  gst_element_register (NULL, TEST_RTP_ENDPOINT, GST_RANK_NONE,
+                        kms_test_rtp_endpoint_get_type () );
+
+  std::shared_ptr <MediaPipelineImpl> pipe (new MediaPipelineImpl (
+        boost::property_tree::ptree() ) );
+  std::shared_ptr <BaseRtpEndpointImpl> endpoint (new BaseRtpEndpointImpl (
+        boost::property_tree::ptree(), pipe, TEST_RTP_ENDPOINT) );
+  std::vector<std::shared_ptr<RtpStats>> stats = endpoint->getStats ();
+  std::shared_ptr<RtpStats> ssrc;
+
+  BOOST_REQUIRE (stats.size() == 3);
+
+  ssrc = findStats (stats, "1");
+  BOOST_CHECK (ssrc->getMediaType()->getValue() == MediaType::VIDEO);
+  BOOST_CHECK (ssrc->getInbound () );
+  /* Counters do not fit in an int */
+  BOOST_CHECK (ssrc->getPackets () == (double) LARGE_PACKETS);
+  BOOST_CHECK (ssrc->getBytes () == (double) (LARGE_PACKETS * 1000) );
+  BOOST_CHECK (ssrc->getPacketsLost () == 4);
+  BOOST_CHECK (ssrc->getFractionLost () == 2);
+  BOOST_CHECK (ssrc->getJitter () == 10);
+  BOOST_CHECK (ssrc->getNackCount () == 3);
+  BOOST_CHECK (ssrc->getPliCount () == 2);
+  BOOST_CHECK (ssrc->getFirCount () == 1);
+  BOOST_CHECK (ssrc->getRemb () == 300000);
+  BOOST_CHECK (ssrc->getJitterBufferLatency () == 120);
+  BOOST_CHECK (ssrc->getLatePackets () == 7);
+
+  ssrc = findStats (stats, "2");
+  BOOST_CHECK (ssrc->getMediaType()->getValue() == MediaType::VIDEO);
+  BOOST_CHECK (!ssrc->getInbound () );
+  BOOST_CHECK (ssrc->getPackets () == 10);
+  BOOST_CHECK (ssrc->getRoundTripTime () == 50);
+  BOOST_CHECK (ssrc->getPliCount () == 5);
+  /* Missing fields are reported as 0 */
+  BOOST_CHECK (ssrc->getNackCount () == 0);
+  BOOST_CHECK (ssrc->getJitterBufferLatency () == 0);
+  BOOST_CHECK (ssrc->getLatePackets () == 0);
+
+  ssrc = findStats (stats, "3");
+  BOOST_CHECK (ssrc->getMediaType()->getValue() == MediaType::AUDIO);
+  BOOST_CHECK (ssrc->getInbound () );
+  BOOST_CHECK (ssrc->getPackets () == 20);
+
+  endpoint.reset ();
+  pipe.reset ();
+}
@@ -0,0 +1,86 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <MediaPipelineImpl.hpp>
+#include <MediaSet.hpp>
+
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <iostream>
+
+using namespace kurento;
+
+/*
+ * Throughput of MediaSet::getMediaObject with a growing number of threads.
+ * Figures are printed, nothing is compared.
+ */
+
+#define N_OBJECTS 256
+#define BENCHMARK_DURATION std::chrono::milliseconds (500)
+
+int
+main (int argc, char **argv)
+{
+  std::string sessionId = "lookup_scaling";
+  std::vector<std::string> ids;
+
+  gst_init (&argc, &argv);
+
+  for (int i = 0; i < N_OBJECTS; i++) {
+    std::shared_ptr<MediaObjectImpl> obj;
+
+    obj = MediaSet::getMediaSet()->ref (new MediaPipelineImpl (
+                                          boost::property_tree::ptree() ) );
+    MediaSet::getMediaSet()->ref (sessionId, obj);
+    ids.push_back (obj->getId() );
+  }
+
+  for (unsigned int n_threads = 1; n_threads <= 8; n_threads *= 2) {
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> lookups (0);
+    std::atomic<bool> running (true);
+
+    for (unsigned int t = 0; t < n_threads; t++) {
+      threads.push_back (std::thread ([&, t] () {
+        uint64_t count = 0;
+        size_t i = t;
+
+        while (running) {
+          MediaSet::getMediaSet()->getMediaObject (ids[i % ids.size()]);
+          i += n_threads;
+          count++;
+        }
+
+        lookups += count;
+      }) );
+    }
+
+    std::this_thread::sleep_for (BENCHMARK_DURATION);
+    running = false;
+
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    std::cout << "getMediaObject with " << n_threads << " thread/s: " <<
+              lookups * 1000 / BENCHMARK_DURATION.count() << " lookups/s" <<
+              std::endl;
+  }
+
+  MediaSet::getMediaSet()->releaseSession (sessionId);
+
+  return 0;
+}
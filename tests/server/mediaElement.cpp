@@ -170,3 +170,198 @@ BOOST_AUTO_TEST_CASE (no_common_pipeline)
     BOOST_CHECK (e.getCode () == CONNECT_ERROR);
   }
 }
+
+BOOST_AUTO_TEST_CASE (connect_async)
+{
+  gst_init (NULL, NULL);
+  std::shared_ptr <MediaPipelineImpl> pipe (new MediaPipelineImpl (
+        boost::property_tree::ptree() ) );
+  std::vector<std::shared_ptr<MediaElementImpl>> sources;
+  std::vector<std::shared_ptr<MediaElementImpl>> sinks;
+
+  for (int i = 0; i < 3; i++) {
+    std::shared_ptr <MediaElementImpl> src (new  MediaElementImpl (
+        boost::property_tree::ptree(), pipe, "dummysrc") );
+    std::shared_ptr <MediaElementImpl> sink (new  MediaElementImpl (
+          boost::property_tree::ptree(), pipe, "dummysink") );
+
+    src->setName ("SOURCE" + std::to_string (i) );
+    sink->setName ("SINK" + std::to_string (i) );
+    g_object_set (src->getGstreamerElement(), "audio", TRUE, "video", TRUE, NULL);
+    g_object_set (sink->getGstreamerElement(), "audio", TRUE, "video", TRUE,
+                  NULL);
+
+    sources.push_back (src);
+    sinks.push_back (sink);
+  }
+
+  int connected = -1;
+
+  MediaElementImpl::connectAsync (sources, sinks, std::shared_ptr<MediaType> (),
+  [&connected] (int connections) {
+    connected = connections;
+  }).wait();
+
+  BOOST_CHECK (connected == 6);
+
+  for (size_t i = 0; i < sinks.size(); i++) {
+    auto connections = sinks[i]->getSourceConnections ();
+    BOOST_CHECK (connections.size() == 2);
+
+    for (auto it : connections) {
+      BOOST_CHECK (it->getSource()->getId() == sources[i]->getId() );
+    }
+  }
+
+  for (auto src : sources) {
+    src->release ();
+  }
+
+  for (auto sink : sinks) {
+    sink->release ();
+  }
+}
+
+BOOST_AUTO_TEST_CASE (connect_async_invalid_pairs)
+{
+  gst_init (NULL, NULL);
+  std::shared_ptr <MediaPipelineImpl> pipe (new MediaPipelineImpl (
+        boost::property_tree::ptree() ) );
+  std::shared_ptr <MediaElementImpl> src (new  MediaElementImpl (
+      boost::property_tree::ptree(), pipe, "dummysrc") );
+  std::shared_ptr <MediaElementImpl> sink (new  MediaElementImpl (
+        boost::property_tree::ptree(), pipe, "dummysink") );
+  std::shared_ptr <MediaElementImpl> duplex (new  MediaElementImpl (
+        boost::property_tree::ptree(), pipe, "dummyduplex") );
+
+  src->setName ("SOURCE");
+  sink->setName ("SINK");
+  duplex->setName ("DUPLEX");
+
+  try {
+    MediaElementImpl::connectAsync ({src, duplex}, {sink},
+                                    std::shared_ptr<MediaType> () );
+    BOOST_FAIL ("Previous operation should raise an exception");
+  } catch (KurentoException e) {
+    BOOST_CHECK (e.getCode () == MEDIA_OBJECT_ILLEGAL_PARAM_ERROR);
+  }
+
+  try {
+    MediaElementImpl::connectAsync ({src, duplex}, {sink, sink},
+                                    std::shared_ptr<MediaType> () );
+    BOOST_FAIL ("Previous operation should raise an exception");
+  } catch (KurentoException e) {
+    BOOST_CHECK (e.getCode () == CONNECT_ERROR);
+  }
+
+  BOOST_CHECK (sink->getSourceConnections ().size() == 0);
+
+  /* Connecting an element to itself is skipped */
+  MediaElementImpl::connectAsync ({duplex, src}, {duplex, sink},
+                                  std::shared_ptr<MediaType> () ).wait();
+
+  BOOST_CHECK (duplex->getSourceConnections ().size() == 0);
+  BOOST_CHECK (sink->getSourceConnections ().size() == 2);
+
+  src->release ();
+  sink->release ();
+  duplex->release ();
+}
+
+static gchar *
+refuse_srcpad (GstElement *element, guint type, const gchar *description,
+               gpointer data)
+{
+  return NULL;
+}
+
+BOOST_AUTO_TEST_CASE (connect_async_rollback)
+{
+  gst_init (NULL, NULL);
+  std::shared_ptr <MediaPipelineImpl> pipe (new MediaPipelineImpl (
+        boost::property_tree::ptree() ) );
+  std::shared_ptr <MediaElementImpl> src (new  MediaElementImpl (
+      boost::property_tree::ptree(), pipe, "dummysrc") );
+  std::shared_ptr <MediaElementImpl> noSrc (new  MediaElementImpl (
+        boost::property_tree::ptree(), pipe, "dummysrc") );
+  std::shared_ptr <MediaElementImpl> sink1 (new  MediaElementImpl (
+        boost::property_tree::ptree(), pipe, "dummysink") );
+  std::shared_ptr <MediaElementImpl> sink2 (new  MediaElementImpl (
+        boost::property_tree::ptree(), pipe, "dummysink") );
+
+  src->setName ("SOURCE");
+  noSrc->setName ("NO_SOURCE");
+  sink1->setName ("SINK1");
+  sink2->setName ("SINK2");
+
+  /* Runs after the default handler, so no pad is ever given */
+  g_signal_connect_after (noSrc->getGstreamerElement(), "request-new-srcpad",
+                          G_CALLBACK (refuse_srcpad), NULL);
+
+  /* The second pair fails once the first one has been prepared */
+  try {
+    MediaElementImpl::connectAsync ({src, noSrc}, {sink1, sink2},
+                                    std::shared_ptr<MediaType> () );
+    BOOST_FAIL ("Previous operation should raise an exception");
+  } catch (KurentoException e) {
+    BOOST_CHECK (e.getCode () == CONNECT_ERROR);
+  }
+
+  BOOST_CHECK (src->getSinkConnections ().size() == 0);
+  BOOST_CHECK (sink1->getSourceConnections ().size() == 0);
+  BOOST_CHECK (sink2->getSourceConnections ().size() == 0);
+
+  src->release ();
+  noSrc->release ();
+  sink1->release ();
+  sink2->release ();
+}
+
+BOOST_AUTO_TEST_CASE (fan_out_connections)
+{
+  gst_init (NULL, NULL);
+  std::shared_ptr <MediaPipelineImpl> pipe (new MediaPipelineImpl (
+        boost::property_tree::ptree() ) );
+  std::shared_ptr <MediaElementImpl> src (new  MediaElementImpl (
+      boost::property_tree::ptree(), pipe, "dummysrc") );
+  std::shared_ptr <MediaType> VIDEO (new MediaType (MediaType::VIDEO) );
+  std::vector<std::shared_ptr<MediaElementImpl>> sinks;
+
+  src->setName ("SOURCE");
+  g_object_set (src->getGstreamerElement(), "audio", TRUE, "video", TRUE, NULL);
+
+  for (int i = 0; i < 64; i++) {
+    std::shared_ptr <MediaElementImpl> sink (new  MediaElementImpl (
+          boost::property_tree::ptree(), pipe, "dummysink") );
+
+    sink->setName ("SINK" + std::to_string (i) );
+    src->connect (sink);
+    sinks.push_back (sink);
+  }
+
+  BOOST_CHECK (src->getSinkConnections ().size() == 128);
+  BOOST_CHECK (src->getSinkConnections (VIDEO).size() == 64);
+  BOOST_CHECK (src->getSinkConnections (VIDEO, "").size() == 64);
+  BOOST_CHECK (src->getSinkConnections (VIDEO, "test").size() == 0);
+
+  for (size_t i = 0; i < sinks.size(); i += 2) {
+    src->disconnect (sinks[i], VIDEO);
+  }
+
+  BOOST_CHECK (src->getSinkConnections ().size() == 96);
+  BOOST_CHECK (src->getSinkConnections (VIDEO).size() == 32);
+
+  for (size_t i = 0; i < sinks.size(); i++) {
+    BOOST_CHECK (sinks[i]->getSourceConnections (VIDEO).size() == i % 2);
+    BOOST_CHECK (sinks[i]->getSourceConnections ().size() == 1 + i % 2);
+  }
+
+  /* Pads are created now, links are found through the pad index */
+  for (auto sink : sinks) {
+    g_object_set (sink->getGstreamerElement(), "audio", TRUE, "video", TRUE,
+                  NULL);
+  }
+
+  src->release ();
+  BOOST_CHECK (src->getSinkConnections ().size() == 0);
+}
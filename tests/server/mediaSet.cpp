@@ -0,0 +1,440 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE MediaSet
+#include <boost/test/unit_test.hpp>
+#include <MediaPipelineImpl.hpp>
+#include <MediaElementImpl.hpp>
+#include <MediaSet.hpp>
+#include <KurentoException.hpp>
+
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+
+using namespace kurento;
+
+#define N_OBJECTS 256
+
+static std::vector<std::shared_ptr<MediaObjectImpl>>
+createPipelines (const std::string &sessionId, int n)
+{
+  std::vector<std::shared_ptr<MediaObjectImpl>> objects;
+
+  for (int i = 0; i < n; i++) {
+    std::shared_ptr<MediaObjectImpl> obj;
+
+    obj = MediaSet::getMediaSet()->ref (new MediaPipelineImpl (
+                                          boost::property_tree::ptree() ) );
+    MediaSet::getMediaSet()->ref (sessionId, obj);
+    objects.push_back (obj);
+  }
+
+  return objects;
+}
+
+BOOST_AUTO_TEST_CASE (ref_and_lookup)
+{
+  gst_init (NULL, NULL);
+  std::string sessionId = "ref_and_lookup";
+  auto objects = createPipelines (sessionId, N_OBJECTS);
+
+  for (auto obj : objects) {
+    BOOST_CHECK (MediaSet::getMediaSet()->getMediaObject (obj->getId() ) == obj);
+  }
+
+  MediaSet::getMediaSet()->keepAliveSession (sessionId);
+
+  try {
+    MediaSet::getMediaSet()->keepAliveSession ("unknown session");
+    BOOST_FAIL ("Previous operation should raise an exception");
+  } catch (KurentoException &e) {
+    BOOST_CHECK (e.getCode () == INVALID_SESSION);
+  }
+
+  for (auto obj : objects) {
+    MediaSet::getMediaSet()->release (obj);
+  }
+
+  for (auto obj : objects) {
+    try {
+      MediaSet::getMediaSet()->getMediaObject (obj->getId() );
+      BOOST_FAIL ("Released object should not be found");
+    } catch (KurentoException &e) {
+      BOOST_CHECK (e.getCode () == MEDIA_OBJECT_NOT_FOUND);
+    }
+  }
+
+  MediaSet::getMediaSet()->releaseSession (sessionId);
+}
+
+BOOST_AUTO_TEST_CASE (lookup_during_object_churn)
+{
+  gst_init (NULL, NULL);
+  std::string sessionId = "lookup_during_object_churn";
+  auto objects = createPipelines (sessionId, N_OBJECTS);
+  std::atomic<bool> running (true);
+  std::atomic<uint64_t> failures (0);
+  std::atomic<uint64_t> wrong (0);
+  std::atomic<uint64_t> lookups (0);
+  std::vector<std::thread> readers;
+
+  /* Objects that stay in the set are always found while others come and go */
+  for (int t = 0; t < 4; t++) {
+    readers.push_back (std::thread ([&] () {
+      while (running) {
+        for (auto obj : objects) {
+          try {
+            if (MediaSet::getMediaSet()->getMediaObject (obj->getId() ) != obj) {
+              wrong++;
+            }
+          } catch (KurentoException &e) {
+            failures++;
+          }
+
+          lookups++;
+        }
+      }
+    }) );
+  }
+
+  for (int i = 0; i < 16; i++) {
+    std::string churnSession = sessionId + std::to_string (i);
+    auto churn = createPipelines (churnSession, 16);
+
+    for (auto obj : churn) {
+      BOOST_CHECK (MediaSet::getMediaSet()->getMediaObject (obj->getId() ) ==
+                   obj);
+    }
+
+    MediaSet::getMediaSet()->releaseSession (churnSession);
+  }
+
+  while (lookups == 0) {
+    std::this_thread::yield ();
+  }
+
+  running = false;
+
+  for (auto &thread : readers) {
+    thread.join();
+  }
+
+  BOOST_CHECK (failures == 0);
+  BOOST_CHECK (wrong == 0);
+
+  MediaSet::getMediaSet()->releaseSession (sessionId);
+}
+
+/* Lets a test wait for the destruction of a pipeline */
+class NotifyingPipeline : public MediaPipelineImpl
+{
+public:
+  NotifyingPipeline (std::mutex &mutex, std::condition_variable &cond,
+                     bool &destroyed) :
+    MediaPipelineImpl (boost::property_tree::ptree() ), mutex (mutex),
+    cond (cond), destroyed (destroyed) {}
+
+  virtual ~NotifyingPipeline ()
+  {
+    std::unique_lock <std::mutex> lock (mutex);
+
+    destroyed = true;
+    cond.notify_all();
+  }
+
+private:
+  std::mutex &mutex;
+  std::condition_variable &cond;
+  bool &destroyed;
+};
+
+BOOST_AUTO_TEST_CASE (session_timeout)
+{
+  gst_init (NULL, NULL);
+  std::string sessionId = "session_timeout";
+  std::chrono::milliseconds timeout (200);
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool destroyed = false;
+  std::shared_ptr<MediaObjectImpl> pipe;
+
+  MediaSet::getMediaSet()->setSessionTimeout (timeout);
+
+  pipe = MediaSet::getMediaSet()->ref (new NotifyingPipeline (mutex, cond,
+                                       destroyed) );
+  MediaSet::getMediaSet()->ref (sessionId, pipe);
+  pipe.reset();
+
+  std::unique_lock <std::mutex> lock (mutex);
+
+  /* Keep alives sent within the timeout hold the session */
+  for (int i = 0; i < 3; i++) {
+    BOOST_CHECK (!cond.wait_for (lock, timeout / 2, [&destroyed] () {
+      return destroyed;
+    }) );
+    MediaSet::getMediaSet()->keepAliveSession (sessionId);
+  }
+
+  /* Without them the session expires and its objects are released */
+  BOOST_REQUIRE (cond.wait_for (lock, std::chrono::seconds (10),
+  [&destroyed] () {
+    return destroyed;
+  }) );
+  lock.unlock();
+
+  try {
+    MediaSet::getMediaSet()->keepAliveSession (sessionId);
+    BOOST_FAIL ("Session should have expired");
+  } catch (KurentoException &e) {
+    BOOST_CHECK (e.getCode () == INVALID_SESSION);
+  }
+
+  MediaSet::getMediaSet()->setSessionTimeout (std::chrono::seconds (480) );
+}
+
+/* Records the order of the release calls of the objects that use it */
+class ReleaseLog
+{
+public:
+  struct Entry {
+    std::string pipelineId;
+    std::string objectId;
+    std::thread::id thread;
+  };
+
+  void begin (const std::string &pipelineId, const std::string &objectId)
+  {
+    std::unique_lock <std::mutex> lock (mutex);
+
+    if (active[pipelineId]++ > 0) {
+      overlaps++;
+    }
+
+    entries.push_back ({pipelineId, objectId, std::this_thread::get_id() });
+  }
+
+  void end (const std::string &pipelineId)
+  {
+    std::unique_lock <std::mutex> lock (mutex);
+
+    active[pipelineId]--;
+    cond.notify_all();
+  }
+
+  /* Returns the entries once n releases have finished */
+  std::vector<Entry> wait (size_t n)
+  {
+    std::unique_lock <std::mutex> lock (mutex);
+
+    BOOST_REQUIRE (cond.wait_for (lock, std::chrono::seconds (10), [&] () {
+      size_t running = 0;
+
+      for (auto it : active) {
+        running += it.second;
+      }
+
+      return entries.size() >= n && running == 0;
+    }) );
+
+    return entries;
+  }
+
+  int getOverlaps ()
+  {
+    std::unique_lock <std::mutex> lock (mutex);
+
+    return overlaps;
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::vector<Entry> entries;
+  std::map<std::string, int> active;
+  int overlaps = 0;
+};
+
+#define RELEASE_TIME std::chrono::milliseconds (5)
+
+class LoggingPipeline : public MediaPipelineImpl
+{
+public:
+  LoggingPipeline (std::shared_ptr<ReleaseLog> log) :
+    MediaPipelineImpl (boost::property_tree::ptree() ), log (log) {}
+
+  virtual void release ()
+  {
+    std::string id = getId();
+
+    log->begin (id, id);
+    std::this_thread::sleep_for (RELEASE_TIME);
+    MediaPipelineImpl::release ();
+    log->end (id);
+  }
+
+private:
+  std::shared_ptr<ReleaseLog> log;
+};
+
+/* Slow release, so a batch of the same pipeline running in parallel would
+ * overlap with it */
+class LoggingElement : public MediaElementImpl
+{
+public:
+  LoggingElement (std::shared_ptr<MediaObjectImpl> pipe,
+                  std::shared_ptr<ReleaseLog> log) :
+    MediaElementImpl (boost::property_tree::ptree(), pipe, "dummysink"),
+    log (log), pipelineId (pipe->getId() ) {}
+
+  virtual void release ()
+  {
+    log->begin (pipelineId, getId() );
+    std::this_thread::sleep_for (RELEASE_TIME);
+    MediaElementImpl::release ();
+    log->end (pipelineId);
+  }
+
+private:
+  std::shared_ptr<ReleaseLog> log;
+  std::string pipelineId;
+};
+
+static std::shared_ptr<MediaObjectImpl>
+createLoggingPipeline (const std::string &sessionId,
+                       std::shared_ptr<ReleaseLog> log,
+                       int n_elements, std::vector<std::string> &elements)
+{
+  std::shared_ptr<MediaObjectImpl> pipe;
+
+  pipe = MediaSet::getMediaSet()->ref (new LoggingPipeline (log) );
+  MediaSet::getMediaSet()->ref (sessionId, pipe);
+
+  for (int i = 0; i < n_elements; i++) {
+    std::shared_ptr<MediaObjectImpl> element;
+
+    element = MediaSet::getMediaSet()->ref (new LoggingElement (pipe, log) );
+    MediaSet::getMediaSet()->ref (sessionId, element);
+    elements.push_back (element->getId() );
+  }
+
+  return pipe;
+}
+
+static void
+checkReleased (const std::vector<std::string> &ids)
+{
+  for (auto id : ids) {
+    try {
+      MediaSet::getMediaSet()->getMediaObject (id);
+      BOOST_FAIL ("Released object should not be found");
+    } catch (KurentoException &e) {
+      BOOST_CHECK (e.getCode () == MEDIA_OBJECT_NOT_FOUND);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE (release_session_batch)
+{
+  gst_init (NULL, NULL);
+  std::string sessionId = "release_session_batch";
+  std::shared_ptr<ReleaseLog> log (new ReleaseLog () );
+  std::map<std::string, std::vector<std::string>> elements;
+  std::vector<std::string> ids;
+
+  for (int i = 0; i < 4; i++) {
+    std::vector<std::string> pipeElements;
+    auto pipe = createLoggingPipeline (sessionId, log, 8, pipeElements);
+
+    elements[pipe->getId()] = pipeElements;
+    ids.push_back (pipe->getId() );
+    ids.insert (ids.end(), pipeElements.begin(), pipeElements.end() );
+  }
+
+  MediaSet::getMediaSet()->releaseSession (sessionId);
+
+  auto entries = log->wait (ids.size() );
+
+  BOOST_CHECK (entries.size() == ids.size() );
+  BOOST_CHECK (log->getOverlaps() == 0);
+
+  /* Each pipeline is released in one batch: pipeline first, then all of its
+   * elements, one after the other in the same task */
+  for (auto it : elements) {
+    std::vector<ReleaseLog::Entry> pipeEntries;
+
+    for (auto entry : entries) {
+      if (entry.pipelineId == it.first) {
+        pipeEntries.push_back (entry);
+      }
+    }
+
+    BOOST_REQUIRE (pipeEntries.size() == it.second.size() + 1);
+    BOOST_CHECK (pipeEntries.front().objectId == it.first);
+
+    for (auto entry : pipeEntries) {
+      BOOST_CHECK (entry.thread == pipeEntries.front().thread);
+    }
+  }
+
+  checkReleased (ids);
+}
+
+BOOST_AUTO_TEST_CASE (concurrent_element_and_pipeline_release)
+{
+  gst_init (NULL, NULL);
+  std::string sessionId = "concurrent_element_and_pipeline_release";
+  std::shared_ptr<ReleaseLog> log (new ReleaseLog () );
+  std::vector<std::string> elements;
+  std::vector<std::thread> threads;
+  std::string pipeId;
+
+  pipeId = createLoggingPipeline (sessionId, log, 16, elements)->getId();
+
+  /* Every release lands on the queue of the same pipeline */
+  for (auto id : elements) {
+    threads.push_back (std::thread ([id] () {
+      MediaSet::getMediaSet()->release (id);
+    }) );
+  }
+
+  threads.push_back (std::thread ([pipeId] () {
+    MediaSet::getMediaSet()->release (pipeId);
+  }) );
+
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  elements.push_back (pipeId);
+
+  auto entries = log->wait (elements.size() );
+
+  /* Batches of the same pipeline run one after the other */
+  BOOST_CHECK (entries.size() == elements.size() );
+  BOOST_CHECK (log->getOverlaps() == 0);
+
+  for (auto entry : entries) {
+    BOOST_CHECK (entry.pipelineId == pipeId);
+  }
+
+  checkReleased (elements);
+
+  MediaSet::getMediaSet()->releaseSession (sessionId);
+}
@@ -0,0 +1,268 @@
+/*
+ * (C) Copyright 2015 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE WorkerPool
+#include <boost/test/unit_test.hpp>
+#include <WorkerPool.hpp>
+#include <gst/gst.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace kurento;
+
+#define N_TASKS 100000
+#define WAIT_TIMEOUT std::chrono::seconds (10)
+#define WATCH_INTERVAL std::chrono::milliseconds (50)
+
+/* Counts executed tasks and wakes up the test when the target is reached */
+class Counter
+{
+public:
+  Counter (int target) : value (0), target (target) {}
+
+  void increment ()
+  {
+    if (++value == target) {
+      std::unique_lock <std::mutex> lock (mutex);
+
+      cond.notify_all();
+    }
+  }
+
+  bool wait ()
+  {
+    std::unique_lock <std::mutex> lock (mutex);
+
+    return cond.wait_for (lock, WAIT_TIMEOUT, [this] () {
+      return value >= target;
+    });
+  }
+
+  std::atomic<int> value;
+
+private:
+  int target;
+  std::mutex mutex;
+  std::condition_variable cond;
+};
+
+/* Keeps the tasks that wait on it busy until it is opened */
+class Gate
+{
+public:
+  Gate () : opened (false) {}
+
+  void open ()
+  {
+    std::unique_lock <std::mutex> lock (mutex);
+
+    opened = true;
+    cond.notify_all();
+  }
+
+  void wait ()
+  {
+    std::unique_lock <std::mutex> lock (mutex);
+
+    cond.wait (lock, [this] () {
+      return opened;
+    });
+  }
+
+private:
+  bool opened;
+  std::mutex mutex;
+  std::condition_variable cond;
+};
+
+BOOST_AUTO_TEST_CASE (execute_all_tasks)
+{
+  gst_init (NULL, NULL);
+  Counter counter (2 * N_TASKS);
+  WorkerPool pool (4);
+  auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < N_TASKS; i++) {
+    pool.post ([&counter] () {
+      counter.increment();
+    });
+  }
+
+  /* Tasks posted from a worker go to its own queue and are stolen by others */
+  pool.post ([&pool, &counter] () {
+    for (int i = 0; i < N_TASKS; i++) {
+      pool.post ([&counter] () {
+        counter.increment();
+      });
+    }
+  });
+
+  BOOST_REQUIRE (counter.wait() );
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>
+                 (std::chrono::steady_clock::now() - start);
+  WorkerPool::Stats stats = pool.getStats();
+
+  BOOST_TEST_MESSAGE ("Executed " << stats.executedTasks << " tasks in " <<
+                      elapsed.count() << " ms, stolen " << stats.stolenTasks <<
+                      ", average latency " << stats.averageLatency.count() <<
+                      " us, max latency " << stats.maxLatency.count() << " us");
+
+  BOOST_CHECK (stats.threads == 4);
+  BOOST_CHECK (stats.spawnedThreads == 0);
+}
+
+BOOST_AUTO_TEST_CASE (recover_from_locked_workers)
+{
+  gst_init (NULL, NULL);
+  Counter counter (1);
+  std::shared_ptr<Gate> gate (new Gate () );
+  WorkerPool pool (1, 32, std::chrono::seconds (60), WATCH_INTERVAL);
+
+  pool.post ([gate] () {
+    gate->wait();
+  });
+
+  pool.post ([&counter] () {
+    counter.increment();
+  });
+
+  BOOST_REQUIRE (counter.wait() );
+  BOOST_CHECK (pool.getStats().spawnedThreads == 1);
+
+  gate->open();
+}
+
+BOOST_AUTO_TEST_CASE (bounded_growth_and_retirement)
+{
+  gst_init (NULL, NULL);
+  Counter counter (1000);
+  std::shared_ptr<Gate> gate (new Gate () );
+  WorkerPool pool (1, 2, std::chrono::milliseconds (200), WATCH_INTERVAL);
+
+  for (int i = 0; i < 3; i++) {
+    pool.post ([gate] () {
+      gate->wait();
+    });
+  }
+
+  /* One extra thread is spawned, then the pool saturates */
+  BOOST_REQUIRE (pool.waitForStats ([] (const WorkerPool::Stats & stats) {
+    return stats.spawnedThreads == 1 && stats.saturationEvents > 0;
+  }, WAIT_TIMEOUT) );
+  BOOST_CHECK (pool.getStats().threads == 2);
+
+  gate->open();
+
+  /* Idle thread above the minimum retires */
+  BOOST_REQUIRE (pool.waitForStats ([] (const WorkerPool::Stats & stats) {
+    return stats.retiredThreads == 1;
+  }, WAIT_TIMEOUT) );
+  BOOST_CHECK (pool.getStats().threads == 1);
+
+  for (int i = 0; i < 1000; i++) {
+    pool.post ([&counter] () {
+      counter.increment();
+    });
+  }
+
+  BOOST_REQUIRE (counter.wait() );
+}
+
+BOOST_AUTO_TEST_CASE (respawn_on_retired_slot)
+{
+  gst_init (NULL, NULL);
+  WorkerPool pool (1, 2, std::chrono::milliseconds (20), WATCH_INTERVAL);
+
+  /* Slot of the retired thread is reused while it may still be exiting */
+  for (size_t i = 1; i <= 20; i++) {
+    Counter counter (1);
+    std::shared_ptr<Gate> gate (new Gate () );
+
+    pool.post ([gate] () {
+      gate->wait();
+    });
+
+    pool.post ([&counter] () {
+      counter.increment();
+    });
+
+    BOOST_REQUIRE (counter.wait() );
+    gate->open();
+
+    BOOST_REQUIRE (pool.waitForStats ([i] (const WorkerPool::Stats & stats) {
+      return stats.retiredThreads == i;
+    }, WAIT_TIMEOUT) );
+  }
+
+  BOOST_CHECK (pool.getStats().spawnedThreads == 20);
+}
+
+BOOST_AUTO_TEST_CASE (shutdown_runs_pending_tasks)
+{
+  gst_init (NULL, NULL);
+  std::atomic<int> executed (0);
+
+  {
+    WorkerPool pool (2);
+
+    for (int i = 0; i < 1000; i++) {
+      pool.post ([&executed] () {
+        executed++;
+      });
+    }
+  }
+
+  BOOST_CHECK (executed == 1000);
+}
+
+BOOST_AUTO_TEST_CASE (shutdown_with_stuck_task)
+{
+  gst_init (NULL, NULL);
+  std::shared_ptr<Gate> gate (new Gate () );
+  std::shared_ptr<Gate> started (new Gate () );
+  std::atomic<int> executed (0);
+  auto start = std::chrono::steady_clock::now();
+
+  {
+    WorkerPool pool (1, 1, std::chrono::seconds (60), WATCH_INTERVAL,
+                     std::chrono::milliseconds (100) );
+
+    pool.post ([gate, started] () {
+      started->open();
+      gate->wait();
+    });
+
+    for (int i = 0; i < 10; i++) {
+      pool.post ([&executed] () {
+        executed++;
+      });
+    }
+
+    started->wait();
+  }
+
+  /* The stuck thread is detached and the tasks behind it are dropped */
+  BOOST_CHECK (std::chrono::steady_clock::now() - start < WAIT_TIMEOUT);
+  BOOST_CHECK (executed == 0);
+
+  gate->open();
+}